@@ -1644,6 +1644,9 @@ static rsRetVal setActionQueType(void __attribute__((unused)) *pVal, uchar *pszT
 	} else if (!strcasecmp((char *) pszType, "direct")) {
 		cs.ActionQueType = QUEUETYPE_DIRECT;
 		DBGPRINTF("action queue type set to DIRECT (no queueing at all)\n");
+	} else if (!strcasecmp((char *) pszType, "lockfree")) {
+		cs.ActionQueType = QUEUETYPE_LOCKFREE;
+		DBGPRINTF("action queue type set to LOCKFREE\n");
 	} else {
 		LogError(0, RS_RET_INVALID_PARAMS, "unknown actionqueue parameter: %s", (char *) pszType);
 		iRet = RS_RET_INVALID_PARAMS;
@@ -59,6 +59,7 @@
 #include "wti.h"
 #include "unicode-helper.h"
 #include "errmsg.h"
+#include "acmatch.h"
 
 #if !defined(_AIX)
 #pragma GCC diagnostic ignored "-Wswitch-enum"
@@ -839,6 +840,8 @@ doGetQueueType(struct nvlst *valnode, struct cnfparamdescr *param,
 		val->val.d.n = QUEUETYPE_DISK;
 	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"direct", 6)) {
 		val->val.d.n = QUEUETYPE_DIRECT;
+	} else if(!es_strcasebufcmp(valnode->val.d.estr, (uchar*)"lockfree", 8)) {
+		val->val.d.n = QUEUETYPE_LOCKFREE;
 	} else {
 		cstr = es_str2cstr(valnode->val.d.estr, NULL);
 		parser_errmsg("param '%s': unknown queue type: '%s'",
@@ -3563,6 +3566,282 @@ cnfexprEvalBool(struct cnfexpr *__restrict__ const expr, void *__restrict__ cons
 	return retVal;
 }
 
+/* ---------- compiled expressions ---------- */
+
+/* load a string register. The register buffer is owned by the worker and
+ * reused for all messages, so it is only (re)allocated when it is too small.
+ */
+static es_str_t *
+exprprogLoadReg(const struct cnfexprprog *const prog, const unsigned reg,
+	smsg_t *const pMsg, wti_t *const pWti)
+{
+	rs_size_t propLen;
+	uchar *pszProp;
+	unsigned short bMustBeFreed = 0;
+	es_str_t *estr = pWti->exprRegs[reg];
+
+	pszProp = (uchar*) MsgGetProp(pMsg, NULL, prog->regProp[reg], &propLen, &bMustBeFreed, NULL);
+	if(estr == NULL || estr->lenBuf < (es_size_t) propLen) {
+		if(estr != NULL)
+			es_deleteStr(estr);
+		/* round up a bit so that we do not need to realloc on each size change */
+		estr = pWti->exprRegs[reg] = es_newStr((propLen + 128) & ~(rs_size_t)127);
+	}
+	if(estr != NULL) {
+		memcpy(es_getBufAddr(estr), pszProp, propLen);
+		estr->lenStr = propLen;
+	}
+	DBGPRINTF("rainerscript: (string) reg %u var %d: '%s'\n", reg, prog->regProp[reg]->id, pszProp);
+	if(bMustBeFreed)
+		free(pszProp);
+	return estr;
+}
+
+/* compare a string against a constant, this must exactly mirror what
+ * cnfexprEval() does for a string lhs and a string constant rhs.
+ */
+static long long
+exprprogStrCmp(es_str_t *const estr_l, es_str_t *const estr_r, const unsigned cmpop)
+{
+	switch(cmpop) {
+	case CMP_EQ:
+		return !es_strcmp(estr_l, estr_r);
+	case CMP_NE:
+		return es_strcmp(estr_l, estr_r);
+	case CMP_LE:
+		return es_strcmp(estr_l, estr_r) <= 0;
+	case CMP_GE:
+		return es_strcmp(estr_l, estr_r) >= 0;
+	case CMP_LT:
+		return es_strcmp(estr_l, estr_r) < 0;
+	case CMP_GT:
+		return es_strcmp(estr_l, estr_r) > 0;
+	case CMP_STARTSWITH:
+		return es_strncmp(estr_l, estr_r, estr_r->lenStr) == 0;
+	case CMP_STARTSWITHI:
+		return es_strncasecmp(estr_l, estr_r, estr_r->lenStr) == 0;
+	case CMP_CONTAINS:
+		return es_strContains(estr_l, estr_r) != -1;
+	case CMP_CONTAINSI:
+		return es_strCaseContains(estr_l, estr_r) != -1;
+	default:
+		assert(0); /* only valid ops are compiled */
+		return 0;
+	}
+}
+
+/* Evaluate a compiled expression as bool. This is the counterpart of
+ * cnfexprEvalBool() and returns the exact same result.
+ */
+int
+cnfexprprogEvalBool(const struct cnfexprprog *__restrict__ const prog, void *__restrict__ const usrptr,
+	wti_t *const pWti)
+{
+	const struct cnfexprop *op;
+	es_str_t *regs[CNFEXPRPROG_MAXREGS];
+	unsigned loaded = 0; /* bitmap of registers loaded for this message */
+	long long acc = 0;
+	unsigned pc;
+	int convok;
+	struct svar r;
+
+	for(pc = 0 ; pc < prog->nops ; ++pc) {
+		op = prog->ops + pc;
+		switch(op->opcode) {
+		case EOP_EVAL:
+			cnfexprEval(op->d.expr, &r, usrptr, pWti);
+			acc = var2Number(&r, &convok);
+			varFreeMembers(&r);
+			break;
+		case EOP_STRCMP:
+		case EOP_ARRCMP:
+			if(!(loaded & (1u << op->reg))) {
+				regs[op->reg] = exprprogLoadReg(prog, op->reg, (smsg_t*) usrptr, pWti);
+				loaded |= 1u << op->reg;
+			}
+			if(regs[op->reg] == NULL) {
+				acc = 0; /* out of memory, treat like an empty string would */
+			} else if(op->opcode == EOP_STRCMP) {
+				acc = exprprogStrCmp(regs[op->reg], op->d.estr, op->cmpop);
+			} else {
+				acc = evalStrArrayCmp(regs[op->reg], op->d.arr, op->cmpop);
+			}
+			break;
+		case EOP_NOT:
+			acc = !acc;
+			break;
+		case EOP_BOOL:
+			acc = (acc != 0);
+			break;
+		case EOP_JZ:
+			if(acc == 0)
+				pc = op->target - 1;
+			break;
+		case EOP_JNZ:
+			if(acc != 0)
+				pc = op->target - 1;
+			break;
+		default:
+			assert(0); /* abort on debug builds, this must not happen! */
+			break;
+		}
+	}
+	DBGPRINTF("eval compiled expr %p, result %lld\n", prog, acc);
+	return (int) acc;
+}
+
+/* append an operation to the program, returns its index or -1 on error */
+static int
+exprprogEmit(struct cnfexprprog *const prog, const enum cnfexprOpcode opcode)
+{
+	struct cnfexprop *newops;
+
+	if((newops = realloc(prog->ops, (prog->nops + 1) * sizeof(struct cnfexprop))) == NULL)
+		return -1;
+	prog->ops = newops;
+	memset(prog->ops + prog->nops, 0, sizeof(struct cnfexprop));
+	prog->ops[prog->nops].opcode = opcode;
+	return (int) prog->nops++;
+}
+
+/* obtain the register for a property, allocating a new one if needed.
+ * Returns -1 if we are out of registers.
+ */
+static int
+exprprogGetReg(struct cnfexprprog *const prog, msgPropDescr_t *const prop)
+{
+	unsigned i;
+
+	for(i = 0 ; i < prog->nregs ; ++i) {
+		/* only non-JSON properties are compiled, so the id is sufficient */
+		if(prog->regProp[i]->id == prop->id)
+			return (int) i;
+	}
+	if(prog->nregs == CNFEXPRPROG_MAXREGS)
+		return -1;
+	prog->regProp[prog->nregs] = prop;
+	return (int) prog->nregs++;
+}
+
+/* check if expression is a comparison of a plain (non-JSON) message property
+ * against a string constant or constant array, which we can compile.
+ */
+static int
+exprprogIsCompilableCmp(const struct cnfexpr *const expr)
+{
+	const struct cnfvar *var;
+
+	switch(expr->nodetype) {
+	case CMP_EQ:
+	case CMP_NE:
+	case CMP_STARTSWITH:
+	case CMP_STARTSWITHI:
+	case CMP_CONTAINS:
+	case CMP_CONTAINSI:
+		if(expr->r->nodetype != 'S' && expr->r->nodetype != 'A')
+			return 0;
+		break;
+	case CMP_LE:
+	case CMP_GE:
+	case CMP_LT:
+	case CMP_GT:
+		if(expr->r->nodetype != 'S')
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+	if(expr->l->nodetype != 'V')
+		return 0;
+	var = (const struct cnfvar*) expr->l;
+	return !(var->prop.id == PROP_CEE || var->prop.id == PROP_LOCAL_VAR
+		|| var->prop.id == PROP_GLOBAL_VAR || var->prop.id == PROP_INVALID);
+}
+
+/* compile a single expression node (recursively). Returns 0 on success. */
+static int
+exprprogCompileNode(struct cnfexprprog *const prog, struct cnfexpr *const expr)
+{
+	int idx;
+	int reg;
+
+	switch(expr->nodetype) {
+	case AND:
+	case OR:
+		if(exprprogCompileNode(prog, expr->l) != 0)
+			return -1;
+		if((idx = exprprogEmit(prog, (expr->nodetype == AND) ? EOP_JZ : EOP_JNZ)) == -1)
+			return -1;
+		if(exprprogCompileNode(prog, expr->r) != 0)
+			return -1;
+		prog->ops[idx].target = prog->nops;
+		return (exprprogEmit(prog, EOP_BOOL) == -1) ? -1 : 0;
+	case NOT:
+		if(exprprogCompileNode(prog, expr->r) != 0)
+			return -1;
+		return (exprprogEmit(prog, EOP_NOT) == -1) ? -1 : 0;
+	default:
+		break;
+	}
+
+	if(exprprogIsCompilableCmp(expr)
+	   && (reg = exprprogGetReg(prog, &((struct cnfvar*)expr->l)->prop)) != -1) {
+		if((idx = exprprogEmit(prog, (expr->r->nodetype == 'S') ? EOP_STRCMP : EOP_ARRCMP)) == -1)
+			return -1;
+		prog->ops[idx].cmpop = expr->nodetype;
+		prog->ops[idx].reg = (unsigned) reg;
+		if(expr->r->nodetype == 'S')
+			prog->ops[idx].d.estr = ((struct cnfstringval*)expr->r)->estr;
+		else
+			prog->ops[idx].d.arr = (struct cnfarray*) expr->r;
+	} else {
+		if((idx = exprprogEmit(prog, EOP_EVAL)) == -1)
+			return -1;
+		prog->ops[idx].d.expr = expr;
+	}
+	return 0;
+}
+
+void
+cnfexprprogDestruct(struct cnfexprprog *const prog)
+{
+	if(prog == NULL)
+		return;
+	free(prog->ops);
+	free(prog);
+}
+
+/* Compile an (already optimized) expression for use in boolean context.
+ * The program references, but does not own, the expression tree, which
+ * must be kept as long as the program is used. NULL is returned if there
+ * is nothing to gain from compilation (or on error, in which case the
+ * expression tree is used as before).
+ */
+struct cnfexprprog*
+cnfexprCompile(struct cnfexpr *const expr)
+{
+	struct cnfexprprog *prog;
+	unsigned i;
+	int bUseful = 0;
+
+	if((prog = calloc(1, sizeof(struct cnfexprprog))) == NULL)
+		goto fail;
+	if(exprprogCompileNode(prog, expr) != 0)
+		goto fail;
+	for(i = 0 ; i < prog->nops ; ++i) {
+		if(prog->ops[i].opcode != EOP_EVAL)
+			bUseful = 1;
+	}
+	if(!bUseful)
+		goto fail;
+	DBGPRINTF("optimizer: compiled expression %p into %u ops, %u registers\n",
+		expr, prog->nops, prog->nregs);
+	return prog;
+fail:
+	cnfexprprogDestruct(prog);
+	return NULL;
+}
+
 struct json_object*
 cnfexprEvalCollection(struct cnfexpr *__restrict__ const expr, void *__restrict__ const usrptr, wti_t *const pWti)
 {
@@ -3852,6 +4131,15 @@ cnfstmtPrintOnly(struct cnfstmt *stmt, int indent, sbool subtree)
 			doIndent(indent); dbgprintf("END PROPFILT\n");
 		}
 		break;
+	case S_PROPFILT_MULTI:
+		doIndent(indent); dbgprintf("PROPFILT_MULTI (%d filters on '%s')\n",
+			stmt->d.s_propfilt_multi.nfilters,
+			propIDToName(stmt->d.s_propfilt_multi.filters->d.s_propfilt.prop.id));
+		if(subtree) {
+			cnfstmtPrint(stmt->d.s_propfilt_multi.filters, indent+1);
+			doIndent(indent); dbgprintf("END PROPFILT_MULTI\n");
+		}
+		break;
 	default:
 		dbgprintf("error: unknown stmt type %u\n",
 			(unsigned) stmt->nodetype);
@@ -3952,7 +4240,7 @@ struct cnfstmt *
 cnfstmtNew(unsigned s_type)
 {
 	struct cnfstmt* cnfstmt;
-	if((cnfstmt = malloc(sizeof(struct cnfstmt))) != NULL) {
+	if((cnfstmt = calloc(1, sizeof(struct cnfstmt))) != NULL) {
 		cnfstmt->nodetype = s_type;
 		cnfstmt->printable = NULL;
 		cnfstmt->next = NULL;
@@ -3995,6 +4283,7 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 		actionDestruct(stmt->d.act);
 		break;
 	case S_IF:
+		cnfexprprogDestruct(stmt->d.s_if.prog);
 		cnfexprDestruct(stmt->d.s_if.expr);
 		if(stmt->d.s_if.t_then != NULL) {
 			cnfstmtDestructLst(stmt->d.s_if.t_then);
@@ -4026,6 +4315,10 @@ cnfstmtDestruct(struct cnfstmt *stmt)
 			cstrDestruct(&stmt->d.s_propfilt.pCSCompValue);
 		cnfstmtDestructLst(stmt->d.s_propfilt.t_then);
 		break;
+	case S_PROPFILT_MULTI:
+		cnfstmtDestructLst(stmt->d.s_propfilt_multi.filters);
+		acmatchDestruct(&stmt->d.s_propfilt_multi.ac);
+		break;
 	case S_RELOAD_LOOKUP_TABLE:
 		if (stmt->d.s_reload_lookup_table.table_name != NULL) {
 				free(stmt->d.s_reload_lookup_table.table_name);
@@ -4670,6 +4963,71 @@ cnfstmtOptimizeForeach(struct cnfstmt *stmt)
 }
 
 
+/* an "if $prop contains|== 'const'" without else is semantically the same
+ * as the legacy property filter. Such statements can be converted so that
+ * they take part in PROPFILT_MULTI grouping (which is where the real speedup
+ * is). This is only done for runs that are actually grouped: a lone
+ * converted if would lose its compiled expression and the script engine's
+ * string semantics (e.g. embedded NULs) without any gain.
+ * Returns the variable if the statement can be converted, NULL otherwise.
+ */
+static struct cnfvar *
+cnfstmtIfPROPFILTVar(struct cnfstmt *stmt)
+{
+	struct cnfexpr *expr;
+	struct cnfvar *var;
+
+	if(stmt == NULL || stmt->nodetype != S_IF || stmt->d.s_if.t_else != NULL)
+		return NULL;
+	expr = stmt->d.s_if.expr;
+	/* check the node type first: only comparison nodes are guaranteed
+	 * to have both l and r (e.g. NOT has no l).
+	 */
+	if(expr->nodetype != CMP_CONTAINS && expr->nodetype != CMP_EQ)
+		return NULL;
+	if(expr->l->nodetype != 'V' || expr->r->nodetype != 'S')
+		return NULL;
+	var = (struct cnfvar*) expr->l;
+	/* empty "contains" has different semantics in script and PROPFILT */
+	if(var->prop.id == PROP_INVALID || var->prop.id >= PROP_SYS_NOW
+	   || es_strlen(((struct cnfstringval*) expr->r)->estr) == 0)
+		return NULL;
+	return var;
+}
+
+/* convert an if to a PROPFILT. The caller must have made sure this is
+ * possible via cnfstmtIfPROPFILTVar().
+ */
+static rsRetVal
+cnfstmtIfToPROPFILT(struct cnfstmt *stmt)
+{
+	struct cnfexpr *const expr = stmt->d.s_if.expr;
+	struct cnfvar *const var = (struct cnfvar*) expr->l;
+	struct cnfstmt *const t_then = stmt->d.s_if.t_then;
+	cstr_t *pCS;
+	DEFiRet;
+
+	CHKiRet(cstrConstructFromESStr(&pCS, ((struct cnfstringval*) expr->r)->estr));
+	cstrFinalize(pCS);
+
+	DBGPRINTF("optimizer: change IF to PROPFILT\n");
+	cnfexprprogDestruct(stmt->d.s_if.prog);
+	stmt->nodetype = S_PROPFILT;
+	/* take over the property descriptor, it is not owned for non-JSON props */
+	memcpy(&stmt->d.s_propfilt.prop, &var->prop, sizeof(msgPropDescr_t));
+	stmt->d.s_propfilt.operation =
+		(expr->nodetype == CMP_CONTAINS) ? FIOP_CONTAINS : FIOP_ISEQUAL;
+	stmt->d.s_propfilt.t_then = t_then;
+	stmt->d.s_propfilt.t_else = NULL;
+	stmt->d.s_propfilt.isNegated = 0;
+	stmt->d.s_propfilt.regex_cache = NULL;
+	stmt->d.s_propfilt.pCSCompValue = pCS;
+	cnfexprDestruct(expr);
+
+finalize_it:
+	RETiRet;
+}
+
 static void
 cnfstmtOptimizeIf(struct cnfstmt *stmt)
 {
@@ -4712,8 +5070,10 @@ cnfstmtOptimizeIf(struct cnfstmt *stmt)
 					es_str2cstr(((struct cnfstringval*)func->expr[0])->estr, NULL);
 			cnfexprDestruct(expr);
 			cnfstmtOptimizePRIFilt(stmt);
+			goto done;
 		}
 	}
+	stmt->d.s_if.prog = cnfexprCompile(stmt->d.s_if.expr);
 done:	return;
 }
 
@@ -4810,6 +5170,302 @@ done:
 	free(rsName);
 	return;
 }
+/* check if a statement list may modify message properties (JSON variables
+ * excluded). This is conservative: everything we cannot prove to be harmless
+ * is considered to modify the message.
+ */
+static int
+cnfstmtMayModifyMsg(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		switch(stmt->nodetype) {
+		case S_NOP:
+		case S_STOP:
+		case S_SET:
+		case S_UNSET:
+		case S_RELOAD_LOOKUP_TABLE:
+			break;
+		case S_ACT:
+			if(stmt->d.act->bUsesMsgPassingMode)
+				return 1;
+			break;
+		case S_CALL: /* queued ruleset works on a copy of the message */
+			if(stmt->d.s_call.ruleset == NULL)
+				return 1;
+			break;
+		case S_IF:
+			if(   cnfstmtMayModifyMsg(stmt->d.s_if.t_then)
+			   || cnfstmtMayModifyMsg(stmt->d.s_if.t_else))
+				return 1;
+			break;
+		case S_PRIFILT:
+			if(   cnfstmtMayModifyMsg(stmt->d.s_prifilt.t_then)
+			   || cnfstmtMayModifyMsg(stmt->d.s_prifilt.t_else))
+				return 1;
+			break;
+		case S_PROPFILT:
+			if(cnfstmtMayModifyMsg(stmt->d.s_propfilt.t_then))
+				return 1;
+			break;
+		case S_PROPFILT_MULTI:
+			if(cnfstmtMayModifyMsg(stmt->d.s_propfilt_multi.filters))
+				return 1;
+			break;
+		case S_FOREACH:
+			if(cnfstmtMayModifyMsg(stmt->d.s_foreach.body))
+				return 1;
+			break;
+		default: /* S_CALL_INDIRECT and whatever we do not know */
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* check if an expression calls previous_action_suspended() */
+static int
+cnfexprNeedsPrevSuspState(struct cnfexpr *expr)
+{
+	struct cnffunc *func;
+	unsigned short i;
+
+	if(expr == NULL)
+		return 0;
+	switch(expr->nodetype) {
+	case CMP_NE:
+	case CMP_EQ:
+	case CMP_LE:
+	case CMP_GE:
+	case CMP_LT:
+	case CMP_GT:
+	case CMP_STARTSWITH:
+	case CMP_STARTSWITHI:
+	case CMP_CONTAINS:
+	case CMP_CONTAINSI:
+	case OR:
+	case AND:
+	case '&':
+	case '+':
+	case '-':
+	case '*':
+	case '/':
+	case '%': /* binary */
+		return cnfexprNeedsPrevSuspState(expr->l) || cnfexprNeedsPrevSuspState(expr->r);
+	case NOT:
+	case 'M': /* unary */
+		return cnfexprNeedsPrevSuspState(expr->r);
+	case 'F':
+		func = (struct cnffunc*) expr;
+		if(func->fPtr == doFunct_PreviousActionSuspended)
+			return 1;
+		for(i = 0 ; i < func->nParams ; ++i)
+			if(cnfexprNeedsPrevSuspState(func->expr[i]))
+				return 1;
+		return 0;
+	default: /* constants, variables, arrays */
+		return 0;
+	}
+}
+
+/* check if a statement list depends on the "previous action suspended"
+ * state, either via action.execOnlyWhenPreviousIsSuspended or via
+ * previous_action_suspended(). Inline-called rulesets are followed up to
+ * a limited depth. Everything we cannot check (indirect calls, too deep
+ * nesting) is conservatively considered to depend on it.
+ */
+static int
+cnfstmtNeedsPrevSuspStateRec(struct cnfstmt *root, const int depth)
+{
+	struct cnfstmt *stmt;
+
+	if(depth > 100)
+		return 1;
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		switch(stmt->nodetype) {
+		case S_NOP:
+		case S_STOP:
+		case S_UNSET:
+		case S_RELOAD_LOOKUP_TABLE:
+			break;
+		case S_ACT:
+			if(stmt->d.act->bExecWhenPrevSusp)
+				return 1;
+			break;
+		case S_SET:
+			if(cnfexprNeedsPrevSuspState(stmt->d.s_set.expr))
+				return 1;
+			break;
+		case S_CALL: /* queued rulesets run in their own worker */
+			if(   stmt->d.s_call.ruleset == NULL
+			   && cnfstmtNeedsPrevSuspStateRec(stmt->d.s_call.stmt, depth + 1))
+				return 1;
+			break;
+		case S_IF:
+			if(   cnfexprNeedsPrevSuspState(stmt->d.s_if.expr)
+			   || cnfstmtNeedsPrevSuspStateRec(stmt->d.s_if.t_then, depth + 1)
+			   || cnfstmtNeedsPrevSuspStateRec(stmt->d.s_if.t_else, depth + 1))
+				return 1;
+			break;
+		case S_PRIFILT:
+			if(   cnfstmtNeedsPrevSuspStateRec(stmt->d.s_prifilt.t_then, depth + 1)
+			   || cnfstmtNeedsPrevSuspStateRec(stmt->d.s_prifilt.t_else, depth + 1))
+				return 1;
+			break;
+		case S_PROPFILT:
+			if(cnfstmtNeedsPrevSuspStateRec(stmt->d.s_propfilt.t_then, depth + 1))
+				return 1;
+			break;
+		case S_PROPFILT_MULTI:
+			if(cnfstmtNeedsPrevSuspStateRec(stmt->d.s_propfilt_multi.filters, depth + 1))
+				return 1;
+			break;
+		case S_FOREACH:
+			if(   cnfexprNeedsPrevSuspState(stmt->d.s_foreach.iter->collection)
+			   || cnfstmtNeedsPrevSuspStateRec(stmt->d.s_foreach.body, depth + 1))
+				return 1;
+			break;
+		default: /* S_CALL_INDIRECT and whatever we do not know */
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int
+cnfstmtNeedsPrevSuspState(struct cnfstmt *root)
+{
+	return cnfstmtNeedsPrevSuspStateRec(root, 0);
+}
+
+static int
+isGroupablePROPFILT(struct cnfstmt *stmt)
+{
+	if(stmt == NULL || stmt->nodetype != S_PROPFILT)
+		return 0;
+	if(   stmt->d.s_propfilt.operation != FIOP_CONTAINS
+	   && stmt->d.s_propfilt.operation != FIOP_STARTSWITH
+	   && stmt->d.s_propfilt.operation != FIOP_ISEQUAL)
+		return 0;
+	return stmt->d.s_propfilt.pCSCompValue != NULL
+	    && stmt->d.s_propfilt.prop.id != PROP_INVALID
+	    && stmt->d.s_propfilt.prop.id < PROP_SYS_NOW;
+}
+
+/* convert the run of nfilters PROPFILTs head..last into a single
+ * PROPFILT_MULTI. This is done in place, so that the head node keeps its
+ * address (ruleset roots and CALL statements point to it).
+ */
+static rsRetVal
+groupPROPFILTs(struct cnfstmt *head, struct cnfstmt *last, int nfilters)
+{
+	struct cnfstmt *first = NULL;
+	struct cnfstmt *stmt;
+	acmatch_t *ac = NULL;
+	acmatchMode_t mode;
+	int i;
+	DEFiRet;
+
+	CHKiRet(acmatchConstruct(&ac));
+	for(stmt = head, i = 0 ; i < nfilters ; stmt = stmt->next, ++i) {
+		switch(stmt->d.s_propfilt.operation) {
+		case FIOP_STARTSWITH:
+			mode = ACMATCH_PREFIX;
+			break;
+		case FIOP_ISEQUAL:
+			mode = ACMATCH_WHOLE;
+			break;
+		default:
+			mode = ACMATCH_ANYWHERE;
+			break;
+		}
+		CHKiRet(acmatchAddPattern(ac, rsCStrGetSzStrNoNULL(stmt->d.s_propfilt.pCSCompValue),
+			cstrLen(stmt->d.s_propfilt.pCSCompValue), i, mode));
+	}
+	CHKiRet(acmatchConstructFinalize(ac));
+	CHKmalloc(first = malloc(sizeof(struct cnfstmt)));
+
+	DBGPRINTF("optimizer: grouping %d PROPFILTs into PROPFILT_MULTI\n", nfilters);
+	memcpy(first, head, sizeof(struct cnfstmt));
+	head->nodetype = S_PROPFILT_MULTI;
+	head->printable = NULL;
+	head->next = last->next;
+	last->next = NULL;
+	memset(&head->d, 0, sizeof(head->d));
+	head->d.s_propfilt_multi.filters = first;
+	head->d.s_propfilt_multi.nfilters = nfilters;
+	head->d.s_propfilt_multi.ac = ac;
+	ac = NULL;
+
+finalize_it:
+	acmatchDestruct(&ac);
+	RETiRet;
+}
+
+/* check if a statement can be part of a PROPFILT_MULTI run. This is the
+ * case for suitable PROPFILTs and for ifs that can be converted to them.
+ * If so, the property id and then-branch are returned.
+ */
+static int
+getPROPFILTRunMember(struct cnfstmt *stmt, propid_t *const propid, struct cnfstmt **const t_then)
+{
+	struct cnfvar *var;
+
+	if(isGroupablePROPFILT(stmt)) {
+		*propid = stmt->d.s_propfilt.prop.id;
+		*t_then = stmt->d.s_propfilt.t_then;
+		return 1;
+	}
+	if((var = cnfstmtIfPROPFILTVar(stmt)) != NULL) {
+		*propid = var->prop.id;
+		*t_then = stmt->d.s_if.t_then;
+		return 1;
+	}
+	return 0;
+}
+
+/* find runs of PROPFILTs that check the same property and can be evaluated
+ * with a single scan over the property value. Runs are only grouped if no
+ * filter action (except for the last one) can modify the message, as the
+ * property value is only obtained once. Ifs inside a run are converted to
+ * PROPFILTs only if the run is actually grouped.
+ */
+static void
+cnfstmtOptimizePROPFILTChains(struct cnfstmt *root)
+{
+	struct cnfstmt *stmt, *last, *cur, *t_then, *next_then;
+	propid_t propid, next_propid;
+	int n;
+	int bConvOK;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(!getPROPFILTRunMember(stmt, &propid, &t_then))
+			continue;
+		n = 1;
+		last = stmt;
+		while(   n < PROPFILT_MULTI_MAX
+		      && getPROPFILTRunMember(last->next, &next_propid, &next_then)
+		      && next_propid == propid
+		      && !cnfstmtMayModifyMsg(t_then)) {
+			last = last->next;
+			t_then = next_then;
+			++n;
+		}
+		if(n < PROPFILT_MULTI_MIN) {
+			stmt = last; /* continue after the run */
+			continue;
+		}
+		bConvOK = 1;
+		for(cur = stmt ; bConvOK && cur != last->next ; cur = cur->next) {
+			if(cur->nodetype == S_IF && cnfstmtIfToPROPFILT(cur) != RS_RET_OK)
+				bConvOK = 0;
+		}
+		if(!bConvOK || groupPROPFILTs(stmt, last, n) != RS_RET_OK)
+			stmt = last; /* continue after the run */
+	}
+}
+
 /* (recursively) optimize a statement */
 struct cnfstmt *
 cnfstmtOptimize(struct cnfstmt *root)
@@ -4861,6 +5517,7 @@ cnfstmtOptimize(struct cnfstmt *root)
 		}
 	}
 	root = removeNOPs(root);
+	cnfstmtOptimizePROPFILTChains(root);
 done:	return root;
 }
 
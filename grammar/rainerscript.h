@@ -118,6 +118,15 @@ struct nvlst {
 #define S_FOREACH 4009
 #define S_RELOAD_LOOKUP_TABLE 4010
 #define S_CALL_INDIRECT 4011
+#define S_PROPFILT_MULTI 4012	/* optimizer-generated chain of S_PROPFILTs */
+
+/* a run of at least PROPFILT_MULTI_MIN property filters on the same property
+ * is matched with a single pass over the property value (see acmatch.c).
+ */
+#define PROPFILT_MULTI_MIN 3
+#define PROPFILT_MULTI_MAX 1024
+
+struct acmatch_s;
 
 enum cnfFiltType { CNFFILT_NONE, CNFFILT_PRI, CNFFILT_PROP, CNFFILT_SCRIPT };
 const char* cnfFiltType2str(const enum cnfFiltType filttype);
@@ -132,6 +141,7 @@ struct cnfstmt {
 			struct cnfexpr *expr;
 			struct cnfstmt *t_then;
 			struct cnfstmt *t_else;
+			struct cnfexprprog *prog; /* compiled expr, NULL if none */
 		} s_if;
 		struct {
 			uchar *varname;
@@ -163,6 +173,11 @@ struct cnfstmt {
 			struct cnfstmt *t_then;
 			struct cnfstmt *t_else;
 		} s_propfilt;
+		struct {
+			struct cnfstmt *filters; /* list of the original S_PROPFILTs */
+			int nfilters;
+			struct acmatch_s *ac;	 /* matcher, pattern id is filter index */
+		} s_propfilt_multi;
 		struct action_s *act;
         struct {
 			struct cnfitr *iter;
@@ -209,6 +224,44 @@ struct cnfarray {
 	es_str_t **arr;
 } __attribute__((aligned (8)));
 
+/* Compiled form of a (boolean) expression. After optimization, if-conditions
+ * are lowered into a flat array of operations which work on an accumulator
+ * plus a small set of string registers, one per message property referenced.
+ * Properties are loaded at most once per evaluation into per-worker buffers,
+ * so string comparisons against constants do not need any temporaries.
+ * Everything that cannot be compiled is kept as EOP_EVAL, which evaluates
+ * the original expression subtree.
+ */
+#define CNFEXPRPROG_MAXREGS 8
+enum cnfexprOpcode {
+	EOP_EVAL,	/* acc = subtree (d.expr) evaluated as number */
+	EOP_STRCMP,	/* acc = compare string register to constant (d.estr) */
+	EOP_ARRCMP,	/* acc = compare string register to constant array (d.arr) */
+	EOP_NOT,	/* acc = !acc */
+	EOP_BOOL,	/* acc = (acc != 0) */
+	EOP_JZ,		/* jump to target if acc == 0 */
+	EOP_JNZ		/* jump to target if acc != 0 */
+};
+
+struct cnfexprop {
+	enum cnfexprOpcode opcode;
+	unsigned cmpop;		/* comparison operation (CMP_*) for EOP_*CMP */
+	unsigned reg;		/* string register for EOP_*CMP */
+	unsigned target;	/* jump target for EOP_JZ, EOP_JNZ */
+	union {
+		struct cnfexpr *expr;
+		es_str_t *estr;
+		struct cnfarray *arr;
+	} d;
+};
+
+struct cnfexprprog {
+	unsigned nops;
+	unsigned nregs;
+	struct cnfexprop *ops;
+	msgPropDescr_t *regProp[CNFEXPRPROG_MAXREGS]; /* property to load per register */
+};
+
 struct cnffparamlst {
 	unsigned nodetype; /* P */
 	struct cnffparamlst *next;
@@ -338,6 +391,9 @@ struct cnfexpr* cnfexprNew(unsigned nodetype, struct cnfexpr *l, struct cnfexpr
 void cnfexprPrint(struct cnfexpr *expr, int indent);
 void cnfexprEval(const struct cnfexpr *const expr, struct svar *ret, void *pusr, wti_t *pWti);
 int cnfexprEvalBool(struct cnfexpr *expr, void *usrptr, wti_t *pWti);
+struct cnfexprprog* cnfexprCompile(struct cnfexpr *expr);
+int cnfexprprogEvalBool(const struct cnfexprprog *prog, void *usrptr, wti_t *pWti);
+void cnfexprprogDestruct(struct cnfexprprog *prog);
 struct json_object* cnfexprEvalCollection(struct cnfexpr * const expr, void * const usrptr, wti_t *pWti);
 void cnfexprDestruct(struct cnfexpr *expr);
 struct cnfnumval* cnfnumvalNew(long long val);
@@ -371,6 +427,7 @@ struct cnfstmt * cnfstmtNewContinue(void);
 struct cnfstmt * cnfstmtNewReloadLookupTable(struct cnffparamlst *fparams);
 void cnfstmtDestructLst(struct cnfstmt *root);
 struct cnfstmt *cnfstmtOptimize(struct cnfstmt *root);
+int cnfstmtNeedsPrevSuspState(struct cnfstmt *root);
 struct cnfarray* cnfarrayNew(es_str_t *val);
 struct cnfarray* cnfarrayDup(struct cnfarray *old);
 struct cnfarray* cnfarrayAdd(struct cnfarray *ar, es_str_t *val);
@@ -612,14 +612,19 @@ static rsRetVal enqLine(lstn_t *const __restrict__ pLstn,
 	MsgSetFlowControlType(pMsg, eFLOWCTL_FULL_DELAY);
 	MsgSetInputName(pMsg, pInputName);
 	if(pLstn->addCeeTag) {
-		/* Make sure we account for terminating null byte */
-		size_t ceeMsgSize = msgLen + CONST_LEN_CEE_COOKIE + 1;
-		char *ceeMsg;
-		CHKmalloc(ceeMsg = MALLOC(ceeMsgSize));
-		strcpy(ceeMsg, CONST_CEE_COOKIE);
-		strcat(ceeMsg, (char*)rsCStrGetSzStrNoNULL(cstrLine));
-		MsgSetRawMsg(pMsg, ceeMsg, ceeMsgSize);
-		free(ceeMsg);
+		/* Make sure we account for terminating null byte. The message is
+		 * built directly inside the msg object, so no temporary copy is needed.
+		 */
+		const size_t ceeMsgSize = msgLen + CONST_LEN_CEE_COOKIE + 1;
+		uchar *pRaw;
+		if((pRaw = MsgGetRawMsgBuf(pMsg, ceeMsgSize + 1)) == NULL) {
+			msgDestruct(&pMsg);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		memcpy(pRaw, CONST_CEE_COOKIE, CONST_LEN_CEE_COOKIE);
+		memcpy(pRaw + CONST_LEN_CEE_COOKIE, rsCStrGetSzStrNoNULL(cstrLine), msgLen);
+		pRaw[CONST_LEN_CEE_COOKIE + msgLen] = '\0';
+		MsgSetRawMsgInPlace(pMsg, ceeMsgSize);
 	} else {
 		MsgSetRawMsg(pMsg, (char*)rsCStrGetSzStrNoNULL(cstrLine), msgLen);
 	}
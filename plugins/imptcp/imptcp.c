@@ -51,6 +51,7 @@
 #include <sys/un.h>
 #include <sys/epoll.h>
 #include <sys/queue.h>
+#include <semaphore.h>
 #include <netinet/tcp.h>
 #include <stdint.h>
 #include <zlib.h>
@@ -97,6 +98,7 @@ static void * wrkr(void *myself);
 
 #define DFLT_wrkrMax 2
 #define DFLT_inlineDispatchThreshold 1
+#define IO_Q_SIZE 4096	/* nbr of slots in io work queue, must be a power of 2 */
 
 #define COMPRESS_NEVER 0
 #define COMPRESS_SINGLE_MSG 1	/* old, single-message compression */
@@ -159,6 +161,8 @@ struct modConfData_s {
 	instanceConf_t *root, *tail;
 	int wrkrMax;
 	int bProcessOnPoller;
+	uchar *pszCpuset;		/* CPUs to pin poller and worker threads to, NULL - no pinning */
+	int iNumaNode;			/* NUMA node to pin poller and worker threads to, -1 - none */
 	sbool configSetViaV2Method;
 };
 
@@ -168,7 +172,9 @@ static modConfData_t *runModConf = NULL;/* modConf ptr to use for the current lo
 /* module-global parameters */
 static struct cnfparamdescr modpdescr[] = {
 	{ "threads", eCmdHdlrPositiveInt, 0 },
-	{ "processOnPoller", eCmdHdlrBinary, 0 }
+	{ "processOnPoller", eCmdHdlrBinary, 0 },
+	{ "cpuset", eCmdHdlrString, 0 },
+	{ "numa.node", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -319,7 +325,6 @@ static struct wrkrInfo_s {
 	pthread_t tid;	/* the worker's thread ID */
 	long long unsigned numCalled;	/* how often was this called */
 } *wrkrInfo;
-static int wrkrRunning;
 
 
 /* type of object stored in epoll descriptor */
@@ -338,21 +343,45 @@ struct epolld_s {
 	struct epoll_event ev;
 };
 
-typedef struct io_req_s {
-	STAILQ_ENTRY(io_req_s) link;
+/* The io work queue is a bounded ring of epoll descriptors, preallocated at
+ * startup. Each slot carries a sequence number that tells whether it is free
+ * or filled for the current lap around the ring, so producers and consumers
+ * just need a CAS on their position (D. Vyukov's bounded MPMC queue). Idle
+ * workers sleep on a semaphore counting the queued items. Without atomic
+ * instructions, the ring is guarded by a mutex instead.
+ * As descriptors are armed with EPOLLONESHOT, each one is queued at most once.
+ * If the ring is nevertheless full, the poller processes the item itself.
+ */
+typedef struct io_q_slot_s {
+	unsigned seq;
 	epolld_t *epd;
-} io_req_t;
+} io_q_slot_t;
 
 typedef struct io_q_s {
-	STAILQ_HEAD(ioq_s, io_req_s) q;
+	io_q_slot_t *slots;
+	unsigned enqPos __attribute__((aligned(64)));	/* producer and consumer positions */
+	unsigned deqPos __attribute__((aligned(64)));	/* live in different cache lines */
+	sem_t itemsAvail __attribute__((aligned(64)));
 	STATSCOUNTER_DEF(ctrEnq, mutCtrEnq);
-	int ctrMaxSz; //TODO: discuss potential problems around concurrent reads and writes
-	int sz; //current q size
+	int ctrMaxSz;
 	statsobj_t *stats;
+#ifndef HAVE_ATOMIC_BUILTINS
 	pthread_mutex_t mut;
-	pthread_cond_t wakeup_worker;
+#endif
 } io_q_t;
 
+#ifdef HAVE_ATOMIC_BUILTINS
+#	define IOQ_CAS(pos, oldVal, newVal) __sync_bool_compare_and_swap((pos), (oldVal), (newVal))
+#	define IOQ_BARRIER() __sync_synchronize()
+#	define IOQ_LOCK()
+#	define IOQ_UNLOCK()
+#else
+#	define IOQ_CAS(pos, oldVal, newVal) (*(pos) = (newVal), 1)
+#	define IOQ_BARRIER()
+#	define IOQ_LOCK() pthread_mutex_lock(&io_q.mut)
+#	define IOQ_UNLOCK() pthread_mutex_unlock(&io_q.mut)
+#endif
+
 /* global data */
 pthread_attr_t wrkrThrdAttr;	/* Attribute for session threads; read only after startup */
 static ptcpsrv_t *pSrvRoot = NULL;
@@ -910,12 +939,37 @@ finalize_it:
 }
 
 
+/* find the first octet-stuffing frame delimiter (LF or the additional
+ * delimiter, if configured) in buf. Returns its index or len if there is
+ * none. memchr() is used as it is vectorized by the C library, which is much
+ * faster than looking at each byte ourselves.
+ */
+static int
+findFrameDelim(const ptcpsrv_t *const pSrv, const char *const buf, const int len)
+{
+	const char *pDelim;
+	const char *pAddtl;
+
+	pDelim = memchr(buf, '\n', len);
+	if(pSrv->iAddtlFrameDelim != TCPSRV_NO_ADDTL_DELIMITER) {
+		pAddtl = memchr(buf, pSrv->iAddtlFrameDelim, (pDelim == NULL) ? len : pDelim - buf);
+		if(pAddtl != NULL)
+			pDelim = pAddtl;
+	}
+	return (pDelim == NULL) ? len : pDelim - buf;
+}
+
+
 /* process the data received. As TCP is stream based, we need to process the
  * data inside a state machine. The actual data received is passed in byte-by-byte
  * from DataRcvd, and this function here compiles messages from them and submits
  * the end result to the queue. Introducing this function fixes a long-term bug ;)
  * rgerhards, 2008-03-14
  * EXTRACT from tcps_sess.c
+ * Message content is not processed byte-by-byte, but in runs: for octet-counted
+ * frames, the rest of the frame, and for octet-stuffed ones, everything up to the
+ * next delimiter is copied at once. *buff is then advanced to the last byte
+ * consumed (the caller moves it one further).
  */
 static rsRetVal
 processDataRcvd(ptcpsess_t *const __restrict__ pThis,
@@ -929,6 +983,7 @@ processDataRcvd(ptcpsess_t *const __restrict__ pThis,
 	DEFiRet;
 	char c = **buff;
 	int octatesToCopy, octatesToDiscard;
+	int lenRun;
 	uchar *propPeerName = NULL;
 	int lenPeerName = 0;
 	uchar *propPeerIP = NULL;
@@ -996,10 +1051,13 @@ processDataRcvd(ptcpsess_t *const __restrict__ pThis,
 			pThis->inputState = eInMsg;
 		}
 	} else if(pThis->inputState == eInMsgTruncation) {
-		if ((c == '\n')
-		|| ((pThis->pLstn->pSrv->iAddtlFrameDelim != TCPSRV_NO_ADDTL_DELIMITER)
-		&& (c == pThis->pLstn->pSrv->iAddtlFrameDelim))) {
+		/* skip everything up to and including the next delimiter */
+		lenRun = findFrameDelim(pThis->pLstn->pSrv, *buff, buffLen);
+		if(lenRun < buffLen) {
 			pThis->inputState = eAtStrtFram;
+			*buff += lenRun;
+		} else {
+			*buff += buffLen - 1;
 		}
 	} else {
 		assert(pThis->inputState == eInMsg);
@@ -1007,13 +1065,7 @@ processDataRcvd(ptcpsess_t *const __restrict__ pThis,
 		if (pThis->eFraming == TCP_FRAMING_OCTET_STUFFING) {
 			if(pThis->iMsg >= iMaxLine) {
 				/* emergency, we now need to flush, no matter if we are at end of message or not... */
-				int i = 1;
-				char currBuffChar;
-				while(i < buffLen && ((currBuffChar = (*buff)[i]) != '\n'
-					&& (pThis->pLstn->pSrv->iAddtlFrameDelim == TCPSRV_NO_ADDTL_DELIMITER
-						|| currBuffChar != pThis->pLstn->pSrv->iAddtlFrameDelim))) {
-					i++;
-				}
+				const int i = 1 + findFrameDelim(pThis->pLstn->pSrv, *buff + 1, buffLen - 1);
 				LogError(0, NO_ERRCODE, "imptcp %s: message received is at least %d byte larger than "
 					"max msg size; message will be split starting at: \"%.*s\"\n",
 					pThis->pLstn->pSrv->pszInputName, i, (i < 32) ? i : 32, *buff);
@@ -1052,9 +1104,21 @@ processDataRcvd(ptcpsess_t *const __restrict__ pThis,
 				 * framing modes! If we have a message that is larger than the max msg size,
 				 * we truncate it. This is the best we can do in light of what the engine supports.
 				 * -- rgerhards, 2008-03-14
+				 * We copy the whole run up to the next delimiter, but not beyond the max
+				 * msg size: the next byte then triggers the "emergency" flush above. If that
+				 * flush just switched us to truncation mode, the rest must be skipped by it.
 				 */
-				if(pThis->iMsg < iMaxLine) {
-					*(pThis->pMsg + pThis->iMsg++) = c;
+				if(pThis->inputState != eInMsg) {
+					if(pThis->iMsg < iMaxLine) {
+						*(pThis->pMsg + pThis->iMsg++) = c;
+					}
+				} else if(pThis->iMsg < iMaxLine) {
+					lenRun = findFrameDelim(pThis->pLstn->pSrv, *buff, buffLen);
+					if(lenRun > iMaxLine - pThis->iMsg)
+						lenRun = iMaxLine - pThis->iMsg;
+					memcpy(pThis->pMsg + pThis->iMsg, *buff, lenRun);
+					pThis->iMsg += lenRun;
+					*buff += lenRun - 1;
 				}
 			}
 		} else {
@@ -1650,9 +1714,6 @@ static void
 startWorkerPool(void)
 {
 	int i;
-	pthread_mutex_lock(&io_q.mut); /* locking to keep Coverity happy */
-	wrkrRunning = 0;
-	pthread_mutex_unlock(&io_q.mut);
 	DBGPRINTF("imptcp: starting worker pool, %d workers\n", runModConf->wrkrMax);
 	wrkrInfo = calloc(runModConf->wrkrMax, sizeof(struct wrkrInfo_s));
 	if (wrkrInfo == NULL) {
@@ -1674,9 +1735,10 @@ stopWorkerPool(void)
 {
 	int i;
 	DBGPRINTF("imptcp: stoping worker pool\n");
-	pthread_mutex_lock(&io_q.mut);
-	pthread_cond_broadcast(&io_q.wakeup_worker); /* awake wrkr if not running */
-	pthread_mutex_unlock(&io_q.mut);
+	/* awake wrkrs if not running; they terminate once the queue is empty */
+	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
+		sem_post(&io_q.itemsAvail);
+	}
 	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
 		pthread_join(wrkrInfo[i].tid, NULL);
 		DBGPRINTF("imptcp: info: worker %d was called %llu times\n", i, wrkrInfo[i].numCalled);
@@ -1837,12 +1899,23 @@ processWorkItem(epolld_t *epd)
 static rsRetVal
 initIoQ(void)
 {
+	unsigned i;
 	DEFiRet;
+#ifndef HAVE_ATOMIC_BUILTINS
 	CHKiConcCtrl(pthread_mutex_init(&io_q.mut, NULL));
-	CHKiConcCtrl(pthread_cond_init(&io_q.wakeup_worker, NULL));
-	STAILQ_INIT(&io_q.q);
-	io_q.sz = 0;
-	io_q.ctrMaxSz = 0; /* TODO: discuss this and fix potential concurrent read/write issues */
+#endif
+	if(sem_init(&io_q.itemsAvail, 0, 0) != 0) {
+		errmsg.LogError(errno, RS_RET_ERR, "imptcp: sem_init() for io work queue failed");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+	CHKmalloc(io_q.slots = malloc(IO_Q_SIZE * sizeof(io_q_slot_t)));
+	for(i = 0 ; i < IO_Q_SIZE ; ++i) {
+		io_q.slots[i].seq = i;
+		io_q.slots[i].epd = NULL;
+	}
+	io_q.enqPos = 0;
+	io_q.deqPos = 0;
+	io_q.ctrMaxSz = 0;
 	CHKiRet(statsobj.Construct(&io_q.stats));
 	CHKiRet(statsobj.SetName(io_q.stats, (uchar*) "io-work-q"));
 	CHKiRet(statsobj.SetOrigin(io_q.stats, (uchar*) "imptcp"));
@@ -1856,62 +1929,111 @@ finalize_it:
 	RETiRet;
 }
 
+/* add a descriptor to the io work queue. Returns 0 if the queue is full. */
+static int
+ioQPush(epolld_t *const epd)
+{
+	io_q_slot_t *slot;
+	unsigned pos;
+	int diff;
+
+	IOQ_LOCK();
+	while(1) {
+		pos = *(volatile unsigned*) &io_q.enqPos;
+		slot = &io_q.slots[pos & (IO_Q_SIZE - 1)];
+		diff = (int) (*(volatile unsigned*) &slot->seq - pos);
+		if(diff == 0) {
+			if(IOQ_CAS(&io_q.enqPos, pos, pos + 1))
+				break;
+		} else if(diff < 0) {
+			IOQ_UNLOCK();
+			return 0; /* slot not yet consumed in previous lap */
+		}
+		/* else another producer was faster, retry */
+	}
+	slot->epd = epd;
+	IOQ_BARRIER();
+	slot->seq = pos + 1;
+	IOQ_UNLOCK();
+	return 1;
+}
+
+/* take a descriptor from the io work queue. Returns NULL if it is empty. */
+static epolld_t *
+ioQPop(void)
+{
+	io_q_slot_t *slot;
+	epolld_t *epd;
+	unsigned pos;
+	int diff;
+
+	IOQ_LOCK();
+	while(1) {
+		pos = *(volatile unsigned*) &io_q.deqPos;
+		slot = &io_q.slots[pos & (IO_Q_SIZE - 1)];
+		diff = (int) (*(volatile unsigned*) &slot->seq - (pos + 1));
+		if(diff == 0) {
+			if(IOQ_CAS(&io_q.deqPos, pos, pos + 1))
+				break;
+		} else if(diff < 0) {
+			IOQ_UNLOCK();
+			return NULL; /* slot not yet filled */
+		}
+		/* else another consumer was faster, retry */
+	}
+	IOQ_BARRIER();
+	epd = slot->epd;
+	IOQ_BARRIER();
+	slot->seq = pos + IO_Q_SIZE; /* free for next lap */
+	IOQ_UNLOCK();
+	return epd;
+}
+
+/* current number of queued items. Only approximate if there are
+ * concurrent queue operations.
+ */
+static int
+ioQSize(void)
+{
+	return (int) (*(volatile unsigned*) &io_q.enqPos - *(volatile unsigned*) &io_q.deqPos);
+}
+
 static void
 destroyIoQ(void)
 {
-	io_req_t *n;
 	if (io_q.stats != NULL) {
 		statsobj.Destruct(&io_q.stats);
 	}
-	pthread_mutex_lock(&io_q.mut);
-	while (!STAILQ_EMPTY(&io_q.q)) {
-		n = STAILQ_FIRST(&io_q.q);
-		STAILQ_REMOVE_HEAD(&io_q.q, link);
-		errmsg.LogError(0, RS_RET_INTERNAL_ERROR, "imptcp: discarded enqueued io-work to allow shutdown "
-								"- ignored");
-		free(n);
-	}
-	io_q.sz = 0;
-	pthread_mutex_unlock(&io_q.mut);
-	pthread_cond_destroy(&io_q.wakeup_worker);
+	if(io_q.slots != NULL) {
+		while(ioQPop() != NULL) {
+			errmsg.LogError(0, RS_RET_INTERNAL_ERROR, "imptcp: discarded enqueued io-work to "
+									"allow shutdown - ignored");
+		}
+		free(io_q.slots);
+		io_q.slots = NULL;
+	}
+	sem_destroy(&io_q.itemsAvail);
+#ifndef HAVE_ATOMIC_BUILTINS
 	pthread_mutex_destroy(&io_q.mut);
+#endif
 }
 
-static rsRetVal
+/* hand an epoll event over to the worker pool. Note that only the poller
+ * calls this, so the stats need no further synchronization.
+ */
+static void
 enqueueIoWork(epolld_t *epd, int dispatchInlineIfQueueFull) {
-	io_req_t *n;
-	int dispatchInline;
-	DEFiRet;
-	
-	CHKmalloc(n = malloc(sizeof(io_req_t)));
-	n->epd = epd;
-	
-	int inlineDispatchThreshold = DFLT_inlineDispatchThreshold * runModConf->wrkrMax;
-	dispatchInline = 0;
-	
-	pthread_mutex_lock(&io_q.mut);
-	if (dispatchInlineIfQueueFull && io_q.sz > inlineDispatchThreshold) {
-		dispatchInline = 1;
-	} else {
-		STAILQ_INSERT_TAIL(&io_q.q, n, link);
-		io_q.sz++;
-		STATSCOUNTER_INC(io_q.ctrEnq, io_q.mutCtrEnq);
-		STATSCOUNTER_SETMAX_NOMUT(io_q.ctrMaxSz, io_q.sz);
-		pthread_cond_signal(&io_q.wakeup_worker);
-	}
-	pthread_mutex_unlock(&io_q.mut);
+	const int inlineDispatchThreshold = DFLT_inlineDispatchThreshold * runModConf->wrkrMax;
+	int sz;
 
-	if (dispatchInline == 1) {
-		free(n);
+	if((dispatchInlineIfQueueFull && ioQSize() > inlineDispatchThreshold) || !ioQPush(epd)) {
 		processWorkItem(epd);
+		return;
 	}
-finalize_it:
-	if (iRet != RS_RET_OK) {
-		if (n == NULL) {
-			errmsg.LogError(0, iRet, "imptcp: couldn't allocate memory to enqueue io-request - ignored");
-		}
-	}
-	RETiRet;
+	sem_post(&io_q.itemsAvail);
+	sz = ioQSize();
+	STATSCOUNTER_INC(io_q.ctrEnq, io_q.mutCtrEnq);
+	STATSCOUNTER_SETMAX_NOMUT(io_q.ctrMaxSz, sz);
 }
 
 /* This function is called to process a complete workset, that
@@ -1944,39 +2066,24 @@ static void *
 wrkr(void *myself)
 {
 	struct wrkrInfo_s *me = (struct wrkrInfo_s*) myself;
-	pthread_mutex_lock(&io_q.mut);
-	++wrkrRunning;
-	pthread_mutex_unlock(&io_q.mut);
+	epolld_t *epd;
+
+	if(srSetThreadAffinity(runModConf->pszCpuset, runModConf->iNumaNode) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_ERR, "imptcp: could not set CPU affinity for worker - ignored");
+	}
 
-	io_req_t *n;
 	while(1) {
-		n = NULL;
-		pthread_mutex_lock(&io_q.mut);
-		if (io_q.sz == 0) {
-			--wrkrRunning;
-			if (glbl.GetGlobalInputTermState() != 0) {
-				pthread_mutex_unlock(&io_q.mut);
+		while(sem_wait(&io_q.itemsAvail) != 0 && errno == EINTR)
+			/* just retry */;
+		if((epd = ioQPop()) == NULL) {
+			if(glbl.GetGlobalInputTermState() != 0)
 				break;
-			} else {
-				DBGPRINTF("imptcp: worker %llu waiting on new work items\n",
-					(unsigned long long) me->tid);
-				pthread_cond_wait(&io_q.wakeup_worker, &io_q.mut);
-				DBGPRINTF("imptcp: worker %llu awoken\n", (unsigned long long) me->tid);
-			}
-			++wrkrRunning;
-		}
-		if (io_q.sz > 0) {
-			n = STAILQ_FIRST(&io_q.q);
-			STAILQ_REMOVE_HEAD(&io_q.q, link);
-			io_q.sz--;
-		}
-		pthread_mutex_unlock(&io_q.mut);
-
-		if (n != NULL) {
-			++me->numCalled;
-			processWorkItem(n->epd);
-			free(n);
+			/* counted, but not yet visible to us - give it back */
+			sem_post(&io_q.itemsAvail);
+			continue;
 		}
+		++me->numCalled;
+		processWorkItem(epd);
 	}
 	return NULL;
 }
@@ -2105,6 +2212,8 @@ CODESTARTbeginCnfLoad
 	/* init our settings */
 	loadModConf->wrkrMax = DFLT_wrkrMax;
 	loadModConf->bProcessOnPoller = 1;
+	loadModConf->pszCpuset = NULL;
+	loadModConf->iNumaNode = -1;
 	loadModConf->configSetViaV2Method = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
@@ -2135,6 +2244,10 @@ CODESTARTsetModCnf
 			loadModConf->wrkrMax = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "processOnPoller")) {
 			loadModConf->bProcessOnPoller = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "cpuset")) {
+			loadModConf->pszCpuset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "numa.node")) {
+			loadModConf->iNumaNode = (int) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imptcp: program error, non-handled "
 			  "param '%s' in beginCnfLoad\n", modpblk.descr[i].name);
@@ -2183,6 +2296,15 @@ CODESTARTcheckCnf
 	for(inst = pModConf->root ; inst != NULL ; inst = inst->next) {
 		std_checkRuleset(pModConf, inst);
 	}
+	if(srCheckAffinity(pModConf->pszCpuset, pModConf->iNumaNode) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "imptcp: cpuset '%s' / numa.node %d "
+				"can not be used for thread affinity on this system - ignored",
+				(pModConf->pszCpuset == NULL) ? "" : (char*) pModConf->pszCpuset,
+				pModConf->iNumaNode);
+		free(pModConf->pszCpuset);
+		pModConf->pszCpuset = NULL;
+		pModConf->iNumaNode = -1;
+	}
 ENDcheckCnf
 
 
@@ -2247,6 +2369,7 @@ CODESTARTfreeCnf
 		inst = inst->next;
 		free(del);
 	}
+	free(pModConf->pszCpuset);
 ENDfreeCnf
 
 
@@ -2256,6 +2379,10 @@ BEGINrunInput
 	int nEvents;
 	struct epoll_event events[128];
 CODESTARTrunInput
+	/* the poller may also process data (processOnPoller), so it is pinned as well */
+	if(srSetThreadAffinity(runModConf->pszCpuset, runModConf->iNumaNode) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_ERR, "imptcp: could not set CPU affinity for poller - ignored");
+	}
 	initIoQ();
 	startWorkerPool();
 	DBGPRINTF("imptcp: now beginning to process input data\n");
@@ -33,6 +33,9 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <pthread.h>
+#ifdef HAVE_LINUX_FILTER_H
+#	include <linux/filter.h>
+#endif
 #include <signal.h>
 #ifdef HAVE_SYS_EPOLL_H
 #	include <sys/epoll.h>
@@ -83,6 +86,7 @@ static struct lstn_s {
 	statsobj_t *stats;	/* listener stats */
 	ratelimit_t *ratelimiter;
 	uchar *dfltTZ;
+	int wrkrId;		/* worker owning this socket, -1 means all workers */
 	STATSCOUNTER_DEF(ctrSubmit, mutCtrSubmit)
 } *lcnfRoot = NULL, *lcnfLast = NULL;
 
@@ -90,6 +94,7 @@ static struct lstn_s {
 static int bLegacyCnfModGlobalsPermitted;/* are legacy module-global config parameters permitted? */
 static int bDoACLCheck;			/* are ACL checks neeed? Cached once immediately before listener startup */
 static int iMaxLine;			/* maximum UDP message size supported */
+#define ZC_MIN_FILL_DIV 4		/* zerocopy: min fill of the receive buffer, see bZeroCopy */
 static time_t ttLastDiscard = 0;	/* timestamp when a message from a non-permitted sender was last discarded
 					 * This shall prevent remote DoS when the "discard on disallowed sender"
 					 * message is configured to be logged on occurance of such a case.
@@ -122,8 +127,10 @@ struct instanceConf_s {
 	1 means:  IP_FREEBIND enabled + warning disabled
 	1+ means: IP+FREEBIND enabled + warning enabled */
 	int ipfreebind;
+	int nReusePortSocks;		/* nbr of SO_REUSEPORT sockets per address; 1 - plain single socket */
 	struct instanceConf_s *next;
 	sbool bAppendPortToInpname;
+	sbool bCpuSteering;		/* steer datagrams to socket (rx cpu % nReusePortSocks) */
 };
 
 /* The following structure controls the worker threads. Global data is
@@ -142,6 +149,7 @@ static struct wrkrInfo_s {
 	struct sockaddr_storage *frominet;
 	struct mmsghdr *recvmsg_mmh;
 	struct iovec *recvmsg_iov;
+	smsg_t **ppZcMsg;	/* zero-copy mode: msg objects whose raw msg buffers we receive into */
 #	endif
 } wrkrInfo[MAX_WRKR_THREADS];
 
@@ -151,9 +159,17 @@ struct modConfData_s {
 	uchar *pszSchedPolicy;		/* scheduling policy string */
 	int iSchedPolicy;		/* scheduling policy as SCHED_xxx */
 	int iSchedPrio;			/* scheduling priority */
+	uchar *pszCpuset;		/* CPUs to pin worker threads to, NULL - no pinning */
+	int iNumaNode;			/* NUMA node to pin worker threads to, -1 - none */
 	int iTimeRequery;		/* how often is time to be queried inside tight recv loop? 0=always */
 	int batchSize;			/* max nbr of input batch --> also recvmmsg() max count */
 	int8_t wrkrMax;			/* max nbr of worker threads */
+	sbool bZeroCopy;		/* recvmmsg() directly into msg object buffers? Each such
+					 * buffer is iMaxLine+1 bytes and stays with the message
+					 * while it is queued. So this is only done for datagrams
+					 * that fill at least 1/ZC_MIN_FILL_DIV of it, smaller ones
+					 * are copied as usual. Memory use per queued zero-copy
+					 * message is thus at most ZC_MIN_FILL_DIV times its size. */
 	sbool configSetViaV2Method;
 };
 static modConfData_t *loadModConf = NULL;/* modConf ptr to use for the current load process */
@@ -165,7 +181,10 @@ static struct cnfparamdescr modpdescr[] = {
 	{ "schedulingpriority", eCmdHdlrInt, 0 },
 	{ "batchsize", eCmdHdlrInt, 0 },
 	{ "threads", eCmdHdlrPositiveInt, 0 },
-	{ "timerequery", eCmdHdlrInt, 0 }
+	{ "timerequery", eCmdHdlrInt, 0 },
+	{ "cpuset", eCmdHdlrString, 0 },
+	{ "numa.node", eCmdHdlrNonNegInt, 0 },
+	{ "zerocopy", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk modpblk =
 	{ CNFPARAMBLK_VERSION,
@@ -187,7 +206,9 @@ static struct cnfparamdescr inppdescr[] = {
 	{ "ratelimit.burst", eCmdHdlrInt, 0 },
 	{ "rcvbufsize", eCmdHdlrSize, 0 },
 	{ "ipfreebind", eCmdHdlrInt, 0 },
-	{ "ruleset", eCmdHdlrString, 0 }
+	{ "ruleset", eCmdHdlrString, 0 },
+	{ "reuseport.sockets", eCmdHdlrPositiveInt, 0 },
+	{ "reuseport.cpusteering", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk inppblk =
 	{ CNFPARAMBLK_VERSION,
@@ -220,6 +241,8 @@ createInstance(instanceConf_t **pinst)
 	inst->ratelimitInterval = 0; /* off */
 	inst->rcvbuf = 0;
 	inst->ipfreebind = IPFREEBIND_ENABLED_WITH_LOG;
+	inst->nReusePortSocks = 1;
+	inst->bCpuSteering = 0;
 	inst->dfltTZ = NULL;
 
 	/* node created, let's add to config */
@@ -270,18 +293,54 @@ finalize_it:
 }
 
 
+/* Attach a classic BPF program to a SO_REUSEPORT group which selects the
+ * socket by the CPU the datagram was received on. So with RSS, all packets
+ * of a NIC rx queue end up in the same socket and thus the same worker,
+ * instead of being spread by the kernel's 4-tuple hash. The program is
+ * shared by the group, so it does not matter on which member we set it.
+ */
+static void
+attachCpuSteering(const int sock, const int nSocks)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+	char errStr[1024];
+	struct sock_filter code[] = {
+		{ BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU }, /* A = rx cpu */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t) nSocks },       /* A = A % nSocks */
+		{ BPF_RET | BPF_A, 0, 0, 0 }                                   /* socket index A */
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof(code)/sizeof(struct sock_filter);
+	prog.filter = code;
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+		rs_strerror_r(errno, errStr, sizeof(errStr));
+		errmsg.LogError(errno, NO_ERRCODE, "imudp: could not attach cpu steering "
+				"program to socket %d: %s - ignored", sock, errStr);
+	}
+#else
+	DBGPRINTF("imudp: cpu steering for socket %d (%d sockets) requested, but not "
+		"supported on this platform\n", sock, nSocks);
+#endif
+}
+
+
 /* This function is called when a new listener shall be added. It takes
  * the instance config description, tries to bind the socket and, if that
  * succeeds, adds it to the list of existing listen sockets.
+ * If reuseport.sockets is greater than one, that many SO_REUSEPORT sockets
+ * are bound to each address. Each of them is owned by exactly one worker
+ * thread, so the workers do not contend on a shared socket.
  */
 static rsRetVal
 addListner(instanceConf_t *inst)
 {
 	DEFiRet;
 	uchar *bindAddr;
-	int *newSocks;
-	int iSrc;
-	struct lstn_s *newlcnfinfo;
+	int *newSocks = NULL;
+	int iSrc = 1;
+	int iSock;
+	struct lstn_s *newlcnfinfo = NULL;
 	uchar *bindName;
 	uchar *port;
 	uchar dispname[64], inpnameBuf[128];
@@ -299,10 +358,18 @@ addListner(instanceConf_t *inst)
 	bindName = (bindAddr == NULL) ? (uchar*)"*" : bindAddr;
 	port = (inst->pszBindPort == NULL || *inst->pszBindPort == '\0') ? (uchar*) "514" : inst->pszBindPort;
 
-	DBGPRINTF("Trying to open syslog UDP ports at %s:%s.\n", bindName, inst->pszBindPort);
-
-	newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf, 0, inst->ipfreebind, inst->pszBindDevice);
-	if(newSocks != NULL) {
+	DBGPRINTF("Trying to open syslog UDP ports at %s:%s (%d socket(s) each).\n", bindName,
+		inst->pszBindPort, inst->nReusePortSocks);
+
+	for(iSock = 0 ; iSock < inst->nReusePortSocks ; ++iSock) {
+		newSocks = net.create_udp_socket(bindAddr, port, 1, inst->rcvbuf, 0, inst->ipfreebind,
+			inst->pszBindDevice, inst->nReusePortSocks > 1);
+		if(newSocks == NULL) {
+			errmsg.LogError(0, NO_ERRCODE, "imudp: Could not create udp listener,"
+					" ignoring port %s bind-address %s.",
+					port, bindAddr);
+			break;
+		}
 		/* we now need to add the new sockets to the existing set */
 		/* ready to copy */
 		for(iSrc = 1 ; iSrc <= newSocks[0] ; ++iSrc) {
@@ -311,12 +378,24 @@ addListner(instanceConf_t *inst)
 			newlcnfinfo->sock = newSocks[iSrc];
 			newlcnfinfo->pRuleset = inst->pBindRuleset;
 			newlcnfinfo->dfltTZ = inst->dfltTZ;
+			/* the last worker runs on the input thread and so always exists;
+			 * hand out sockets starting from it.
+			 */
+			newlcnfinfo->wrkrId = (inst->nReusePortSocks > 1)
+				? runModConf->wrkrMax - 1 - (iSock % runModConf->wrkrMax) : -1;
+			if(inst->bCpuSteering && inst->nReusePortSocks > 1)
+				attachCpuSteering(newlcnfinfo->sock, inst->nReusePortSocks);
 			if(inst->inputname == NULL) {
 				inputname = (uchar*)"imudp";
 			} else {
 				inputname = inst->inputname;
 			}
-			snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
+			if(inst->nReusePortSocks > 1) {
+				snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s/%d)", inputname,
+					bindName, port, iSock);
+			} else {
+				snprintf((char*)dispname, sizeof(dispname), "%s(%s:%s)", inputname, bindName, port);
+			}
 			dispname[sizeof(dispname)-1] = '\0'; /* just to be on the save side... */
 			CHKiRet(ratelimitNew(&newlcnfinfo->ratelimiter, (char*)dispname, NULL));
 			if(inst->bAppendPortToInpname) {
@@ -351,11 +430,10 @@ addListner(instanceConf_t *inst)
 				lcnfLast->next = newlcnfinfo;
 				lcnfLast = newlcnfinfo;
 			}
+			newlcnfinfo = NULL;
 		}
-	} else {
-		errmsg.LogError(0, NO_ERRCODE, "imudp: Could not create udp listener,"
-				" ignoring port %s bind-address %s.",
-				port, bindAddr);
+		free(newSocks);
+		newSocks = NULL;
 	}
 
 finalize_it:
@@ -371,8 +449,10 @@ finalize_it:
 		}
 		/* close the rest of the open sockets as there's
 		   nowhere to put them */
-		for(; iSrc <= newSocks[0]; iSrc++) {
-			close(newSocks[iSrc]);
+		if(newSocks != NULL) {
+			for(; iSrc <= newSocks[0]; iSrc++) {
+				close(newSocks[iSrc]);
+			}
 		}
 	}
 
@@ -393,11 +473,17 @@ std_checkRuleset_genErrMsg(__attribute__((unused)) modConfData_t *modConf, insta
 
 /* This function processes received data. It provides unified handling
  * in cases where recvmmsg() is available and not.
+ * In zero-copy mode, ppZcMsg points to the msg object whose buffer rcvBuf
+ * is. If the datagram fills a sufficient part of that (iMaxLine-sized)
+ * buffer, we take over that object instead of copying the data into a new
+ * one. Smaller datagrams are copied, so that a queued message does not
+ * pin a buffer many times its size.
  */
 static rsRetVal
 processPacket(struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *pbIsPermitted,
 	uchar *rcvBuf, ssize_t lenRcvBuf, struct syslogTime *stTime, time_t ttGenTime,
-	struct sockaddr_storage *frominet, socklen_t socklen, multi_submit_t *multiSub)
+	struct sockaddr_storage *frominet, socklen_t socklen, multi_submit_t *multiSub,
+	smsg_t **ppZcMsg)
 {
 	DEFiRet;
 	smsg_t *pMsg = NULL;
@@ -443,8 +529,16 @@ processPacket(struct lstn_s *lstn, struct sockaddr_storage *frominetPrev, int *p
 
 	if(*pbIsPermitted != 0)  {
 		/* we now create our own message object and submit it to the queue */
-		CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
-		MsgSetRawMsg(pMsg, (char*)rcvBuf, lenRcvBuf);
+		if(ppZcMsg != NULL && lenRcvBuf >= CONF_RAWMSG_BUFSIZE
+		   && lenRcvBuf >= (iMaxLine + 1) / ZC_MIN_FILL_DIV) {
+			pMsg = *ppZcMsg;
+			*ppZcMsg = NULL;
+			MsgSetRcvdTime(pMsg, stTime, ttGenTime);
+			MsgSetRawMsgInPlace(pMsg, lenRcvBuf);
+		} else {
+			CHKiRet(msgConstructWithTime(&pMsg, stTime, ttGenTime));
+			MsgSetRawMsg(pMsg, (char*)rcvBuf, lenRcvBuf);
+		}
 		MsgSetInputName(pMsg, lstn->pInputName);
 		MsgSetRuleset(pMsg, lstn->pRuleset);
 		MsgSetFlowControlType(pMsg, eFLOWCTL_NO_DELAY);
@@ -476,6 +570,59 @@ finalize_it:
  * an appropriate version is compiled (as such we need to maintain both!).
  */
 #ifdef HAVE_RECVMMSG
+/* set up the recvmmsg() header vectors. This needs to be done only once,
+ * as the kernel does not modify them except for msg_namelen, which we
+ * reset after each received datagram. In zero-copy mode, the receive
+ * buffers are set by zcFillBufs().
+ */
+static void
+initRcvVectors(struct wrkrInfo_s *const pWrkr)
+{
+	int i;
+
+	memset(pWrkr->recvmsg_iov, 0, runModConf->batchSize * sizeof(struct iovec));
+	memset(pWrkr->recvmsg_mmh, 0, runModConf->batchSize * sizeof(struct mmsghdr));
+	for(i = 0 ; i < runModConf->batchSize ; ++i) {
+		if(pWrkr->ppZcMsg == NULL)
+			pWrkr->recvmsg_iov[i].iov_base = pWrkr->pRcvBuf+(i*(iMaxLine+1));
+		pWrkr->recvmsg_iov[i].iov_len = iMaxLine;
+		pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		pWrkr->recvmsg_mmh[i].msg_hdr.msg_name = &(pWrkr->frominet[i]);
+		pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov = &(pWrkr->recvmsg_iov[i]);
+		pWrkr->recvmsg_mmh[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+
+/* zero-copy mode: make sure each receive slot has a msg object with a raw
+ * msg buffer that recvmmsg() can place the datagram in. Slots are refilled
+ * after their object has been submitted. This must be called on the worker
+ * thread, so that the objects come from (and return to) its msg cache.
+ */
+static rsRetVal
+zcFillBufs(struct wrkrInfo_s *const pWrkr)
+{
+	static const struct syslogTime stTimeUnset; /* real time is set on reception */
+	uchar *pBuf;
+	int i;
+	DEFiRet;
+
+	for(i = 0 ; i < runModConf->batchSize ; ++i) {
+		if(pWrkr->ppZcMsg[i] != NULL)
+			continue;
+		CHKiRet(msgConstructWithTime(&pWrkr->ppZcMsg[i], &stTimeUnset, 0));
+		if((pBuf = MsgGetRawMsgBuf(pWrkr->ppZcMsg[i], iMaxLine + 1)) == NULL) {
+			msgDestruct(&pWrkr->ppZcMsg[i]);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		pWrkr->recvmsg_iov[i].iov_base = pBuf;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 static rsRetVal
 processSocket(struct wrkrInfo_s *pWrkr, struct lstn_s *lstn, struct sockaddr_storage *frominetPrev,
 int *pbIsPermitted)
@@ -499,16 +646,8 @@ int *pbIsPermitted)
 	while(1) { /* loop is terminated if we have a "bad" receive, done below in the body */
 		if(pWrkr->pThrd->bShallStop == RSTRUE)
 			ABORT_FINALIZE(RS_RET_FORCE_TERM);
-		memset(pWrkr->recvmsg_iov, 0, runModConf->batchSize * sizeof(struct iovec));
-		memset(pWrkr->recvmsg_mmh, 0, runModConf->batchSize * sizeof(struct mmsghdr));
-		for(i = 0 ; i < runModConf->batchSize ; ++i) {
-			pWrkr->recvmsg_iov[i].iov_base = pWrkr->pRcvBuf+(i*(iMaxLine+1));
-			pWrkr->recvmsg_iov[i].iov_len = iMaxLine;
-			pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage); 
-			pWrkr->recvmsg_mmh[i].msg_hdr.msg_name = &(pWrkr->frominet[i]);
-			pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov = &(pWrkr->recvmsg_iov[i]);
-			pWrkr->recvmsg_mmh[i].msg_hdr.msg_iovlen = 1;
-		}
+		if(pWrkr->ppZcMsg != NULL)
+			CHKiRet(zcFillBufs(pWrkr));
 		nelem = recvmmsg(lstn->sock, pWrkr->recvmsg_mmh, runModConf->batchSize, 0, NULL);
 		STATSCOUNTER_INC(pWrkr->ctrCall_recvmmsg, pWrkr->mutCtrCall_recvmmsg);
 		DBGPRINTF("imudp: recvmmsg returned %d\n", nelem);
@@ -541,7 +680,9 @@ int *pbIsPermitted)
 			processPacket(lstn, frominetPrev, pbIsPermitted,
 				pWrkr->recvmsg_mmh[i].msg_hdr.msg_iov->iov_base,
 				pWrkr->recvmsg_mmh[i].msg_len, &stTime, ttGenTime, &(pWrkr->frominet[i]),
-				pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen, &multiSub);
+				pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen, &multiSub,
+				(pWrkr->ppZcMsg == NULL) ? NULL : &(pWrkr->ppZcMsg[i]));
+			pWrkr->recvmsg_mmh[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
 		}
 	}
 
@@ -613,7 +754,7 @@ int *pbIsPermitted)
 		}
 
 		CHKiRet(processPacket(lstn, frominetPrev, pbIsPermitted, pWrkr->pRcvBuf, lenRcvBuf, &stTime,
-			ttGenTime, &frominet, mh.msg_namelen, &multiSub));
+			ttGenTime, &frominet, mh.msg_namelen, &multiSub, NULL));
 	}
 
 
@@ -744,6 +885,11 @@ finalize_it:
 }
 
 
+/* does the listener belong to the given worker? Plain listeners are shared
+ * by all workers, SO_REUSEPORT ones have exactly one owner.
+ */
+#define LSTN_IS_MINE(lstn, pWrkr) ((lstn)->wrkrId == -1 || (lstn)->wrkrId == (pWrkr)->id)
+
 /* This function implements the main reception loop. Depending on the environment,
  * we either use the traditional (but slower) select() or the Linux-specific epoll()
  * interface. ./configure settings control which one is used.
@@ -772,16 +918,23 @@ rcvMainLoop(struct wrkrInfo_s *const __restrict__ pWrkr)
 	bIsPermitted = 0;
 	memset(&frominetPrev, 0, sizeof(frominetPrev));
 
+	if(lcnfRoot == NULL) {
+		errmsg.LogError(errno, RS_RET_ERR,
+			"imudp error: we have 0 listeners, terminating"
+			"worker thread");
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+
 	/* count num listeners -- do it here in order to avoid inconsistency */
 	nLstn = 0;
 	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next)
-		++nLstn;
+		if(LSTN_IS_MINE(lstn, pWrkr))
+			++nLstn;
 
 	if(nLstn == 0) {
-		errmsg.LogError(errno, RS_RET_ERR,
-			"imudp error: we have 0 listeners, terminating"
-			"worker thread");
-		ABORT_FINALIZE(RS_RET_ERR);
+		/* possible with reuseport.sockets below the number of threads */
+		DBGPRINTF("imudp: worker %d has no listeners, terminating\n", pWrkr->id);
+		FINALIZE;
 	}
 	CHKmalloc(udpEPollEvt = calloc(nLstn, sizeof(struct epoll_event)));
 
@@ -805,6 +958,8 @@ rcvMainLoop(struct wrkrInfo_s *const __restrict__ pWrkr)
 	 */
 	i = 0;
 	for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
+		if(!LSTN_IS_MINE(lstn, pWrkr))
+			continue;
 		if(lstn->sock != -1) {
 			udpEPollEvt[i].events = EPOLLIN | EPOLLET;
 			udpEPollEvt[i].data.ptr = lstn;
@@ -866,7 +1021,7 @@ rcvMainLoop(struct wrkrInfo_s *const __restrict__ pWrkr)
 
 		/* Add the UDP listen sockets to the list of read descriptors. */
 		for(lstn = lcnfRoot ; lstn != NULL ; lstn = lstn->next) {
-			if (lstn->sock != -1) {
+			if (lstn->sock != -1 && LSTN_IS_MINE(lstn, pWrkr)) {
 				if(Debug)
 					net.debugListenInfo(lstn->sock, (char*)"UDP");
 				FD_SET(lstn->sock, &readfds);
@@ -887,7 +1042,7 @@ rcvMainLoop(struct wrkrInfo_s *const __restrict__ pWrkr)
 			break; /* terminate input! */
 
 		for(lstn = lcnfRoot ; nfds && lstn != NULL ; lstn = lstn->next) {
-			if(FD_ISSET(lstn->sock, &readfds)) {
+			if(LSTN_IS_MINE(lstn, pWrkr) && FD_ISSET(lstn->sock, &readfds)) {
 		       		processSocket(pWrkr, lstn, &frominetPrev, &bIsPermitted);
 			--nfds; /* indicate we have processed one descriptor */
 			}
@@ -972,6 +1127,23 @@ createListner(es_str_t *port, struct cnfparamvals *pvals)
 			}
 		} else if(!strcmp(inppblk.descr[i].name, "ipfreebind")) {
 			inst->ipfreebind = (int) pvals[i].val.d.n;
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport.sockets")) {
+			inst->nReusePortSocks = (int) pvals[i].val.d.n;
+#			ifndef SO_REUSEPORT
+			if(inst->nReusePortSocks > 1) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: reuseport.sockets "
+						"is not supported on this platform - using a single socket");
+				inst->nReusePortSocks = 1;
+			}
+#			endif
+			if(inst->nReusePortSocks > MAX_WRKR_THREADS) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: configured for %d "
+						"reuseport sockets, but maximum permitted is %d",
+						inst->nReusePortSocks, MAX_WRKR_THREADS);
+				inst->nReusePortSocks = MAX_WRKR_THREADS;
+			}
+		} else if(!strcmp(inppblk.descr[i].name, "reuseport.cpusteering")) {
+			inst->bCpuSteering = (sbool) pvals[i].val.d.n;
 		} else {
 			dbgprintf("imudp: program error, non-handled "
 			  "param '%s'\n", inppblk.descr[i].name);
@@ -1020,6 +1192,9 @@ CODESTARTbeginCnfLoad
 	loadModConf->iTimeRequery = TIME_REQUERY_DFLT;
 	loadModConf->iSchedPrio = SCHED_PRIO_UNSET;
 	loadModConf->pszSchedPolicy = NULL;
+	loadModConf->pszCpuset = NULL;
+	loadModConf->iNumaNode = -1;
+	loadModConf->bZeroCopy = 0;
 	bLegacyCnfModGlobalsPermitted = 1;
 	/* init legacy config vars */
 	cs.pszBindRuleset = NULL;
@@ -1059,6 +1234,19 @@ CODESTARTsetModCnf
 			loadModConf->iSchedPrio = (int) pvals[i].val.d.n;
 		} else if(!strcmp(modpblk.descr[i].name, "schedulingpolicy")) {
 			loadModConf->pszSchedPolicy = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "cpuset")) {
+			loadModConf->pszCpuset = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(modpblk.descr[i].name, "numa.node")) {
+			loadModConf->iNumaNode = (int) pvals[i].val.d.n;
+		} else if(!strcmp(modpblk.descr[i].name, "zerocopy")) {
+			loadModConf->bZeroCopy = (sbool) pvals[i].val.d.n;
+#			ifndef HAVE_RECVMMSG
+			if(loadModConf->bZeroCopy) {
+				errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: zerocopy requires "
+						"recvmmsg(), which is not available - ignored");
+				loadModConf->bZeroCopy = 0;
+			}
+#			endif
 		} else if(!strcmp(modpblk.descr[i].name, "threads")) {
 			wrkrMax = (int) pvals[i].val.d.n;
 			if(wrkrMax > MAX_WRKR_THREADS) {
@@ -1111,8 +1299,24 @@ BEGINcheckCnf
 	instanceConf_t *inst;
 CODESTARTcheckCnf
 	checkSchedParam(pModConf); /* this can not cause fatal errors */
+	if(srCheckAffinity(pModConf->pszCpuset, pModConf->iNumaNode) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_PARAM_ERROR, "imudp: cpuset '%s' / numa.node %d "
+				"can not be used for thread affinity on this system - ignored",
+				(pModConf->pszCpuset == NULL) ? "" : (char*) pModConf->pszCpuset,
+				pModConf->iNumaNode);
+		free(pModConf->pszCpuset);
+		pModConf->pszCpuset = NULL;
+		pModConf->iNumaNode = -1;
+	}
 	for(inst = pModConf->root ; inst != NULL ; inst = inst->next) {
 		std_checkRuleset(pModConf, inst);
+		/* each reuseport socket needs a worker of its own */
+		if(inst->nReusePortSocks > pModConf->wrkrMax) {
+			DBGPRINTF("imudp: raising number of worker threads from %d to %d for "
+				"reuseport sockets of port %s\n", pModConf->wrkrMax,
+				inst->nReusePortSocks, inst->pszBindPort);
+			pModConf->wrkrMax = inst->nReusePortSocks;
+		}
 	}
 	if(pModConf->root == NULL) {
 		errmsg.LogError(0, RS_RET_NO_LISTNERS , "imudp: module loaded, but "
@@ -1150,14 +1354,25 @@ CODESTARTactivateCnf
 #	ifdef HAVE_RECVMMSG
 	lenRcvBuf *= runModConf->batchSize;
 #	endif
-	DBGPRINTF("imudp: config params iMaxLine %d, lenRcvBuf %d\n", iMaxLine, lenRcvBuf);
+	DBGPRINTF("imudp: config params iMaxLine %d, lenRcvBuf %d, zerocopy %d\n", iMaxLine,
+		lenRcvBuf, runModConf->bZeroCopy);
 	for(i = 0 ; i < runModConf->wrkrMax ; ++i) {
 #		ifdef HAVE_RECVMMSG
 		CHKmalloc(wrkrInfo[i].recvmsg_iov = MALLOC(runModConf->batchSize * sizeof(struct iovec)));
 		CHKmalloc(wrkrInfo[i].recvmsg_mmh = MALLOC(runModConf->batchSize * sizeof(struct mmsghdr)));
 		CHKmalloc(wrkrInfo[i].frominet = MALLOC(runModConf->batchSize * sizeof(struct sockaddr_storage)));
-#		endif
+		if(runModConf->bZeroCopy) {
+			/* the msg objects provide the buffers */
+			CHKmalloc(wrkrInfo[i].ppZcMsg = calloc(runModConf->batchSize, sizeof(smsg_t*)));
+			wrkrInfo[i].pRcvBuf = NULL;
+		} else {
+			wrkrInfo[i].ppZcMsg = NULL;
+			CHKmalloc(wrkrInfo[i].pRcvBuf = MALLOC(lenRcvBuf));
+		}
+		initRcvVectors(&wrkrInfo[i]);
+#		else
 		CHKmalloc(wrkrInfo[i].pRcvBuf = MALLOC(lenRcvBuf));
+#		endif
 		wrkrInfo[i].id = i;
 	}
 finalize_it:
@@ -1177,6 +1392,7 @@ CODESTARTfreeCnf
 		inst = inst->next;
 		free(del);
 	}
+	free(pModConf->pszCpuset);
 ENDfreeCnf
 
 
@@ -1207,6 +1423,13 @@ wrkr(void *myself)
 	 * privileges within the same instance.
 	 */
 	setSchedParams(runModConf);
+	/* receive buffer pages are first touched by this thread, so once it
+	 * is pinned, the kernel places them on the local NUMA node.
+	 */
+	if(srSetThreadAffinity(runModConf->pszCpuset, runModConf->iNumaNode) != RS_RET_OK) {
+		errmsg.LogError(0, RS_RET_ERR, "imudp: could not set CPU affinity for %s - ignored",
+				thrdName);
+	}
 
 	/* support statistics gathering */
 	statsobj.Construct(&(pWrkr->stats));
@@ -1270,6 +1493,9 @@ ENDwillRun
 BEGINafterRun
 	struct lstn_s *lstn, *lstnDel;
 	int i;
+#	ifdef HAVE_RECVMMSG
+	int j;
+#	endif
 CODESTARTafterRun
 	/* do cleanup here */
 	net.clearAllowedSenders((uchar*)"UDP");
@@ -1288,6 +1514,13 @@ CODESTARTafterRun
 		free(wrkrInfo[i].recvmsg_iov);
 		free(wrkrInfo[i].recvmsg_mmh);
 		free(wrkrInfo[i].frominet);
+		if(wrkrInfo[i].ppZcMsg != NULL) {
+			for(j = 0 ; j < runModConf->batchSize ; ++j) {
+				if(wrkrInfo[i].ppZcMsg[j] != NULL)
+					msgDestruct(&wrkrInfo[i].ppZcMsg[j]);
+			}
+			free(wrkrInfo[i].ppZcMsg);
+		}
 #		endif
 		free(wrkrInfo[i].pRcvBuf);
 	}
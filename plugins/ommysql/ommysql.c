@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <time.h>
 #include <netdb.h>
+#include <ctype.h>
 #include <mysql.h>
 #include <mysqld_error.h>
 #include "conf.h"
@@ -64,12 +65,15 @@ typedef struct _instanceData {
 	uchar   *configfile;			/* MySQL Client Configuration File */
 	uchar   *configsection;		/* MySQL Client Configuration Section */
 	uchar	*tplName;			/* format template to use */
+	unsigned multiRows;			/* max rows per multi-row INSERT, <= 1 means off */
 } instanceData;
 
 typedef struct wrkrInstanceData {
 	instanceData *pData;
 	MYSQL	*hmysql;			/* handle to MySQL */
 	unsigned uLastMySQLErrno;		/* last errno returned by MySQL or 0 if all is well */
+	uchar *bulkBuf;				/* buffer for multi-row INSERT statements */
+	size_t lenBulkBuf;			/* allocated size of bulkBuf */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -89,6 +93,13 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "serverport", eCmdHdlrInt, 0 },
 	{ "mysqlconfig.file", eCmdHdlrGetWord, 0 },
 	{ "mysqlconfig.section", eCmdHdlrGetWord, 0 },
+	/* multirows: combine up to this many rows into one INSERT. If a
+	 * multi-row INSERT fails with a data error, its rows are retried one by
+	 * one inside the same transaction; rows that still fail are reported
+	 * and skipped, the rest of the transaction is committed (same as
+	 * ompgsql).
+	 */
+	{ "multirows", eCmdHdlrPositiveInt, 0 },
 	{ "template", eCmdHdlrGetWord, 0 }
 };
 static struct cnfparamblk actpblk =
@@ -112,6 +123,8 @@ ENDcreateInstance
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->hmysql = NULL;
+	pWrkrData->bulkBuf = NULL;
+	pWrkrData->lenBulkBuf = 0;
 ENDcreateWrkrInstance
 
 
@@ -146,6 +159,7 @@ BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	closeMySQL(pWrkrData);
 	mysql_thread_end();
+	free(pWrkrData->bulkBuf);
 ENDfreeWrkrInstance
 
 
@@ -287,6 +301,213 @@ finalize_it:
 }
 
 
+/* Support for multi-row INSERTs. Each statement rendered by the template
+ * is split into the part up to and including the VALUES keyword and the
+ * value tuple. Consecutive statements with identical first parts are then
+ * combined into a single INSERT ... VALUES (...),(...) statement, which
+ * saves one server round trip per row.
+ */
+#define BULK_MAX_STMT_SIZE (1024 * 1024) /* keep well below max_allowed_packet */
+
+/* skip a quoted string or identifier starting at p[i]. Returns the index
+ * after the closing quote (len if unterminated).
+ */
+static size_t
+sqlSkipQuoted(const uchar *const p, size_t i, const size_t len)
+{
+	const uchar q = p[i++];
+
+	while(i < len) {
+		if(p[i] == '\\' && q != '`') {
+			i += 2;
+		} else if(p[i] == q) {
+			if(i + 1 < len && p[i+1] == q)
+				i += 2; /* doubled quote */
+			else
+				return i + 1;
+		} else {
+			++i;
+		}
+	}
+	return len;
+}
+
+/* check if the statement is a single-row INSERT ... VALUES (...) and, if
+ * so, return the length of the part up to and including VALUES as well as
+ * the position of the value tuple. Returns 1 if so, 0 otherwise.
+ */
+static int
+sqlSplitInsert(const uchar *const p, const size_t len,
+	size_t *const pLenPrefix, size_t *const pOffsTuple, size_t *const pLenTuple)
+{
+	size_t i;
+	size_t start;
+	size_t end;
+	int depth;
+
+	for(i = 0 ; i < len && isspace(p[i]) ; ++i)
+		;
+	if(len - i < 6 || strncasecmp((char*) p + i, "insert", 6))
+		return 0;
+
+	/* find VALUES keyword outside of quotes */
+	while(i < len) {
+		if(p[i] == '\'' || p[i] == '"' || p[i] == '`') {
+			i = sqlSkipQuoted(p, i, len);
+		} else if(   (p[i] == 'v' || p[i] == 'V')
+			  && (isspace(p[i-1]) || p[i-1] == ')')
+			  && len - i >= 6 && !strncasecmp((char*) p + i, "values", 6)
+			  && (len - i == 6 || isspace(p[i+6]) || p[i+6] == '(')) {
+			break;
+		} else {
+			++i;
+		}
+	}
+	if(i >= len)
+		return 0;
+	*pLenPrefix = i + 6;
+
+	/* the value tuple must span the rest of the statement */
+	for(start = i + 6 ; start < len && isspace(p[start]) ; ++start)
+		;
+	for(end = len ; end > start && (isspace(p[end-1]) || p[end-1] == ';') ; --end)
+		;
+	if(start >= end || p[start] != '(' || p[end-1] != ')')
+		return 0;
+	depth = 0;
+	for(i = start ; i < end ; ) {
+		if(p[i] == '\'' || p[i] == '"' || p[i] == '`') {
+			i = sqlSkipQuoted(p, i, len);
+			continue;
+		}
+		if(p[i] == '(') {
+			++depth;
+		} else if(p[i] == ')') {
+			if(--depth == 0 && i != end - 1)
+				return 0; /* something follows the tuple */
+		}
+		++i;
+	}
+	if(depth != 0)
+		return 0;
+
+	*pOffsTuple = start;
+	*pLenTuple = end - start;
+	return 1;
+}
+
+/* combine as many statements as possible, starting at iFirst, into one
+ * multi-row INSERT inside bulkBuf. *pnRows receives the number of
+ * statements combined. If it is less than 2, bulkBuf is not valid and the
+ * statement at iFirst must be executed on its own.
+ */
+static rsRetVal
+buildBulkInsert(wrkrInstanceData_t *const pWrkrData, actWrkrIParams_t *const pParams,
+	const unsigned iFirst, const unsigned nParams, unsigned *const pnRows)
+{
+	const uchar *psz;
+	size_t len;
+	size_t lenPrefix;
+	size_t lenPrefixFirst = 0;
+	size_t offsTuple;
+	size_t lenTuple;
+	size_t lenBuf = 0;
+	unsigned i;
+	DEFiRet;
+
+	*pnRows = 0;
+	for(i = iFirst ; i < nParams && *pnRows < pWrkrData->pData->multiRows ; ++i) {
+		psz = actParam(pParams, 1, i, 0).param;
+		len = actParam(pParams, 1, i, 0).lenStr;
+		if(!sqlSplitInsert(psz, len, &lenPrefix, &offsTuple, &lenTuple))
+			break;
+		if(i == iFirst) {
+			lenPrefixFirst = lenPrefix;
+		} else if(lenPrefix != lenPrefixFirst
+			  || memcmp(psz, actParam(pParams, 1, iFirst, 0).param, lenPrefix)
+			  || lenBuf + lenTuple + 2 > BULK_MAX_STMT_SIZE) {
+			break;
+		}
+		if(lenBuf + lenPrefix + lenTuple + 2 > pWrkrData->lenBulkBuf) {
+			const size_t lenNew = lenBuf + lenPrefix + lenTuple + 2 + 4096;
+			uchar *const newBuf = realloc(pWrkrData->bulkBuf, lenNew);
+			CHKmalloc(newBuf);
+			pWrkrData->bulkBuf = newBuf;
+			pWrkrData->lenBulkBuf = lenNew;
+		}
+		if(i == iFirst) {
+			memcpy(pWrkrData->bulkBuf, psz, lenPrefix);
+			lenBuf = lenPrefix;
+		} else {
+			pWrkrData->bulkBuf[lenBuf++] = ',';
+		}
+		memcpy(pWrkrData->bulkBuf + lenBuf, psz + offsTuple, lenTuple);
+		lenBuf += lenTuple;
+		++(*pnRows);
+	}
+	if(*pnRows > 0)
+		pWrkrData->bulkBuf[lenBuf] = '\0';
+
+finalize_it:
+	RETiRet;
+}
+
+/* execute a multi-row INSERT. Other than writeMySQL(), a server (data)
+ * error is not reported but returned as RS_RET_DATAFAIL, so that the
+ * caller can retry the rows one by one. On a client error, the connection
+ * is closed and the whole transaction needs to be retried.
+ */
+static rsRetVal
+writeMySQLBulk(wrkrInstanceData_t *pWrkrData, const uchar *const psz)
+{
+	DEFiRet;
+
+	if(mysql_query(pWrkrData->hmysql, (char*)psz)) {
+		const int mysql_err = mysql_errno(pWrkrData->hmysql);
+		if(mysql_err < 2000 || mysql_err > 2999) {
+			DBGPRINTF("ommysql: multi-row insert failed with server error %d\n", mysql_err);
+			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		}
+		reportDBError(pWrkrData, 0);
+		closeMySQL(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* write a single row inside a transaction. Unlike writeMySQL(), this never
+ * reconnects, as a new connection would silently drop the open transaction.
+ * A server (data) error only rolls back the failing statement, so the row is
+ * reported and RS_RET_DATAFAIL is returned to let the caller skip it. Any
+ * other error closes the connection (the server then rolls back) and returns
+ * RS_RET_SUSPENDED, so that the whole transaction is retried.
+ */
+static rsRetVal
+writeMySQLRow(wrkrInstanceData_t *pWrkrData, const uchar *const psz)
+{
+	DEFiRet;
+
+	if(mysql_query(pWrkrData->hmysql, (char*)psz)) {
+		const int mysql_err = mysql_errno(pWrkrData->hmysql);
+		reportDBError(pWrkrData, 0);
+		/* a deadlock rolls back the whole transaction, not just the statement */
+		if((mysql_err < 2000 || mysql_err > 2999) && mysql_err != ER_LOCK_DEADLOCK) {
+			LogError(0, RS_RET_DATAFAIL, "The error statement was: %s", psz);
+			ABORT_FINALIZE(RS_RET_DATAFAIL);
+		}
+		closeMySQL(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	pWrkrData->uLastMySQLErrno = 0;
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
 	if(pWrkrData->hmysql == NULL) {
@@ -300,16 +521,41 @@ CODESTARTbeginTransaction
 ENDbeginTransaction
 
 BEGINcommitTransaction
+	unsigned nRows;
 CODESTARTcommitTransaction
 	DBGPRINTF("ommysql: commitTransaction\n");
 	CHKiRet(writeMySQL(pWrkrData, (uchar*)"START TRANSACTION"));
 
-	for(unsigned i = 0 ; i < nParams ; ++i) {
-		iRet = writeMySQL(pWrkrData, actParam(pParams, 1, i, 0).param);
+	for(unsigned i = 0 ; i < nParams ; i += nRows) {
+		nRows = 0;
+		if(pWrkrData->pData->multiRows > 1)
+			CHKiRet(buildBulkInsert(pWrkrData, pParams, i, nParams, &nRows));
+		if(nRows > 1) {
+			iRet = writeMySQLBulk(pWrkrData, pWrkrData->bulkBuf);
+			if(iRet == RS_RET_DATAFAIL) {
+				/* as in ompgsql, only the bad rows are skipped */
+				DBGPRINTF("ommysql: retrying %u rows one by one\n", nRows);
+				for(unsigned j = i ; j < i + nRows ; ++j) {
+					iRet = writeMySQLRow(pWrkrData, actParam(pParams, 1, j, 0).param);
+					if(iRet == RS_RET_DATAFAIL)
+						iRet = RS_RET_OK;
+					else if(iRet != RS_RET_OK)
+						break;
+				}
+			}
+		} else if(pWrkrData->pData->multiRows > 1) {
+			nRows = 1;
+			iRet = writeMySQLRow(pWrkrData, actParam(pParams, 1, i, 0).param);
+			if(iRet == RS_RET_DATAFAIL)
+				iRet = RS_RET_OK;
+		} else {
+			nRows = 1;
+			iRet = writeMySQL(pWrkrData, actParam(pParams, 1, i, 0).param);
+		}
 		if(iRet != RS_RET_OK
 			&& iRet != RS_RET_DEFER_COMMIT
 			&& iRet != RS_RET_PREVIOUS_COMMITTED) {
-			if(mysql_rollback(pWrkrData->hmysql) != 0) {
+			if(pWrkrData->hmysql != NULL && mysql_rollback(pWrkrData->hmysql) != 0) {
 				DBGPRINTF("ommysql: server error: transaction could not be rolled back\n");
 			}
 			closeMySQL(pWrkrData);
@@ -333,6 +579,7 @@ setInstParamDefaults(instanceData *pData)
 	pData->configfile = NULL;
 	pData->configsection = NULL;
 	pData->tplName = NULL;
+	pData->multiRows = 1;
 }
 
 
@@ -377,6 +624,8 @@ CODESTARTnewActInst
 			pData->configfile = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else if(!strcmp(actpblk.descr[i].name, "mysqlconfig.section")) {
 			pData->configsection = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(actpblk.descr[i].name, "multirows")) {
+			pData->multiRows = (unsigned) pvals[i].val.d.n;
 		} else if(!strcmp(actpblk.descr[i].name, "template")) {
 			pData->tplName = (uchar*)es_str2cstr(pvals[i].val.d.estr, NULL);
 		} else {
@@ -40,6 +40,7 @@
 #include <errno.h>
 #include <time.h>
 #include <netdb.h>
+#include <ctype.h>
 #include <libpq-fe.h>
 #include "conf.h"
 #include "syslogd-types.h"
@@ -66,7 +67,7 @@ typedef struct _instanceData {
 	char            pass[_DB_MAXPWDLEN+1];   /* DB user's password */
 	unsigned int    trans_age;
 	unsigned int    trans_commit;
-	unsigned short  multi_row;
+	unsigned short  multi_row;	/* max rows per multi-row INSERT, <= 1 means off */
 	int             port;
 	uchar          *tpl;                      /* format template to use */
 } instanceData;
@@ -75,6 +76,8 @@ typedef struct wrkrInstanceData {
 	instanceData   *pData;
 	PGconn         *f_hpgsql;                /* handle to PgSQL */
 	ConnStatusType  eLastPgSQLStatus;        /* last status from postgres */
+	uchar          *bulkBuf;                 /* buffer for multi-row INSERT statements */
+	size_t          lenBulkBuf;              /* allocated size of bulkBuf */
 } wrkrInstanceData_t;
 
 typedef struct configSettings_s {
@@ -90,6 +93,12 @@ static struct cnfparamdescr actpdescr[] = {
 	{ "uid",        eCmdHdlrGetWord, 0 },
 	{ "pass",       eCmdHdlrGetWord, 0 },
 	{ "pwd",        eCmdHdlrGetWord, 0 },
+	/* multirows: combine up to this many rows into one INSERT. If a
+	 * multi-row INSERT fails with a data error, its rows are retried one by
+	 * one, each under its own savepoint; rows that still fail are reported
+	 * and skipped, the rest of the transaction is committed (same as
+	 * ommysql).
+	 */
 	{ "multirows",  eCmdHdlrInt,     0 },
 	{ "trans_size", eCmdHdlrInt,     0 },
 	{ "trans_age",  eCmdHdlrInt,     0 },
@@ -121,6 +130,8 @@ ENDcreateInstance
 BEGINcreateWrkrInstance
 CODESTARTcreateWrkrInstance
 	pWrkrData->f_hpgsql = NULL;
+	pWrkrData->bulkBuf = NULL;
+	pWrkrData->lenBulkBuf = 0;
 ENDcreateWrkrInstance
 
 
@@ -152,6 +163,7 @@ ENDfreeInstance
 BEGINfreeWrkrInstance
 CODESTARTfreeWrkrInstance
 	closePgSQL(pWrkrData);
+	free(pWrkrData->bulkBuf);
 ENDfreeWrkrInstance
 
 BEGINdbgPrintInstInfo
@@ -303,6 +315,237 @@ finalize_it:
 }
 
 
+/* Support for multi-row INSERTs. Each statement rendered by the template
+ * is split into the part up to and including the VALUES keyword and the
+ * value tuple. Consecutive statements with identical first parts are then
+ * combined into a single INSERT ... VALUES (...),(...) statement, which
+ * saves one server round trip per row. The combined statement is wrapped
+ * into a savepoint, so that a failing row does not abort the transaction
+ * and the rows can be retried one by one.
+ */
+#define BULK_MAX_STMT_SIZE (1024 * 1024)
+#define BULK_STMT_HEAD "SAVEPOINT rsyslog_bulk; "
+#define BULK_STMT_TAIL "; RELEASE SAVEPOINT rsyslog_bulk"
+
+/* skip a quoted string or identifier starting at p[i]. Returns the index
+ * after the closing quote (len if unterminated). Note that we always use
+ * standard conforming strings, so backslash is no escape character.
+ */
+static size_t
+sqlSkipQuoted(const uchar *const p, size_t i, const size_t len)
+{
+	const uchar q = p[i++];
+
+	while(i < len) {
+		if(p[i] == q) {
+			if(i + 1 < len && p[i+1] == q)
+				i += 2; /* doubled quote */
+			else
+				return i + 1;
+		} else {
+			++i;
+		}
+	}
+	return len;
+}
+
+/* check if the statement is a single-row INSERT ... VALUES (...) and, if
+ * so, return the length of the part up to and including VALUES as well as
+ * the position of the value tuple. Returns 1 if so, 0 otherwise.
+ */
+static int
+sqlSplitInsert(const uchar *const p, const size_t len,
+	size_t *const pLenPrefix, size_t *const pOffsTuple, size_t *const pLenTuple)
+{
+	size_t i;
+	size_t start;
+	size_t end;
+	int depth;
+
+	for(i = 0 ; i < len && isspace(p[i]) ; ++i)
+		;
+	if(len - i < 6 || strncasecmp((char*) p + i, "insert", 6))
+		return 0;
+
+	/* find VALUES keyword outside of quotes */
+	while(i < len) {
+		if(p[i] == '\'' || p[i] == '"') {
+			i = sqlSkipQuoted(p, i, len);
+		} else if(   (p[i] == 'v' || p[i] == 'V')
+			  && (isspace(p[i-1]) || p[i-1] == ')')
+			  && len - i >= 6 && !strncasecmp((char*) p + i, "values", 6)
+			  && (len - i == 6 || isspace(p[i+6]) || p[i+6] == '(')) {
+			break;
+		} else {
+			++i;
+		}
+	}
+	if(i >= len)
+		return 0;
+	*pLenPrefix = i + 6;
+
+	/* the value tuple must span the rest of the statement */
+	for(start = i + 6 ; start < len && isspace(p[start]) ; ++start)
+		;
+	for(end = len ; end > start && (isspace(p[end-1]) || p[end-1] == ';') ; --end)
+		;
+	if(start >= end || p[start] != '(' || p[end-1] != ')')
+		return 0;
+	depth = 0;
+	for(i = start ; i < end ; ) {
+		if(p[i] == '\'' || p[i] == '"') {
+			i = sqlSkipQuoted(p, i, len);
+			continue;
+		}
+		if(p[i] == '(') {
+			++depth;
+		} else if(p[i] == ')') {
+			if(--depth == 0 && i != end - 1)
+				return 0; /* something follows the tuple */
+		}
+		++i;
+	}
+	if(depth != 0)
+		return 0;
+
+	*pOffsTuple = start;
+	*pLenTuple = end - start;
+	return 1;
+}
+
+/* combine as many statements as possible, starting at iFirst, into one
+ * multi-row INSERT inside bulkBuf. *pnRows receives the number of
+ * statements combined. If it is less than 2, bulkBuf is not valid and the
+ * statement at iFirst must be executed on its own.
+ */
+static rsRetVal
+buildBulkInsert(wrkrInstanceData_t *const pWrkrData, actWrkrIParams_t *const pParams,
+	const unsigned iFirst, const unsigned nParams, unsigned *const pnRows)
+{
+	const uchar *psz;
+	size_t len;
+	size_t lenPrefix;
+	size_t lenPrefixFirst = 0;
+	size_t offsTuple;
+	size_t lenTuple;
+	size_t lenBuf = 0;
+	unsigned i;
+	DEFiRet;
+
+	*pnRows = 0;
+	for(i = iFirst ; i < nParams && *pnRows < pWrkrData->pData->multi_row ; ++i) {
+		psz = actParam(pParams, 1, i, 0).param;
+		len = actParam(pParams, 1, i, 0).lenStr;
+		if(!sqlSplitInsert(psz, len, &lenPrefix, &offsTuple, &lenTuple))
+			break;
+		if(i == iFirst) {
+			lenPrefixFirst = lenPrefix;
+		} else if(lenPrefix != lenPrefixFirst
+			  || memcmp(psz, actParam(pParams, 1, iFirst, 0).param, lenPrefix)
+			  || lenBuf + lenTuple + 2 > BULK_MAX_STMT_SIZE) {
+			break;
+		}
+		if(lenBuf + sizeof(BULK_STMT_HEAD) + lenPrefix + lenTuple + sizeof(BULK_STMT_TAIL) + 1
+		   > pWrkrData->lenBulkBuf) {
+			const size_t lenNew = lenBuf + sizeof(BULK_STMT_HEAD) + lenPrefix + lenTuple
+				+ sizeof(BULK_STMT_TAIL) + 4096;
+			uchar *const newBuf = realloc(pWrkrData->bulkBuf, lenNew);
+			CHKmalloc(newBuf);
+			pWrkrData->bulkBuf = newBuf;
+			pWrkrData->lenBulkBuf = lenNew;
+		}
+		if(i == iFirst) {
+			memcpy(pWrkrData->bulkBuf, BULK_STMT_HEAD, sizeof(BULK_STMT_HEAD) - 1);
+			lenBuf = sizeof(BULK_STMT_HEAD) - 1;
+			memcpy(pWrkrData->bulkBuf + lenBuf, psz, lenPrefix);
+			lenBuf += lenPrefix;
+		} else {
+			pWrkrData->bulkBuf[lenBuf++] = ',';
+		}
+		memcpy(pWrkrData->bulkBuf + lenBuf, psz + offsTuple, lenTuple);
+		lenBuf += lenTuple;
+		++(*pnRows);
+	}
+	if(*pnRows > 0)
+		memcpy(pWrkrData->bulkBuf + lenBuf, BULK_STMT_TAIL, sizeof(BULK_STMT_TAIL));
+
+finalize_it:
+	RETiRet;
+}
+
+/* execute a multi-row INSERT. If it fails due to a data error, we roll
+ * back to the savepoint and return RS_RET_DATAFAIL, so that the caller
+ * can retry the rows one by one. If the connection is broken, the
+ * whole transaction needs to be retried.
+ */
+static rsRetVal
+writePgSQLBulk(uchar *psz, wrkrInstanceData_t *pWrkrData)
+{
+	DEFiRet;
+
+	dbgprintf("writePgSQLBulk: %s\n", psz);
+	if(!tryExec(psz, pWrkrData))
+		FINALIZE;
+
+	if(PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK
+	   || tryExec((uchar*) "ROLLBACK TO SAVEPOINT rsyslog_bulk", pWrkrData)) {
+		reportDBError(pWrkrData, 0);
+		closePgSQL(pWrkrData);
+		ABORT_FINALIZE(RS_RET_SUSPENDED);
+	}
+	iRet = RS_RET_DATAFAIL;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* abort the open transaction after a hard error. We never reconnect and
+ * retry inside a transaction, as that would silently drop everything
+ * written since BEGIN. Instead, the connection is closed (which makes the
+ * server roll back) and the whole transaction is retried by the action.
+ */
+static rsRetVal
+abortPgSQLTransaction(wrkrInstanceData_t *pWrkrData)
+{
+	reportDBError(pWrkrData, 0);
+	closePgSQL(pWrkrData);
+	return RS_RET_SUSPENDED;
+}
+
+/* execute a single row inside the open transaction, guarded by its own
+ * savepoint. This is used to retry the rows of a failed multi-row INSERT.
+ * If the row fails due to a data error, only that row is rolled back and
+ * RS_RET_DATAFAIL is returned; the transaction stays usable. Any other
+ * error aborts the transaction and returns RS_RET_SUSPENDED.
+ */
+static rsRetVal
+writePgSQLRow(uchar *psz, wrkrInstanceData_t *pWrkrData)
+{
+	DEFiRet;
+
+	dbgprintf("writePgSQLRow: %s\n", psz);
+	if(tryExec((uchar*) "SAVEPOINT rsyslog_row", pWrkrData))
+		ABORT_FINALIZE(abortPgSQLTransaction(pWrkrData));
+
+	if(!tryExec(psz, pWrkrData)) {
+		if(tryExec((uchar*) "RELEASE SAVEPOINT rsyslog_row", pWrkrData))
+			ABORT_FINALIZE(abortPgSQLTransaction(pWrkrData));
+		FINALIZE;
+	}
+
+	if(PQstatus(pWrkrData->f_hpgsql) != CONNECTION_OK)
+		ABORT_FINALIZE(abortPgSQLTransaction(pWrkrData));
+	reportDBError(pWrkrData, 0);
+	if(tryExec((uchar*) "ROLLBACK TO SAVEPOINT rsyslog_row", pWrkrData))
+		ABORT_FINALIZE(abortPgSQLTransaction(pWrkrData));
+	iRet = RS_RET_DATAFAIL;
+
+finalize_it:
+	RETiRet;
+}
+
+
 BEGINtryResume
 CODESTARTtryResume
 	if (pWrkrData->f_hpgsql == NULL) {
@@ -326,14 +569,42 @@ ENDbeginTransaction
 
 
 BEGINcommitTransaction
+	unsigned nRows;
 CODESTARTcommitTransaction
 	dbgprintf("ompgsql: beginTransaction\n");
 	if (pWrkrData->f_hpgsql == NULL)
 		initPgSQL(pWrkrData, 0);
 	CHKiRet(writePgSQL((uchar*) "BEGIN", pWrkrData)); /* TODO: make user-configurable */
 
-	for (unsigned i = 0 ; i < nParams ; ++i) {
-		iRet = writePgSQL(actParam(pParams, 1, i, 0).param, pWrkrData);
+	for (unsigned i = 0 ; i < nParams ; i += nRows) {
+		nRows = 0;
+		if (pWrkrData->pData->multi_row > 1)
+			CHKiRet(buildBulkInsert(pWrkrData, pParams, i, nParams, &nRows));
+		if (nRows > 1) {
+			iRet = writePgSQLBulk(pWrkrData->bulkBuf, pWrkrData);
+			if (iRet == RS_RET_SUSPENDED)
+				FINALIZE;
+			if (iRet == RS_RET_DATAFAIL) {
+				dbgprintf("ompgsql: retrying %u rows one by one\n", nRows);
+				for (unsigned j = i ; j < i + nRows ; ++j) {
+					iRet = writePgSQLRow(actParam(pParams, 1, j, 0).param, pWrkrData);
+					if (iRet == RS_RET_DATAFAIL) {
+						/* row was rolled back and reported, go on with the rest */
+						iRet = RS_RET_OK;
+					}
+					CHKiRet(iRet);
+				}
+			}
+		} else if (pWrkrData->pData->multi_row > 1) {
+			nRows = 1;
+			iRet = writePgSQLRow(actParam(pParams, 1, i, 0).param, pWrkrData);
+			if (iRet == RS_RET_DATAFAIL)
+				iRet = RS_RET_OK;
+			CHKiRet(iRet);
+		} else {
+			nRows = 1;
+			iRet = writePgSQL(actParam(pParams, 1, i, 0).param, pWrkrData);
+		}
 		if (iRet != RS_RET_OK
 			&& iRet != RS_RET_DEFER_COMMIT
 			&& iRet != RS_RET_PREVIOUS_COMMITTED) {
@@ -345,7 +616,11 @@ CODESTARTcommitTransaction
 		}
 	}
 
-	CHKiRet(writePgSQL((uchar*) "COMMIT", pWrkrData)); /* TODO: make user-configurable */
+	/* a failed COMMIT must not be retried on a new connection: outside of
+	 * the transaction it would "succeed" without anything being written.
+	 */
+	if (tryExec((uchar*) "COMMIT", pWrkrData)) /* TODO: make user-configurable */
+		ABORT_FINALIZE(abortPgSQLTransaction(pWrkrData));
 
 finalize_it:
 	if (iRet == RS_RET_OK) {
@@ -359,7 +634,7 @@ static inline void
 setInstParamDefaults(instanceData *pData)
 {
 	pData->tpl           = NULL;
-	pData->multi_row     = 100;
+	pData->multi_row     = 1;
 	pData->trans_commit  = 100;
 	pData->trans_age     = 60;
 	pData->port          = 5432;
@@ -0,0 +1,287 @@
+/* acmatch.c - multi-pattern string matcher
+ *
+ * This implements the Aho-Corasick algorithm. All patterns are compiled
+ * into a single deterministic automaton, so that one pass over the subject
+ * string finds all patterns contained in it, no matter how many there are.
+ * It is used to evaluate chains of property filters (":msg, contains, ...")
+ * in one go.
+ *
+ * To keep the transition table small, input bytes are mapped to equivalence
+ * classes first: each byte value that occurs in any pattern gets its own
+ * class, all others share class 0 (which never advances the automaton).
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rsyslog.h"
+#include "acmatch.h"
+
+/* a single pattern as handed over by the caller */
+typedef struct acmatchPat_s {
+	uchar *pattern;
+	size_t len;
+	int id;
+	acmatchMode_t mode;
+	int state;	/* final state of this pattern, set during finalize */
+} acmatchPat_t;
+
+struct acmatch_s {
+	acmatchPat_t *pats;	/* patterns, sorted by final state after finalize */
+	int nPats;
+	int nPatsMax;
+	unsigned short classmap[256];	/* byte value -> input class */
+	int nClasses;
+	int nStates;
+	int *delta;		/* transition table, nStates * nClasses entries */
+	int *outFirst;		/* per state: index of first pattern ending in it */
+	int *outCnt;		/* per state: number of patterns ending in it */
+	int *dictLink;		/* per state: next state on failure chain with output, 0 if none */
+	sbool bFinalized;
+};
+
+#define DELTA(pThis, state, class) ((pThis)->delta[(state) * (pThis)->nClasses + (class)])
+
+
+rsRetVal
+acmatchConstruct(acmatch_t **ppThis)
+{
+	acmatch_t *pThis;
+	DEFiRet;
+
+	CHKmalloc(pThis = calloc(1, sizeof(acmatch_t)));
+	*ppThis = pThis;
+finalize_it:
+	RETiRet;
+}
+
+
+void
+acmatchDestruct(acmatch_t **ppThis)
+{
+	acmatch_t *pThis = *ppThis;
+	int i;
+
+	if(pThis == NULL)
+		return;
+	for(i = 0 ; i < pThis->nPats ; ++i)
+		free(pThis->pats[i].pattern);
+	free(pThis->pats);
+	free(pThis->delta);
+	free(pThis->outFirst);
+	free(pThis->outCnt);
+	free(pThis->dictLink);
+	free(pThis);
+	*ppThis = NULL;
+}
+
+
+/* add a pattern. The id is what will be flagged in the hits array
+ * passed to acmatchScan(). The pattern is copied.
+ */
+rsRetVal
+acmatchAddPattern(acmatch_t *const pThis, const uchar *const pattern, const size_t lenPattern,
+	const int id, const acmatchMode_t mode)
+{
+	acmatchPat_t *newPats;
+	DEFiRet;
+
+	assert(!pThis->bFinalized);
+	if(pThis->nPats == pThis->nPatsMax) {
+		const int newMax = (pThis->nPatsMax == 0) ? 16 : pThis->nPatsMax * 2;
+		CHKmalloc(newPats = realloc(pThis->pats, newMax * sizeof(acmatchPat_t)));
+		pThis->pats = newPats;
+		pThis->nPatsMax = newMax;
+	}
+	CHKmalloc(pThis->pats[pThis->nPats].pattern = malloc(lenPattern + 1));
+	memcpy(pThis->pats[pThis->nPats].pattern, pattern, lenPattern);
+	pThis->pats[pThis->nPats].pattern[lenPattern] = '\0';
+	pThis->pats[pThis->nPats].len = lenPattern;
+	pThis->pats[pThis->nPats].id = id;
+	pThis->pats[pThis->nPats].mode = mode;
+	pThis->pats[pThis->nPats].state = 0;
+	++pThis->nPats;
+finalize_it:
+	RETiRet;
+}
+
+
+/* qsort helper to order patterns by their final state */
+static int
+cmpPatState(const void *v1, const void *v2)
+{
+	return ((const acmatchPat_t*)v1)->state - ((const acmatchPat_t*)v2)->state;
+}
+
+
+/* build the automaton. No patterns can be added after this call. */
+rsRetVal
+acmatchConstructFinalize(acmatch_t *const pThis)
+{
+	size_t maxStates = 1;
+	size_t i;
+	int p;
+	int c;
+	int state;
+	int *fail = NULL;
+	int *bfsq = NULL;
+	int qhead, qtail;
+	DEFiRet;
+
+	assert(!pThis->bFinalized);
+
+	/* compute input classes */
+	memset(pThis->classmap, 0, sizeof(pThis->classmap));
+	pThis->nClasses = 1;
+	for(p = 0 ; p < pThis->nPats ; ++p) {
+		maxStates += pThis->pats[p].len;
+		for(i = 0 ; i < pThis->pats[p].len ; ++i) {
+			if(pThis->classmap[pThis->pats[p].pattern[i]] == 0)
+				pThis->classmap[pThis->pats[p].pattern[i]] = pThis->nClasses++;
+		}
+	}
+
+	/* build the trie. We use -1 for "no transition" during this stage. */
+	CHKmalloc(pThis->delta = malloc(maxStates * pThis->nClasses * sizeof(int)));
+	memset(pThis->delta, 0xff, maxStates * pThis->nClasses * sizeof(int));
+	pThis->nStates = 1;
+	for(p = 0 ; p < pThis->nPats ; ++p) {
+		state = 0;
+		for(i = 0 ; i < pThis->pats[p].len ; ++i) {
+			c = pThis->classmap[pThis->pats[p].pattern[i]];
+			if(DELTA(pThis, state, c) == -1)
+				DELTA(pThis, state, c) = pThis->nStates++;
+			state = DELTA(pThis, state, c);
+		}
+		pThis->pats[p].state = state;
+	}
+
+	/* outputs: patterns are grouped by final state, so that each state
+	 * just needs to know its range inside the pattern array.
+	 */
+	qsort(pThis->pats, pThis->nPats, sizeof(acmatchPat_t), cmpPatState);
+	CHKmalloc(pThis->outFirst = calloc(pThis->nStates, sizeof(int)));
+	CHKmalloc(pThis->outCnt = calloc(pThis->nStates, sizeof(int)));
+	CHKmalloc(pThis->dictLink = calloc(pThis->nStates, sizeof(int)));
+	for(p = pThis->nPats - 1 ; p >= 0 ; --p) {
+		pThis->outFirst[pThis->pats[p].state] = p;
+		++pThis->outCnt[pThis->pats[p].state];
+	}
+
+	/* compute failure links in BFS order and turn the trie into a DFA */
+	CHKmalloc(fail = calloc(pThis->nStates, sizeof(int)));
+	CHKmalloc(bfsq = malloc(pThis->nStates * sizeof(int)));
+	qhead = qtail = 0;
+	for(c = 0 ; c < pThis->nClasses ; ++c) {
+		if(DELTA(pThis, 0, c) == -1) {
+			DELTA(pThis, 0, c) = 0;
+		} else {
+			fail[DELTA(pThis, 0, c)] = 0;
+			bfsq[qtail++] = DELTA(pThis, 0, c);
+		}
+	}
+	while(qhead < qtail) {
+		state = bfsq[qhead++];
+		for(c = 0 ; c < pThis->nClasses ; ++c) {
+			const int next = DELTA(pThis, state, c);
+			if(next == -1) {
+				DELTA(pThis, state, c) = DELTA(pThis, fail[state], c);
+			} else {
+				const int f = DELTA(pThis, fail[state], c);
+				fail[next] = f;
+				pThis->dictLink[next] = (pThis->outCnt[f] > 0) ? f : pThis->dictLink[f];
+				bfsq[qtail++] = next;
+			}
+		}
+	}
+	/* class 0 never occurs in patterns, so it always leads back to root */
+	for(state = 0 ; state < pThis->nStates ; ++state)
+		assert(DELTA(pThis, state, 0) == 0);
+
+	pThis->bFinalized = 1;
+	DBGPRINTF("acmatch %p: %d patterns, %d states, %d input classes\n",
+		pThis, pThis->nPats, pThis->nStates, pThis->nClasses);
+
+finalize_it:
+	free(fail);
+	free(bfsq);
+	RETiRet;
+}
+
+
+/* report all patterns ending in the given state. endpos is the number of
+ * subject bytes consumed so far (that is one past the match end).
+ */
+static void
+reportState(const acmatch_t *const pThis, const int state, const size_t endpos,
+	const size_t lenSubject, sbool *const hits)
+{
+	int p;
+	const acmatchPat_t *pat;
+
+	for(p = pThis->outFirst[state] ; p < pThis->outFirst[state] + pThis->outCnt[state] ; ++p) {
+		pat = pThis->pats + p;
+		switch(pat->mode) {
+		case ACMATCH_ANYWHERE:
+			hits[pat->id] = 1;
+			break;
+		case ACMATCH_PREFIX:
+			if(endpos == pat->len)
+				hits[pat->id] = 1;
+			break;
+		case ACMATCH_WHOLE:
+			if(endpos == pat->len && lenSubject == pat->len)
+				hits[pat->id] = 1;
+			break;
+		default:
+			assert(0);
+			break;
+		}
+	}
+}
+
+
+/* scan a subject string. For each pattern which matches, hits[id] is set
+ * to 1. Entries of non-matching patterns are NOT touched, so the caller
+ * must initialize the array.
+ */
+void
+acmatchScan(const acmatch_t *const pThis, const uchar *const subject, const size_t lenSubject,
+	sbool *const hits)
+{
+	size_t i;
+	int state = 0;
+	int s;
+
+	assert(pThis->bFinalized);
+	/* the empty pattern, if present, ends in the root state */
+	if(pThis->outCnt[0] > 0)
+		reportState(pThis, 0, 0, lenSubject, hits);
+
+	for(i = 0 ; i < lenSubject ; ++i) {
+		state = DELTA(pThis, state, pThis->classmap[subject[i]]);
+		if(pThis->outCnt[state] > 0)
+			reportState(pThis, state, i + 1, lenSubject, hits);
+		for(s = pThis->dictLink[state] ; s != 0 ; s = pThis->dictLink[s])
+			reportState(pThis, s, i + 1, lenSubject, hits);
+	}
+}
@@ -0,0 +1,40 @@
+/* header for acmatch.c - multi-pattern string matcher
+ *
+ * Copyright 2018 Adiscon GmbH.
+ *
+ * This file is part of the rsyslog runtime library.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *       -or-
+ *       see COPYING.ASL20 in the source distribution
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef INCLUDED_ACMATCH_H
+#define INCLUDED_ACMATCH_H
+
+/* how a pattern must match to be reported */
+typedef enum {
+	ACMATCH_ANYWHERE = 0,	/* pattern is contained somewhere in the subject */
+	ACMATCH_PREFIX = 1,	/* subject starts with pattern */
+	ACMATCH_WHOLE = 2	/* subject is equal to pattern */
+} acmatchMode_t;
+
+typedef struct acmatch_s acmatch_t;
+
+rsRetVal acmatchConstruct(acmatch_t **ppThis);
+rsRetVal acmatchAddPattern(acmatch_t *pThis, const uchar *pattern, size_t lenPattern,
+	int id, acmatchMode_t mode);
+rsRetVal acmatchConstructFinalize(acmatch_t *pThis);
+void acmatchDestruct(acmatch_t **ppThis);
+void acmatchScan(const acmatch_t *pThis, const uchar *subject, size_t lenSubject, sbool *hits);
+
+#endif /* #ifndef INCLUDED_ACMATCH_H */
@@ -31,6 +31,8 @@
 #include <ctype.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 #ifdef HAVE_SYS_TIME_H
 #	include <sys/time.h>
 #endif
@@ -42,10 +44,44 @@
 #include "srUtils.h"
 #include "stringbuf.h"
 #include "errmsg.h"
+#include "glbl.h"
 
 /* static data */
 DEFobjStaticHelpers
 
+/* Per-thread cache of the broken-down time of the most recently converted
+ * second, one entry for local time and one for UTC. Converting the same
+ * second again only needs secfrac to be updated, which saves the
+ * localtime_r() call (and glibc's tz lock) for all but the first timestamp
+ * of each second. The cache is invalidated when the second changes or the
+ * time zone is changed via dateTimeTZChanged().
+ */
+typedef struct timeCacheEntry_s {
+	time_t secs;
+	int tzGen;	/* tzGeneration at the time the entry was filled, -1 = empty */
+	struct syslogTime t;
+} timeCacheEntry_t;
+/* The same applies to formatting: consecutive messages mostly carry the
+ * same second, so the formatted date and time up to the seconds and the
+ * UTC offset are kept and only the fractional seconds are rendered anew.
+ */
+typedef struct timeFmtCacheEntry_s {
+	int valid;
+	int bBuggyDay;	/* RFC3164 only */
+	struct syslogTime ts;	/* the timestamp the strings were formatted from */
+	char szTime[20];	/* date and time up to the seconds */
+	char szOffs[8];	/* RFC3339 only: UTC offset */
+	int lenOffs;
+} timeFmtCacheEntry_t;
+typedef struct timeCache_s {
+	timeCacheEntry_t ent[2]; /* [0] local time, [1] UTC */
+	timeFmtCacheEntry_t fmt3339;
+	timeFmtCacheEntry_t fmt3164;
+} timeCache_t;
+static pthread_key_t keyTimeCache;
+static int bHaveKeyTimeCache = 0;
+static volatile int tzGeneration = 0;
+
 /* the following table of ten powers saves us some computation */
 static const int tenPowers[6] = { 1, 10, 100, 1000, 10000, 100000 };
 
@@ -96,6 +132,70 @@ static const char* monthNames[12] = {
 /** 
  * Convert struct timeval to syslog_time
  */
+static void
+timeCacheRelease(void *const pCache)
+{
+	free(pCache);
+}
+
+/* obtain this thread's time cache. Returns NULL if it cannot be
+ * allocated, in which case the caller must do the full conversion.
+ */
+static timeCache_t *
+timeCacheGetMine(void)
+{
+	timeCache_t *pCache;
+
+	if(!bHaveKeyTimeCache)
+		return NULL;
+	pCache = pthread_getspecific(keyTimeCache);
+	if(pCache == NULL) {
+		if((pCache = malloc(sizeof(timeCache_t))) == NULL)
+			return NULL;
+		pCache->ent[0].tzGen = -1;
+		pCache->ent[1].tzGen = -1;
+		pCache->fmt3339.valid = 0;
+		pCache->fmt3164.valid = 0;
+		if(pthread_setspecific(keyTimeCache, pCache) != 0) {
+			free(pCache);
+			return NULL;
+		}
+	}
+	return pCache;
+}
+
+
+/* must be called whenever the TZ environment variable is changed. It makes
+ * libc pick up the new time zone and invalidates all threads' time caches.
+ */
+void
+dateTimeTZChanged(void)
+{
+	tzset();
+	++tzGeneration;
+}
+
+
+/* obtain the current time. If so configured, the coarse realtime clock is
+ * used, which is served from the vDSO without reading the hardware clock.
+ * Its resolution is that of the kernel tick (typically 1 to 4ms).
+ */
+static void
+getTimeval(struct timeval *const tp)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_REALTIME_COARSE)
+	struct timespec ts;
+
+	if(glblTimestampCoarseClock && clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0) {
+		tp->tv_sec = ts.tv_sec;
+		tp->tv_usec = ts.tv_nsec / 1000;
+		return;
+	}
+#endif
+	gettimeofday(tp, NULL);
+}
+
+
 static void
 timeval2syslogTime(struct timeval *tp, struct syslogTime *t, const int inUTC)
 {
@@ -103,6 +203,9 @@ timeval2syslogTime(struct timeval *tp, struct syslogTime *t, const int inUTC)
 	struct tm tmBuf;
 	long lBias;
 	time_t secs;
+	timeCache_t *pCache;
+	timeCacheEntry_t *pEnt = NULL;
+	const int tzGen = tzGeneration;
 /* AIXPORT : fix build error : "tm_gmtoff" is not a member of "struct tm" 
  *           Choose the HPUX code path, only for this function. 
  *           This is achieved by adding a check to _AIX wherever _hpux is checked
@@ -113,6 +216,15 @@ timeval2syslogTime(struct timeval *tp, struct syslogTime *t, const int inUTC)
 	struct timezone tz;
 #	endif
 	secs = tp->tv_sec;
+	if((pCache = timeCacheGetMine()) != NULL) {
+		pEnt = &pCache->ent[inUTC ? 1 : 0];
+		if(pEnt->tzGen == tzGen && pEnt->secs == secs) {
+			*t = pEnt->t;
+			t->secfrac = tp->tv_usec;
+			return;
+		}
+	}
+
 	if(inUTC)
 		tm = gmtime_r(&secs, &tmBuf);
 	else
@@ -151,6 +263,12 @@ timeval2syslogTime(struct timeval *tp, struct syslogTime *t, const int inUTC)
 	t->OffsetMinute = (lBias % 3600) / 60;
 	t->timeType = TIME_TYPE_RFC5424; /* we have a high precision timestamp */
 	t->inUTC = inUTC;
+
+	if(pEnt != NULL) {
+		pEnt->t = *t;
+		pEnt->secs = secs;
+		pEnt->tzGen = tzGen;
+	}
 }
 
 /**
@@ -189,7 +307,7 @@ static void getCurrTime(struct syslogTime *t, time_t *ttSeconds, const int inUTC
 		 */
 		gettimeofday(&tp, &tz);
 #	else
-		gettimeofday(&tp, NULL);
+		getTimeval(&tp);
 #	endif
 	if(ttSeconds != NULL)
 		*ttSeconds = tp.tv_sec;
@@ -209,6 +327,16 @@ getTime(time_t *ttSeconds)
 {
 	struct timeval tp;
 
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_REALTIME_COARSE)
+	if(glblTimestampCoarseClock) {
+		struct timespec ts;
+		if(clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0) {
+			if(ttSeconds != NULL)
+				*ttSeconds = ts.tv_sec;
+			return ts.tv_sec;
+		}
+	}
+#endif
 	if(gettimeofday(&tp, NULL) == -1)
 		return -1;
 
@@ -920,6 +1048,26 @@ formatTimestampSecFrac(struct syslogTime *ts, char* pBuf)
 }
 
 
+static inline int
+isSameSecond(const struct syslogTime *const ts1, const struct syslogTime *const ts2)
+{
+	return ts1->second == ts2->second
+		&& ts1->minute == ts2->minute
+		&& ts1->hour == ts2->hour
+		&& ts1->day == ts2->day
+		&& ts1->month == ts2->month
+		&& ts1->year == ts2->year;
+}
+
+static inline int
+isSameOffset(const struct syslogTime *const ts1, const struct syslogTime *const ts2)
+{
+	return ts1->OffsetMode == ts2->OffsetMode
+		&& ts1->OffsetHour == ts2->OffsetHour
+		&& ts1->OffsetMinute == ts2->OffsetMinute;
+}
+
+
 /**
  * Format a syslogTimestamp to a RFC3339 timestamp string (as
  * specified in syslog-protocol).
@@ -932,40 +1080,54 @@ static int
 formatTimestamp3339(struct syslogTime *ts, char* pBuf)
 {
 	int iBuf;
+	int iOffs;
 	int power;
 	int secfrac;
 	short digit;
+	timeCache_t *pCache;
+	timeFmtCacheEntry_t *pEnt = NULL;
+	int bCached = 0;
 
 	BEGINfunc
 	assert(ts != NULL);
 	assert(pBuf != NULL);
 
-	/* start with fixed parts */
-	/* year yyyy */
-	pBuf[0] = (ts->year / 1000) % 10 + '0';
-	pBuf[1] = (ts->year / 100) % 10 + '0';
-	pBuf[2] = (ts->year / 10) % 10 + '0';
-	pBuf[3] = ts->year % 10 + '0';
-	pBuf[4] = '-';
-	/* month */
-	pBuf[5] = (ts->month / 10) % 10 + '0';
-	pBuf[6] = ts->month % 10 + '0';
-	pBuf[7] = '-';
-	/* day */
-	pBuf[8] = (ts->day / 10) % 10 + '0';
-	pBuf[9] = ts->day % 10 + '0';
-	pBuf[10] = 'T';
-	/* hour */
-	pBuf[11] = (ts->hour / 10) % 10 + '0';
-	pBuf[12] = ts->hour % 10 + '0';
-	pBuf[13] = ':';
-	/* minute */
-	pBuf[14] = (ts->minute / 10) % 10 + '0';
-	pBuf[15] = ts->minute % 10 + '0';
-	pBuf[16] = ':';
-	/* second */
-	pBuf[17] = (ts->second / 10) % 10 + '0';
-	pBuf[18] = ts->second % 10 + '0';
+	if((pCache = timeCacheGetMine()) != NULL) {
+		pEnt = &pCache->fmt3339;
+		if(pEnt->valid && isSameSecond(ts, &pEnt->ts) && isSameOffset(ts, &pEnt->ts)) {
+			memcpy(pBuf, pEnt->szTime, 19);
+			bCached = 1;
+		}
+	}
+
+	if(!bCached) {
+		/* start with fixed parts */
+		/* year yyyy */
+		pBuf[0] = (ts->year / 1000) % 10 + '0';
+		pBuf[1] = (ts->year / 100) % 10 + '0';
+		pBuf[2] = (ts->year / 10) % 10 + '0';
+		pBuf[3] = ts->year % 10 + '0';
+		pBuf[4] = '-';
+		/* month */
+		pBuf[5] = (ts->month / 10) % 10 + '0';
+		pBuf[6] = ts->month % 10 + '0';
+		pBuf[7] = '-';
+		/* day */
+		pBuf[8] = (ts->day / 10) % 10 + '0';
+		pBuf[9] = ts->day % 10 + '0';
+		pBuf[10] = 'T';
+		/* hour */
+		pBuf[11] = (ts->hour / 10) % 10 + '0';
+		pBuf[12] = ts->hour % 10 + '0';
+		pBuf[13] = ':';
+		/* minute */
+		pBuf[14] = (ts->minute / 10) % 10 + '0';
+		pBuf[15] = ts->minute % 10 + '0';
+		pBuf[16] = ':';
+		/* second */
+		pBuf[17] = (ts->second / 10) % 10 + '0';
+		pBuf[18] = ts->second % 10 + '0';
+	}
 
 	iBuf = 19; /* points to next free entry, now it becomes dynamic! */
 
@@ -981,15 +1143,28 @@ formatTimestamp3339(struct syslogTime *ts, char* pBuf)
 		}
 	}
 
-	if(ts->OffsetMode == 'Z') {
-		pBuf[iBuf++] = 'Z';
+	if(bCached) {
+		memcpy(pBuf + iBuf, pEnt->szOffs, pEnt->lenOffs);
+		iBuf += pEnt->lenOffs;
 	} else {
-		pBuf[iBuf++] = ts->OffsetMode;
-		pBuf[iBuf++] = (ts->OffsetHour / 10) % 10 + '0';
-		pBuf[iBuf++] = ts->OffsetHour % 10 + '0';
-		pBuf[iBuf++] = ':';
-		pBuf[iBuf++] = (ts->OffsetMinute / 10) % 10 + '0';
-		pBuf[iBuf++] = ts->OffsetMinute % 10 + '0';
+		iOffs = iBuf;
+		if(ts->OffsetMode == 'Z') {
+			pBuf[iBuf++] = 'Z';
+		} else {
+			pBuf[iBuf++] = ts->OffsetMode;
+			pBuf[iBuf++] = (ts->OffsetHour / 10) % 10 + '0';
+			pBuf[iBuf++] = ts->OffsetHour % 10 + '0';
+			pBuf[iBuf++] = ':';
+			pBuf[iBuf++] = (ts->OffsetMinute / 10) % 10 + '0';
+			pBuf[iBuf++] = ts->OffsetMinute % 10 + '0';
+		}
+		if(pEnt != NULL) {
+			memcpy(pEnt->szTime, pBuf, 19);
+			pEnt->lenOffs = iBuf - iOffs;
+			memcpy(pEnt->szOffs, pBuf + iOffs, pEnt->lenOffs);
+			pEnt->ts = *ts;
+			pEnt->valid = 1;
+		}
 	}
 
 	pBuf[iBuf] = '\0';
@@ -1013,9 +1188,21 @@ static int
 formatTimestamp3164(struct syslogTime *ts, char* pBuf, int bBuggyDay)
 {
 	int iDay;
+	timeCache_t *pCache;
+	timeFmtCacheEntry_t *pEnt;
 	assert(ts != NULL);
 	assert(pBuf != NULL);
-	
+
+	if((pCache = timeCacheGetMine()) != NULL) {
+		pEnt = &pCache->fmt3164;
+		if(pEnt->valid && pEnt->bBuggyDay == bBuggyDay && isSameSecond(ts, &pEnt->ts)) {
+			memcpy(pBuf, pEnt->szTime, 16);
+			return 16;
+		}
+	} else {
+		pEnt = NULL;
+	}
+
 	pBuf[0] = monthNames[(ts->month - 1)% 12][0];
 	pBuf[1] = monthNames[(ts->month - 1) % 12][1];
 	pBuf[2] = monthNames[(ts->month - 1) % 12][2];
@@ -1033,6 +1220,12 @@ formatTimestamp3164(struct syslogTime *ts, char* pBuf, int bBuggyDay)
 	pBuf[13] = (ts->second / 10) % 10 + '0';
 	pBuf[14] = ts->second % 10 + '0';
 	pBuf[15] = '\0';
+	if(pEnt != NULL) {
+		memcpy(pEnt->szTime, pBuf, 16);
+		pEnt->bBuggyDay = bBuggyDay;
+		pEnt->ts = *ts;
+		pEnt->valid = 1;
+	}
 	return 16;	/* traditional: number of bytes written */
 }
 
@@ -1355,6 +1548,8 @@ ENDobjQueryInterface(datetime)
  */
 BEGINAbstractObjClassInit(datetime, 1, OBJ_IS_CORE_MODULE) /* class, version */
 	/* request objects we use */
+	/* without the key, timestamps are simply converted uncached */
+	bHaveKeyTimeCache = (pthread_key_create(&keyTimeCache, timeCacheRelease) == 0);
 ENDObjClassInit(datetime)
 
 /* vi:set ai:
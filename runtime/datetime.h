@@ -95,5 +95,6 @@ int getWeek(struct syslogTime *ts);
 void timeConvertToUTC(const struct syslogTime *const __restrict__ local, struct syslogTime *const __restrict__ utc);
 time_t getTime(time_t *ttSeconds);
 dateTimeFormat_t getDateTimeFormatFromStr(const char * const __restrict__ s);
+void dateTimeTZChanged(void);
 
 #endif /* #ifndef INCLUDED_DATETIME_H */
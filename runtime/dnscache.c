@@ -6,6 +6,8 @@
  * first get somethting that'S functionally OK, and then evolve the algorithm.
  * In any case, even the initial implementaton is far faster than what we had
  * before. -- rgerhards, 2011-06-06
+ * The cache is now sharded, supports entry TTLs and a size limit with LRU
+ * eviction and can hand lookups to async resolver threads (2018-04).
  *
  * Copyright 2011-2016 by Rainer Gerhards and Adiscon GmbH.
  *
@@ -34,12 +36,14 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "syslogd-types.h"
 #include "glbl.h"
 #include "errmsg.h"
 #include "obj.h"
 #include "unicode-helper.h"
+#include "srUtils.h"
 #include "net.h"
 #include "hashtable.h"
 #include "prop.h"
@@ -52,23 +56,61 @@ struct dnscache_entry_s {
 	prop_t *fqdnLowerCase;
 	prop_t *localName; /* only local name, without domain part (if configured so) */
 	prop_t *ip;
-	struct dnscache_entry_s *next;
+	time_t validUntil; /* 0 means the entry never expires */
+	rsRetVal resolveRet; /* result of (async) resolution, handed to all callers */
+	sbool bResolved; /* set once a real lookup result is present (else IP-only placeholder) */
+	sbool bPending; /* async lookup queued or in progress */
+	struct timespec pendingDeadline; /* callers wait no longer than this for a placeholder */
+	struct dnscache_entry_s *lruPrev; /* LRU list, head is most recently used */
+	struct dnscache_entry_s *lruNext;
 	unsigned nUsed;
 };
 typedef struct dnscache_entry_s dnscache_entry_t;
-struct dnscache_s {
-	pthread_rwlock_t rwlock;
+
+/* The cache is split into shards, each one with its own lock, so that
+ * inputs on different threads rarely contend. We use a mutex (and not
+ * a rwlock) because each hit updates the LRU list. Critical sections
+ * are short: DNS is never queried while a shard lock is held.
+ */
+#define DNSCACHE_NSHARDS 16
+struct dnscache_shard_s {
+	pthread_mutex_t mut;
+	pthread_cond_t condResolved; /* signalled when an async lookup completes */
 	struct hashtable *ht;
+	dnscache_entry_t *lruHead;
+	dnscache_entry_t *lruTail;
 	unsigned nEntries;
 };
-typedef struct dnscache_s dnscache_t;
+typedef struct dnscache_shard_s dnscache_shard_t;
+
+/* if async resolution is enabled, cache misses are handed to a small
+ * pool of resolver threads via this queue.
+ */
+#define DNSCACHE_MAX_QUEUED 10000
+struct dnscache_req_s {
+	struct sockaddr_storage addr;
+	struct dnscache_req_s *next;
+};
+typedef struct dnscache_req_s dnscache_req_t;
+struct dnscache_resolver_s {
+	pthread_mutex_t mut;
+	pthread_cond_t condWork;
+	dnscache_req_t *head;
+	dnscache_req_t *tail;
+	int nQueued;
+	pthread_t *thrds;
+	int nThrds;
+	sbool bShutdown;
+};
+typedef struct dnscache_resolver_s dnscache_resolver_t;
 
 
 /* static data */
 DEFobjStaticHelpers
 DEFobjCurrIf(glbl)
 DEFobjCurrIf(prop)
-static dnscache_t dnsCache;
+static dnscache_shard_t dnsCache[DNSCACHE_NSHARDS];
+static dnscache_resolver_t resolver;
 static prop_t *staticErrValue;
 
 
@@ -126,11 +168,9 @@ key_equals_fn(void *key1, void *key2)
 	return RetVal;
 }
 
-/* destruct a cache entry.
- * Precondition: entry must already be unlinked from list
- */
+/* release the properties of a cache entry (or of a temporary lookup result) */
 static void ATTR_NONNULL()
-entryDestruct(dnscache_entry_t *const etry)
+entryFreeProps(dnscache_entry_t *const etry)
 {
 	if(etry->fqdn != NULL)
 		prop.Destruct(&etry->fqdn);
@@ -140,21 +180,42 @@ entryDestruct(dnscache_entry_t *const etry)
 		prop.Destruct(&etry->localName);
 	if(etry->ip != NULL)
 		prop.Destruct(&etry->ip);
+}
+
+/* destruct a cache entry.
+ * Precondition: entry must already be unlinked from list
+ */
+static void ATTR_NONNULL()
+entryDestruct(dnscache_entry_t *const etry)
+{
+	entryFreeProps(etry);
 	free(etry);
 }
 
+
+static void resolverShutdown(void);
+
 /* init function (must be called once) */
 rsRetVal
 dnscacheInit(void)
 {
+	int i;
 	DEFiRet;
-	if((dnsCache.ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
-				(void(*)(void*))entryDestruct)) == NULL) {
-		DBGPRINTF("dnscache: error creating hash table!\n");
-		ABORT_FINALIZE(RS_RET_ERR); // TODO: make this degrade, but run!
+	for(i = 0 ; i < DNSCACHE_NSHARDS ; ++i) {
+		if((dnsCache[i].ht = create_hashtable(100, hash_from_key_fn, key_equals_fn,
+					(void(*)(void*))entryDestruct)) == NULL) {
+			DBGPRINTF("dnscache: error creating hash table!\n");
+			ABORT_FINALIZE(RS_RET_ERR); // TODO: make this degrade, but run!
+		}
+		dnsCache[i].lruHead = NULL;
+		dnsCache[i].lruTail = NULL;
+		dnsCache[i].nEntries = 0;
+		pthread_mutex_init(&dnsCache[i].mut, NULL);
+		pthread_cond_init(&dnsCache[i].condResolved, NULL);
 	}
-	dnsCache.nEntries = 0;
-	pthread_rwlock_init(&dnsCache.rwlock, NULL);
+	memset(&resolver, 0, sizeof(resolver));
+	pthread_mutex_init(&resolver.mut, NULL);
+	pthread_cond_init(&resolver.condWork, NULL);
 	CHKiRet(objGetObjInterface(&obj)); /* this provides the root pointer for all other queries */
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
@@ -170,20 +231,122 @@ finalize_it:
 rsRetVal
 dnscacheDeinit(void)
 {
+	int i;
 	DEFiRet;
+	resolverShutdown();
+	pthread_mutex_destroy(&resolver.mut);
+	pthread_cond_destroy(&resolver.condWork);
 	prop.Destruct(&staticErrValue);
-	hashtable_destroy(dnsCache.ht, 1); /* 1 => free all values automatically */
-	pthread_rwlock_destroy(&dnsCache.rwlock);
+	for(i = 0 ; i < DNSCACHE_NSHARDS ; ++i) {
+		hashtable_destroy(dnsCache[i].ht, 1); /* 1 => free all values automatically */
+		pthread_mutex_destroy(&dnsCache[i].mut);
+		pthread_cond_destroy(&dnsCache[i].condResolved);
+	}
 	objRelease(glbl, CORE_COMPONENT);
 	objRelease(prop, CORE_COMPONENT);
 	RETiRet;
 }
 
 
+/* select the shard responsible for an address. The hash is mixed
+ * once more, as the hashtable itself uses its low-order bits.
+ */
+static inline dnscache_shard_t *
+getShard(struct sockaddr_storage *addr)
+{
+	unsigned h = hash_from_key_fn(addr);
+	h ^= h >> 16;
+	h *= 0x45d9f3bu;
+	h ^= h >> 16;
+	return &dnsCache[h % DNSCACHE_NSHARDS];
+}
+
+
 static inline dnscache_entry_t*
-findEntry(struct sockaddr_storage *addr)
+findEntry(dnscache_shard_t *const shard, struct sockaddr_storage *addr)
+{
+	return((dnscache_entry_t*) hashtable_search(shard->ht, addr));
+}
+
+
+static inline int
+entryIsExpired(const dnscache_entry_t *const etry)
 {
-	return((dnscache_entry_t*) hashtable_search(dnsCache.ht, addr));
+	return etry->validUntil != 0 && time(NULL) >= etry->validUntil;
+}
+
+
+static void
+lruUnlink(dnscache_shard_t *const shard, dnscache_entry_t *const etry)
+{
+	if(etry->lruPrev == NULL)
+		shard->lruHead = etry->lruNext;
+	else
+		etry->lruPrev->lruNext = etry->lruNext;
+	if(etry->lruNext == NULL)
+		shard->lruTail = etry->lruPrev;
+	else
+		etry->lruNext->lruPrev = etry->lruPrev;
+	etry->lruPrev = etry->lruNext = NULL;
+}
+
+
+static void
+lruPushHead(dnscache_shard_t *const shard, dnscache_entry_t *const etry)
+{
+	etry->lruPrev = NULL;
+	etry->lruNext = shard->lruHead;
+	if(shard->lruHead != NULL)
+		shard->lruHead->lruPrev = etry;
+	shard->lruHead = etry;
+	if(shard->lruTail == NULL)
+		shard->lruTail = etry;
+}
+
+
+/* remove an entry from the cache and destruct it. Shard must be locked. */
+static void
+entryRemove(dnscache_shard_t *const shard, dnscache_entry_t *const etry)
+{
+	lruUnlink(shard, etry);
+	hashtable_remove(shard->ht, &etry->addr); /* frees the key, but not the value */
+	--shard->nEntries;
+	entryDestruct(etry);
+}
+
+
+/* evict least recently used entries if the shard is over its share
+ * of the configured maximum cache size. Shard must be locked.
+ */
+static void
+evictEntries(dnscache_shard_t *const shard)
+{
+	unsigned maxPerShard;
+
+	if(glblDnscacheMaxEntries == 0)
+		return;
+	maxPerShard = (glblDnscacheMaxEntries + DNSCACHE_NSHARDS - 1) / DNSCACHE_NSHARDS;
+	while(shard->nEntries > maxPerShard && shard->lruTail != NULL) {
+		DBGPRINTF("dnscache: evicting entry %p\n", shard->lruTail);
+		entryRemove(shard, shard->lruTail);
+	}
+}
+
+
+/* move the lookup result in pRes into the cache entry etry, replacing
+ * whatever it contained before. pRes no longer owns the properties
+ * after the call. Shard must be locked.
+ */
+static void
+entryInstall(dnscache_entry_t *const etry, dnscache_entry_t *const pRes)
+{
+	entryFreeProps(etry);
+	etry->fqdn = pRes->fqdn;
+	etry->fqdnLowerCase = pRes->fqdnLowerCase;
+	etry->localName = pRes->localName;
+	etry->ip = pRes->ip;
+	etry->validUntil = pRes->validUntil;
+	pRes->fqdn = pRes->fqdnLowerCase = pRes->localName = pRes->ip = NULL;
 }
 
 
@@ -283,9 +446,11 @@ done:	return;
  * there is a user-configurabel option that will tell us if
  * we should abort. For this, the return value tells the caller if the
  * message should be processed (1) or discarded (0).
+ * If bNumericOnly is set, no DNS query is done and only the IP address
+ * is filled in (used for placeholders while async lookups are pending).
  */
 static rsRetVal ATTR_NONNULL()
-resolveAddr(struct sockaddr_storage *addr, dnscache_entry_t *etry)
+resolveAddr(struct sockaddr_storage *addr, dnscache_entry_t *etry, const int bNumericOnly)
 {
 	DEFiRet;
 	int error;
@@ -303,7 +468,7 @@ resolveAddr(struct sockaddr_storage *addr, dnscache_entry_t *etry)
 		ABORT_FINALIZE(RS_RET_INVALID_SOURCE);
 	}
 
-	if(!glbl.GetDisableDNS()) {
+	if(!bNumericOnly && !glbl.GetDisableDNS()) {
 		sigemptyset(&nmask);
 		sigaddset(&nmask, SIGHUP);
 		pthread_sigmask(SIG_BLOCK, &nmask, &omask);
@@ -375,7 +540,7 @@ finalize_it:
 	/* we need to create the inputName property (only once during our lifetime) */
 	prop.CreateStringProp(&etry->ip, (uchar*)szIP, strlen(szIP));
 
-        if(error || glbl.GetDisableDNS()) {
+        if(error || bNumericOnly || glbl.GetDisableDNS()) {
                 dbgprintf("Host name for your address (%s) unknown\n", szIP);
 		prop.AddRef(etry->ip);
 		etry->fqdn = etry->ip;
@@ -385,60 +550,246 @@ finalize_it:
 
 	setLocalHostName(etry);
 
+	if(glblDnscacheEnableTTL) {
+		etry->validUntil = time(NULL) + (error ? glblDnscacheNegativeTTL : glblDnscacheDefaultTTL);
+	} else {
+		etry->validUntil = 0;
+	}
+
 	RETiRet;
 }
 
 
+/* store a lookup result for addr in the cache, either by updating the
+ * existing entry or by creating a new one. On return, *ppEtry points to
+ * the entry. pRes is always consumed. Shard must be locked.
+ */
 static rsRetVal ATTR_NONNULL()
-addEntry(struct sockaddr_storage *const addr, dnscache_entry_t **const pEtry)
+storeResult(dnscache_shard_t *const shard, struct sockaddr_storage *const addr,
+	dnscache_entry_t *const pRes, dnscache_entry_t **const ppEtry)
 {
-	int r;
 	struct sockaddr_storage *keybuf = NULL;
-	dnscache_entry_t *etry = NULL;
+	dnscache_entry_t *etry;
 	DEFiRet;
 
-	pthread_rwlock_wrlock(&dnsCache.rwlock);
-	/* first check, if the entry was added in the mean time */
-	etry = findEntry(addr);
-	if(etry != NULL) {
-		FINALIZE;
+	etry = findEntry(shard, addr);
+	if(etry == NULL) {
+		CHKmalloc(etry = calloc(1, sizeof(dnscache_entry_t)));
+		if((keybuf = malloc(sizeof(struct sockaddr_storage))) == NULL) {
+			free(etry);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		memcpy(&etry->addr, addr, SALEN((struct sockaddr*) addr));
+		memcpy(keybuf, addr, sizeof(struct sockaddr_storage));
+		if(hashtable_insert(shard->ht, keybuf, etry) == 0) {
+			DBGPRINTF("dnscache: inserting element failed\n");
+			free(keybuf);
+			free(etry);
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+		}
+		lruPushHead(shard, etry);
+		++shard->nEntries;
+		evictEntries(shard); /* never evicts etry, as it is at LRU head */
 	}
+	entryInstall(etry, pRes);
+	etry->resolveRet = RS_RET_OK;
+	*ppEtry = etry;
 
-	/* entry still does not exist, so add it */
-	CHKmalloc(etry = MALLOC(sizeof(dnscache_entry_t)));
-	CHKmalloc(keybuf = malloc(sizeof(struct sockaddr_storage)));
-	CHKiRet(resolveAddr(addr, etry));
-	memcpy(&etry->addr, addr, SALEN((struct sockaddr*) addr));
-	etry->nUsed = 0;
+finalize_it:
+	if(iRet != RS_RET_OK)
+		entryFreeProps(pRes);
+	RETiRet;
+}
 
-	memcpy(keybuf, addr, sizeof(struct sockaddr_storage));
 
-	r = hashtable_insert(dnsCache.ht, keybuf, etry);
-	keybuf = NULL;
-	if(r == 0) {
-		DBGPRINTF("dnscache: inserting element failed\n");
+/* resolve addr on the caller's thread and store the result. The shard lock
+ * is released during the DNS query, so other lookups are not blocked by it.
+ * Called and returns with shard locked.
+ */
+static rsRetVal ATTR_NONNULL()
+resolveSync(dnscache_shard_t *const shard, struct sockaddr_storage *const addr,
+	dnscache_entry_t **const ppEtry)
+{
+	dnscache_entry_t res;
+	rsRetVal localRet;
+	DEFiRet;
+
+	memset(&res, 0, sizeof(res));
+	pthread_mutex_unlock(&shard->mut);
+	localRet = resolveAddr(addr, &res, 0);
+	pthread_mutex_lock(&shard->mut);
+	if(localRet != RS_RET_OK) {
+		entryFreeProps(&res);
+		ABORT_FINALIZE(localRet);
 	}
+	CHKiRet(storeResult(shard, addr, &res, ppEtry));
+	(*ppEtry)->bResolved = 1;
+	(*ppEtry)->bPending = 0;
 
 finalize_it:
-	pthread_rwlock_unlock(&dnsCache.rwlock);
-	if(iRet == RS_RET_OK) {
-		*pEtry = etry;
-	} else {
-		free(keybuf);
-		free(etry); /* Note: sub-fields cannot be populated in this case */
+	RETiRet;
+}
+
+
+/* async resolver thread: takes requests from the queue, does the (potentially
+ * slow) DNS lookup and updates the cache entry.
+ */
+static void *
+resolverWorker(void __attribute__((unused)) *arg)
+{
+	sigset_t sigSet;
+	dnscache_req_t *req;
+	dnscache_entry_t res;
+	dnscache_entry_t *etry;
+	dnscache_shard_t *shard;
+	rsRetVal localRet;
+
+	sigfillset(&sigSet);
+	pthread_sigmask(SIG_BLOCK, &sigSet, NULL);
+
+	pthread_mutex_lock(&resolver.mut);
+	while(1) {
+		while(resolver.head == NULL && !resolver.bShutdown)
+			pthread_cond_wait(&resolver.condWork, &resolver.mut);
+		if(resolver.bShutdown)
+			break;
+		req = resolver.head;
+		resolver.head = req->next;
+		if(resolver.head == NULL)
+			resolver.tail = NULL;
+		--resolver.nQueued;
+		pthread_mutex_unlock(&resolver.mut);
+
+		memset(&res, 0, sizeof(res));
+		localRet = resolveAddr(&req->addr, &res, 0);
+		shard = getShard(&req->addr);
+		pthread_mutex_lock(&shard->mut);
+		etry = findEntry(shard, &req->addr);
+		if(etry == NULL) {
+			entryFreeProps(&res); /* evicted in the mean time, result not needed */
+		} else {
+			entryInstall(etry, &res);
+			etry->resolveRet = localRet;
+			etry->bResolved = 1;
+			etry->bPending = 0;
+			if(localRet != RS_RET_OK) {
+				/* failures are retried; the sync code does not cache them at all */
+				etry->validUntil = time(NULL) + glblDnscacheNegativeTTL;
+			}
+		}
+		pthread_cond_broadcast(&shard->condResolved);
+		pthread_mutex_unlock(&shard->mut);
+		free(req);
+		pthread_mutex_lock(&resolver.mut);
 	}
+	pthread_mutex_unlock(&resolver.mut);
+	return NULL;
+}
+
+
+/* queue an async lookup request. The resolver threads are started
+ * on first use. Fails if the queue is full.
+ */
+static rsRetVal ATTR_NONNULL()
+resolverEnqueue(struct sockaddr_storage *const addr)
+{
+	dnscache_req_t *req = NULL;
+	int i;
+	DEFiRet;
+
+	pthread_mutex_lock(&resolver.mut);
+	if(resolver.bShutdown)
+		ABORT_FINALIZE(RS_RET_ERR);
+	if(resolver.thrds == NULL) {
+		CHKmalloc(resolver.thrds = calloc(glblDnscacheAsyncWorkers, sizeof(pthread_t)));
+		for(i = 0 ; i < glblDnscacheAsyncWorkers ; ++i) {
+			if(pthread_create(&resolver.thrds[i], NULL, resolverWorker, NULL) != 0)
+				break;
+			++resolver.nThrds;
+		}
+		DBGPRINTF("dnscache: started %d async resolver threads\n", resolver.nThrds);
+	}
+	if(resolver.nThrds == 0 || resolver.nQueued >= DNSCACHE_MAX_QUEUED)
+		ABORT_FINALIZE(RS_RET_ERR);
+
+	CHKmalloc(req = malloc(sizeof(dnscache_req_t)));
+	memcpy(&req->addr, addr, sizeof(struct sockaddr_storage));
+	req->next = NULL;
+	if(resolver.tail == NULL)
+		resolver.head = req;
+	else
+		resolver.tail->next = req;
+	resolver.tail = req;
+	++resolver.nQueued;
+	pthread_cond_signal(&resolver.condWork);
+
+finalize_it:
+	pthread_mutex_unlock(&resolver.mut);
 	RETiRet;
 }
 
 
-/* validate if an entry is still valid and, if not, re-query it.
- * In the initial implementation, this is a dummy!
- * TODO: implement!
+static void
+resolverShutdown(void)
+{
+	dnscache_req_t *req;
+	int i;
+
+	pthread_mutex_lock(&resolver.mut);
+	resolver.bShutdown = 1;
+	pthread_cond_broadcast(&resolver.condWork);
+	pthread_mutex_unlock(&resolver.mut);
+	for(i = 0 ; i < resolver.nThrds ; ++i)
+		pthread_join(resolver.thrds[i], NULL);
+	free(resolver.thrds);
+	resolver.thrds = NULL;
+	resolver.nThrds = 0;
+	while(resolver.head != NULL) {
+		req = resolver.head;
+		resolver.head = req->next;
+		free(req);
+	}
+	resolver.tail = NULL;
+}
+
+
+/* hand a lookup to the async resolver. If there is no entry yet, a
+ * placeholder carrying just the IP address is created, so callers have
+ * something to work with until the lookup completes. Existing (expired)
+ * entries keep serving their old data during the refresh.
+ * Called and returns with shard locked.
  */
-static inline rsRetVal
-validateEntry(dnscache_entry_t __attribute__((unused)) *etry, struct sockaddr_storage __attribute__((unused)) *addr)
+static rsRetVal ATTR_NONNULL(1, 2)
+resolveAsync(dnscache_shard_t *const shard, struct sockaddr_storage *const addr,
+	dnscache_entry_t *etry, dnscache_entry_t **const ppEtry)
 {
-	return RS_RET_OK;
+	dnscache_entry_t res;
+	DEFiRet;
+
+	if(etry == NULL) {
+		memset(&res, 0, sizeof(res));
+		if((iRet = resolveAddr(addr, &res, 1)) != RS_RET_OK) {
+			entryFreeProps(&res);
+			FINALIZE;
+		}
+		CHKiRet(storeResult(shard, addr, &res, &etry));
+		etry->bResolved = 0;
+		timeoutComp(&etry->pendingDeadline, glblDnscacheAsyncDeadline);
+	}
+	etry->validUntil = 0; /* do not trigger another refresh while this one runs */
+	etry->resolveRet = RS_RET_OK;
+	etry->bPending = 1;
+	if(resolverEnqueue(addr) != RS_RET_OK) {
+		/* resolver overloaded: go with what we have and retry later */
+		DBGPRINTF("dnscache: async resolver queue full, using IP address\n");
+		etry->bPending = 0;
+		etry->bResolved = 1;
+		etry->validUntil = time(NULL) + glblDnscacheNegativeTTL;
+	}
+	*ppEtry = etry;
+
+finalize_it:
+	RETiRet;
 }
 
 
@@ -446,27 +797,56 @@ validateEntry(dnscache_entry_t __attribute__((unused)) *etry, struct sockaddr_st
  * and IP address. If the entry is not yet inside the cache, it is added.
  * If the entry can not be resolved, an error is reported back. If fqdn
  * or fqdnLowerCase are NULL, they are not set.
+ * With async resolution enabled, a cache miss does not block the caller
+ * longer than the configured deadline. Until the lookup completes, the
+ * IP address is returned as host name.
  */
 rsRetVal
 dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerCase,
 	       prop_t **localName, prop_t **ip)
 {
+	dnscache_shard_t *const shard = getShard(addr);
 	dnscache_entry_t *etry;
+	dnscache_entry_t tmpEtry;
+	struct timespec deadline;
+	int bUseTmp = 0;
+	int r;
 	DEFiRet;
 
-	pthread_rwlock_rdlock(&dnsCache.rwlock); /* TODO: optimize this! */
-	do {
-		etry = findEntry(addr);
-		dbgprintf("dnscache: entry %p found\n", etry);
-		if(etry == NULL) {
-			pthread_rwlock_unlock(&dnsCache.rwlock);
-			iRet = addEntry(addr, &etry);
-			pthread_rwlock_rdlock(&dnsCache.rwlock); /* TODO: optimize this! */
-			CHKiRet(iRet);
+	pthread_mutex_lock(&shard->mut);
+	etry = findEntry(shard, addr);
+	dbgprintf("dnscache: entry %p found\n", etry);
+	if(etry == NULL || (!etry->bPending && entryIsExpired(etry))) {
+		if(glblDnscacheAsyncWorkers > 0) {
+			CHKiRet(resolveAsync(shard, addr, etry, &etry));
 		} else {
-			CHKiRet(validateEntry(etry, addr));
+			CHKiRet(resolveSync(shard, addr, &etry));
+		}
+	}
+
+	/* a fresh placeholder: give the resolver a chance to complete. Note that
+	 * the entry may go away while we wait, so we need a copy of the deadline.
+	 */
+	while(etry != NULL && etry->bPending && !etry->bResolved && glblDnscacheAsyncDeadline > 0) {
+		deadline = etry->pendingDeadline;
+		r = pthread_cond_timedwait(&shard->condResolved, &shard->mut, &deadline);
+		etry = findEntry(shard, addr); /* may have been evicted while we waited */
+		if(r != 0)
+			break; /* deadline reached, use what we have */
+	}
+	if(etry == NULL) {
+		/* evicted under our feet - return an uncached IP-only result */
+		memset(&tmpEtry, 0, sizeof(tmpEtry));
+		bUseTmp = 1;
+		CHKiRet(resolveAddr(addr, &tmpEtry, 1));
+		etry = &tmpEtry;
+	} else {
+		CHKiRet(etry->resolveRet);
+		if(etry != shard->lruHead) {
+			lruUnlink(shard, etry);
+			lruPushHead(shard, etry);
 		}
-	} while(etry == NULL);
+	}
 
 	prop.AddRef(etry->ip);
 	*ip = etry->ip;
@@ -484,7 +864,9 @@ dnscacheLookup(struct sockaddr_storage *addr, prop_t **fqdn, prop_t **fqdnLowerC
 	}
 
 finalize_it:
-	pthread_rwlock_unlock(&dnsCache.rwlock);
+	pthread_mutex_unlock(&shard->mut);
+	if(bUseTmp)
+		entryFreeProps(&tmpEtry);
 	if(iRet != RS_RET_OK && iRet != RS_RET_ADDRESS_UNKNOWN) {
 		DBGPRINTF("dnscacheLookup failed with iRet %d\n", iRet);
 		prop.AddRef(staticErrValue);
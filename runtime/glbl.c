@@ -38,6 +38,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <errno.h>
+#include <time.h>
 
 #include "rsyslog.h"
 #include "obj.h"
@@ -53,6 +54,7 @@
 #include "srUtils.h"
 #include "net.h"
 #include "rsconf.h"
+#include "datetime.h"
 
 /* some defaults */
 #ifndef DFLT_NETSTRM_DRVR
@@ -119,8 +121,16 @@ int glblReportNewSenders = 0;
 int glblReportGoneAwaySenders = 0;
 int glblSenderStatsTimeout = 12 * 60 * 60; /* 12 hr timeout for senders */
 int glblSenderKeepTrack = 0;  /* keep track of known senders? */
+int glblDnscacheEnableTTL = 0; /* expire reverse lookup cache entries? */
+int glblDnscacheDefaultTTL = 24 * 60 * 60; /* TTL (seconds) for successful reverse lookups */
+int glblDnscacheNegativeTTL = 60; /* TTL (seconds) for failed reverse lookups */
+int glblDnscacheMaxEntries = 0; /* max entries in reverse lookup cache, 0 = unlimited */
+int glblDnscacheAsyncWorkers = 0; /* number of async resolver threads, 0 = resolve synchronously */
+int glblDnscacheAsyncDeadline = 100; /* max ms a message waits for an async lookup */
 int glblUnloadModules = 1;
 int bPermitSlashInProgramname = 0;
+int glblScriptBatchExec = 0; /* execute rulesets statement-by-statement over whole batches? */
+int glblTimestampCoarseClock = 0; /* obtain current time from CLOCK_REALTIME_COARSE? */
 int glblIntMsgRateLimitItv = 5;
 int glblIntMsgRateLimitBurst = 500;
 char** glblDbgFiles = NULL;
@@ -172,6 +182,12 @@ static struct cnfparamdescr cnfparamdescr[] = {
 	{ "senders.reportgoneaway", eCmdHdlrBinary, 0 },
 	{ "senders.timeoutafter", eCmdHdlrPositiveInt, 0 },
 	{ "senders.keeptrack", eCmdHdlrBinary, 0 },
+	{ "reverselookup.cache.ttl.enable", eCmdHdlrBinary, 0 },
+	{ "reverselookup.cache.ttl.default", eCmdHdlrNonNegInt, 0 },
+	{ "reverselookup.cache.ttl.negative", eCmdHdlrNonNegInt, 0 },
+	{ "reverselookup.cache.maxentries", eCmdHdlrNonNegInt, 0 },
+	{ "reverselookup.async.workers", eCmdHdlrNonNegInt, 0 },
+	{ "reverselookup.async.deadline", eCmdHdlrNonNegInt, 0 },
 	{ "privdrop.group.keepsupplemental", eCmdHdlrBinary, 0 },
 	{ "net.ipprotocol", eCmdHdlrGetWord, 0 },
 	{ "net.acladdhostnameonfail", eCmdHdlrBinary, 0 },
@@ -187,7 +203,9 @@ static struct cnfparamdescr cnfparamdescr[] = {
 	{ "errormessagestostderr.maxnumber", eCmdHdlrPositiveInt, 0 },
 	{ "shutdown.enable.ctlc", eCmdHdlrBinary, 0 },
 	{ "debug.files", eCmdHdlrArray, 0 },
-	{ "debug.whitelist", eCmdHdlrBinary, 0 }
+	{ "debug.whitelist", eCmdHdlrBinary, 0 },
+	{ "script.batchexecution", eCmdHdlrBinary, 0 },
+	{ "timestamp.coarseclock", eCmdHdlrBinary, 0 }
 };
 static struct cnfparamblk paramblk =
 	{ CNFPARAMBLK_VERSION,
@@ -1098,7 +1116,8 @@ do_setenv(const char *const var)
 			"'%s' to '%s': %s", varname, val, errStr);
 		ABORT_FINALIZE(RS_RET_ERR_SETENV);
 	}
-
+	if(!strcmp(varname, "TZ"))
+		dateTimeTZChanged();
 
 finalize_it:
 	RETiRet;
@@ -1219,6 +1238,16 @@ glblDoneLoadCnf(void)
 			bParseHOSTNAMEandTAG = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "parser.permitslashinprogramname")) {
 			bPermitSlashInProgramname = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "script.batchexecution")) {
+			glblScriptBatchExec = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "timestamp.coarseclock")) {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_REALTIME_COARSE)
+			glblTimestampCoarseClock = (int) cnfparamvals[i].val.d.n;
+#else
+			if(cnfparamvals[i].val.d.n)
+				LogError(0, RS_RET_NOT_IMPLEMENTED, "timestamp.coarseclock is not "
+					"supported on this platform - using the regular clock");
+#endif
 		} else if(!strcmp(paramblk.descr[i].name, "debug.logfile")) {
 			if(pszAltDbgFileName == NULL) {
 				pszAltDbgFileName = es_str2cstr(cnfparamvals[i].val.d.estr, NULL);
@@ -1256,6 +1285,18 @@ glblDoneLoadCnf(void)
 		        glblSenderStatsTimeout = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "senders.keeptrack")) {
 		        glblSenderKeepTrack = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "reverselookup.cache.ttl.enable")) {
+		        glblDnscacheEnableTTL = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "reverselookup.cache.ttl.default")) {
+		        glblDnscacheDefaultTTL = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "reverselookup.cache.ttl.negative")) {
+		        glblDnscacheNegativeTTL = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "reverselookup.cache.maxentries")) {
+		        glblDnscacheMaxEntries = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "reverselookup.async.workers")) {
+		        glblDnscacheAsyncWorkers = (int) cnfparamvals[i].val.d.n;
+		} else if(!strcmp(paramblk.descr[i].name, "reverselookup.async.deadline")) {
+		        glblDnscacheAsyncDeadline = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "privdrop.group.keepsupplemental")) {
 		        loadConf->globals.gidDropPrivKeepSupplemental = (int) cnfparamvals[i].val.d.n;
 		} else if(!strcmp(paramblk.descr[i].name, "net.acladdhostnameonfail")) {
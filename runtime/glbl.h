@@ -42,6 +42,7 @@
 extern pid_t glbl_ourpid;
 extern int bProcessInternalMessages;
 extern int bPermitSlashInProgramname;
+extern int glblScriptBatchExec;
 #ifdef HAVE_LIBLOGGING_STDLOG
 extern stdlog_channel_t stdlog_hdl;
 #endif
@@ -114,6 +115,13 @@ extern int glblReportNewSenders;
 extern int glblReportGoneAwaySenders;
 extern int glblSenderStatsTimeout;
 extern int glblSenderKeepTrack;
+extern int glblDnscacheEnableTTL;
+extern int glblDnscacheDefaultTTL;
+extern int glblDnscacheNegativeTTL;
+extern int glblDnscacheMaxEntries;
+extern int glblDnscacheAsyncWorkers;
+extern int glblDnscacheAsyncDeadline;
+extern int glblTimestampCoarseClock;
 extern int glblUnloadModules;
 extern short janitorInterval;
 extern int glblIntMsgRateLimitItv;
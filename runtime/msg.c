@@ -49,6 +49,7 @@
   #include <uuid/uuid.h>
 #endif
 #include <errno.h>
+#include <sched.h>
 #include "rsyslog.h"
 #include "srUtils.h"
 #include "stringbuf.h"
@@ -66,6 +67,7 @@
 #include "rsconf.h"
 #include "parserif.h"
 #include "errmsg.h"
+#include "statsobj.h"
 
 /* inlines */
 extern void msgSetPRI(smsg_t *const __restrict__ pMsg, syslog_pri_t pri);
@@ -84,6 +86,7 @@ DEFobjCurrIf(regexp)
 DEFobjCurrIf(prop)
 DEFobjCurrIf(net)
 DEFobjCurrIf(var)
+DEFobjCurrIf(statsobj)
 
 static const char *one_digit[10] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9" };
 
@@ -427,20 +430,139 @@ static json_bool jsonVarExtract(struct json_object* root, const char *key, struc
 void getRawMsgAfterPRI(smsg_t * const pM, uchar **pBuf, int *piLen);
 
 
+/* Messages do not have a mutex of their own. The (rare) operations that
+ * need to update several fields together, like DNS resolution or access
+ * to the json trees, use one of a small set of mutexes which is selected
+ * by the message address. Note that this means no code must ever hold the
+ * lock for one message while locking another one.
+ */
+#define MSG_MUT_STRIPES 64 /* must be a power of 2 */
+static pthread_mutex_t msgMutStripes[MSG_MUT_STRIPES];
+
+static inline pthread_mutex_t *
+msgGetMut(const smsg_t *const pThis)
+{
+	const uintptr_t addr = (uintptr_t) pThis;
+	return &msgMutStripes[((addr >> 8) ^ (addr >> 14)) & (MSG_MUT_STRIPES - 1)];
+}
+
+static void
+msgInitMutStripes(void)
+{
+	int i;
+	for(i = 0 ; i < MSG_MUT_STRIPES ; ++i)
+		pthread_mutex_init(&msgMutStripes[i], NULL);
+}
+
 /* the locking and unlocking implementations: */
 static inline void
 MsgLock(smsg_t *pThis)
 {
 	/* DEV debug only! dbgprintf("MsgLock(0x%lx)\n", (unsigned long) pThis); */
-	pthread_mutex_lock(&pThis->mut);
+	pthread_mutex_lock(msgGetMut(pThis));
 }
 static inline void
 MsgUnlock(smsg_t *pThis)
 {
 	/* DEV debug only! dbgprintf("MsgUnlock(0x%lx)\n", (unsigned long) pThis); */
-	pthread_mutex_unlock(&pThis->mut);
+	pthread_mutex_unlock(msgGetMut(pThis));
+}
+
+
+/* Lazily computed properties.
+ * Many properties, most importantly the formatted timestamps, are only
+ * computed on first use and then cached inside the message. As a message
+ * may be processed by several action workers concurrently, this must be
+ * thread-safe. Each such property has a bit in lazyClaimed and lazyReady.
+ * The first thread that needs the property atomically sets its "claimed"
+ * bit and computes it; when done, it sets the "ready" bit. Everyone else
+ * sees "ready" and just uses the value. Only if a thread comes in while
+ * the value is still being computed, it needs to wait for it to become
+ * ready, which should happen very seldom and be very quick.
+ * Usage:
+ *	if(msgLazyClaim(pM, LAZY_xxx)) {
+ *		... compute property (if not yet set otherwise) ...
+ *		msgLazyDone(pM, LAZY_xxx);
+ *	}
+ *	... use property ...
+ * Without atomic instructions, we fall back to the message lock.
+ */
+#define LAZY_TIMESTAMP3164	0x00001
+#define LAZY_TIMESTAMP3339	0x00002
+#define LAZY_TIMESTAMP_MYSQL	0x00004
+#define LAZY_TIMESTAMP_PGSQL	0x00008
+#define LAZY_TIMESTAMP_UNIX	0x00010
+#define LAZY_TIMESTAMP_SECFRAC	0x00020
+#define LAZY_RCVDAT3164		0x00040
+#define LAZY_RCVDAT3339		0x00080
+#define LAZY_RCVDAT_MYSQL	0x00100
+#define LAZY_RCVDAT_PGSQL	0x00200
+#define LAZY_RCVDAT_UNIX	0x00400
+#define LAZY_RCVDAT_SECFRAC	0x00800
+#define LAZY_UUID		0x01000
+#define LAZY_PROCID		0x02000
+#define LAZY_APPNAME		0x04000
+#define LAZY_PROGNAME		0x08000
+#define LAZY_TAG		0x10000
+
+#ifdef HAVE_ATOMIC_BUILTINS
+static inline int
+msgLazyClaim(smsg_t *const pM, const int bit)
+{
+	if(*((volatile int*) &pM->lazyReady) & bit) {
+		__sync_synchronize(); /* pairs with msgLazyDone() */
+		return 0;
+	}
+	if((ATOMIC_OR_INT_TO_INT(&pM->lazyClaimed, NULL, bit) & bit) == 0)
+		return 1; /* we need to compute it */
+	while((*((volatile int*) &pM->lazyReady) & bit) == 0)
+		sched_yield();
+	__sync_synchronize();
+	return 0;
 }
 
+static inline void
+msgLazyDone(smsg_t *const pM, const int bit)
+{
+	ATOMIC_OR_INT_TO_INT(&pM->lazyReady, NULL, bit);
+}
+#else
+/* note: we must not keep the lock while computing, as computing one
+ * property may require another one (e.g. TAG emulation needs APP-NAME).
+ */
+static inline int
+msgLazyClaim(smsg_t *const pM, const int bit)
+{
+	int bMustCompute;
+
+	MsgLock(pM);
+	while(1) {
+		if(pM->lazyReady & bit) {
+			bMustCompute = 0;
+			break;
+		}
+		if((pM->lazyClaimed & bit) == 0) {
+			pM->lazyClaimed |= bit;
+			bMustCompute = 1;
+			break;
+		}
+		MsgUnlock(pM);
+		sched_yield();
+		MsgLock(pM);
+	}
+	MsgUnlock(pM);
+	return bMustCompute;
+}
+
+static inline void
+msgLazyDone(smsg_t *const pM, const int bit)
+{
+	MsgLock(pM);
+	pM->lazyReady |= bit;
+	MsgUnlock(pM);
+}
+#endif
+
 
 /* set RcvFromIP name in msg object WITHOUT calling AddRef.
  * rgerhards, 2013-01-22
@@ -795,6 +917,219 @@ uchar *propIDToName(propid_t propID)
 }
 
 
+/* Per-thread msg object cache.
+ * Message objects are usually created by an input thread and destructed by a
+ * queue worker thread. Having all of them go through malloc()/free() causes
+ * contention on the malloc arenas and fragmentation. So we keep freed objects
+ * in per-thread caches. Each object remembers the cache it belongs to. If it is
+ * destructed by the owning thread, it goes to that thread's local free list,
+ * which is accessed without any synchronization. If destructed by another
+ * thread, it is pushed onto the owner's "remote" list, which the owner grabs
+ * as a whole when its local list runs empty. Cached objects keep a spare raw
+ * message buffer for messages too large for szRawMsg, so re-using them saves
+ * that malloc() as well.
+ * The caches are in a fixed-size table; a thread claims a slot on first use and
+ * releases it on termination, handing the cached objects over to the next
+ * thread that claims the slot. Threads that do not get a slot use plain
+ * malloc()/free(). Cache sizes are bounded, objects beyond that are free()ed.
+ * All of this requires atomic instructions; without them, we always malloc().
+ */
+#define MSG_SLAB_SLOTS 64		/* max number of threads with their own cache */
+#define MSG_SLAB_MAX_CACHED 1024	/* max objects in a local resp. remote list */
+#define MSG_SLAB_RAWBUF_MAX 8192	/* max raw msg buffer size kept with a cached object */
+
+#ifdef HAVE_ATOMIC_BUILTINS
+typedef struct msgSlabFree_s {
+	struct msgSlabFree_s *next;
+} msgSlabFree_t;
+
+typedef struct msgSlab_s {
+	int inUse;			/* claimed by a thread? */
+	int nLocal;
+	msgSlabFree_t *localFree;	/* owner only */
+	msgSlabFree_t *remoteFree;	/* pushed by other threads, taken as a whole by owner */
+	int nRemote;
+	/* stats, written by owner only, summed up on stats read */
+	uint64 hits;
+	uint64 misses;
+	uint64 remoteFrees;		/* frees we did to other thread's caches */
+} __attribute__((aligned(64))) msgSlab_t;
+
+static msgSlab_t msgSlabs[MSG_SLAB_SLOTS];
+static char msgSlabNone;		/* key value for threads without cache slot */
+static pthread_key_t keyMsgSlab;
+static statsobj_t *msgSlabStats;
+STATSCOUNTER_DEF(ctrSlabHits, mutCtrSlabHits)
+STATSCOUNTER_DEF(ctrSlabMisses, mutCtrSlabMisses)
+STATSCOUNTER_DEF(ctrSlabRemoteFrees, mutCtrSlabRemoteFrees)
+static uint64 msgSlabNoSlotMisses;
+
+/* called on thread termination: hand the slot over to the next thread */
+static void
+msgSlabRelease(void *const pSlab)
+{
+	if(pSlab != &msgSlabNone)
+		ATOMIC_STORE_0_TO_INT(&((msgSlab_t*) pSlab)->inUse, NULL);
+}
+
+static msgSlab_t *
+msgSlabGetMine(void)
+{
+	void *pSlab;
+	int i;
+
+	pSlab = pthread_getspecific(keyMsgSlab);
+	if(pSlab == NULL) {
+		pSlab = &msgSlabNone;
+		for(i = 0 ; i < MSG_SLAB_SLOTS ; ++i) {
+			if(msgSlabs[i].inUse == 0 && ATOMIC_CAS(&msgSlabs[i].inUse, 0, 1, NULL)) {
+				pSlab = &msgSlabs[i];
+				break;
+			}
+		}
+		pthread_setspecific(keyMsgSlab, pSlab);
+	}
+	return (pSlab == &msgSlabNone) ? NULL : pSlab;
+}
+
+/* obtain a cached msg object. Returns NULL if the cache is empty, in which
+ * case the caller must malloc() one. *ppSlab receives the cache that the
+ * object belongs to (NULL if this thread has none).
+ */
+static smsg_t *
+msgSlabAlloc(void **const ppSlab)
+{
+	msgSlab_t *const pSlab = msgSlabGetMine();
+	msgSlabFree_t *pFree;
+	int n;
+
+	*ppSlab = pSlab;
+	if(pSlab == NULL) {
+		ATOMIC_INC_uint64(&msgSlabNoSlotMisses, NULL);
+		return NULL;
+	}
+
+	if(pSlab->localFree == NULL && pSlab->remoteFree != NULL) {
+		pSlab->localFree = __sync_lock_test_and_set(&pSlab->remoteFree, NULL);
+		n = 0;
+		for(pFree = pSlab->localFree ; pFree != NULL ; pFree = pFree->next)
+			++n;
+		ATOMIC_SUB(&pSlab->nRemote, n, NULL);
+		pSlab->nLocal = n;
+	}
+
+	pFree = pSlab->localFree;
+	if(pFree == NULL) {
+		++pSlab->misses;
+		return NULL;
+	}
+	pSlab->localFree = pFree->next;
+	--pSlab->nLocal;
+	++pSlab->hits;
+	return (smsg_t*) pFree;
+}
+
+/* try to put a msg object into the cache. Returns 1 if it was cached, 0 if
+ * the caller must free() it.
+ */
+static int
+msgSlabFree(smsg_t *const pM)
+{
+	msgSlab_t *const pMine = msgSlabGetMine();
+	msgSlab_t *pSlab = pM->pSlab;
+	msgSlabFree_t *const pFree = (msgSlabFree_t*) pM;
+	msgSlabFree_t *pHead;
+
+	if(pSlab == NULL) {
+		pSlab = pMine;	/* adopt objects from threads without a cache */
+		if(pSlab == NULL)
+			return 0;
+		pM->pSlab = pSlab;
+	}
+
+	if(pSlab == pMine) {
+		if(pSlab->nLocal >= MSG_SLAB_MAX_CACHED)
+			return 0;
+		pFree->next = pSlab->localFree;
+		pSlab->localFree = pFree;
+		++pSlab->nLocal;
+	} else {
+		if(pSlab->nRemote >= MSG_SLAB_MAX_CACHED)
+			return 0;
+		ATOMIC_INC(&pSlab->nRemote, NULL);
+		do {
+			pHead = pSlab->remoteFree;
+			pFree->next = pHead;
+		} while(!__sync_bool_compare_and_swap(&pSlab->remoteFree, pHead, pFree));
+		if(pMine != NULL)
+			++pMine->remoteFrees;
+	}
+	return 1;
+}
+
+static void
+msgSlabStatsReadCallback(statsobj_t __attribute__((unused)) *const ignore_stats,
+	void __attribute__((unused)) *const ignore_ctx)
+{
+	uint64 hits = 0, misses = 0, remoteFrees = 0;
+	int i;
+
+	for(i = 0 ; i < MSG_SLAB_SLOTS ; ++i) {
+		hits += msgSlabs[i].hits;
+		misses += msgSlabs[i].misses;
+		remoteFrees += msgSlabs[i].remoteFrees;
+	}
+	ctrSlabHits = hits;
+	ctrSlabMisses = misses + msgSlabNoSlotMisses;
+	ctrSlabRemoteFrees = remoteFrees;
+}
+
+static rsRetVal
+msgSlabInit(void)
+{
+	DEFiRet;
+
+	CHKiConcCtrl(pthread_key_create(&keyMsgSlab, msgSlabRelease));
+	CHKiRet(statsobj.Construct(&msgSlabStats));
+	CHKiRet(statsobj.SetName(msgSlabStats, UCHAR_CONSTANT("msg-slab")));
+	CHKiRet(statsobj.SetOrigin(msgSlabStats, UCHAR_CONSTANT("core.msg")));
+	STATSCOUNTER_INIT(ctrSlabHits, mutCtrSlabHits);
+	CHKiRet(statsobj.AddCounter(msgSlabStats, UCHAR_CONSTANT("hits"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrSlabHits));
+	STATSCOUNTER_INIT(ctrSlabMisses, mutCtrSlabMisses);
+	CHKiRet(statsobj.AddCounter(msgSlabStats, UCHAR_CONSTANT("misses"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrSlabMisses));
+	STATSCOUNTER_INIT(ctrSlabRemoteFrees, mutCtrSlabRemoteFrees);
+	CHKiRet(statsobj.AddCounter(msgSlabStats, UCHAR_CONSTANT("remotefrees"),
+		ctrType_IntCtr, CTR_FLAG_NONE, &ctrSlabRemoteFrees));
+	CHKiRet(statsobj.SetReadNotifier(msgSlabStats, msgSlabStatsReadCallback, NULL));
+	CHKiRet(statsobj.ConstructFinalize(msgSlabStats));
+
+finalize_it:
+	RETiRet;
+}
+#else /* #ifdef HAVE_ATOMIC_BUILTINS */
+static smsg_t *
+msgSlabAlloc(void **const ppSlab)
+{
+	*ppSlab = NULL;
+	return NULL;
+}
+
+static int
+msgSlabFree(smsg_t __attribute__((unused)) *const pM)
+{
+	return 0;
+}
+
+static rsRetVal
+msgSlabInit(void)
+{
+	return RS_RET_OK;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
+
 /* This is common code for all Constructors. It is defined in an
  * inline'able function so that we can save a function call in the
  * actual constructors (otherwise, the msgConstruct would need
@@ -819,15 +1154,24 @@ msgBaseConstruct(smsg_t **ppThis)
 {
 	DEFiRet;
 	smsg_t *pM;
+	void *pSlab;
 
 	assert(ppThis != NULL);
-	CHKmalloc(pM = MALLOC(sizeof(smsg_t)));
+	pM = msgSlabAlloc(&pSlab);
+	if(pM == NULL) {
+		CHKmalloc(pM = MALLOC(sizeof(smsg_t)));
+		pM->pszRawMsgSpare = NULL;
+		pM->lenRawMsgSpare = 0;
+	}
+	pM->pSlab = pSlab;
 	objConstructSetObjInfo(pM); /* intialize object helper entities */
 
 	/* initialize members in ORDER they appear in structure (think "cache line"!) */
 	pM->flowCtlType = 0;
 	pM->bParseSuccess = 0;
 	pM->iRefCount = 1;
+	pM->lazyClaimed = 0;
+	pM->lazyReady = 0;
 	pM->iSeverity = LOG_DEBUG;
 	pM->iFacility = LOG_INVLD;
 	pM->iLenPROGNAME = -1;
@@ -840,6 +1184,7 @@ msgBaseConstruct(smsg_t **ppThis)
 	pM->iLenTAG = 0;
 	pM->iLenHOSTNAME = 0;
 	pM->pszRawMsg = NULL;
+	pM->lenRawMsgBuf = 0;
 	pM->pszHOSTNAME = NULL;
 	pM->pszRcvdAt3164 = NULL;
 	pM->pszRcvdAt3339 = NULL;
@@ -870,7 +1215,6 @@ msgBaseConstruct(smsg_t **ppThis)
 	pM->pszTIMESTAMP_Unix[0] = '\0';
 	pM->pszRcvdAt_Unix[0] = '\0';
 	pM->pszUUID = NULL;
-	pthread_mutex_init(&pM->mut, NULL);
 
 	/* DEV debugging only! dbgprintf("msgConstruct\t0x%x, ref 1\n", (int)pM);*/
 
@@ -978,8 +1322,18 @@ CODESTARTobjDestruct(msg)
 	{
 		/* DEV Debugging Only! dbgprintf("msgDestruct\t0x%lx, RefCount now 0,
 			doing DESTROY\n", (unsigned long)pThis); */
-		if(pThis->pszRawMsg != pThis->szRawMsg)
-			free(pThis->pszRawMsg);
+		if(pThis->pszRawMsg != pThis->szRawMsg) {
+			const int lenRawMsgBuf = (pThis->lenRawMsgBuf > 0)
+				? pThis->lenRawMsgBuf : pThis->iLenRawMsg + 1;
+			if(pThis->pSlab != NULL && pThis->pszRawMsgSpare == NULL
+			   && lenRawMsgBuf <= MSG_SLAB_RAWBUF_MAX) {
+				/* keep it for the next user of this object */
+				pThis->pszRawMsgSpare = pThis->pszRawMsg;
+				pThis->lenRawMsgSpare = lenRawMsgBuf;
+			} else {
+				free(pThis->pszRawMsg);
+			}
+		}
 		freeTAG(pThis);
 		freeHOSTNAME(pThis);
 		if(pThis->pInputName != NULL)
@@ -1016,7 +1370,13 @@ CODESTARTobjDestruct(msg)
 #	ifndef HAVE_ATOMIC_BUILTINS
 		MsgUnlock(pThis);
 # 	endif
-		pthread_mutex_destroy(&pThis->mut);
+		if(msgSlabFree(pThis)) {
+			/* cached for re-use, so we must not free it */
+			obj.DestructObjSelf((obj_t*) pThis);
+			pThis = NULL;
+		} else {
+			free(pThis->pszRawMsgSpare);
+		}
 		/* now we need to do our own optimization. Testing has shown that at least the glibc
 		 * malloc() subsystem returns memory to the OS far too late in our case. So we need
 		 * to help it a bit, by calling malloc_trim(), which will tell the alloc subsystem
@@ -1431,6 +1791,340 @@ finalize_it:
 #undef isProp
 
 
+/* ------------------------- binary serialization -------------------------
+ * This is a compact alternative to MsgSerialize()/MsgDeserialize(), used by
+ * disk queues if so configured. It only covers the message payload, framing
+ * (record header, checksum) is up to the caller. The payload consists of
+ * the scalar fields, encoded as (zigzag) varints, followed by the string
+ * fields. Each string is stored as varint (length + 1), with 0 meaning "not
+ * present", followed by the octets and a terminating NUL. The NUL permits
+ * the deserializer to use the strings directly from the read buffer.
+ * Fields must only ever be appended, the deserializer ignores trailing data.
+ */
+enum binserStrFields {
+	BINSER_TAG = 0,
+	BINSER_RAWMSG,
+	BINSER_HOSTNAME,
+	BINSER_INPUTNAME,
+	BINSER_RCVFROM,
+	BINSER_RCVFROMIP,
+	BINSER_STRUCDATA,
+	BINSER_JSON,
+	BINSER_LOCALVARS,
+	BINSER_APPNAME,
+	BINSER_PROCID,
+	BINSER_MSGID,
+	BINSER_UUID,
+	BINSER_RULESET,
+	BINSER_NSTR	/* must be last */
+};
+#define BINSER_MAX_VARINT 10 /* max octets for a 64 bit varint */
+#define BINSER_LEN_TIME (11 + 2 * BINSER_MAX_VARINT)
+#define BINSER_ZIGZAG(v) (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define BINSER_UNZIGZAG(v) ((int64_t)((v) >> 1) ^ -(int64_t)((v) & 1))
+
+static inline uchar *
+binserPutVarint(uchar *p, uint64_t v)
+{
+	while(v >= 0x80) {
+		*p++ = (uchar) (v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uchar) v;
+	return p;
+}
+
+static inline uchar *
+binserPutTime(uchar *p, const struct syslogTime *const t)
+{
+	*p++ = (uchar) t->timeType;
+	*p++ = (uchar) t->month;
+	*p++ = (uchar) t->day;
+	*p++ = (uchar) t->hour;
+	*p++ = (uchar) t->minute;
+	*p++ = (uchar) t->second;
+	*p++ = (uchar) t->secfracPrecision;
+	*p++ = (uchar) t->OffsetMinute;
+	*p++ = (uchar) t->OffsetHour;
+	*p++ = (uchar) t->OffsetMode;
+	*p++ = (uchar) t->inUTC;
+	p = binserPutVarint(p, BINSER_ZIGZAG(t->year));
+	p = binserPutVarint(p, BINSER_ZIGZAG(t->secfrac));
+	return p;
+}
+
+static rsRetVal
+binserGetVarint(uchar **pp, const uchar *const end, uint64_t *const pVal)
+{
+	uchar *p = *pp;
+	uint64_t v = 0;
+	int shift = 0;
+	DEFiRet;
+
+	do {
+		if(p == end || shift > 63)
+			ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+		v |= (uint64_t) (*p & 0x7f) << shift;
+		shift += 7;
+	} while(*p++ & 0x80);
+
+	*pVal = v;
+	*pp = p;
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+binserGetTime(uchar **pp, const uchar *const end, struct syslogTime *const t)
+{
+	uchar *p = *pp;
+	uint64_t v;
+	DEFiRet;
+
+	if(end - p < 11)
+		ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+	t->timeType = (intTiny) p[0];
+	t->month = (intTiny) p[1];
+	t->day = (intTiny) p[2];
+	t->hour = (intTiny) p[3];
+	t->minute = (intTiny) p[4];
+	t->second = (intTiny) p[5];
+	t->secfracPrecision = (intTiny) p[6];
+	t->OffsetMinute = (intTiny) p[7];
+	t->OffsetHour = (intTiny) p[8];
+	t->OffsetMode = (char) p[9];
+	t->inUTC = (intTiny) p[10];
+	p += 11;
+	CHKiRet(binserGetVarint(&p, end, &v));
+	t->year = (short) BINSER_UNZIGZAG(v);
+	CHKiRet(binserGetVarint(&p, end, &v));
+	t->secfrac = (int) BINSER_UNZIGZAG(v);
+
+	*pp = p;
+finalize_it:
+	RETiRet;
+}
+
+static rsRetVal
+binserGetStr(uchar **pp, const uchar *const end, uchar **ppsz, size_t *const pLen)
+{
+	uint64_t v;
+	DEFiRet;
+
+	CHKiRet(binserGetVarint(pp, end, &v));
+	if(v == 0) {
+		*ppsz = NULL;
+		*pLen = 0;
+		FINALIZE;
+	}
+	--v;
+	/* we need v octets plus the NUL terminator */
+	if(v >= (uint64_t) (end - *pp) || (*pp)[v] != '\0')
+		ABORT_FINALIZE(RS_RET_DS_PROP_SEQ_ERR);
+	*ppsz = *pp;
+	*pLen = (size_t) v;
+	*pp += v + 1;
+finalize_it:
+	RETiRet;
+}
+
+
+/* serialize the message into the caller-provided buffer *ppBuf, which
+ * has size *pLenBuf. If the buffer is too small, it is re-allocated and
+ * the new buffer and size are returned. This permits the caller to keep
+ * a buffer across calls. The number of octets used is returned in
+ * *pLenData.
+ */
+rsRetVal
+MsgSerializeBinary(smsg_t *const pThis, uchar **ppBuf, size_t *const pLenBuf, size_t *const pLenData)
+{
+	uchar *psz[BINSER_NSTR];
+	size_t len[BINSER_NSTR];
+	uchar *pszInputName;
+	int lenInputName;
+	size_t lenNeeded;
+	uchar *pNewBuf;
+	uchar *p;
+	int i;
+	DEFiRet;
+
+	assert(pThis != NULL);
+
+	psz[BINSER_TAG] = (pThis->iLenTAG < CONF_TAG_BUFSIZE) ? pThis->TAG.szBuf : pThis->TAG.pszTAG;
+	len[BINSER_TAG] = pThis->iLenTAG;
+	psz[BINSER_RAWMSG] = pThis->pszRawMsg;
+	len[BINSER_RAWMSG] = pThis->iLenRawMsg;
+	psz[BINSER_HOSTNAME] = pThis->pszHOSTNAME;
+	len[BINSER_HOSTNAME] = pThis->iLenHOSTNAME;
+	getInputName(pThis, &pszInputName, &lenInputName);
+	psz[BINSER_INPUTNAME] = pszInputName;
+	len[BINSER_INPUTNAME] = lenInputName;
+	psz[BINSER_RCVFROM] = getRcvFrom(pThis);
+	psz[BINSER_RCVFROMIP] = getRcvFromIP(pThis);
+	psz[BINSER_STRUCDATA] = pThis->pszStrucData;
+	psz[BINSER_JSON] = (pThis->json == NULL) ? NULL : (uchar*)
+		json_object_to_json_string_ext(pThis->json, JSON_C_TO_STRING_PLAIN);
+	psz[BINSER_LOCALVARS] = (pThis->localvars == NULL) ? NULL : (uchar*)
+		json_object_to_json_string_ext(pThis->localvars, JSON_C_TO_STRING_PLAIN);
+	psz[BINSER_APPNAME] = (pThis->pCSAPPNAME == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSAPPNAME);
+	psz[BINSER_PROCID] = (pThis->pCSPROCID == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSPROCID);
+	psz[BINSER_MSGID] = (pThis->pCSMSGID == NULL) ? NULL : rsCStrGetSzStrNoNULL(pThis->pCSMSGID);
+	psz[BINSER_UUID] = pThis->pszUUID;
+	psz[BINSER_RULESET] = (pThis->pRuleset == NULL) ? NULL : rulesetGetName(pThis->pRuleset);
+	for(i = 0 ; i < BINSER_NSTR ; ++i) {
+		if(psz[i] == NULL)
+			len[i] = 0;
+		else if(i >= BINSER_RCVFROM)
+			len[i] = ustrlen(psz[i]);
+	}
+
+	/* 6 scalars, 2 timestamps, and per string length varint + NUL */
+	lenNeeded = 6 * BINSER_MAX_VARINT + 2 * BINSER_LEN_TIME;
+	for(i = 0 ; i < BINSER_NSTR ; ++i) {
+		lenNeeded += BINSER_MAX_VARINT + len[i] + 1;
+	}
+	if(lenNeeded > *pLenBuf) {
+		CHKmalloc(pNewBuf = realloc(*ppBuf, lenNeeded));
+		*ppBuf = pNewBuf;
+		*pLenBuf = lenNeeded;
+	}
+
+	p = *ppBuf;
+	p = binserPutVarint(p, (uint64_t) pThis->iProtocolVersion);
+	p = binserPutVarint(p, (uint64_t) pThis->iSeverity);
+	p = binserPutVarint(p, (uint64_t) pThis->iFacility);
+	p = binserPutVarint(p, BINSER_ZIGZAG(pThis->msgFlags));
+	p = binserPutVarint(p, BINSER_ZIGZAG(pThis->ttGenTime));
+	p = binserPutVarint(p, BINSER_ZIGZAG(pThis->offMSG));
+	p = binserPutTime(p, &pThis->tRcvdAt);
+	p = binserPutTime(p, &pThis->tTIMESTAMP);
+	for(i = 0 ; i < BINSER_NSTR ; ++i) {
+		if(psz[i] == NULL) {
+			*p++ = 0;
+		} else {
+			p = binserPutVarint(p, (uint64_t) len[i] + 1);
+			memcpy(p, psz[i], len[i]);
+			p += len[i];
+			*p++ = '\0';
+		}
+	}
+	*pLenData = p - *ppBuf;
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* deserialize a message from a buffer created by MsgSerializeBinary().
+ * The buffer is modified in the process. If the stored JSON (message or
+ * local variables) cannot be parsed, the rest of the message is still
+ * deserialized and RS_RET_JSON_PARSE_ERR is returned, so that the caller
+ * can report it with its context and decide whether to use the message.
+ */
+rsRetVal
+MsgDeserializeBinary(smsg_t *const pMsg, uchar *const pBuf, const size_t lenBuf)
+{
+	uchar *p = pBuf;
+	const uchar *const end = pBuf + lenBuf;
+	uchar *psz[BINSER_NSTR];
+	size_t len[BINSER_NSTR];
+	uint64_t v;
+	int64_t offMSG;
+	prop_t *myProp;
+	prop_t *propRcvFrom = NULL;
+	prop_t *propRcvFromIP = NULL;
+	struct json_tokener *tokener;
+	rsRetVal localRet;
+	int bJsonErr = 0;
+	int i;
+	DEFiRet;
+
+	CHKiRet(binserGetVarint(&p, end, &v));
+	setProtocolVersion(pMsg, (int) v);
+	CHKiRet(binserGetVarint(&p, end, &v));
+	pMsg->iSeverity = (short) v;
+	CHKiRet(binserGetVarint(&p, end, &v));
+	pMsg->iFacility = (short) v;
+	CHKiRet(binserGetVarint(&p, end, &v));
+	pMsg->msgFlags = (int) BINSER_UNZIGZAG(v);
+	CHKiRet(binserGetVarint(&p, end, &v));
+	pMsg->ttGenTime = (time_t) BINSER_UNZIGZAG(v);
+	CHKiRet(binserGetVarint(&p, end, &v));
+	offMSG = BINSER_UNZIGZAG(v);
+	CHKiRet(binserGetTime(&p, end, &pMsg->tRcvdAt));
+	CHKiRet(binserGetTime(&p, end, &pMsg->tTIMESTAMP));
+	for(i = 0 ; i < BINSER_NSTR ; ++i) {
+		CHKiRet(binserGetStr(&p, end, &psz[i], &len[i]));
+	}
+
+	if(psz[BINSER_TAG] != NULL)
+		MsgSetTAG(pMsg, psz[BINSER_TAG], len[BINSER_TAG]);
+	if(psz[BINSER_RAWMSG] != NULL)
+		MsgSetRawMsg(pMsg, (char*) psz[BINSER_RAWMSG], len[BINSER_RAWMSG]);
+	if(psz[BINSER_HOSTNAME] != NULL)
+		MsgSetHOSTNAME(pMsg, psz[BINSER_HOSTNAME], len[BINSER_HOSTNAME]);
+	if(psz[BINSER_INPUTNAME] != NULL) {
+		CHKiRet(prop.Construct(&myProp));
+		CHKiRet(prop.SetString(myProp, psz[BINSER_INPUTNAME], len[BINSER_INPUTNAME]));
+		CHKiRet(prop.ConstructFinalize(myProp));
+		MsgSetInputName(pMsg, myProp);
+		prop.Destruct(&myProp);
+	}
+	if(psz[BINSER_RCVFROM] != NULL) {
+		MsgSetRcvFromStr(pMsg, psz[BINSER_RCVFROM], len[BINSER_RCVFROM], &propRcvFrom);
+		prop.Destruct(&propRcvFrom);
+	}
+	if(psz[BINSER_RCVFROMIP] != NULL) {
+		MsgSetRcvFromIPStr(pMsg, psz[BINSER_RCVFROMIP], len[BINSER_RCVFROMIP], &propRcvFromIP);
+		prop.Destruct(&propRcvFromIP);
+	}
+	if(psz[BINSER_STRUCDATA] != NULL)
+		CHKiRet(MsgSetStructuredData(pMsg, (char*) psz[BINSER_STRUCDATA]));
+	if(psz[BINSER_JSON] != NULL) {
+		tokener = json_tokener_new();
+		pMsg->json = json_tokener_parse_ex(tokener, (char*) psz[BINSER_JSON], len[BINSER_JSON]);
+		json_tokener_free(tokener);
+		if(pMsg->json == NULL)
+			bJsonErr = 1;
+	}
+	if(psz[BINSER_LOCALVARS] != NULL) {
+		tokener = json_tokener_new();
+		pMsg->localvars = json_tokener_parse_ex(tokener, (char*) psz[BINSER_LOCALVARS],
+							len[BINSER_LOCALVARS]);
+		json_tokener_free(tokener);
+		if(pMsg->localvars == NULL)
+			bJsonErr = 1;
+	}
+	if(psz[BINSER_APPNAME] != NULL)
+		CHKiRet(MsgSetAPPNAME(pMsg, (char*) psz[BINSER_APPNAME]));
+	if(psz[BINSER_PROCID] != NULL)
+		CHKiRet(MsgSetPROCID(pMsg, (char*) psz[BINSER_PROCID]));
+	if(psz[BINSER_MSGID] != NULL)
+		CHKiRet(MsgSetMSGID(pMsg, (char*) psz[BINSER_MSGID]));
+	if(psz[BINSER_UUID] != NULL)
+		CHKmalloc(pMsg->pszUUID = ustrdup(psz[BINSER_UUID]));
+	if(psz[BINSER_RULESET] != NULL) {
+		localRet = rulesetGetRuleset(runConf, &(pMsg->pRuleset), psz[BINSER_RULESET]);
+		if(localRet != RS_RET_OK) {
+			LogError(0, localRet, "msg: ruleset '%s' could not be found and could not "
+				"be assgined to message object. This possibly leads to the message "
+				"being processed incorrectly. We cannot do anything against this, but "
+				"wanted to let you know.", psz[BINSER_RULESET]);
+		}
+	}
+	/* must be done after the raw message is set, see MsgSerialize() */
+	MsgSetMSGoffs(pMsg, (short) offMSG);
+	if(bJsonErr)
+		iRet = RS_RET_JSON_PARSE_ERR;
+
+finalize_it:
+	if(Debug && iRet != RS_RET_OK) {
+		dbgprintf("MsgDeserializeBinary error %d\n", iRet);
+	}
+	RETiRet;
+}
+
+
 /* Increment reference count - see description of the "msg"
  * structure for details. As a convenience to developers,
  * this method returns the msg pointer that is passed to it.
@@ -1626,15 +2320,12 @@ static void getUUID(smsg_t * const pM, uchar **pBuf, int *piLen)
 		*pBuf=	UCHAR_CONSTANT("");
 		*piLen = 0;
 	} else {
-		if(pM->pszUUID == NULL) {
-			dbgprintf("[getUUID] pM->pszUUID is NULL\n");
-			MsgLock(pM);
-			/* re-query, things may have changed in the mean time... */
-			if(pM->pszUUID == NULL)
+		if(msgLazyClaim(pM, LAZY_UUID)) {
+			if(pM->pszUUID == NULL) {
+				dbgprintf("[getUUID] pM->pszUUID is NULL\n");
 				msgSetUUID(pM);
-			MsgUnlock(pM);
-		} else { /* UUID already there we reuse it */
-			dbgprintf("[getUUID] pM->pszUUID already exists\n");
+			}
+			msgLazyDone(pM, LAZY_UUID);
 		}
 		*pBuf = pM->pszUUID;
 		*piLen = sizeof(uuid_t) * 2;
@@ -1761,59 +2452,56 @@ getTimeReported(smsg_t * const pM, enum tplFormatTypes eFmt)
 	case tplFmtDefault:
 	case tplFmtRFC3164Date:
 	case tplFmtRFC3164BuggyDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP3164 == NULL) {
-			pM->pszTIMESTAMP3164 = pM->pszTimestamp3164;
-			datetime.formatTimestamp3164(&pM->tTIMESTAMP, pM->pszTIMESTAMP3164,
-						     (eFmt == tplFmtRFC3164BuggyDate));
+		if(msgLazyClaim(pM, LAZY_TIMESTAMP3164)) {
+			if(pM->pszTIMESTAMP3164 == NULL) {
+				datetime.formatTimestamp3164(&pM->tTIMESTAMP, pM->pszTimestamp3164,
+							     (eFmt == tplFmtRFC3164BuggyDate));
+				pM->pszTIMESTAMP3164 = pM->pszTimestamp3164;
+			}
+			msgLazyDone(pM, LAZY_TIMESTAMP3164);
 		}
-		MsgUnlock(pM);
 		return(pM->pszTIMESTAMP3164);
 	case tplFmtMySQLDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_MySQL == NULL) {
-			if((pM->pszTIMESTAMP_MySQL = MALLOC(15)) == NULL) {
-				MsgUnlock(pM);
-				return "";
+		if(msgLazyClaim(pM, LAZY_TIMESTAMP_MYSQL)) {
+			if(pM->pszTIMESTAMP_MySQL == NULL
+			   && (pM->pszTIMESTAMP_MySQL = MALLOC(15)) != NULL) {
+				datetime.formatTimestampToMySQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_MySQL);
 			}
-			datetime.formatTimestampToMySQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_MySQL);
+			msgLazyDone(pM, LAZY_TIMESTAMP_MYSQL);
 		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_MySQL);
+		return (pM->pszTIMESTAMP_MySQL == NULL) ? "" : pM->pszTIMESTAMP_MySQL;
 	case tplFmtPgSQLDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_PgSQL == NULL) {
-			if((pM->pszTIMESTAMP_PgSQL = MALLOC(21)) == NULL) {
-				MsgUnlock(pM);
-				return "";
+		if(msgLazyClaim(pM, LAZY_TIMESTAMP_PGSQL)) {
+			if(pM->pszTIMESTAMP_PgSQL == NULL
+			   && (pM->pszTIMESTAMP_PgSQL = MALLOC(21)) != NULL) {
+				datetime.formatTimestampToPgSQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_PgSQL);
 			}
-			datetime.formatTimestampToPgSQL(&pM->tTIMESTAMP, pM->pszTIMESTAMP_PgSQL);
+			msgLazyDone(pM, LAZY_TIMESTAMP_PGSQL);
 		}
-		MsgUnlock(pM);
-		return(pM->pszTIMESTAMP_PgSQL);
+		return (pM->pszTIMESTAMP_PgSQL == NULL) ? "" : pM->pszTIMESTAMP_PgSQL;
 	case tplFmtRFC3339Date:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP3339 == NULL) {
-			pM->pszTIMESTAMP3339 = pM->pszTimestamp3339;
-			datetime.formatTimestamp3339(&pM->tTIMESTAMP, pM->pszTIMESTAMP3339);
+		if(msgLazyClaim(pM, LAZY_TIMESTAMP3339)) {
+			if(pM->pszTIMESTAMP3339 == NULL) {
+				datetime.formatTimestamp3339(&pM->tTIMESTAMP, pM->pszTimestamp3339);
+				pM->pszTIMESTAMP3339 = pM->pszTimestamp3339;
+			}
+			msgLazyDone(pM, LAZY_TIMESTAMP3339);
 		}
-		MsgUnlock(pM);
 		return(pM->pszTIMESTAMP3339);
 	case tplFmtUnixDate:
-		MsgLock(pM);
-		if(pM->pszTIMESTAMP_Unix[0] == '\0') {
-			datetime.formatTimestampUnix(&pM->tTIMESTAMP, pM->pszTIMESTAMP_Unix);
+		if(msgLazyClaim(pM, LAZY_TIMESTAMP_UNIX)) {
+			if(pM->pszTIMESTAMP_Unix[0] == '\0') {
+				datetime.formatTimestampUnix(&pM->tTIMESTAMP, pM->pszTIMESTAMP_Unix);
+			}
+			msgLazyDone(pM, LAZY_TIMESTAMP_UNIX);
 		}
-		MsgUnlock(pM);
 		return(pM->pszTIMESTAMP_Unix);
 	case tplFmtSecFrac:
-		if(pM->pszTIMESTAMP_SecFrac[0] == '\0') {
-			MsgLock(pM);
-			/* re-check, may have changed while we did not hold lock */
+		if(msgLazyClaim(pM, LAZY_TIMESTAMP_SECFRAC)) {
 			if(pM->pszTIMESTAMP_SecFrac[0] == '\0') {
 				datetime.formatTimestampSecFrac(&pM->tTIMESTAMP, pM->pszTIMESTAMP_SecFrac);
 			}
-			MsgUnlock(pM);
+			msgLazyDone(pM, LAZY_TIMESTAMP_SECFRAC);
 		}
 		return(pM->pszTIMESTAMP_SecFrac);
 	case tplFmtWDayName:
@@ -1965,77 +2653,58 @@ getTimeGenerated(smsg_t *const __restrict__ pM,
 
 	switch(eFmt) {
 	case tplFmtDefault:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3164 == NULL) {
-			if((pM->pszRcvdAt3164 = MALLOC(16)) == NULL) {
-				MsgUnlock(pM);
-				return "";
+	case tplFmtRFC3164Date:
+	case tplFmtRFC3164BuggyDate:
+		if(msgLazyClaim(pM, LAZY_RCVDAT3164)) {
+			if(pM->pszRcvdAt3164 == NULL
+			   && (pM->pszRcvdAt3164 = MALLOC(16)) != NULL) {
+				datetime.formatTimestamp3164(pTm, pM->pszRcvdAt3164,
+							     (eFmt == tplFmtRFC3164BuggyDate));
 			}
-			datetime.formatTimestamp3164(pTm, pM->pszRcvdAt3164, 0);
+			msgLazyDone(pM, LAZY_RCVDAT3164);
 		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3164);
+		return (pM->pszRcvdAt3164 == NULL) ? "" : pM->pszRcvdAt3164;
 	case tplFmtMySQLDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_MySQL == NULL) {
-			if((pM->pszRcvdAt_MySQL = MALLOC(15)) == NULL) {
-				MsgUnlock(pM);
-				return "";
+		if(msgLazyClaim(pM, LAZY_RCVDAT_MYSQL)) {
+			if(pM->pszRcvdAt_MySQL == NULL
+			   && (pM->pszRcvdAt_MySQL = MALLOC(15)) != NULL) {
+				datetime.formatTimestampToMySQL(pTm, pM->pszRcvdAt_MySQL);
 			}
-			datetime.formatTimestampToMySQL(pTm, pM->pszRcvdAt_MySQL);
+			msgLazyDone(pM, LAZY_RCVDAT_MYSQL);
 		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_MySQL);
+		return (pM->pszRcvdAt_MySQL == NULL) ? "" : pM->pszRcvdAt_MySQL;
 	case tplFmtPgSQLDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_PgSQL == NULL) {
-			if((pM->pszRcvdAt_PgSQL = MALLOC(21)) == NULL) {
-				MsgUnlock(pM);
-				return "";
+		if(msgLazyClaim(pM, LAZY_RCVDAT_PGSQL)) {
+			if(pM->pszRcvdAt_PgSQL == NULL
+			   && (pM->pszRcvdAt_PgSQL = MALLOC(21)) != NULL) {
+				datetime.formatTimestampToPgSQL(pTm, pM->pszRcvdAt_PgSQL);
 			}
-			datetime.formatTimestampToPgSQL(pTm, pM->pszRcvdAt_PgSQL);
+			msgLazyDone(pM, LAZY_RCVDAT_PGSQL);
 		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt_PgSQL);
-	case tplFmtRFC3164Date:
-	case tplFmtRFC3164BuggyDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3164 == NULL) {
-			if((pM->pszRcvdAt3164 = MALLOC(16)) == NULL) {
-					MsgUnlock(pM);
-					return "";
-				}
-			datetime.formatTimestamp3164(pTm, pM->pszRcvdAt3164,
-						     (eFmt == tplFmtRFC3164BuggyDate));
-		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3164);
+		return (pM->pszRcvdAt_PgSQL == NULL) ? "" : pM->pszRcvdAt_PgSQL;
 	case tplFmtRFC3339Date:
-		MsgLock(pM);
-		if(pM->pszRcvdAt3339 == NULL) {
-			if((pM->pszRcvdAt3339 = MALLOC(33)) == NULL) {
-				MsgUnlock(pM);
-				return "";
+		if(msgLazyClaim(pM, LAZY_RCVDAT3339)) {
+			if(pM->pszRcvdAt3339 == NULL
+			   && (pM->pszRcvdAt3339 = MALLOC(33)) != NULL) {
+				datetime.formatTimestamp3339(pTm, pM->pszRcvdAt3339);
 			}
-			datetime.formatTimestamp3339(pTm, pM->pszRcvdAt3339);
+			msgLazyDone(pM, LAZY_RCVDAT3339);
 		}
-		MsgUnlock(pM);
-		return(pM->pszRcvdAt3339);
+		return (pM->pszRcvdAt3339 == NULL) ? "" : pM->pszRcvdAt3339;
 	case tplFmtUnixDate:
-		MsgLock(pM);
-		if(pM->pszRcvdAt_Unix[0] == '\0') {
-			datetime.formatTimestampUnix(pTm, pM->pszRcvdAt_Unix);
+		if(msgLazyClaim(pM, LAZY_RCVDAT_UNIX)) {
+			if(pM->pszRcvdAt_Unix[0] == '\0') {
+				datetime.formatTimestampUnix(pTm, pM->pszRcvdAt_Unix);
+			}
+			msgLazyDone(pM, LAZY_RCVDAT_UNIX);
 		}
-		MsgUnlock(pM);
 		return(pM->pszRcvdAt_Unix);
 	case tplFmtSecFrac:
-		if(pM->pszRcvdAt_SecFrac[0] == '\0') {
-			MsgLock(pM);
-			/* re-check, may have changed while we did not hold lock */
+		if(msgLazyClaim(pM, LAZY_RCVDAT_SECFRAC)) {
 			if(pM->pszRcvdAt_SecFrac[0] == '\0') {
 				datetime.formatTimestampSecFrac(pTm, pM->pszRcvdAt_SecFrac);
 			}
-			MsgUnlock(pM);
+			msgLazyDone(pM, LAZY_RCVDAT_SECFRAC);
 		}
 		return(pM->pszRcvdAt_SecFrac);
 	case tplFmtWDayName:
@@ -2212,19 +2881,20 @@ finalize_it:
 
 
 /* check if we have a procid, and, if not, try to aquire/emulate it.
- * This must be called WITHOUT the message lock being held.
+ * With MUTEX_ALREADY_LOCKED, the caller must have exclusive access
+ * to the message.
  * rgerhards, 2009-06-26
  */
 static void preparePROCID(smsg_t * const pM, sbool bLockMutex)
 {
-	if(pM->pCSPROCID == NULL) {
-		if(bLockMutex == LOCK_MUTEX)
-			MsgLock(pM);
-		/* re-query, things may have changed in the mean time... */
-		if(pM->pCSPROCID == NULL)
-			aquirePROCIDFromTAG(pM);
-		if(bLockMutex == LOCK_MUTEX)
-			MsgUnlock(pM);
+	if(bLockMutex == LOCK_MUTEX) {
+		if(msgLazyClaim(pM, LAZY_PROCID)) {
+			if(pM->pCSPROCID == NULL)
+				aquirePROCIDFromTAG(pM);
+			msgLazyDone(pM, LAZY_PROCID);
+		}
+	} else if(pM->pCSPROCID == NULL) {
+		aquirePROCIDFromTAG(pM);
 	}
 }
 
@@ -2248,15 +2918,11 @@ char *getPROCID(smsg_t * const pM, sbool bLockMutex)
 	uchar *pszRet;
 
 	ISOBJ_TYPE_assert(pM, msg);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgLock(pM);
-	preparePROCID(pM, MUTEX_ALREADY_LOCKED);
+	preparePROCID(pM, bLockMutex);
 	if(pM->pCSPROCID == NULL)
 		pszRet = UCHAR_CONSTANT("-");
 	else 
 		pszRet = rsCStrGetSzStrNoNULL(pM->pCSPROCID);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgUnlock(pM);
 	return (char*) pszRet;
 }
 
@@ -2453,29 +3119,26 @@ tryEmulateTAG(smsg_t * const pM, sbool bLockMutex)
 	uchar bufTAG[CONF_TAG_MAXSIZE];
 	assert(pM != NULL);
 
-	if(bLockMutex == LOCK_MUTEX)
-		MsgLock(pM);
-	if(pM->iLenTAG > 0) {
-		if(bLockMutex == LOCK_MUTEX)
-			MsgUnlock(pM);
-		return; /* done, no need to emulate */
-	}
+	if(bLockMutex == LOCK_MUTEX && !msgLazyClaim(pM, LAZY_TAG))
+		return; /* someone else already did the job */
 	
-	if(msgGetProtocolVersion(pM) == 1) {
-		if(!strcmp(getPROCID(pM, MUTEX_ALREADY_LOCKED), "-")) {
+	if(pM->iLenTAG == 0 && msgGetProtocolVersion(pM) == 1) {
+		/* Note: APP-NAME and PROCID are never emulated from the TAG for
+		 * protocol version 1, so we can safely claim them here. */
+		if(!strcmp(getPROCID(pM, bLockMutex), "-")) {
 			/* no process ID, use APP-NAME only */
-			MsgSetTAG(pM, (uchar*) getAPPNAME(pM, MUTEX_ALREADY_LOCKED),
-					getAPPNAMELen(pM, MUTEX_ALREADY_LOCKED));
+			MsgSetTAG(pM, (uchar*) getAPPNAME(pM, bLockMutex),
+					getAPPNAMELen(pM, bLockMutex));
 		} else {
 			/* now we can try to emulate */
 			lenTAG = snprintf((char*)bufTAG, CONF_TAG_MAXSIZE, "%s[%s]",
-					  getAPPNAME(pM, MUTEX_ALREADY_LOCKED), getPROCID(pM, MUTEX_ALREADY_LOCKED));
+					  getAPPNAME(pM, bLockMutex), getPROCID(pM, bLockMutex));
 			bufTAG[sizeof(bufTAG)-1] = '\0'; /* just to make sure... */
 			MsgSetTAG(pM, bufTAG, lenTAG);
 		}
 	}
 	if(bLockMutex == LOCK_MUTEX)
-		MsgUnlock(pM);
+		msgLazyDone(pM, LAZY_TAG);
 }
 
 
@@ -2486,8 +3149,7 @@ getTAG(smsg_t * const pM, uchar **ppBuf, int *piLen)
 		*ppBuf = UCHAR_CONSTANT("");
 		*piLen = 0;
 	} else {
-		if(pM->iLenTAG == 0)
-			tryEmulateTAG(pM, LOCK_MUTEX);
+		tryEmulateTAG(pM, LOCK_MUTEX);
 		if(pM->iLenTAG == 0) {
 			*ppBuf = UCHAR_CONSTANT("");
 			*piLen = 0;
@@ -2590,16 +3252,18 @@ MsgGetStructuredData(smsg_t * const pM, uchar **pBuf, rs_size_t *len)
  */
 uchar *getProgramName(smsg_t * const pM, sbool bLockMutex)
 {
-	if(pM->iLenPROGNAME == -1) {
-		if(bLockMutex == LOCK_MUTEX) {
-			MsgLock(pM);
-			/* need to re-check, things may have change in between! */
+	/* PROGNAME is derived from the TAG, so the TAG must be final (emulated
+	 * if need be) before we read it - it is not guarded by LAZY_PROGNAME.
+	 */
+	tryEmulateTAG(pM, bLockMutex);
+	if(bLockMutex == LOCK_MUTEX) {
+		if(msgLazyClaim(pM, LAZY_PROGNAME)) {
 			if(pM->iLenPROGNAME == -1)
 				aquireProgramName(pM);
-			MsgUnlock(pM);
-		} else {
-			aquireProgramName(pM);
+			msgLazyDone(pM, LAZY_PROGNAME);
 		}
+	} else if(pM->iLenPROGNAME == -1) {
+		aquireProgramName(pM);
 	}
 	return (pM->iLenPROGNAME < CONF_PROGNAME_BUFSIZE) ? pM->PROGNAME.szBuf
 						       : pM->PROGNAME.ptr;
@@ -2609,9 +3273,9 @@ uchar *getProgramName(smsg_t * const pM, sbool bLockMutex)
 /* This function tries to emulate APPNAME if it is not present. Its
  * main use is when we have received a log record via legacy syslog and
  * now would like to send out the same one via syslog-protocol.
- * MUST be called with the Msg Lock locked!
+ * MUST be called with exclusive access to APPNAME (see prepareAPPNAME())!
  */
-static void tryEmulateAPPNAME(smsg_t * const pM)
+static void tryEmulateAPPNAME(smsg_t * const pM, sbool bLockMutex)
 {
 	assert(pM != NULL);
 	if(pM->pCSAPPNAME != NULL)
@@ -2619,28 +3283,26 @@ static void tryEmulateAPPNAME(smsg_t * const pM)
 
 	if(msgGetProtocolVersion(pM) == 0) {
 		/* only then it makes sense to emulate */
-		MsgSetAPPNAME(pM, (char*)getProgramName(pM, MUTEX_ALREADY_LOCKED));
+		MsgSetAPPNAME(pM, (char*)getProgramName(pM, bLockMutex));
 	}
 }
 
 
 
 /* check if we have a APPNAME, and, if not, try to aquire/emulate it.
- * This must be called WITHOUT the message lock being held.
+ * With MUTEX_ALREADY_LOCKED, the caller must have exclusive access
+ * to the message.
  * rgerhards, 2009-06-26
  */
 static void prepareAPPNAME(smsg_t * const pM, sbool bLockMutex)
 {
-	if(pM->pCSAPPNAME == NULL) {
-		if(bLockMutex == LOCK_MUTEX)
-			MsgLock(pM);
-
-		/* re-query as things might have changed during locking */
-		if(pM->pCSAPPNAME == NULL)
-			tryEmulateAPPNAME(pM);
-
-		if(bLockMutex == LOCK_MUTEX)
-			MsgUnlock(pM);
+	if(bLockMutex == LOCK_MUTEX) {
+		if(msgLazyClaim(pM, LAZY_APPNAME)) {
+			tryEmulateAPPNAME(pM, LOCK_MUTEX);
+			msgLazyDone(pM, LAZY_APPNAME);
+		}
+	} else {
+		tryEmulateAPPNAME(pM, MUTEX_ALREADY_LOCKED);
 	}
 }
 
@@ -2651,15 +3313,11 @@ char *getAPPNAME(smsg_t * const pM, sbool bLockMutex)
 	uchar *pszRet;
 
 	assert(pM != NULL);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgLock(pM);
-	prepareAPPNAME(pM, MUTEX_ALREADY_LOCKED);
+	prepareAPPNAME(pM, bLockMutex);
 	if(pM->pCSAPPNAME == NULL)
 		pszRet = UCHAR_CONSTANT("");
 	else 
 		pszRet = rsCStrGetSzStrNoNULL(pM->pCSAPPNAME);
-	if(bLockMutex == LOCK_MUTEX)
-		MsgUnlock(pM);
 	return (char*)pszRet;
 }
 
@@ -2863,6 +3521,7 @@ rsRetVal MsgReplaceMSG(smsg_t *pThis, const uchar* pszMSG, int lenMSG)
 		if(pThis->pszRawMsg != pThis->szRawMsg)
 			free(pThis->pszRawMsg);
 		pThis->pszRawMsg = bufNew;
+		pThis->lenRawMsgBuf = lenNew + 1;
 	}
 
 	if(lenMSG > 0)
@@ -2889,13 +3548,21 @@ void MsgSetRawMsg(smsg_t *pThis, const char* pszRawMsg, size_t lenMsg)
 
 	deltaSize = lenMsg - pThis->iLenRawMsg;
 	pThis->iLenRawMsg = lenMsg;
+	pThis->lenRawMsgBuf = 0;
 	if(pThis->iLenRawMsg < CONF_RAWMSG_BUFSIZE) {
 		/* small enough: use fixed buffer (faster!) */
 		pThis->pszRawMsg = pThis->szRawMsg;
+	} else if(pThis->pszRawMsgSpare != NULL && pThis->iLenRawMsg < pThis->lenRawMsgSpare) {
+		/* a buffer kept from a previous use of this object is large enough */
+		pThis->pszRawMsg = pThis->pszRawMsgSpare;
+		pThis->lenRawMsgBuf = pThis->lenRawMsgSpare;
+		pThis->pszRawMsgSpare = NULL;
 	} else if((pThis->pszRawMsg = (uchar*) MALLOC(pThis->iLenRawMsg + 1)) == NULL) {
 		/* truncate message, better than completely loosing it... */
 		pThis->pszRawMsg = pThis->szRawMsg;
 		pThis->iLenRawMsg = CONF_RAWMSG_BUFSIZE - 1;
+	} else {
+		pThis->lenRawMsgBuf = pThis->iLenRawMsg + 1;
 	}
 
 	memcpy(pThis->pszRawMsg, pszRawMsg, pThis->iLenRawMsg);
@@ -2919,6 +3586,76 @@ void MsgSetRawMsgWOSize(smsg_t * const pMsg, char* pszRawMsg)
 }
 
 
+/* Obtain a raw message buffer of at least lenBuf bytes which is owned by the
+ * message object. This permits inputs to receive data directly into the
+ * message and so save the copy done by MsgSetRawMsg(). Once data has been
+ * received, it must be committed via MsgSetRawMsgInPlace(). The buffer kept
+ * by a cached message object is used if it is large enough.
+ * Returns NULL if we run out of memory.
+ */
+uchar *
+MsgGetRawMsgBuf(smsg_t *const pThis, const int lenBuf)
+{
+	uchar *pBuf;
+	assert(pThis != NULL);
+
+	if(pThis->pszRawMsg != NULL && pThis->pszRawMsg != pThis->szRawMsg) {
+		if(pThis->lenRawMsgBuf >= lenBuf)
+			return pThis->pszRawMsg;
+		free(pThis->pszRawMsg);
+	}
+
+	if(pThis->pszRawMsgSpare != NULL && pThis->lenRawMsgSpare >= lenBuf) {
+		pBuf = pThis->pszRawMsgSpare;
+		pThis->lenRawMsgBuf = pThis->lenRawMsgSpare;
+		pThis->pszRawMsgSpare = NULL;
+	} else if((pBuf = (uchar*) MALLOC(lenBuf)) != NULL) {
+		pThis->lenRawMsgBuf = lenBuf;
+	} else {
+		pThis->pszRawMsg = NULL;
+		pThis->lenRawMsgBuf = 0;
+		pThis->iLenRawMsg = 0;
+		return NULL;
+	}
+	pBuf[0] = '\0';
+	pThis->pszRawMsg = pBuf;
+	pThis->iLenRawMsg = 0;
+	return pBuf;
+}
+
+
+/* set the raw message to the lenMsg bytes that have been placed into the
+ * buffer obtained by MsgGetRawMsgBuf().
+ */
+void
+MsgSetRawMsgInPlace(smsg_t *const pThis, const size_t lenMsg)
+{
+	int deltaSize;
+	assert(pThis != NULL);
+	assert(pThis->pszRawMsg != NULL && (int) lenMsg < pThis->lenRawMsgBuf);
+
+	deltaSize = lenMsg - pThis->iLenRawMsg;
+	pThis->iLenRawMsg = lenMsg;
+	pThis->pszRawMsg[lenMsg] = '\0';
+	if(pThis->iLenRawMsg > pThis->offMSG)
+		pThis->iLenMSG += deltaSize;
+	else
+		pThis->iLenMSG = 0;
+}
+
+
+/* set the reception time of a message. Needed if the object was
+ * constructed before the message was actually received.
+ */
+void
+MsgSetRcvdTime(smsg_t *const pThis, const struct syslogTime *const stTime, const time_t ttGenTime)
+{
+	pThis->ttGenTime = ttGenTime;
+	memcpy(&pThis->tRcvdAt, stTime, sizeof(struct syslogTime));
+	memcpy(&pThis->tTIMESTAMP, stTime, sizeof(struct syslogTime));
+}
+
+
 /* create textual representation of facility and severity.
  * The variable pRes must point to a user-supplied buffer of
  * at least 20 characters.
@@ -3025,10 +3762,10 @@ getJSONRootAndMutex(smsg_t *const pMsg, const propid_t id,
 	assert(id == PROP_CEE || id == PROP_LOCAL_VAR || id == PROP_GLOBAL_VAR);
 
 	if(id == PROP_CEE) {
-		*mut = &pMsg->mut;
+		*mut = msgGetMut(pMsg);
 		*jroot = &pMsg->json;
 	} else if(id == PROP_LOCAL_VAR) {
-		*mut = &pMsg->mut;
+		*mut = msgGetMut(pMsg);
 		*jroot = &pMsg->localvars;
 	} else if(id == PROP_GLOBAL_VAR) {
 		*mut = &glblVars_lock;
@@ -3223,6 +3960,7 @@ jsonAddVal(uchar *pSrc, unsigned buflen, es_str_t **dst, int escapeAll)
 {
 	unsigned char c;
 	es_size_t i;
+	es_size_t nClean;
 	char numbuf[4];
 	unsigned ni;
 	unsigned char nc;
@@ -3230,86 +3968,162 @@ jsonAddVal(uchar *pSrc, unsigned buflen, es_str_t **dst, int escapeAll)
 	DEFiRet;
 
 	for(i = 0 ; i < buflen ; ++i) {
-		c = pSrc[i];
-		if(   (c >= 0x23 && c <= 0x2e)
-		   || (c >= 0x30 && c <= 0x5b)
-		   || (c >= 0x5d /* && c <= 0x10FFFF*/)
-		   || c == 0x20 || c == 0x21) {
-			/* no need to escape */
+		/* skip the run of characters which need no escaping */
+		nClean = srScanJSON(pSrc + i, buflen - i);
+		if(nClean > 0) {
 			if(*dst != NULL)
-				es_addChar(dst, c);
-		} else {
+				es_addBuf(dst, (char*) pSrc + i, nClean);
+			i += nClean;
+			if(i == buflen)
+				break;
+		}
+		c = pSrc[i];
+		if(*dst == NULL) {
+			if(i == 0) {
+				/* we hope we have only few escapes... */
+				*dst = es_newStr(buflen+10);
+			} else {
+				*dst = es_newStrFromBuf((char*)pSrc, i);
+			}
 			if(*dst == NULL) {
-				if(i == 0) {
-					/* we hope we have only few escapes... */
-					*dst = es_newStr(buflen+10);
-				} else {
-					*dst = es_newStrFromBuf((char*)pSrc, i);
-				}
-				if(*dst == NULL) {
-					ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
-				}
+				ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
 			}
-			/* we must escape, try RFC4627-defined special sequences first */
-			switch(c) {
-			case '\0':
-				es_addBuf(dst, "\\u0000", 6);
-				break;
-			case '\"':
-				es_addBuf(dst, "\\\"", 2);
-				break;
-			case '/':
-				es_addBuf(dst, "\\/", 2);
-				break;
-			case '\\':
-				if (escapeAll == RSFALSE) {
-					ni = i + 1;
-					if (ni <= buflen) {
-						nc = pSrc[ni];
-
-						/* Attempt to not double encode */
-						if (   nc == '"' || nc == '/' || nc == '\\' || nc == 'b' || nc == 'f'
-							|| nc == 'n' || nc == 'r' || nc == 't' || nc == 'u') {
-
-							es_addChar(dst, c);
-							es_addChar(dst, nc);
-							i = ni;
-							break;
-						}
+		}
+		/* we must escape, try RFC4627-defined special sequences first */
+		switch(c) {
+		case '\0':
+			es_addBuf(dst, "\\u0000", 6);
+			break;
+		case '\"':
+			es_addBuf(dst, "\\\"", 2);
+			break;
+		case '/':
+			es_addBuf(dst, "\\/", 2);
+			break;
+		case '\\':
+			if (escapeAll == RSFALSE) {
+				ni = i + 1;
+				if (ni <= buflen) {
+					nc = pSrc[ni];
+
+					/* Attempt to not double encode */
+					if (   nc == '"' || nc == '/' || nc == '\\' || nc == 'b' || nc == 'f'
+						|| nc == 'n' || nc == 'r' || nc == 't' || nc == 'u') {
+
+						es_addChar(dst, c);
+						es_addChar(dst, nc);
+						i = ni;
+						break;
 					}
 				}
+			}
 
-				es_addBuf(dst, "\\\\", 2);
-				break;
-			case '\010':
-				es_addBuf(dst, "\\b", 2);
-				break;
-			case '\014':
-				es_addBuf(dst, "\\f", 2);
-				break;
-			case '\n':
-				es_addBuf(dst, "\\n", 2);
-				break;
-			case '\r':
-				es_addBuf(dst, "\\r", 2);
-				break;
-			case '\t':
-				es_addBuf(dst, "\\t", 2);
+			es_addBuf(dst, "\\\\", 2);
+			break;
+		case '\010':
+			es_addBuf(dst, "\\b", 2);
+			break;
+		case '\014':
+			es_addBuf(dst, "\\f", 2);
+			break;
+		case '\n':
+			es_addBuf(dst, "\\n", 2);
+			break;
+		case '\r':
+			es_addBuf(dst, "\\r", 2);
+			break;
+		case '\t':
+			es_addBuf(dst, "\\t", 2);
+			break;
+		default:
+			/* TODO : proper Unicode encoding (see header comment) */
+			for(j = 0 ; j < 4 ; ++j) {
+				numbuf[3-j] = hexdigit[c % 16];
+				c = c / 16;
+			}
+			es_addBuf(dst, "\\u", 2);
+			es_addBuf(dst, numbuf, 4);
+			break;
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* Streaming counterpart of jsonAddVal(): write the JSON-escaped form of
+ * pSrc directly to pDst, which must be large enough. If pDst is NULL,
+ * nothing is written. In any case, the length of the escaped value is
+ * returned, so callers can size their buffer with a first call and then
+ * emit without any intermediate allocation. Escaping rules are exactly
+ * those of jsonAddVal().
+ */
+size_t
+jsonEscapeBuf(uchar *pDst, const uchar *const pSrc, const size_t buflen, const int escapeAll)
+{
+	unsigned char c;
+	unsigned char nc;
+	size_t i;
+	size_t nClean;
+	size_t lenDst = 0;
+	int j;
+
+	for(i = 0 ; i < buflen ; ++i) {
+		nClean = srScanJSON(pSrc + i, buflen - i);
+		if(nClean > 0) {
+			if(pDst != NULL)
+				memcpy(pDst + lenDst, pSrc + i, nClean);
+			lenDst += nClean;
+			i += nClean;
+			if(i == buflen)
 				break;
-			default:
-				/* TODO : proper Unicode encoding (see header comment) */
+		}
+		c = pSrc[i];
+		if(c == '\\' && escapeAll == RSFALSE && i + 1 < buflen) {
+			nc = pSrc[i + 1];
+			/* Attempt to not double encode */
+			if(   nc == '"' || nc == '/' || nc == '\\' || nc == 'b' || nc == 'f'
+			   || nc == 'n' || nc == 'r' || nc == 't' || nc == 'u') {
+				if(pDst != NULL) {
+					pDst[lenDst] = c;
+					pDst[lenDst+1] = nc;
+				}
+				lenDst += 2;
+				++i;
+				continue;
+			}
+		}
+		switch(c) {
+		case '\"': nc = '"'; break;
+		case '/': nc = '/'; break;
+		case '\\': nc = '\\'; break;
+		case '\010': nc = 'b'; break;
+		case '\014': nc = 'f'; break;
+		case '\n': nc = 'n'; break;
+		case '\r': nc = 'r'; break;
+		case '\t': nc = 't'; break;
+		default: nc = '\0'; break;
+		}
+		if(nc != '\0') {
+			if(pDst != NULL) {
+				pDst[lenDst] = '\\';
+				pDst[lenDst+1] = nc;
+			}
+			lenDst += 2;
+		} else {
+			/* \uXXXX form, also used for \0 */
+			if(pDst != NULL) {
+				pDst[lenDst] = '\\';
+				pDst[lenDst+1] = 'u';
 				for(j = 0 ; j < 4 ; ++j) {
-					numbuf[3-j] = hexdigit[c % 16];
+					pDst[lenDst+5-j] = hexdigit[c % 16];
 					c = c / 16;
 				}
-				es_addBuf(dst, "\\u", 2);
-				es_addBuf(dst, numbuf, 4);
-				break;
 			}
+			lenDst += 6;
 		}
 	}
-finalize_it:
-	RETiRet;
+	return lenDst;
 }
 
 
@@ -3392,6 +4206,105 @@ finalize_it:
 }
 
 
+/* Direct getters for the most frequently used properties. The template
+ * compiler asks for them via MsgGetPropGetter() and calls them instead of
+ * going through MsgGetProp() for entries which need no complex processing.
+ * They must return exactly what MsgGetProp() would return in that case.
+ * Returned memory is never to be freed by the caller.
+ */
+static uchar *
+msgGetterMSG(smsg_t *const pMsg, struct templateEntry *const __attribute__((unused)) pTpe,
+	rs_size_t *const pLen)
+{
+	*pLen = getMSGLen(pMsg);
+	return getMSG(pMsg);
+}
+
+static uchar *
+msgGetterHOSTNAME(smsg_t *const pMsg, struct templateEntry *const __attribute__((unused)) pTpe,
+	rs_size_t *const pLen)
+{
+	*pLen = getHOSTNAMELen(pMsg);
+	return (uchar*) getHOSTNAME(pMsg);
+}
+
+static uchar *
+msgGetterSYSLOGTAG(smsg_t *const pMsg, struct templateEntry *const __attribute__((unused)) pTpe,
+	rs_size_t *const pLen)
+{
+	uchar *pRes;
+	getTAG(pMsg, &pRes, pLen);
+	if(*pLen == -1)
+		*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+msgGetterRAWMSG(smsg_t *const pMsg, struct templateEntry *const __attribute__((unused)) pTpe,
+	rs_size_t *const pLen)
+{
+	uchar *pRes;
+	getRawMsg(pMsg, &pRes, pLen);
+	if(*pLen == -1)
+		*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+msgGetterPROGRAMNAME(smsg_t *const pMsg, struct templateEntry *const __attribute__((unused)) pTpe,
+	rs_size_t *const pLen)
+{
+	uchar *const pRes = getProgramName(pMsg, LOCK_MUTEX);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+msgGetterTIMESTAMP(smsg_t *const pMsg, struct templateEntry *const pTpe, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getTimeReported(pMsg, pTpe->data.field.eDateFormat);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+static uchar *
+msgGetterTIMEGENERATED(smsg_t *const pMsg, struct templateEntry *const pTpe, rs_size_t *const pLen)
+{
+	uchar *const pRes = (uchar*) getTimeGenerated(pMsg, pTpe->data.field.eDateFormat);
+	*pLen = ustrlen(pRes);
+	return pRes;
+}
+
+/* return a direct getter for the property used inside template entry pTpe,
+ * or NULL if there is none and MsgGetProp() must be used.
+ */
+msgPropGetter_t
+MsgGetPropGetter(struct templateEntry *const pTpe)
+{
+	if(pTpe->eEntryType != FIELD || pTpe->bComplexProcessing)
+		return NULL;
+
+	switch(pTpe->data.field.msgProp.id) {
+		case PROP_MSG:
+			return msgGetterMSG;
+		case PROP_HOSTNAME:
+			return msgGetterHOSTNAME;
+		case PROP_SYSLOGTAG:
+			return msgGetterSYSLOGTAG;
+		case PROP_RAWMSG:
+			return msgGetterRAWMSG;
+		case PROP_PROGRAMNAME:
+			return msgGetterPROGRAMNAME;
+		case PROP_TIMESTAMP:
+			return pTpe->data.field.options.bDateInUTC ? NULL : msgGetterTIMESTAMP;
+		case PROP_TIMEGENERATED:
+			return pTpe->data.field.options.bDateInUTC ? NULL : msgGetterTIMEGENERATED;
+		default:
+			return NULL;
+	}
+}
+
+
 /* This function returns a string-representation of the 
  * requested message property. This is a generic function used
  * to abstract properties so that these can be easier
@@ -5172,6 +6085,7 @@ BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
 	CHKiRet(objUse(glbl, CORE_COMPONENT));
 	CHKiRet(objUse(prop, CORE_COMPONENT));
 	CHKiRet(objUse(var, CORE_COMPONENT));
+	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
 	/* set our own handlers */
 	OBJSetMethodHandler(objMethod_SERIALIZE, MsgSerialize);
@@ -5179,6 +6093,8 @@ BEGINObjClassInit(msg, 1, OBJ_IS_CORE_MODULE)
 #	ifdef HAVE_MALLOC_TRIM
 	INIT_ATOMIC_HELPER_MUT(mutTrimCtr);
 #	endif
+	msgInitMutStripes();
+	CHKiRet(msgSlabInit());
 ENDObjClassInit(msg)
 /* vim:set ai:
  */
@@ -62,8 +62,9 @@ struct msg {
 	flowControl_t flowCtlType;
 	/**< type of flow control we can apply, for enqueueing, needs not to be persisted because
 				        once data has entered the queue, this property is no longer needed. */
-	pthread_mutex_t mut;
 	int	iRefCount;	/* reference counter (0 = unused) */
+	int	lazyClaimed;	/* LAZY_* bits: property is being computed (see msg.c) */
+	int	lazyReady;	/* LAZY_* bits: property has been computed and may be used */
 	sbool	bParseSuccess;	/* set to reflect state of last executed higher level parser */
 	unsigned short	iSeverity;/* the severity  */
 	unsigned short	iFacility;/* Facility code */
@@ -78,6 +79,7 @@ struct msg {
 	int	iLenPROGNAME;	/* Length of PROGNAME (-1 = not yet set) */
 	uchar	*pszRawMsg;	/* message as it was received on the wire. This is important in case we
 				 * need to preserve cryptographic verifiers.  */
+	int	lenRawMsgBuf;	/* size of the buffer pszRawMsg points to, 0 if not known */
 	uchar	*pszHOSTNAME;	/* HOSTNAME from syslog message */
 	char *pszRcvdAt3164;	/* time as RFC3164 formatted string (always 15 charcters) */
 	char *pszRcvdAt3339;	/* time as RFC3164 formatted string (32 charcters at most) */
@@ -133,6 +135,11 @@ struct msg {
 	char pszRcvdAt_Unix[12];
 	char dfltTZ[8];	    /* 7 chars max, less overhead than ptr! */
 	uchar *pszUUID; /* The message's UUID */
+	/* the following are managed by the per-thread msg object cache and are NOT
+	 * reset when a cached object is handed out again */
+	void *pSlab;	/* cache this object belongs to, NULL if none */
+	uchar *pszRawMsgSpare;	/* raw msg buffer kept from the previous use of this object */
+	int lenRawMsgSpare;	/* size of that buffer */
 };
 
 
@@ -196,9 +203,15 @@ rsRetVal MsgSetAfterPRIOffs(smsg_t *pMsg, short offs);
 void MsgSetMSGoffs(smsg_t *pMsg, short offs);
 void MsgSetRawMsgWOSize(smsg_t *pMsg, char* pszRawMsg);
 void MsgSetRawMsg(smsg_t *pMsg, const char* pszRawMsg, size_t lenMsg);
+uchar *MsgGetRawMsgBuf(smsg_t *pMsg, int lenBuf);
+void MsgSetRawMsgInPlace(smsg_t *pMsg, size_t lenMsg);
+void MsgSetRcvdTime(smsg_t *pMsg, const struct syslogTime *stTime, time_t ttGenTime);
 rsRetVal MsgReplaceMSG(smsg_t *pThis, const uchar* pszMSG, int lenMSG);
 uchar *MsgGetProp(smsg_t *pMsg, struct templateEntry *pTpe, msgPropDescr_t *pProp,
 		  rs_size_t *pPropLen, unsigned short *pbMustBeFreed, struct syslogTime *ttNow);
+typedef uchar *(*msgPropGetter_t)(smsg_t *pMsg, struct templateEntry *pTpe, rs_size_t *pLen);
+msgPropGetter_t MsgGetPropGetter(struct templateEntry *pTpe);
+size_t jsonEscapeBuf(uchar *pDst, const uchar *pSrc, size_t buflen, int escapeAll);
 uchar *getRcvFrom(smsg_t *pM);
 void getTAG(smsg_t *pM, uchar **ppBuf, int *piLen);
 const char *getTimeReported(smsg_t *pM, enum tplFormatTypes eFmt);
@@ -210,6 +223,8 @@ rsRetVal msgAddMetadata(smsg_t *msg, uchar *metaname, uchar *metaval);
 rsRetVal msgAddMultiMetadata(smsg_t *msg, const uchar **metaname, const uchar **metaval, const int count);
 rsRetVal MsgGetSeverity(smsg_t *pThis, int *piSeverity);
 rsRetVal MsgDeserialize(smsg_t *pMsg, strm_t *pStrm);
+rsRetVal MsgSerializeBinary(smsg_t *pThis, uchar **ppBuf, size_t *pLenBuf, size_t *pLenData);
+rsRetVal MsgDeserializeBinary(smsg_t *pMsg, uchar *pBuf, size_t lenBuf);
 rsRetVal MsgSetPropsViaJSON(smsg_t *__restrict__ const pMsg, const uchar *__restrict__ const json);
 rsRetVal MsgSetPropsViaJSON_Object(smsg_t *__restrict__ const pMsg, struct json_object *json);
 const uchar* msgGetJSONMESG(smsg_t *__restrict__ const pMsg);
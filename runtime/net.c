@@ -95,6 +95,37 @@ struct AllowedSenders *pAllowedSenders_GSS = NULL;
 static struct AllowedSenders *pLastAllowedSenders_GSS = NULL;
 #endif
 
+/* For fast lookups, each allowed sender list is additionally compiled into
+ * a pair of multibit prefix tries (one for IPv4, one for IPv6). Each trie
+ * level consumes ACL_TRIE_STRIDE address bits; prefixes whose length is not
+ * a multiple of the stride are expanded into all child slots they cover.
+ * As we only need to know whether *any* entry matches (there are no deny
+ * rules), a node just records which of its slots are fully covered. Lookup
+ * is thus bounded by 8 (IPv4) resp. 32 (IPv6) steps, independent of the
+ * number of ACL entries. Entries that cannot be expressed as a plain prefix
+ * (hostname wildcards, scoped IPv6 addresses) are kept in a small slow-path
+ * array and still checked via MaskCmp().
+ */
+#define ACL_TRIE_STRIDE 4
+#define ACL_TRIE_FANOUT (1 << ACL_TRIE_STRIDE)
+struct aclTrieNode {
+	uint16_t covered;	/* bit n set: all addresses below slot n match */
+	struct aclTrieNode *child[ACL_TRIE_FANOUT];
+};
+struct aclIndex {
+	struct aclTrieNode *pRoot4;
+	struct aclTrieNode *pRoot6;
+	struct AllowedSenders **pSlow;	/* entries not representable in the tries */
+	int nSlow;
+	int maxSlow;
+};
+/* like the lists themselves, these are read-only after startup */
+static struct aclIndex aclIdx_UDP;
+static struct aclIndex aclIdx_TCP;
+#ifdef USE_GSSAPI
+static struct aclIndex aclIdx_GSS;
+#endif
+
 int     ACLAddHostnameOnFail = 0; /* add hostname to acl when DNS resolving has failed */
 int     ACLDontResolve = 0;       /* add hostname to acl instead of resolving it to IP(s) */
 
@@ -126,6 +157,22 @@ setAllowRoot(struct AllowedSenders **ppAllowRoot, uchar *pszType)
 finalize_it:
 	RETiRet;
 }
+/* obtain the lookup index belonging to the allowed sender list of the
+ * provided type. Returns NULL for an invalid type.
+ */
+static struct aclIndex *
+getAclIndex(const uchar *pszType)
+{
+	if(!strcmp((char*)pszType, "UDP"))
+		return &aclIdx_UDP;
+	else if(!strcmp((char*)pszType, "TCP"))
+		return &aclIdx_TCP;
+#ifdef USE_GSSAPI
+	else if(!strcmp((char*)pszType, "GSS"))
+		return &aclIdx_GSS;
+#endif
+	return NULL;
+}
 /* re-initializes (sets to NULL) the correct allow root pointer
  * rgerhards, 2009-01-12
  */
@@ -537,6 +584,123 @@ mygetnameinfo(const struct sockaddr *sa, socklen_t salen,
 }
 
 
+/* get the n-th stride-sized chunk ("nibble") of a network-order address */
+static inline unsigned
+aclTrieNibble(const uint8_t *const addr, const unsigned n)
+{
+	return (n & 1) ? (addr[n / 2] & 0x0f) : (addr[n / 2] >> 4);
+}
+
+
+/* add a (masked) prefix of the given length to an ACL trie. bits must
+ * be at least 1, which is ensured by AddAllowedSender().
+ */
+static rsRetVal
+aclTrieInsert(struct aclTrieNode **ppRoot, const uint8_t *const addr, const uint8_t bits)
+{
+	struct aclTrieNode **ppNode = ppRoot;
+	const unsigned nFull = (bits - 1) / ACL_TRIE_STRIDE;
+	unsigned rest;
+	unsigned i;
+	DEFiRet;
+
+	assert(bits > 0);
+	for(i = 0 ; ; ++i) {
+		if(*ppNode == NULL)
+			CHKmalloc(*ppNode = calloc(1, sizeof(struct aclTrieNode)));
+		if(i == nFull)
+			break;
+		ppNode = &(*ppNode)->child[aclTrieNibble(addr, i)];
+	}
+
+	/* the remaining 1..STRIDE prefix bits cover a contiguous range of slots;
+	 * the host part of addr is already zeroed, so the nibble is its start.
+	 */
+	rest = bits - nFull * ACL_TRIE_STRIDE;
+	(*ppNode)->covered |= (uint16_t)
+		(((1u << (1u << (ACL_TRIE_STRIDE - rest))) - 1) << aclTrieNibble(addr, nFull));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* returns 1 if any prefix stored in the trie covers addr, 0 otherwise */
+static int
+aclTrieLookup(const struct aclTrieNode *pNode, const uint8_t *const addr, const unsigned nNibbles)
+{
+	unsigned i;
+	unsigned n;
+
+	for(i = 0 ; pNode != NULL && i < nNibbles ; ++i) {
+		n = aclTrieNibble(addr, i);
+		if(pNode->covered & (1u << n))
+			return 1;
+		pNode = pNode->child[n];
+	}
+	return 0;
+}
+
+
+static void
+aclTrieFree(struct aclTrieNode *pNode)
+{
+	int i;
+
+	if(pNode == NULL)
+		return;
+	for(i = 0 ; i < ACL_TRIE_FANOUT ; ++i)
+		aclTrieFree(pNode->child[i]);
+	free(pNode);
+}
+
+
+/* add a freshly created list entry to the lookup index. Plain IP prefixes
+ * go into the tries, everything else into the slow-path array.
+ */
+static rsRetVal
+aclIndexAdd(struct aclIndex *const pIdx, struct AllowedSenders *const pEntry)
+{
+	struct NetAddr *const pAddr = &pEntry->allowedSender;
+	struct AllowedSenders **pNewSlow;
+	DEFiRet;
+
+	if(!F_ISSET(pAddr->flags, ADDR_NAME)) {
+		if(pAddr->addr.NetAddr->sa_family == AF_INET) {
+			iRet = aclTrieInsert(&pIdx->pRoot4,
+				(uint8_t*) &SIN(pAddr->addr.NetAddr)->sin_addr, pEntry->SignificantBits);
+			FINALIZE;
+		} else if(pAddr->addr.NetAddr->sa_family == AF_INET6
+			  && SIN6(pAddr->addr.NetAddr)->sin6_scope_id == 0) {
+			iRet = aclTrieInsert(&pIdx->pRoot6,
+				SIN6(pAddr->addr.NetAddr)->sin6_addr.s6_addr, pEntry->SignificantBits);
+			FINALIZE;
+		}
+	}
+
+	if(pIdx->nSlow == pIdx->maxSlow) {
+		const int newMax = (pIdx->maxSlow == 0) ? 8 : 2 * pIdx->maxSlow;
+		CHKmalloc(pNewSlow = realloc(pIdx->pSlow, newMax * sizeof(struct AllowedSenders*)));
+		pIdx->pSlow = pNewSlow;
+		pIdx->maxSlow = newMax;
+	}
+	pIdx->pSlow[pIdx->nSlow++] = pEntry;
+
+finalize_it:
+	RETiRet;
+}
+
+
+static void
+aclIndexClear(struct aclIndex *const pIdx)
+{
+	aclTrieFree(pIdx->pRoot4);
+	aclTrieFree(pIdx->pRoot6);
+	free(pIdx->pSlow);
+	memset(pIdx, 0, sizeof(*pIdx));
+}
+
+
 /* This function adds an allowed sender entry to the ACL linked list.
  * In any case, a single entry is added. If an error occurs, the
  * function does its error reporting itself. All validity checks
@@ -545,12 +709,14 @@ mygetnameinfo(const struct sockaddr *sa, socklen_t salen,
  * rgerhards, 2007-07-17
  */
 static rsRetVal AddAllowedSenderEntry(struct AllowedSenders **ppRoot, struct AllowedSenders **ppLast,
-		     		      struct NetAddr *iAllow, uint8_t iSignificantBits)
+				      struct aclIndex *pIdx, struct NetAddr *iAllow, uint8_t iSignificantBits)
 {
 	struct AllowedSenders *pEntry = NULL;
+	rsRetVal localRet;
 
 	assert(ppRoot != NULL);
 	assert(ppLast != NULL);
+	assert(pIdx != NULL);
 	assert(iAllow != NULL);
 
 	if((pEntry = (struct AllowedSenders*) calloc(1, sizeof(struct AllowedSenders))) == NULL) {
@@ -560,6 +726,11 @@ static rsRetVal AddAllowedSenderEntry(struct AllowedSenders **ppRoot, struct All
 	memcpy(&(pEntry->allowedSender), iAllow, sizeof (struct NetAddr));
 	pEntry->pNext = NULL;
 	pEntry->SignificantBits = iSignificantBits;
+
+	if((localRet = aclIndexAdd(pIdx, pEntry)) != RS_RET_OK) {
+		free(pEntry);
+		return localRet;
+	}
 	
 	/* enqueue */
 	if(*ppRoot == NULL) {
@@ -585,6 +756,8 @@ clearAllowedSenders(uchar *pszType)
 
 	if(setAllowRoot(&pCurr, pszType) != RS_RET_OK)
 		return;	/* if something went wrong, so let's leave */
+
+	aclIndexClear(getAclIndex(pszType));
 	
 	while(pCurr != NULL) {
 		pPrev = pCurr;
@@ -615,13 +788,14 @@ clearAllowedSenders(uchar *pszType)
  * added (all addresses from that host).
  */
 static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedSenders **ppLast,
-		     		 struct NetAddr *iAllow, uint8_t iSignificantBits)
+				 struct aclIndex *pIdx, struct NetAddr *iAllow, uint8_t iSignificantBits)
 {
 	struct addrinfo *restmp = NULL;
 	DEFiRet;
 
 	assert(ppRoot != NULL);
 	assert(ppLast != NULL);
+	assert(pIdx != NULL);
 	assert(iAllow != NULL);
 
 	if (!F_ISSET(iAllow->flags, ADDR_NAME)) {
@@ -665,7 +839,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 			ABORT_FINALIZE(RS_RET_ERR);
 		}
 		/* OK, entry constructed, now lets add it to the ACL list */
-		iRet = AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+		iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, iAllow, iSignificantBits);
 	} else {
 		/* we need to process a hostname ACL */
 		if(glbl.GetDisableDNS()) {
@@ -695,7 +869,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 				if (ACLAddHostnameOnFail) {
 				        LogError(0, NO_ERRCODE, "Adding hostname \"%s\" to ACL as a wildcard "
 					"entry.", iAllow->addr.HostWildcard);
-				        iRet = AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+				        iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, iAllow, iSignificantBits);
 					FINALIZE;
 				} else {
 				        LogError(0, NO_ERRCODE, "Hostname \"%s\" WON\'T be added to ACL.",
@@ -715,7 +889,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 					}
 					memcpy(allowIP.addr.NetAddr, res->ai_addr, res->ai_addrlen);
 					
-					if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP, iSignificantBits))
+					if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, &allowIP, iSignificantBits))
 						!= RS_RET_OK) {
 						free(allowIP.addr.NetAddr);
 						FINALIZE;
@@ -740,7 +914,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 							&(SIN6(res->ai_addr)->sin6_addr.s6_addr32[3]),
 							sizeof (in_addr_t));
 
-						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP,
+						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, &allowIP,
 								iSignificantBits))
 							!= RS_RET_OK) {
 							free(allowIP.addr.NetAddr);
@@ -756,7 +930,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 						}
 						memcpy(allowIP.addr.NetAddr, res->ai_addr, res->ai_addrlen);
 						
-						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, &allowIP,
+						if((iRet = AddAllowedSenderEntry(ppRoot, ppLast, pIdx, &allowIP,
 								iSignificantBits))
 							!= RS_RET_OK) {
 							free(allowIP.addr.NetAddr);
@@ -771,7 +945,7 @@ static rsRetVal AddAllowedSender(struct AllowedSenders **ppRoot, struct AllowedS
 			 * For this, we already have everything ready and just need
 			 * to pass it along...
 			 */
-			iRet =  AddAllowedSenderEntry(ppRoot, ppLast, iAllow, iSignificantBits);
+			iRet =  AddAllowedSenderEntry(ppRoot, ppLast, pIdx, iAllow, iSignificantBits);
 		}
 	}
 
@@ -861,6 +1035,7 @@ addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 {
 	struct AllowedSenders **ppRoot;
 	struct AllowedSenders **ppLast;
+	struct aclIndex *pIdx;
 	rsParsObj *pPars;
 	rsRetVal iRet;
 	struct NetAddr *uIP = NULL;
@@ -873,13 +1048,16 @@ addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 	if(!strcasecmp(pName, "udp")) {
 		ppRoot = &pAllowedSenders_UDP;
 		ppLast = &pLastAllowedSenders_UDP;
+		pIdx = &aclIdx_UDP;
 	} else if(!strcasecmp(pName, "tcp")) {
 		ppRoot = &pAllowedSenders_TCP;
 		ppLast = &pLastAllowedSenders_TCP;
+		pIdx = &aclIdx_TCP;
 #ifdef USE_GSSAPI
 	} else if(!strcasecmp(pName, "gss")) {
 		ppRoot = &pAllowedSenders_GSS;
 		ppLast = &pLastAllowedSenders_GSS;
+		pIdx = &aclIdx_GSS;
 #endif
 	} else {
 		LogError(0, RS_RET_ERR, "Invalid protocol '%s' in allowed sender "
@@ -907,7 +1085,7 @@ addAllowedSenderLine(char* pName, uchar** ppRestOfConfLine)
 			rsParsDestruct(pPars);
 			return(iRet);
 		}
-		if((iRet = AddAllowedSender(ppRoot, ppLast, uIP, iBits)) != RS_RET_OK) {
+		if((iRet = AddAllowedSender(ppRoot, ppLast, pIdx, uIP, iBits)) != RS_RET_OK) {
 		        if(iRet == RS_RET_NOENTRY) {
 			        LogError(0, iRet, "Error %d adding allowed sender entry "
 					    "- ignoring.", iRet);
@@ -1020,8 +1198,10 @@ static int isAllowedSender2(uchar *pszType, struct sockaddr *pFrom, const char *
 {
 	struct AllowedSenders *pAllow;
 	struct AllowedSenders *pAllowRoot = NULL;
+	const struct aclIndex *pIdx;
 	int bNeededDNS = 0;	/* partial check because we could not resolve DNS? */
 	int ret;
+	int i;
 
 	assert(pFrom != NULL);
 	
@@ -1030,14 +1210,36 @@ static int isAllowedSender2(uchar *pszType, struct sockaddr *pFrom, const char *
 
 	if(pAllowRoot == NULL)
 		return 1; /* checking disabled, everything is valid! */
-	
-	/* now we loop through the list of allowed senders. As soon as
-	 * we find a match, we return back (indicating allowed). We loop
+
+	pIdx = getAclIndex(pszType);
+
+	/* first try the prefix tries, which cover all plain IP entries. Note that,
+	 * just like MaskCmp(), a v4-mapped IPv6 sender also matches IPv4 entries.
+	 */
+	switch(pFrom->sa_family) {
+	case AF_INET:
+		if(aclTrieLookup(pIdx->pRoot4, (uint8_t*) &SIN(pFrom)->sin_addr, 32 / ACL_TRIE_STRIDE))
+			return 1;
+		break;
+	case AF_INET6:
+		if(aclTrieLookup(pIdx->pRoot6, SIN6(pFrom)->sin6_addr.s6_addr, 128 / ACL_TRIE_STRIDE))
+			return 1;
+		if(IN6_IS_ADDR_V4MAPPED(&SIN6(pFrom)->sin6_addr)
+		   && aclTrieLookup(pIdx->pRoot4, SIN6(pFrom)->sin6_addr.s6_addr + 12, 32 / ACL_TRIE_STRIDE))
+			return 1;
+		break;
+	default:
+		break;
+	}
+
+	/* now we loop through the remaining (non-prefix) allowed senders. As soon
+	 * as we find a match, we return back (indicating allowed). We loop
 	 * until we are out of allowed senders. If so, we fall through the
 	 * loop and the function's terminal return statement will indicate
 	 * that the sender is disallowed.
 	 */
-	for(pAllow = pAllowRoot ; pAllow != NULL ; pAllow = pAllow->pNext) {
+	for(i = 0 ; i < pIdx->nSlow ; ++i) {
+		pAllow = pIdx->pSlow[i];
 		ret = MaskCmp (&(pAllow->allowedSender), pAllow->SignificantBits, pFrom, pszFromHost, bChkDNS);
 		if(ret == 1)
 			return 1;
@@ -1265,7 +1467,8 @@ create_single_udp_socket(int *const s, /* socket */
 	const int rcvbuf,
 	const int sndbuf,
 	const int ipfreebind,
-	const char *const device
+	const char *const device,
+	const int bReusePort
 	)
 {
         const int on = 1;
@@ -1321,6 +1524,16 @@ create_single_udp_socket(int *const s, /* socket */
 		ABORT_FINALIZE(RS_RET_ERR);
 	}
 
+	if(bReusePort) {
+#		if defined(SO_REUSEPORT)
+		if(setsockopt(*s, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on)) < 0)
+#		endif
+		{
+			LogError(errno, RS_RET_ERR, "create UDP socket failed to set REUSEPORT");
+			ABORT_FINALIZE(RS_RET_ERR);
+		}
+	}
+
 	/* We need to enable BSD compatibility. Otherwise an attacker
 	 * could flood our log files by sending us tons of ICMP errors.
 	 */
@@ -1461,6 +1674,9 @@ finalize_it:
  * are blocking.
  * param rcvbuf indicates desired rcvbuf size; 0 means OS default,
  * similar for sndbuf.
+ * If bReusePort is set, SO_REUSEPORT is enabled so that the caller can
+ * bind several sockets to the same address and port. The kernel then
+ * distributes incoming datagrams across them.
  */
 static int *
 create_udp_socket(uchar *hostname,
@@ -1469,7 +1685,8 @@ create_udp_socket(uchar *hostname,
 	const int rcvbuf,
 	const int sndbuf,
 	const int ipfreebind,
-	char *device)
+	char *device,
+	const int bReusePort)
 {
         struct addrinfo hints, *res, *r;
         int error, maxs, *s, *socks;
@@ -1511,7 +1728,7 @@ create_udp_socket(uchar *hostname,
         s = socks + 1;
 	for (r = res; r != NULL ; r = r->ai_next) {
 		localRet = create_single_udp_socket(s, r, hostname, bIsServer, rcvbuf,
-			sndbuf, ipfreebind, device);
+			sndbuf, ipfreebind, device, bReusePort);
 		if(localRet == RS_RET_OK) {
 			(*socks)++;
 			s++;
@@ -40,12 +40,14 @@
 #include <assert.h>
 #include <signal.h>
 #include <pthread.h>
+#include <zlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>	 /* required for HP UX */
 #include <time.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <sched.h>
 
 #include "rsyslog.h"
 #include "queue.h"
@@ -79,6 +81,14 @@ DEFobjCurrIf(statsobj)
 unsigned int iOverallQueueSize = 0;
 #endif
 
+/* for sharded queues, each producer thread is bound to a shard. The binding
+ * is stored as a per-thread slot number, which is handed out round-robin.
+ * Slot 0 (NULL) means "not yet assigned".
+ */
+static pthread_key_t keyShardSlot;
+static unsigned nextShardSlot = 0;
+DEF_ATOMIC_HELPER_MUT(mutNextShardSlot)
+
 /* forward-definitions */
 static rsRetVal doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, smsg_t *pMsg);
 static rsRetVal qqueueChkPersist(qqueue_t *pThis, int nUpdates);
@@ -94,12 +104,21 @@ static rsRetVal ConsumerDA(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal batchProcessed(qqueue_t *pThis, wti_t *pWti);
 static rsRetVal qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
 static rsRetVal qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub);
+#ifdef HAVE_ATOMIC_BUILTINS
+static rsRetVal qqueueMultiEnqObjLockFree(qqueue_t *pThis, multi_submit_t *pMultiSub);
+#endif
+static rsRetVal qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub);
 static rsRetVal qAddDirect(qqueue_t *pThis, smsg_t *pMsg);
 static rsRetVal qDestructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qConstructDirect(qqueue_t __attribute__((unused)) *pThis);
 static rsRetVal qDestructDisk(qqueue_t *pThis);
 rsRetVal qqueueSetSpoolDir(qqueue_t *pThis, uchar *pszSpoolDir, int lenSpoolDir);
 
+/* binary disk queue records (see qAddDiskBinary()) */
+#define BINREC_COOKIE	0xbe	/* must never be '<', which starts a text record */
+#define BINREC_VERSION	1
+#define BINREC_HDRLEN	10	/* cookie, version, payload length (4), CRC32 (4) */
+
 /* some constants for queuePersist () */
 #define QUEUE_CHECKPOINT	1
 #define QUEUE_NO_CHECKPOINT	0
@@ -132,7 +151,14 @@ static struct cnfparamdescr cnfpdescr[] = {
 	{ "queue.dequeuetimebegin", eCmdHdlrInt, 0 },
 	{ "queue.dequeuetimeend", eCmdHdlrInt, 0 },
 	{ "queue.cry.provider", eCmdHdlrGetWord, 0 },
-	{ "queue.samplinginterval", eCmdHdlrInt, 0 }
+	{ "queue.samplinginterval", eCmdHdlrInt, 0 },
+	{ "queue.shards", eCmdHdlrPositiveInt, 0 },
+	{ "queue.serializationformat", eCmdHdlrGetWord, 0 },
+	{ "queue.groupcommitinterval", eCmdHdlrNonNegInt, 0 },
+	{ "queue.groupcommitbytes", eCmdHdlrSize, 0 },
+	{ "queue.mmapread", eCmdHdlrBinary, 0 },
+	{ "queue.cpuset", eCmdHdlrString, 0 },
+	{ "queue.numa.node", eCmdHdlrNonNegInt, 0 }
 };
 static struct cnfparamblk pblk =
 	{ CNFPARAMBLK_VERSION,
@@ -260,6 +286,9 @@ getQueueTypeName(queueType_t t)
 	case QUEUETYPE_DIRECT: 
 		r = "Direct";
 		break;
+	case QUEUETYPE_LOCKFREE:
+		r = "LockFree";
+		break;
 	default:
 		r = "invalid/unknown queue mode";
 		break;
@@ -296,6 +325,15 @@ qqueueDbgPrint(qqueue_t *pThis)
 	dbgoprint((obj_t*) pThis, "queue.dequeueslowdown: %d\n", pThis->iDeqSlowdown);
 	dbgoprint((obj_t*) pThis, "queue.dequeuetimebegin: %d\n", pThis->iDeqtWinFromHr);
 	dbgoprint((obj_t*) pThis, "queue.dequeuetimeend: %d\n", pThis->iDeqtWinToHr);
+	dbgoprint((obj_t*) pThis, "queue.shards: %d\n", pThis->nShards);
+	dbgoprint((obj_t*) pThis, "queue.groupcommitinterval: %d\n", pThis->iGroupCommitInterval);
+	dbgoprint((obj_t*) pThis, "queue.groupcommitbytes: %d\n", pThis->iGroupCommitBytes);
+	dbgoprint((obj_t*) pThis, "queue.mmapread: %d\n", pThis->bMmapRead);
+	dbgoprint((obj_t*) pThis, "queue.cpuset: '%s'\n",
+		(pThis->pszCpuset == NULL) ? "[NONE]" : (char*)pThis->pszCpuset);
+	dbgoprint((obj_t*) pThis, "queue.numa.node: %d\n", pThis->iNumaNode);
+	dbgoprint((obj_t*) pThis, "queue.serializationformat: %s\n",
+		pThis->bBinarySerialization ? "binary" : "text");
 }
 
 
@@ -379,6 +417,20 @@ qqueueAdviseMaxWorkers(qqueue_t *pThis)
 			iMaxWorkers = getLogicalQueueSize(pThis) / pThis->iMinMsgsPerWrkr + 1;
 		}
 		wtpAdviseMaxWorkers(pThis->pWtpReg, iMaxWorkers);
+		if(pThis->pShardRoot != NULL && iMaxWorkers > pThis->iNumWorkerThreads) {
+			/* we have more work than our own workers can handle, so wake
+			 * up all idle sibling shards. Their workers will steal from us
+			 * as they have no work of their own (see ConsumerSteal()).
+			 * Siblings with a backlog are busy anyway.
+			 */
+			qqueue_t *const pRoot = pThis->pShardRoot;
+			for(int i = 1 ; i < pRoot->nShards ; ++i) {
+				qqueue_t *const pSibling =
+					pRoot->ppShards[(pThis->iShardIdx + i) % pRoot->nShards];
+				if(pSibling->pWtpReg != NULL && getLogicalQueueSize(pSibling) == 0)
+					wtpAdviseMaxWorkers(pSibling->pWtpReg, 1);
+			}
+		}
 	}
 
 	RETiRet;
@@ -440,6 +492,14 @@ StartDA(qqueue_t *pThis)
 	CHKiRet(qqueueSetSpoolDir(pThis->pqDA, pThis->pszSpoolDir, pThis->lenSpoolDir));
 	CHKiRet(qqueueSetiPersistUpdCnt(pThis->pqDA, pThis->iPersistUpdCnt));
 	CHKiRet(qqueueSetbSyncQueueFiles(pThis->pqDA, pThis->bSyncQueueFiles));
+	/* group commit is not inherited: the DA queue has a single producer
+	 * (ConsumerDA), so there is no group to gather.
+	 */
+	pThis->pqDA->bBinarySerialization = pThis->bBinarySerialization;
+	pThis->pqDA->bMmapRead = pThis->bMmapRead;
+	if(pThis->pszCpuset != NULL)
+		CHKmalloc(pThis->pqDA->pszCpuset = ustrdup(pThis->pszCpuset));
+	pThis->pqDA->iNumaNode = pThis->iNumaNode;
 	CHKiRet(qqueueSettoActShutdown(pThis->pqDA, pThis->toActShutdown));
 	CHKiRet(qqueueSettoEnq(pThis->pqDA, pThis->toEnq));
 	CHKiRet(qqueueSetiDeqtWinFromHr(pThis->pqDA, pThis->iDeqtWinFromHr));
@@ -506,6 +566,8 @@ InitDA(qqueue_t *pThis, int bLockMutex)
 	CHKiRet(wtpSetpmutUsr		(pThis->pWtpDA, pThis->mut));
 	CHKiRet(wtpSetiNumWorkerThreads	(pThis->pWtpDA, 1));
 	CHKiRet(wtpSettoWrkShutdown	(pThis->pWtpDA, pThis->toWrkShutdown));
+	CHKiRet(wtpSetpszCpuset		(pThis->pWtpDA, pThis->pszCpuset));
+	CHKiRet(wtpSetiNumaNode		(pThis->pWtpDA, pThis->iNumaNode));
 	CHKiRet(wtpSetpUsr		(pThis->pWtpDA, pThis));
 	CHKiRet(wtpConstructFinalize	(pThis->pWtpDA));
 	/* if we reach this point, we have a "good" DA worker pool */
@@ -702,6 +764,143 @@ static rsRetVal qDelLinkedList(qqueue_t *pThis)
 }
 
 
+#ifdef HAVE_ATOMIC_BUILTINS
+/* -------------------- lock-free ring  -------------------- */
+/* This is a bounded multi-producer ring with per-slot sequence numbers.
+ * Producers claim a position by CAS on enqPos and then publish the message
+ * by updating the slot's sequence number, so no lock is needed to add. The
+ * consumer side (dequeue and delete) is still run by the queue workers
+ * while holding the queue mutex, so it is single-consumer. That also keeps
+ * batch dequeue, the to-delete list and DA mode working exactly as for the
+ * other in-memory queue types.
+ */
+
+/* upper bound for queue.size of lock-free queues. The ring has twice as
+ * many slots, and its size must be representable as unsigned.
+ */
+#define QUEUE_LOCKFREE_MAX_SIZE (1 << 24)
+
+static rsRetVal qConstructLockFree(qqueue_t *pThis)
+{
+	unsigned size;
+	unsigned i;
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	if(pThis->iMaxQueueSize == 0)
+		ABORT_FINALIZE(RS_RET_QSIZE_ZERO);
+	if(pThis->iMaxQueueSize > QUEUE_LOCKFREE_MAX_SIZE)
+		pThis->iMaxQueueSize = QUEUE_LOCKFREE_MAX_SIZE; /* qqueueStart() already warned */
+
+	/* we use twice the queue size, so that producers racing on the
+	 * (unlocked) size check practically never find the ring full.
+	 */
+	for(size = 2 ; size < 2 * (unsigned) pThis->iMaxQueueSize ; size <<= 1)
+		/* just compute power of two */;
+	CHKmalloc(pThis->tVars.lockfree.pSlots = MALLOC(sizeof(qLockFreeSlot_t) * size));
+	for(i = 0 ; i < size ; ++i) {
+		pThis->tVars.lockfree.pSlots[i].seq = i;
+		pThis->tVars.lockfree.pSlots[i].pMsg = NULL;
+	}
+	pThis->tVars.lockfree.mask = size - 1;
+	pThis->tVars.lockfree.enqPos = 0;
+	pThis->tVars.lockfree.deqPos = 0;
+	pThis->tVars.lockfree.delPos = 0;
+	pThis->tVars.lockfree.bWrkrIdle = 0;
+
+	qqueueChkIsDA(pThis);
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qDestructLockFree(qqueue_t *pThis)
+{
+	DEFiRet;
+
+	ASSERT(pThis != NULL);
+
+	queueDrain(pThis); /* discard any remaining queue entries */
+	free(pThis->tVars.lockfree.pSlots);
+
+	RETiRet;
+}
+
+
+/* add an element. This is safe to be called concurrently by any number of
+ * threads, with or without holding the queue mutex.
+ */
+static rsRetVal qAddLockFree(qqueue_t *pThis, smsg_t* pMsg)
+{
+	qLockFreeSlot_t *pSlot;
+	unsigned pos;
+	int dif;
+	DEFiRet;
+
+	pos = (unsigned) ATOMIC_FETCH_32BIT(&pThis->tVars.lockfree.enqPos, NULL);
+	while(1) {
+		pSlot = pThis->tVars.lockfree.pSlots + (pos & pThis->tVars.lockfree.mask);
+		dif = (int) ((unsigned) ATOMIC_FETCH_32BIT(&pSlot->seq, NULL) - pos);
+		if(dif == 0) {
+			if(ATOMIC_CAS(&pThis->tVars.lockfree.enqPos, pos, pos + 1, NULL))
+				break;
+		} else if(dif < 0) {
+			/* ring full - can only happen if more producers than free
+			 * slots race on the fast path, so we do not wait.
+			 */
+			ABORT_FINALIZE(RS_RET_QUEUE_FULL);
+		}
+		pos = (unsigned) ATOMIC_FETCH_32BIT(&pThis->tVars.lockfree.enqPos, NULL);
+	}
+
+	pSlot->pMsg = pMsg;
+	__sync_synchronize(); /* message must be visible before it is published */
+	pSlot->seq = pos + 1;
+
+finalize_it:
+	RETiRet;
+}
+
+
+static rsRetVal qDeqLockFree(qqueue_t *pThis, smsg_t **ppMsg)
+{
+	qLockFreeSlot_t *pSlot;
+	const unsigned pos = pThis->tVars.lockfree.deqPos;
+	DEFiRet;
+
+	pSlot = pThis->tVars.lockfree.pSlots + (pos & pThis->tVars.lockfree.mask);
+	/* the queue size is only incremented after the message was published,
+	 * but another producer may still be publishing an earlier position.
+	 * That is a matter of a few instructions, so we just wait for it.
+	 */
+	while((unsigned) ATOMIC_FETCH_32BIT(&pSlot->seq, NULL) != pos + 1)
+		sched_yield();
+	*ppMsg = pSlot->pMsg;
+	pThis->tVars.lockfree.deqPos = pos + 1;
+
+	RETiRet;
+}
+
+
+static rsRetVal qDelLockFree(qqueue_t *pThis)
+{
+	qLockFreeSlot_t *pSlot;
+	const unsigned pos = pThis->tVars.lockfree.delPos;
+	DEFiRet;
+
+	pSlot = pThis->tVars.lockfree.pSlots + (pos & pThis->tVars.lockfree.mask);
+	pSlot->pMsg = NULL;
+	__sync_synchronize();
+	pSlot->seq = pos + pThis->tVars.lockfree.mask + 1; /* free for next round */
+	pThis->tVars.lockfree.delPos = pos + 1;
+
+	RETiRet;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
+
 /* -------------------- disk  -------------------- */
 
 
@@ -913,6 +1112,12 @@ static rsRetVal qConstructDisk(qqueue_t *pThis)
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDeq, pThis->iMaxFileSize));
 	CHKiRet(strm.SetiMaxFileSize(pThis->tVars.disk.pReadDel, pThis->iMaxFileSize));
 
+	pThis->tVars.disk.bGroupCommit = pThis->bSyncQueueFiles && pThis->iGroupCommitInterval > 0;
+	CHKiRet(strm.SetbGroupCommit(pThis->tVars.disk.pWrite, pThis->tVars.disk.bGroupCommit));
+	CHKiRet(strm.SetbMmap(pThis->tVars.disk.pReadDeq, pThis->bMmapRead));
+	pthread_cond_init(&pThis->tVars.disk.condSyncDone, NULL);
+	pthread_cond_init(&pThis->tVars.disk.condSyncWindow, NULL);
+
 finalize_it:
 	RETiRet;
 }
@@ -940,7 +1145,162 @@ static rsRetVal qDestructDisk(qqueue_t *pThis)
 		strm.Destruct(&pThis->tVars.disk.pReadDeq);
 	if(pThis->tVars.disk.pReadDel != NULL)
 		strm.Destruct(&pThis->tVars.disk.pReadDel);
+	free(pThis->tVars.disk.pSerBuf);
+	pthread_cond_destroy(&pThis->tVars.disk.condSyncDone);
+	pthread_cond_destroy(&pThis->tVars.disk.condSyncWindow);
+
+	RETiRet;
+}
+
+
+/* Group commit: make sure everything we have written so far is on stable
+ * storage. Instead of syncing each write, the first producer that needs a
+ * sync becomes the "leader" of a group. It waits for up to the group commit
+ * interval (or until the byte limit is reached) so that other producers can
+ * add their writes, and then does a single sync for all of them. Producers
+ * that arrive while a sync is in progress simply wait for it; if it does not
+ * cover their writes, one of them leads the next group.
+ * The window is only waited out if there is someone to wait for: if the
+ * leader is the only producer in group commit and the previous group was
+ * not shared either, it syncs right away. So a single producer is not
+ * throttled to one record per interval.
+ * Must be called with the queue mutex locked, which is released while
+ * waiting and syncing. So the producer is acknowledged (returns from the
+ * enqueue call) only after its data is synced.
+ */
+static void
+qqueueGroupCommit(qqueue_t *const pThis)
+{
+	const int64 mySeq = pThis->tVars.disk.syncSeqWritten;
+	struct timespec tWindowEnd;
+	int64 syncSeq;
+	int fd, fdDir;
+
+	++pThis->tVars.disk.nGroupWaiters;
+	while(pThis->tVars.disk.syncSeqDone < mySeq) {
+		if(pThis->tVars.disk.bSyncInProgress) {
+			pthread_cond_wait(&pThis->tVars.disk.condSyncDone, pThis->mut);
+			continue;
+		}
+
+		/* we are the leader of the next group */
+		pThis->tVars.disk.bSyncInProgress = 1;
+		if(pThis->tVars.disk.nGroupWaiters > 1 || pThis->tVars.disk.bLastGroupShared) {
+			timeoutComp(&tWindowEnd, pThis->iGroupCommitInterval);
+			while(pThis->iGroupCommitBytes == 0
+			      || pThis->tVars.disk.bytesUnsynced < pThis->iGroupCommitBytes) {
+				if(pthread_cond_timedwait(&pThis->tVars.disk.condSyncWindow, pThis->mut,
+				   &tWindowEnd) == ETIMEDOUT)
+					break;
+			}
+		}
+
+		syncSeq = pThis->tVars.disk.syncSeqWritten;
+		pThis->tVars.disk.bytesUnsynced = 0;
+		pThis->tVars.disk.bLastGroupShared = (pThis->tVars.disk.nGroupWaiters > 1);
+		strmGetSyncHandle(pThis->tVars.disk.pWrite, &fd, &fdDir);
+		d_pthread_mutex_unlock(pThis->mut);
+		strmSyncHandle(fd, fdDir);
+		d_pthread_mutex_lock(pThis->mut);
+
+		DBGOPRINT((obj_t*) pThis, "group commit synced %lld records\n",
+			(long long) (syncSeq - pThis->tVars.disk.syncSeqDone));
+		pThis->tVars.disk.syncSeqDone = syncSeq;
+		pThis->tVars.disk.bSyncInProgress = 0;
+		pthread_cond_broadcast(&pThis->tVars.disk.condSyncDone);
+	}
+	--pThis->tVars.disk.nGroupWaiters;
+}
+
+
+static inline void
+binrecPut32(uchar *const p, const uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static inline uint32_t
+binrecGet32(const uchar *const p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
 
+
+/* write a message as binary record. The record is a fixed-size header
+ * followed by the payload generated by MsgSerializeBinary(). The header
+ * contains the payload length and its CRC32, so the reader can grab the
+ * whole record in one go and detect corruption.
+ */
+static rsRetVal
+qAddDiskBinary(qqueue_t *pThis, smsg_t *pMsg)
+{
+	uchar hdr[BINREC_HDRLEN];
+	size_t lenData;
+	DEFiRet;
+
+	CHKiRet(MsgSerializeBinary(pMsg, &pThis->tVars.disk.pSerBuf, &pThis->tVars.disk.lenSerBuf, &lenData));
+	hdr[0] = BINREC_COOKIE;
+	hdr[1] = BINREC_VERSION;
+	binrecPut32(hdr + 2, (uint32_t) lenData);
+	binrecPut32(hdr + 6, (uint32_t) crc32(0, pThis->tVars.disk.pSerBuf, lenData));
+
+	CHKiRet(strm.RecordBegin(pThis->tVars.disk.pWrite));
+	CHKiRet(strm.Write(pThis->tVars.disk.pWrite, hdr, sizeof(hdr)));
+	CHKiRet(strm.Write(pThis->tVars.disk.pWrite, pThis->tVars.disk.pSerBuf, lenData));
+	CHKiRet(strm.RecordEnd(pThis->tVars.disk.pWrite));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* read a binary record. The cookie has already been consumed by the caller. */
+static rsRetVal
+qDeqDiskBinary(qqueue_t *pThis, smsg_t **ppMsg)
+{
+	strm_t *const pStrm = pThis->tVars.disk.pReadDeq;
+	uchar hdr[BINREC_HDRLEN];
+	uchar *pNewBuf;
+	size_t lenData;
+	smsg_t *pMsg = NULL;
+	rsRetVal localRet;
+	DEFiRet;
+
+	CHKiRet(strmReadBlock(pStrm, hdr + 1, sizeof(hdr) - 1));
+	if(hdr[1] != BINREC_VERSION)
+		ABORT_FINALIZE(RS_RET_INVALID_HEADER_VERS);
+	lenData = binrecGet32(hdr + 2);
+	if(lenData > pThis->tVars.disk.lenSerBuf) {
+		CHKmalloc(pNewBuf = realloc(pThis->tVars.disk.pSerBuf, lenData));
+		pThis->tVars.disk.pSerBuf = pNewBuf;
+		pThis->tVars.disk.lenSerBuf = lenData;
+	}
+	CHKiRet(strmReadBlock(pStrm, pThis->tVars.disk.pSerBuf, lenData));
+	if((uint32_t) crc32(0, pThis->tVars.disk.pSerBuf, lenData) != binrecGet32(hdr + 6))
+		ABORT_FINALIZE(RS_RET_DS_CRC_ERR);
+
+	CHKiRet(msgConstructForDeserializer(&pMsg));
+	localRet = MsgDeserializeBinary(pMsg, pThis->tVars.disk.pSerBuf, lenData);
+	if(localRet == RS_RET_JSON_PARSE_ERR) {
+		/* the CRC matched, so this is no file damage; the message itself
+		 * is still fine, so we process it without its variables.
+		 */
+		LogError(0, localRet, "queue '%s': file '%s': JSON variables of a stored "
+			"message could not be parsed, processing message without them",
+			obj.GetName((obj_t*) pThis),
+			(pStrm->pszCurrFName == NULL) ? "N/A" : (char*) pStrm->pszCurrFName);
+	} else {
+		CHKiRet(localRet);
+	}
+	*ppMsg = pMsg;
+	pMsg = NULL;
+
+finalize_it:
+	if(pMsg != NULL)
+		msgDestruct(&pMsg);
 	RETiRet;
 }
 
@@ -953,11 +1313,21 @@ static rsRetVal qAddDisk(qqueue_t *pThis, smsg_t* pMsg)
 	ASSERT(pThis != NULL);
 
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, &nWriteCount));
-	CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	if(pThis->bBinarySerialization) {
+		CHKiRet(qAddDiskBinary(pThis, pMsg));
+	} else {
+		CHKiRet((objSerialize(pMsg))(pMsg, pThis->tVars.disk.pWrite));
+	}
 	CHKiRet(strm.Flush(pThis->tVars.disk.pWrite));
 	CHKiRet(strm.SetWCntr(pThis->tVars.disk.pWrite, NULL)); /* no more counting for now... */
 
 	pThis->tVars.disk.sizeOnDisk += nWriteCount;
+	if(pThis->tVars.disk.bGroupCommit) {
+		++pThis->tVars.disk.syncSeqWritten;
+		pThis->tVars.disk.bytesUnsynced += nWriteCount;
+		if(pThis->iGroupCommitBytes > 0 && pThis->tVars.disk.bytesUnsynced >= pThis->iGroupCommitBytes)
+			pthread_cond_signal(&pThis->tVars.disk.condSyncWindow);
+	}
 
 	/* we have enqueued the user element to disk. So we now need to destruct
 	 * the in-memory representation. The instance will be re-created upon
@@ -988,10 +1358,23 @@ finalize_it:
 static rsRetVal
 qDeqDisk(qqueue_t *pThis, smsg_t **ppMsg)
 {
+	uchar c;
 	DEFiRet;
-	iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3,
-		pThis->tVars.disk.pReadDeq, NULL,
-		NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+
+	/* the record format is detected per record, so queue files written
+	 * in either format (or a mix of both) can always be read.
+	 */
+	iRet = strm.ReadChar(pThis->tVars.disk.pReadDeq, &c);
+	if(iRet == RS_RET_OK) {
+		if(c == BINREC_COOKIE) {
+			iRet = qDeqDiskBinary(pThis, ppMsg);
+		} else {
+			strm.UnreadChar(pThis->tVars.disk.pReadDeq, c);
+			iRet = objDeserializeWithMethods(ppMsg, (uchar*) "msg", 3,
+				pThis->tVars.disk.pReadDeq, NULL,
+				NULL, msgConstructForDeserializer, NULL, MsgDeserialize);
+		}
+	}
 	if(iRet != RS_RET_OK) {
 		LogError(0, iRet, "%s: qDeqDisk error happened at around offset %lld",
 			obj.GetName((obj_t*)pThis),
@@ -1363,6 +1746,14 @@ qqueueShutdownWorkers(qqueue_t *const pThis)
 	ISOBJ_TYPE_assert(pThis, qqueue);
 	ASSERT(pThis->pqParent == NULL); /* detect invalid calling sequence */
 
+	if(pThis->ppShards != NULL) {
+		for(int i = 0 ; i < pThis->nShards ; ++i) {
+			if(pThis->ppShards[i] != NULL && pThis->ppShards[i]->pWtpReg != NULL)
+				qqueueShutdownWorkers(pThis->ppShards[i]);
+		}
+		FINALIZE;
+	}
+
 	DBGOPRINT((obj_t*) pThis, "initiating worker thread shutdown sequence\n");
 
 	CHKiRet(tryShutdownWorkersWithinQueueTimeout(pThis));
@@ -1428,6 +1819,8 @@ rsRetVal qqueueConstruct(qqueue_t **ppThis, queueType_t qType, int iWorkerThread
 
 	pThis->pszFilePrefix = NULL;
 	pThis->qType = qType;
+	pThis->nShards = 1;
+	pThis->iNumaNode = -1;
 
 
 	INIT_ATOMIC_HELPER_MUT(pThis->mutQueueSize);
@@ -1560,6 +1953,9 @@ DoDeleteBatchFromQStore(qqueue_t *pThis, int nElem)
 	if(pThis->qType == QUEUETYPE_DISK) {
 		strmMultiFileSeek(pThis->tVars.disk.pReadDel, pThis->tVars.disk.deqFileNumOut,
 				  pThis->tVars.disk.deqOffs, &bytesDel);
+		/* the dequeue stream will never again need what has just been deleted */
+		strmReleaseConsumed(pThis->tVars.disk.pReadDeq, pThis->tVars.disk.deqFileNumOut,
+				    pThis->tVars.disk.deqOffs);
 		/* We need to correct the on-disk file size. This time it is a bit tricky:
 		 * we free disk space only upon file deletion. So we need to keep track of what we
 		 * have read until we get an out-offset that is lower than the in-offset (which
@@ -1942,6 +2338,21 @@ DequeueForConsumer(qqueue_t *pThis, wti_t *pWti, int *const pSkippedMsgs)
 
 	CHKiRet(DequeueConsumable(pThis, pWti, pSkippedMsgs));
 
+#ifdef HAVE_ATOMIC_BUILTINS
+	if(pWti->batch.nElem == 0 && pThis->qType == QUEUETYPE_LOCKFREE) {
+		/* producers of lock-free queues do not take the mutex, so they
+		 * cannot know we are about to sleep. We tell them and then check
+		 * once more. Either we see their message now or they see the flag
+		 * and wake us up (see qqueueAdviseMaxWorkersLockFree()).
+		 */
+		ATOMIC_STORE_1_TO_INT(&pThis->tVars.lockfree.bWrkrIdle, NULL);
+		if(getLogicalQueueSize(pThis) > 0) {
+			ATOMIC_STORE_0_TO_INT(&pThis->tVars.lockfree.bWrkrIdle, NULL);
+			CHKiRet(DequeueConsumable(pThis, pWti, pSkippedMsgs));
+		}
+	}
+#endif
+
 	if(pWti->batch.nElem == 0)
 		ABORT_FINALIZE(RS_RET_IDLE);
 
@@ -1980,6 +2391,95 @@ batchProcessed(qqueue_t *pThis, wti_t *pWti)
 }
 
 
+/* cancel cleanup handler for a worker that is processing a batch it stole
+ * from a sibling shard. The batch belongs to the victim, so it must be
+ * deleted from there. Afterwards the batch is empty, which makes the regular
+ * worker cleanup (that deletes from the worker's own queue) a no-op.
+ */
+struct stolenBatch_s {
+	qqueue_t *pVictim;
+	wti_t *pWti;
+};
+
+static void
+stolenBatchCancelCleanup(void *arg)
+{
+	struct stolenBatch_s *const pStolen = (struct stolenBatch_s*) arg;
+
+	d_pthread_mutex_lock(pStolen->pVictim->mut);
+	DeleteProcessedBatch(pStolen->pVictim, &pStolen->pWti->batch);
+	d_pthread_mutex_unlock(pStolen->pVictim->mut);
+}
+
+
+/* Work stealing for sharded queues. This is called by an idle worker with
+ * its own queue mutex locked. We look for a sibling shard that has at least
+ * a full batch waiting and process one batch of it. The batch is dequeued,
+ * and later deleted, under the victim's mutex, so to the victim it looks
+ * just like one of its own workers had processed it. We never hold two
+ * queue mutexes at the same time except for a trylock, so there can be no
+ * lock order problems.
+ * Returns RS_RET_IDLE if there was nothing to steal. On return, our own
+ * mutex is locked again.
+ */
+static rsRetVal
+ConsumerSteal(qqueue_t *pThis, wti_t *pWti)
+{
+	qqueue_t *const pRoot = pThis->pShardRoot;
+	qqueue_t *pVictim = NULL;
+	struct stolenBatch_s stolen;
+	int iCancelStateSave;
+	int skippedMsgs;
+	int i;
+	DEFiRet;
+
+	if(pWti->batch.nElemDeq != 0 || pThis->pWtpReg->wtpState != wtpState_RUNNING)
+		ABORT_FINALIZE(RS_RET_IDLE);
+
+	for(i = 1 ; i < pRoot->nShards ; ++i) {
+		pVictim = pRoot->ppShards[(pThis->iShardIdx + i) % pRoot->nShards];
+		if(getLogicalQueueSize(pVictim) < pVictim->iDeqBatchSize)
+			continue; /* unlocked check, but good enough as a hint */
+		if(pthread_mutex_trylock(pVictim->mut) != 0)
+			continue; /* busy, try next one */
+		DequeueConsumable(pVictim, pWti, &skippedMsgs);
+		if(pWti->batch.nElem > 0)
+			break;
+		DeleteProcessedBatch(pVictim, &pWti->batch);
+		d_pthread_mutex_unlock(pVictim->mut);
+		pVictim = NULL;
+	}
+	if(pVictim == NULL)
+		ABORT_FINALIZE(RS_RET_IDLE);
+
+	/* we have a batch - process it outside of any queue lock */
+	d_pthread_mutex_unlock(pVictim->mut);
+	d_pthread_mutex_unlock(pThis->mut);
+	DBGOPRINT((obj_t*) pThis, "stole %d messages from %s\n", pWti->batch.nElem,
+		obj.GetName((obj_t*) pVictim));
+	STATSCOUNTER_ADD(pThis->ctrStolen, pThis->mutCtrStolen, pWti->batch.nElem);
+
+	stolen.pVictim = pVictim;
+	stolen.pWti = pWti;
+	pthread_cleanup_push(stolenBatchCancelCleanup, &stolen);
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &iCancelStateSave);
+	pWti->pbShutdownImmediate = &pVictim->bShutdownImmediate;
+	pVictim->pConsumer(pVictim->pAction, &pWti->batch, pWti);
+	pthread_setcancelstate(iCancelStateSave, NULL);
+	pthread_cleanup_pop(0);
+
+	d_pthread_mutex_lock(pVictim->mut);
+	DeleteProcessedBatch(pVictim, &pWti->batch);
+	pthread_cond_signal(&pVictim->notFull);
+	d_pthread_mutex_unlock(pVictim->mut);
+
+	d_pthread_mutex_lock(pThis->mut);
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* This is the queue consumer in the regular (non-DA) case. It is 
  * protected by the queue mutex, but MUST release it as soon as possible.
  * rgerhards, 2008-01-21
@@ -2005,6 +2505,10 @@ ConsumerReg(qqueue_t *pThis, wti_t *pWti)
 		// TODO: think about what to return as iRet -- keep RS_RET_FILE_NOT_FOUND?
 		d_pthread_mutex_lock(pThis->mut);
 	}
+	if(iRet == RS_RET_IDLE && pThis->pShardRoot != NULL) {
+		iRet = ConsumerSteal(pThis, pWti);
+		FINALIZE;
+	}
 	if (iRet != RS_RET_OK) {
 		FINALIZE;
 	}
@@ -2200,6 +2704,180 @@ if(pThis->pqParent != NULL) // TODO: check why we actually do this!
 /* start up the queue - it must have been constructed and parameters defined
  * before.
  */
+/* scale a (user-configured) mark down to a single shard. -1 means "not
+ * set", in which case the shard computes its own default.
+ */
+static int
+shardMark(const int iMrk, const int nShards)
+{
+	return (iMrk == -1) ? -1 : (iMrk + nShards - 1) / nShards;
+}
+
+
+/* sum up the counters of all shards into the root of a sharded queue. This
+ * is called right before the root's stats are read. The root is registered
+ * with the stats subsystem before its shards, so it is read before the
+ * shard counters are reset (if impstats resets counters at all).
+ */
+static void
+qqueueShardStatsAggregate(statsobj_t __attribute__((unused)) *const ignore_stats, void *const ctx)
+{
+	qqueue_t *const pThis = (qqueue_t*) ctx;
+	qqueue_t *pShard;
+	int size = 0;
+	int maxqsize = 0;
+	intctr_t enqueued = 0, full = 0, fdscrd = 0, nfdscrd = 0, stolen = 0;
+	int i;
+
+	if(pThis->ppShards == NULL)
+		return; /* shards not yet started */
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		if((pShard = pThis->ppShards[i]) == NULL)
+			continue;
+		size += PREFER_FETCH_32BIT(pShard->iQueueSize);
+		/* shard peaks need not be simultaneous, so this is an upper bound */
+		maxqsize += pShard->ctrMaxqsize;
+		enqueued += pShard->ctrEnqueued;
+		full += pShard->ctrFull;
+		fdscrd += pShard->ctrFDscrd;
+		nfdscrd += pShard->ctrNFDscrd;
+		stolen += pShard->ctrStolen;
+	}
+	pThis->iQueueSize = size;
+	pThis->ctrMaxqsize = maxqsize;
+	pThis->ctrEnqueued = enqueued;
+	pThis->ctrFull = full;
+	pThis->ctrFDscrd = fdscrd;
+	pThis->ctrNFDscrd = nfdscrd;
+	pThis->ctrStolen = stolen;
+}
+
+
+/* set up the impstats counters of a queue */
+static rsRetVal
+qqueueInitStats(qqueue_t *pThis)
+{
+	uchar *qName;
+	DEFiRet;
+
+	qName = obj.GetName((obj_t*)pThis);
+	CHKiRet(statsobj.Construct(&pThis->statsobj));
+	CHKiRet(statsobj.SetName(pThis->statsobj, qName));
+	CHKiRet(statsobj.SetOrigin(pThis->statsobj, (uchar*)"core.queue"));
+	/* we need to save the queue size, as the stats module initializes it to 0! */
+	/* iQueueSize is a dual-use counter: no init, no mutex! */
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("size"),
+		ctrType_Int, CTR_FLAG_NONE, &pThis->iQueueSize));
+
+	STATSCOUNTER_INIT(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("enqueued"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrEnqueued));
+
+	STATSCOUNTER_INIT(pThis->ctrFull, pThis->mutCtrFull);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("full"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrFull));
+
+	STATSCOUNTER_INIT(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.full"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrFDscrd));
+	STATSCOUNTER_INIT(pThis->ctrNFDscrd, pThis->mutCtrNFDscrd);
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.nf"),
+		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrNFDscrd));
+	if(pThis->pShardRoot != NULL || pThis->nShards > 1) {
+		STATSCOUNTER_INIT(pThis->ctrStolen, pThis->mutCtrStolen);
+		CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("stolen"),
+			ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrStolen));
+	}
+
+	pThis->ctrMaxqsize = 0; /* no mutex needed, thus no init call */
+	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("maxqsize"),
+		ctrType_Int, CTR_FLAG_NONE, &pThis->ctrMaxqsize));
+
+	if(pThis->nShards > 1)
+		CHKiRet(statsobj.SetPreReadNotifier(pThis->statsobj, qqueueShardStatsAggregate, pThis));
+
+	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* Start the shards of a sharded queue. Each shard is a complete queue of
+ * the configured type with its own store, mutex and worker pool. Size and
+ * worker count are divided between the shards.
+ */
+static rsRetVal
+StartShards(qqueue_t *pThis)
+{
+	qqueue_t *pShard;
+	uchar pszName[128];
+	const int n = pThis->nShards;
+	int i;
+	DEFiRet;
+
+	CHKmalloc(pThis->ppShards = (qqueue_t**) calloc(n, sizeof(qqueue_t*)));
+	for(i = 0 ; i < n ; ++i) {
+		CHKiRet(qqueueConstruct(&pShard, pThis->qType, (pThis->iNumWorkerThreads + n - 1) / n,
+			(pThis->iMaxQueueSize + n - 1) / n, pThis->pConsumer));
+		pThis->ppShards[i] = pShard;
+		snprintf((char*)pszName, sizeof(pszName), "%s[shard%d]", obj.GetName((obj_t*) pThis), i);
+		CHKiRet(obj.SetName((obj_t*) pShard, pszName));
+		pShard->pShardRoot = pThis;
+		pShard->iShardIdx = i;
+		pShard->iDeqBatchSize = pThis->iDeqBatchSize;
+		pShard->iHighWtrMrk = -1;
+		pShard->iLowWtrMrk = -1;
+		pShard->iFullDlyMrk = shardMark(pThis->iFullDlyMrk, n);
+		pShard->iLightDlyMrk = shardMark(pThis->iLightDlyMrk, n);
+		pShard->iDiscardMrk = shardMark(pThis->iDiscardMrk, n);
+		pShard->iMinMsgsPerWrkr = shardMark(pThis->iMinMsgsPerWrkr, n);
+		pShard->iDiscardSeverity = pThis->iDiscardSeverity;
+		pShard->toQShutdown = pThis->toQShutdown;
+		pShard->toActShutdown = pThis->toActShutdown;
+		pShard->toEnq = pThis->toEnq;
+		pShard->toWrkShutdown = pThis->toWrkShutdown;
+		pShard->iDeqSlowdown = pThis->iDeqSlowdown;
+		pShard->iDeqtWinFromHr = pThis->iDeqtWinFromHr;
+		pShard->iDeqtWinToHr = pThis->iDeqtWinToHr;
+		pShard->iSmpInterval = pThis->iSmpInterval;
+		pShard->bEnqOnly = pThis->bEnqOnly;
+		if(pThis->pszCpuset != NULL)
+			CHKmalloc(pShard->pszCpuset = ustrdup(pThis->pszCpuset));
+		pShard->iNumaNode = pThis->iNumaNode;
+		CHKiRet(qqueueStart(pShard));
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* destruct the shards of a sharded queue. All workers must be terminated
+ * before the first shard goes away, as they may steal from any sibling.
+ */
+static void
+DestructShards(qqueue_t *pThis)
+{
+	int i;
+
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		if(pThis->ppShards[i] != NULL && !pThis->bEnqOnly && pThis->ppShards[i]->pWtpReg != NULL)
+			qqueueShutdownWorkers(pThis->ppShards[i]);
+	}
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		if(pThis->ppShards[i] != NULL && pThis->ppShards[i]->pWtpReg != NULL)
+			wtpDestruct(&pThis->ppShards[i]->pWtpReg);
+	}
+	for(i = 0 ; i < pThis->nShards ; ++i) {
+		if(pThis->ppShards[i] != NULL)
+			qqueueDestruct(&pThis->ppShards[i]);
+	}
+	free(pThis->ppShards);
+	pThis->ppShards = NULL;
+}
+
+
 rsRetVal
 qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 {
@@ -2208,7 +2886,6 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	uchar pszQIFNam[MAXFNAME];
 	int wrk;
 	int goodval; /* a "good value" to use for comparisons (different objects) */
-	uchar *qName;
 	size_t lenBuf;
 
 	ASSERT(pThis != NULL);
@@ -2259,6 +2936,27 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			DBGOPRINT((obj_t*) pThis, ".qi file name is '%s', len %d\n", pThis->pszQIFNam,
 				(int) pThis->lenQIFNam);
 			break;
+		case QUEUETYPE_LOCKFREE:
+#ifdef HAVE_ATOMIC_BUILTINS
+			pThis->qConstruct = qConstructLockFree;
+			pThis->qDestruct = qDestructLockFree;
+			pThis->qAdd = qAddLockFree;
+			pThis->qDeq = qDeqLockFree;
+			pThis->qDel = qDelLockFree;
+			pThis->MultiEnq = qqueueMultiEnqObjLockFree;
+#else
+			LogError(0, RS_RET_NOT_IMPLEMENTED, "queue \"%s\": queue.type \"LockFree\" "
+				"is not supported on this platform, using \"FixedArray\" instead",
+				obj.GetName((obj_t*) pThis));
+			pThis->qType = QUEUETYPE_FIXED_ARRAY;
+			pThis->qConstruct = qConstructFixedArray;
+			pThis->qDestruct = qDestructFixedArray;
+			pThis->qAdd = qAddFixedArray;
+			pThis->qDeq = qDeqFixedArray;
+			pThis->qDel = qDelFixedArray;
+			pThis->MultiEnq = qqueueMultiEnqObjNonDirect;
+#endif
+			break;
 		case QUEUETYPE_DIRECT:
 			pThis->qConstruct = qConstructDirect;
 			pThis->qDestruct = qDestructDirect;
@@ -2272,8 +2970,39 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			break;
 	}
 
+	if(pThis->nShards > 1) {
+		if(   pThis->pszFilePrefix != NULL || pThis->pAction != NULL || pThis->pqParent != NULL
+		   || (pThis->qType != QUEUETYPE_FIXED_ARRAY && pThis->qType != QUEUETYPE_LINKEDLIST
+		       && pThis->qType != QUEUETYPE_LOCKFREE)) {
+			LogError(0, RS_RET_PARAM_ERROR, "queue \"%s\": queue.shards is only "
+				"supported for in-memory main and ruleset queues without "
+				"disk assistance - ignored", obj.GetName((obj_t*) pThis));
+			pThis->nShards = 1;
+		} else {
+			/* the sharded queue itself is just a dispatcher to its shards,
+			 * its stats are the sum of the shard stats. Stats must be set up
+			 * first, see qqueueShardStatsAggregate().
+			 */
+			CHKiRet(qqueueInitStats(pThis));
+			CHKiRet(StartShards(pThis));
+			pThis->MultiEnq = qqueueMultiEnqObjSharded;
+			pThis->bQueueStarted = 1;
+			DBGOPRINT((obj_t*) pThis, "queue started with %d shards\n", pThis->nShards);
+			FINALIZE;
+		}
+	}
+
+	if(pThis->qType == QUEUETYPE_LOCKFREE && pThis->iMaxQueueSize > QUEUE_LOCKFREE_MAX_SIZE) {
+		LogError(0, RS_RET_PARAM_ERROR, "queue \"%s\": queue.size %d is too large "
+				"for queue.type \"LockFree\", reduced to the maximum of %d",
+				obj.GetName((obj_t*) pThis), pThis->iMaxQueueSize,
+				QUEUE_LOCKFREE_MAX_SIZE);
+		pThis->iMaxQueueSize = QUEUE_LOCKFREE_MAX_SIZE;
+	}
+
 	if(pThis->iMaxQueueSize < 100
-	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY)) {
+	   && (pThis->qType == QUEUETYPE_LINKEDLIST || pThis->qType == QUEUETYPE_FIXED_ARRAY
+	       || pThis->qType == QUEUETYPE_LOCKFREE)) {
 		LogMsg(0, RS_RET_OK_WARN, LOG_WARNING, "Note: queue.size=\"%d\" is very "
 			"low and can lead to unpredictable results. See also "
 			"http://www.rsyslog.com/lower-bound-for-queue-sizes/",
@@ -2407,6 +3136,24 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 			pThis->iFullDlyMrk = wrk;
 	}
 
+	if(pThis->qType == QUEUETYPE_LOCKFREE) {
+		/* the mutex-free enqueue path is only used while none of flow control,
+		 * discarding and DA mode can kick in, as all of them need the mutex.
+		 */
+		wrk = pThis->iMaxQueueSize;
+		if(pThis->iLightDlyMrk < wrk)
+			wrk = pThis->iLightDlyMrk;
+		if(pThis->iFullDlyMrk < wrk)
+			wrk = pThis->iFullDlyMrk;
+		if(pThis->iDiscardMrk < wrk)
+			wrk = pThis->iDiscardMrk;
+		if(pThis->bIsDA && pThis->iHighWtrMrk < wrk)
+			wrk = pThis->iHighWtrMrk;
+		if(pThis->iSmpInterval > 0)
+			wrk = 0; /* sampling is not thread-safe, always use the mutex */
+		pThis->tVars.lockfree.iFastMrk = wrk;
+	}
+
 	DBGOPRINT((obj_t*) pThis, "params: type %d, enq-only %d, disk assisted %d, spoolDir '%s', maxFileSz %lld, "
 			          "maxQSize %d, lqsize %d, pqsize %d, child %d, full delay %d, "
 				  "light delay %d, deq batch size %d, high wtrmrk %d, low wtrmrk %d, "
@@ -2435,6 +3182,8 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	CHKiRet(wtpSetpmutUsr		(pThis->pWtpReg, pThis->mut));
 	CHKiRet(wtpSetiNumWorkerThreads	(pThis->pWtpReg, pThis->iNumWorkerThreads));
 	CHKiRet(wtpSettoWrkShutdown	(pThis->pWtpReg, pThis->toWrkShutdown));
+	CHKiRet(wtpSetpszCpuset		(pThis->pWtpReg, pThis->pszCpuset));
+	CHKiRet(wtpSetiNumaNode		(pThis->pWtpReg, pThis->iNumaNode));
 	CHKiRet(wtpSetpUsr		(pThis->pWtpReg, pThis));
 	CHKiRet(wtpConstructFinalize	(pThis->pWtpReg));
 
@@ -2450,35 +3199,7 @@ qqueueStart(qqueue_t *pThis) /* this is the ConstructionFinalizer */
 	qqueueAdviseMaxWorkers(pThis);
 
 	/* support statistics gathering */
-	qName = obj.GetName((obj_t*)pThis);
-	CHKiRet(statsobj.Construct(&pThis->statsobj));
-	CHKiRet(statsobj.SetName(pThis->statsobj, qName));
-	CHKiRet(statsobj.SetOrigin(pThis->statsobj, (uchar*)"core.queue"));
-	/* we need to save the queue size, as the stats module initializes it to 0! */
-	/* iQueueSize is a dual-use counter: no init, no mutex! */
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("size"),
-		ctrType_Int, CTR_FLAG_NONE, &pThis->iQueueSize));
-
-	STATSCOUNTER_INIT(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("enqueued"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrEnqueued));
-
-	STATSCOUNTER_INIT(pThis->ctrFull, pThis->mutCtrFull);
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("full"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrFull));
-
-	STATSCOUNTER_INIT(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.full"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrFDscrd));
-	STATSCOUNTER_INIT(pThis->ctrNFDscrd, pThis->mutCtrNFDscrd);
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("discarded.nf"),
-		ctrType_IntCtr, CTR_FLAG_RESETTABLE, &pThis->ctrNFDscrd));
-
-	pThis->ctrMaxqsize = 0; /* no mutex needed, thus no init call */
-	CHKiRet(statsobj.AddCounter(pThis->statsobj, UCHAR_CONSTANT("maxqsize"),
-		ctrType_Int, CTR_FLAG_NONE, &pThis->ctrMaxqsize));
-
-	CHKiRet(statsobj.ConstructFinalize(pThis->statsobj));
+	CHKiRet(qqueueInitStats(pThis));
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
@@ -2673,7 +3394,14 @@ DoSaveOnShutdown(qqueue_t *pThis)
 BEGINobjDestruct(qqueue) /* be sure to specify the object type also in END and CODESTART macros! */
 CODESTARTobjDestruct(qqueue)
 	DBGOPRINT((obj_t*) pThis, "shutdown: begin to destruct queue\n");
-	if(pThis->bQueueStarted) {
+	if(pThis->ppShards != NULL) {
+		/* a sharded queue owns nothing but its shards. Its stats are
+		 * computed from the shards, so they must go away first.
+		 */
+		if(pThis->statsobj != NULL)
+			statsobj.Destruct(&pThis->statsobj);
+		DestructShards(pThis);
+	} else if(pThis->bQueueStarted) {
 		/* shut down all workers
 		 * We do not need to shutdown workers when we are in enqueue-only mode or we are a
 		 * direct queue - because in both cases we have none... ;)
@@ -2744,6 +3472,7 @@ CODESTARTobjDestruct(qqueue)
 
 	free(pThis->pszFilePrefix);
 	free(pThis->pszSpoolDir);
+	free(pThis->pszCpuset);
 	if(pThis->useCryprov) {
 		pThis->cryprov.Destruct(&pThis->cryprovData);
 		obj.ReleaseObj(__FILE__, pThis->cryprovNameFull+2, pThis->cryprovNameFull,
@@ -2938,7 +3667,14 @@ doEnqSingleObj(qqueue_t *pThis, flowControl_t flowCtlType, smsg_t *pMsg)
 	}
 
 	/* and finally enqueue the message */
-	CHKiRet(qqueueAdd(pThis, pMsg));
+	if((iRet = qqueueAdd(pThis, pMsg)) != RS_RET_OK) {
+		if(iRet == RS_RET_QUEUE_FULL) {
+			/* lock-free ring full (producers racing on the fast path) */
+			STATSCOUNTER_INC(pThis->ctrFDscrd, pThis->mutCtrFDscrd);
+			msgDestruct(&pMsg);
+		}
+		FINALIZE;
+	}
 	STATSCOUNTER_SETMAX_NOMUT(pThis->ctrMaxqsize, pThis->iQueueSize);
 
 	/* check if we had a file rollover and need to persist
@@ -2993,6 +3729,8 @@ qqueueMultiEnqObjNonDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 finalize_it:
 	/* make sure at least one worker is running. */
 	qqueueAdviseMaxWorkers(pThis);
+	if(pThis->qType == QUEUETYPE_DISK && pThis->tVars.disk.bGroupCommit)
+		qqueueGroupCommit(pThis);
 	/* and release the mutex */
 	d_pthread_mutex_unlock(pThis->mut);
 	pthread_setcancelstate(iCancelStateSave, NULL);
@@ -3001,6 +3739,93 @@ finalize_it:
 	RETiRet;
 }
 
+#ifdef HAVE_ATOMIC_BUILTINS
+/* try to enqueue a message to a lock-free queue without taking the queue
+ * mutex. This is only done while the queue is below all of its marks (see
+ * iFastMrk), otherwise the caller must use the regular locked code path,
+ * which handles flow control, discarding and DA mode.
+ * Returns 1 if the message was enqueued, 0 otherwise.
+ */
+static int
+qqueueEnqLockFree(qqueue_t *pThis, smsg_t *pMsg)
+{
+	if(ATOMIC_FETCH_32BIT(&pThis->iQueueSize, &pThis->mutQueueSize) >= pThis->tVars.lockfree.iFastMrk)
+		return 0;
+	if(qqueueAdd(pThis, pMsg) != RS_RET_OK)
+		return 0;
+	STATSCOUNTER_INC(pThis->ctrEnqueued, pThis->mutCtrEnqueued);
+	STATSCOUNTER_SETMAX_NOMUT(pThis->ctrMaxqsize, pThis->iQueueSize);
+	return 1;
+}
+
+
+/* the lock-free counterpart of qqueueAdviseMaxWorkers(). The mutex is only
+ * acquired if a worker may be sleeping or more workers are needed, so in
+ * the usual case (workers busy) producers do not touch it at all.
+ */
+static void
+qqueueAdviseMaxWorkersLockFree(qqueue_t *pThis)
+{
+	int nWrkr;
+	int iQueueSize;
+
+	if(pThis->bEnqOnly)
+		return;
+	nWrkr = ATOMIC_FETCH_32BIT(&pThis->pWtpReg->iCurNumWrkThrd, &pThis->pWtpReg->mutCurNumWrkThrd);
+	iQueueSize = ATOMIC_FETCH_32BIT(&pThis->iQueueSize, &pThis->mutQueueSize);
+	if(   ATOMIC_FETCH_32BIT(&pThis->tVars.lockfree.bWrkrIdle, NULL)
+	   || nWrkr == 0
+	   || (nWrkr < pThis->iNumWorkerThreads && iQueueSize >= nWrkr * pThis->iMinMsgsPerWrkr)) {
+		d_pthread_mutex_lock(pThis->mut);
+		ATOMIC_STORE_0_TO_INT(&pThis->tVars.lockfree.bWrkrIdle, NULL);
+		qqueueAdviseMaxWorkers(pThis);
+		d_pthread_mutex_unlock(pThis->mut);
+	}
+}
+
+
+/* multi-enqueue for lock-free queues. We use the mutex-free path as long
+ * as possible and switch to the regular one for the rest of the batch (to
+ * keep message order) once it cannot be used.
+ */
+static rsRetVal
+qqueueMultiEnqObjLockFree(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	int iCancelStateSave;
+	int i;
+	rsRetVal localRet;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, qqueue);
+	assert(pMultiSub != NULL);
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+	for(i = 0 ; i < pMultiSub->nElem ; ++i) {
+		if(!qqueueEnqLockFree(pThis, pMultiSub->ppMsgs[i]))
+			break;
+	}
+
+	if(i == pMultiSub->nElem) {
+		qqueueAdviseMaxWorkersLockFree(pThis);
+	} else {
+		d_pthread_mutex_lock(pThis->mut);
+		for( ; i < pMultiSub->nElem ; ++i) {
+			localRet = doEnqSingleObj(pThis, pMultiSub->ppMsgs[i]->flowCtlType,
+				(void*)pMultiSub->ppMsgs[i]);
+			if(localRet != RS_RET_OK && localRet != RS_RET_QUEUE_FULL) {
+				iRet = localRet;
+				break;
+			}
+		}
+		qqueueAdviseMaxWorkers(pThis);
+		d_pthread_mutex_unlock(pThis->mut);
+	}
+	pthread_setcancelstate(iCancelStateSave, NULL);
+
+	RETiRet;
+}
+#endif /* #ifdef HAVE_ATOMIC_BUILTINS */
+
 /* now, the same function, but for direct mode */
 static rsRetVal
 qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
@@ -3019,6 +3844,27 @@ qqueueMultiEnqObjDirect(qqueue_t *pThis, multi_submit_t *pMultiSub)
 finalize_it:
 	RETiRet;
 }
+
+/* sharded queues: find the shard that is bound to the current thread */
+static qqueue_t *
+qqueueGetShard(qqueue_t *pThis)
+{
+	uintptr_t slot;
+
+	slot = (uintptr_t) pthread_getspecific(keyShardSlot);
+	if(slot == 0) {
+		slot = (uintptr_t) ATOMIC_INC_AND_FETCH_unsigned(&nextShardSlot, &mutNextShardSlot) + 1;
+		pthread_setspecific(keyShardSlot, (void*) slot);
+	}
+	return pThis->ppShards[(slot - 1) % pThis->nShards];
+}
+
+static rsRetVal
+qqueueMultiEnqObjSharded(qqueue_t *pThis, multi_submit_t *pMultiSub)
+{
+	qqueue_t *const pShard = qqueueGetShard(pThis);
+	return pShard->MultiEnq(pShard, pMultiSub);
+}
 /* ------------------------------ END multi-enqueue functions ------------------------------ */
 
 
@@ -3032,11 +3878,22 @@ qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, smsg_t *pMsg)
 	int iCancelStateSave;
 	ISOBJ_TYPE_assert(pThis, qqueue);
 
+	if(pThis->ppShards != NULL)
+		return qqueueEnqMsg(qqueueGetShard(pThis), flowCtlType, pMsg);
+
 	const int isNonDirectQ = pThis->qType != QUEUETYPE_DIRECT;
+	int bLocked = 0;
 
 	if(isNonDirectQ) {
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &iCancelStateSave);
+#ifdef HAVE_ATOMIC_BUILTINS
+		if(pThis->qType == QUEUETYPE_LOCKFREE && qqueueEnqLockFree(pThis, pMsg)) {
+			qqueueAdviseMaxWorkersLockFree(pThis);
+			FINALIZE;
+		}
+#endif
 		d_pthread_mutex_lock(pThis->mut);
+		bLocked = 1;
 	}
 
 	CHKiRet(doEnqSingleObj(pThis, flowCtlType, pMsg));
@@ -3044,14 +3901,17 @@ qqueueEnqMsg(qqueue_t *pThis, flowControl_t flowCtlType, smsg_t *pMsg)
 	qqueueChkPersist(pThis, 1);
 
 finalize_it:
-	if(isNonDirectQ) {
+	if(bLocked) {
 		/* make sure at least one worker is running. */
 		qqueueAdviseMaxWorkers(pThis);
+		if(pThis->qType == QUEUETYPE_DISK && pThis->tVars.disk.bGroupCommit)
+			qqueueGroupCommit(pThis);
 		/* and release the mutex */
 		d_pthread_mutex_unlock(pThis->mut);
-		pthread_setcancelstate(iCancelStateSave, NULL);
 		DBGOPRINT((obj_t*) pThis, "EnqueueMsg advised worker start\n");
 	}
+	if(isNonDirectQ)
+		pthread_setcancelstate(iCancelStateSave, NULL);
 
 	RETiRet;
 }
@@ -3206,6 +4066,31 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 			pThis->iDeqtWinToHr = pvals[i].val.d.n;
 		} else if(!strcmp(pblk.descr[i].name, "queue.samplinginterval")) {
 			pThis->iSmpInterval = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.shards")) {
+			pThis->nShards = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.groupcommitinterval")) {
+			pThis->iGroupCommitInterval = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.groupcommitbytes")) {
+			pThis->iGroupCommitBytes = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.mmapread")) {
+			pThis->bMmapRead = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.cpuset")) {
+			free(pThis->pszCpuset);
+			pThis->pszCpuset = (uchar*) es_str2cstr(pvals[i].val.d.estr, NULL);
+		} else if(!strcmp(pblk.descr[i].name, "queue.numa.node")) {
+			pThis->iNumaNode = pvals[i].val.d.n;
+		} else if(!strcmp(pblk.descr[i].name, "queue.serializationformat")) {
+			char *const fmt = es_str2cstr(pvals[i].val.d.estr, NULL);
+			if(!strcasecmp(fmt, "binary")) {
+				pThis->bBinarySerialization = 1;
+			} else if(!strcasecmp(fmt, "text")) {
+				pThis->bBinarySerialization = 0;
+			} else {
+				LogError(0, RS_RET_PARAM_ERROR, "queue: invalid value '%s' for "
+					"queue.serializationFormat, using 'text'", fmt);
+				pThis->bBinarySerialization = 0;
+			}
+			free(fmt);
 		} else {
 			DBGPRINTF("queue: program error, non-handled "
 			  "param '%s'\n", pblk.descr[i].name);
@@ -3220,6 +4105,17 @@ qqueueApplyCnfParam(qqueue_t *pThis, struct nvlst *lst)
 		}
 	}
 
+	if(srCheckAffinity(pThis->pszCpuset, pThis->iNumaNode) != RS_RET_OK) {
+		LogError(0, RS_RET_PARAM_ERROR, "error on queue '%s', queue.cpuset '%s' / "
+				"queue.numa.node %d can not be used for thread affinity "
+				"on this system - ignored", obj.GetName((obj_t*) pThis),
+				(pThis->pszCpuset == NULL) ? "" : (char*) pThis->pszCpuset,
+				pThis->iNumaNode);
+		free(pThis->pszCpuset);
+		pThis->pszCpuset = NULL;
+		pThis->iNumaNode = -1;
+	}
+
 	if(pThis->pszFilePrefix == NULL && pThis->cryprovName != NULL) {
 		LogError(0, RS_RET_QUEUE_CRY_DISK_ONLY, "error on queue '%s', crypto provider can "
 				"only be set for disk or disk assisted queue - ignored",
@@ -3306,6 +4202,10 @@ BEGINObjClassInit(qqueue, 1, OBJ_IS_CORE_MODULE)
 	CHKiRet(objUse(datetime, CORE_COMPONENT));
 	CHKiRet(objUse(statsobj, CORE_COMPONENT));
 
+	INIT_ATOMIC_HELPER_MUT(mutNextShardSlot);
+	if(pthread_key_create(&keyShardSlot, NULL) != 0)
+		ABORT_FINALIZE(RS_RET_ERR);
+
 	/* now set our own handlers */
 	OBJSetMethodHandler(objMethod_SETPROPERTY, qqueueSetProperty);
 ENDObjClassInit(qqueue)
@@ -46,7 +46,8 @@ typedef enum {
 	QUEUETYPE_FIXED_ARRAY = 0,/* a simple queue made out of a fixed (initially malloced) array fast but memoryhog */
 	QUEUETYPE_LINKEDLIST = 1, /* linked list used as buffer, lower fixed memory overhead but slower */
 	QUEUETYPE_DISK = 2, 	  /* disk files used as buffer */
-	QUEUETYPE_DIRECT = 3 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_DIRECT = 3, 	  /* no queuing happens, consumer is directly called */
+	QUEUETYPE_LOCKFREE = 4	  /* fixed ring, producers enqueue without taking the queue mutex */
 } queueType_t;
 
 /* list member definition for linked list types of queues: */
@@ -56,6 +57,16 @@ typedef struct qLinkedList_S {
 } qLinkedList_t;
 
 
+/* slot of the lock-free ring. seq tells the slot state: it is equal to the
+ * enqueue position when the slot is free for that position and equal to
+ * position + 1 once the message is published.
+ */
+typedef struct qLockFreeSlot_s {
+	volatile unsigned seq;
+	smsg_t *pMsg;
+} qLockFreeSlot_t;
+
+
 /* the queue object */
 struct queue_s {
 	BEGINobjInstance;
@@ -77,6 +88,12 @@ struct queue_s {
 	int	iUpdsSincePersist;/* nbr of queue updates since the last persist call */
 	int	iPersistUpdCnt;	/* persits queue info after this nbr of updates - 0 -> persist only on shutdown */
 	sbool	bSyncQueueFiles;/* if working with files, sync them after each write? */
+	sbool	bBinarySerialization;/* write disk queue records in compact binary format? */
+	int	iGroupCommitInterval;/* with bSyncQueueFiles: max ms to gather writes for one sync, 0 - off */
+	int	iGroupCommitBytes;/* ... or until this many bytes are pending, 0 - no limit */
+	sbool	bMmapRead;	/* read disk queue files via mmap()? */
+	uchar	*pszCpuset;	/* CPUs to pin worker threads to, NULL - no pinning */
+	int	iNumaNode;	/* NUMA node to pin worker threads to, -1 - none */
 	int	iHighWtrMrk;	/* high water mark for disk-assisted memory queues */
 	int	iLowWtrMrk;	/* low water mark for disk-assisted memory queues */
 	int	iDiscardMrk;	/* if the queue is above this mark, low-severity messages are discarded */
@@ -147,6 +164,13 @@ struct queue_s {
 	struct queue_s *pqDA;	/* queue for disk-assisted modes */
 	struct queue_s *pqParent;/* pointer to the parent (if this is a child queue) */
 	int	bDAEnqOnly;	/* EnqOnly setting for DA queue */
+	/* sharded queues: the root queue has no store and workers of its own, it
+	 * just hands messages to one of its shards, which are regular queues.
+	 */
+	int	nShards;	/* number of shards requested, 1 means unsharded */
+	struct queue_s **ppShards;/* shard array (root queue only) */
+	struct queue_s *pShardRoot;/* pointer to the root queue (shards only) */
+	int	iShardIdx;	/* our index inside the root's shard array (shards only) */
 	/* now follow queueing mode specific data elements */
 	//union {			/* different data elements based on queue type (qType) */
 	struct {			/* different data elements based on queue type (qType) */
@@ -168,7 +192,28 @@ struct queue_s {
 			strm_t *pReadDeq; /* current file for dequeueing */
 			strm_t *pReadDel; /* current file for deleting */
 			int nForcePersist;/* force persist of .qi file the next "n" times */
+			uchar *pSerBuf;	  /* binary record buffer, used under queue mutex */
+			size_t lenSerBuf;
+			/* group commit, all guarded by the queue mutex */
+			sbool bGroupCommit;	/* is group commit active? */
+			sbool bSyncInProgress;	/* is some producer currently syncing for the group? */
+			int64 syncSeqWritten;	/* number of records written so far */
+			int64 syncSeqDone;	/* number of records known to be on stable storage */
+			int64 bytesUnsynced;	/* bytes written since the last sync started */
+			int nGroupWaiters;	/* producers currently waiting for their records to be synced */
+			sbool bLastGroupShared;	/* did the previous sync cover more than one producer? */
+			pthread_cond_t condSyncDone;	/* a group sync has completed */
+			pthread_cond_t condSyncWindow;	/* the byte limit for a group was hit */
 		} disk;
+		struct {
+			qLockFreeSlot_t *pSlots;
+			unsigned mask;	/* ring size - 1, ring size is a power of two */
+			unsigned enqPos;/* next position to claim by producers (atomic) */
+			unsigned deqPos;/* next position to dequeue (under queue mutex) */
+			unsigned delPos;/* next position to delete (under queue mutex) */
+			int bWrkrIdle;	/* a worker may be going to sleep (atomic) */
+			int iFastMrk;	/* below this size, enqueue does not need the mutex */
+		} lockfree;
 	} tVars;
 	sbool	useCryprov;	/* quicker than checkig ptr (1 vs 8 bytes!) */
 	uchar *cryprovName; /* crypto provider to use */
@@ -183,6 +228,7 @@ struct queue_s {
 	STATSCOUNTER_DEF(ctrFull, mutCtrFull)
 	STATSCOUNTER_DEF(ctrFDscrd, mutCtrFDscrd)
 	STATSCOUNTER_DEF(ctrNFDscrd, mutCtrNFDscrd)
+	STATSCOUNTER_DEF(ctrStolen, mutCtrStolen)
 	int ctrMaxqsize; /* NOT guarded by a mutex */
 	int iSmpInterval; /* line interval of sampling logs */
 };
@@ -970,6 +970,9 @@ static rsRetVal setMainMsgQueType(void __attribute__((unused)) *pVal, uchar *psz
 	} else if (!strcasecmp((char *) pszType, "direct")) {
 		loadConf->globals.mainQ.MainMsgQueType = QUEUETYPE_DIRECT;
 		DBGPRINTF("main message queue type set to DIRECT (no queueing at all)\n");
+	} else if (!strcasecmp((char *) pszType, "lockfree")) {
+		loadConf->globals.mainQ.MainMsgQueType = QUEUETYPE_LOCKFREE;
+		DBGPRINTF("main message queue type set to LOCKFREE\n");
 	} else {
 		LogError(0, RS_RET_INVALID_PARAMS, "unknown mainmessagequeuetype parameter: %s",
 			(char *) pszType);
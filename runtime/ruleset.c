@@ -49,6 +49,8 @@
 #include "srUtils.h"
 #include "modules.h"
 #include "wti.h"
+#include "glbl.h"
+#include "acmatch.h"
 #include "dirty.h" /* for main ruleset queue creation */
 
 
@@ -70,6 +72,8 @@ static struct cnfparamblk rspblk =
 /* forward definitions */
 static rsRetVal processBatch(batch_t *pBatch, wti_t *pWti);
 static rsRetVal scriptExec(struct cnfstmt *root, smsg_t *pMsg, wti_t *pWti);
+static rsRetVal scriptExecBatch(struct cnfstmt *root, batch_t *pBatch, const sbool *active,
+	sbool *done, wti_t *pWti);
 
 
 /* ---------- linked-list key handling functions (ruleset) ---------- */
@@ -128,6 +132,10 @@ scriptIterateAllActions(struct cnfstmt *root, rsRetVal (*pFunc)(void*, void*), v
 			scriptIterateAllActions(stmt->d.s_propfilt.t_then,
 						pFunc, pParam);
 			break;
+		case S_PROPFILT_MULTI:
+			scriptIterateAllActions(stmt->d.s_propfilt_multi.filters,
+						pFunc, pParam);
+			break;
 		case S_RELOAD_LOOKUP_TABLE: /* this is a NOP */
 			break;
 		default:
@@ -301,12 +309,17 @@ finalize_it:
 	RETiRet;
 }
 
+/* evaluate an if condition, using the compiled form if there is one */
+#define evalIfCond(stmt, pMsg, pWti) \
+	(((stmt)->d.s_if.prog == NULL) ? cnfexprEvalBool((stmt)->d.s_if.expr, (pMsg), (pWti)) \
+		: cnfexprprogEvalBool((stmt)->d.s_if.prog, (pMsg), (pWti)))
+
 static rsRetVal
 execIf(struct cnfstmt *const stmt, smsg_t *const pMsg, wti_t *const pWti)
 {
 	sbool bRet;
 	DEFiRet;
-	bRet = cnfexprEvalBool(stmt->d.s_if.expr, pMsg, pWti);
+	bRet = evalIfCond(stmt, pMsg, pWti);
 	DBGPRINTF("if condition result is %d\n", bRet);
 	if(bRet) {
 		if(stmt->d.s_if.t_then != NULL)
@@ -414,17 +427,24 @@ finalize_it:
 	RETiRet;
 }
 
-static rsRetVal
-execPRIFILT(struct cnfstmt *stmt, smsg_t *pMsg, wti_t *pWti)
+/* helper to execPRIFILT(), also used by the batch executor */
+static int
+evalPRIFILT(struct cnfstmt *stmt, smsg_t *pMsg)
 {
-	int bRet;
-	DEFiRet;
 	if( (stmt->d.s_prifilt.pmask[pMsg->iFacility] == TABLE_NOPRI) ||
 	   ((stmt->d.s_prifilt.pmask[pMsg->iFacility]
 		    & (1<<pMsg->iSeverity)) == 0) )
-		bRet = 0;
+		return 0;
 	else
-		bRet = 1;
+		return 1;
+}
+
+static rsRetVal
+execPRIFILT(struct cnfstmt *stmt, smsg_t *pMsg, wti_t *pWti)
+{
+	int bRet;
+	DEFiRet;
+	bRet = evalPRIFILT(stmt, pMsg);
 
 	DBGPRINTF("PRIFILT condition result is %d\n", bRet);
 	if(bRet) {
@@ -545,6 +565,58 @@ finalize_it:
 	RETiRet;
 }
 
+/* helper to execPROPFILTMulti(). Evaluates all filters of the group with a
+ * single scan over the property value. The result for filter i (in list
+ * order) is stored in hits[i], hits must be large enough for all filters.
+ */
+static void
+evalPROPFILTMulti(struct cnfstmt *stmt, smsg_t *pMsg, sbool *const hits)
+{
+	struct cnfstmt *filt;
+	unsigned short pbMustBeFreed;
+	uchar *pszPropVal;
+	rs_size_t propLen;
+	int i;
+
+	filt = stmt->d.s_propfilt_multi.filters;
+	memset(hits, 0, stmt->d.s_propfilt_multi.nfilters * sizeof(sbool));
+	pszPropVal = MsgGetProp(pMsg, NULL, &filt->d.s_propfilt.prop,
+				&propLen, &pbMustBeFreed, NULL);
+	acmatchScan(stmt->d.s_propfilt_multi.ac, pszPropVal, propLen, hits);
+	for(i = 0 ; filt != NULL ; filt = filt->next, ++i) {
+		if(filt->d.s_propfilt.isNegated)
+			hits[i] = !hits[i];
+	}
+	if(Debug) {
+		DBGPRINTF("Filter: multi-check for property '%s' (value '%s'): ",
+			propIDToName(stmt->d.s_propfilt_multi.filters->d.s_propfilt.prop.id),
+			pszPropVal);
+		for(i = 0 ; i < stmt->d.s_propfilt_multi.nfilters ; ++i)
+			dbgprintf("%d", (int) hits[i]);
+		dbgprintf("\n");
+	}
+
+	if(pbMustBeFreed)
+		free(pszPropVal);
+}
+
+static rsRetVal
+execPROPFILTMulti(struct cnfstmt *stmt, smsg_t *pMsg, wti_t *pWti)
+{
+	struct cnfstmt *filt;
+	sbool hits[PROPFILT_MULTI_MAX];
+	int i;
+	DEFiRet;
+
+	evalPROPFILTMulti(stmt, pMsg, hits);
+	for(filt = stmt->d.s_propfilt_multi.filters, i = 0 ; filt != NULL ; filt = filt->next, ++i) {
+		if(hits[i])
+			CHKiRet(scriptExec(filt->d.s_propfilt.t_then, pMsg, pWti));
+	}
+finalize_it:
+	RETiRet;
+}
+
 static rsRetVal ATTR_NONNULL()
 execReloadLookupTable(struct cnfstmt *stmt)
 {
@@ -565,6 +637,11 @@ finalize_it:
 	RETiRet;
 }
 
+/* get the ruleset a batch element is bound to */
+#define batchElemRuleset(pBatch, i) \
+	(((pBatch)->pElem[(i)].pMsg->pRuleset == NULL) ? ourConf->rulesets.pDflt \
+		: (pBatch)->pElem[(i)].pMsg->pRuleset)
+
 /* The rainerscript execution engine. It is debatable if that would be better
  * contained in grammer/rainerscript.c, HOWEVER, that file focusses primarily
  * on the parsing and object creation part. So as an actual executor, it is
@@ -619,6 +696,9 @@ scriptExec(struct cnfstmt *const root, smsg_t *const pMsg, wti_t *const pWti)
 		case S_PROPFILT:
 			CHKiRet(execPROPFILT(stmt, pMsg, pWti));
 			break;
+		case S_PROPFILT_MULTI:
+			CHKiRet(execPROPFILTMulti(stmt, pMsg, pWti));
+			break;
 		case S_RELOAD_LOOKUP_TABLE:
 			CHKiRet(execReloadLookupTable(stmt));
 			break;
@@ -633,6 +713,323 @@ finalize_it:
 }
 
 
+/* Batch-at-a-time script execution (global "script.batchExecution").
+ * Instead of running the complete script for one message before turning
+ * to the next one, each statement is executed for all messages of the batch
+ * which are still "active" at that point, before the next statement is
+ * looked at. Which elements are active is kept in a mask that parallels
+ * pBatch->eltState. Conditional statements evaluate their condition for all
+ * active messages and then run their then/else subtrees with a new mask
+ * built from the results (subtrees no message selected are not entered at
+ * all). That keeps the statement dispatch hot in cache and hands actions
+ * runs of messages instead of single ones.
+ * The "done" array is shared by all nesting levels. A message is flagged
+ * there once its script processing ended early, that is due to "stop" or
+ * an error. Just like in the message-at-a-time executor, such messages are
+ * NOT committed by the caller.
+ */
+
+/* check if element i is to be processed at the current nesting level */
+#define batchExecIsActive(active, done, i) ((active)[(i)] && !(done)[(i)])
+
+/* Run a single-message executor for all active messages. This is used for all
+ * statements where there is nothing to gain from batching, e.g. because they
+ * need to work on each message's data anyway.
+ */
+#define BATCHEXEC_PER_MSG(active, done, execCall) \
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) { \
+		if(!batchExecIsActive((active), (done), i)) \
+			continue; \
+		pMsg = pBatch->pElem[i].pMsg; \
+		if((execCall) != RS_RET_OK) \
+			(done)[i] = 1; \
+	}
+
+/* execute a conditional subtree for those messages selected by mask.
+ * nSel is the number of selected elements, the subtree is skipped if
+ * there are none.
+ */
+static rsRetVal
+execBatchBranch(struct cnfstmt *const root, batch_t *const pBatch, const sbool *const mask,
+	const int nSel, sbool *const done, wti_t *const pWti)
+{
+	DEFiRet;
+	if(root != NULL && nSel > 0)
+		iRet = scriptExecBatch(root, pBatch, mask, done, pWti);
+	RETiRet;
+}
+
+/* execute a conditional statement (if, PRIFILT, PROPFILT) over the batch.
+ * The condition is evaluated for all active elements in one go, then the
+ * "then" and "else" subtrees are executed for their respective subsets.
+ */
+static rsRetVal
+execBatchCond(struct cnfstmt *const stmt, batch_t *const pBatch, const sbool *const active,
+	sbool *const done, wti_t *const pWti)
+{
+	struct cnfstmt *t_then;
+	struct cnfstmt *t_else;
+	sbool *maskThen = NULL;
+	sbool *maskElse;
+	smsg_t *pMsg;
+	int nThen = 0;
+	int nElse = 0;
+	int bRet;
+	int i;
+	DEFiRet;
+
+	switch(stmt->nodetype) {
+	case S_IF:
+		t_then = stmt->d.s_if.t_then;
+		t_else = stmt->d.s_if.t_else;
+		break;
+	case S_PRIFILT:
+		t_then = stmt->d.s_prifilt.t_then;
+		t_else = stmt->d.s_prifilt.t_else;
+		break;
+	case S_PROPFILT:
+		t_then = stmt->d.s_propfilt.t_then;
+		t_else = NULL;
+		break;
+	default:
+		assert(0); /* must never be called for other types */
+		FINALIZE;
+	}
+
+	CHKmalloc(maskThen = wtiGetBatchMask(pWti, 2 * (size_t) batchNumMsgs(pBatch)));
+	maskElse = maskThen + batchNumMsgs(pBatch);
+
+	/* evaluation phase */
+	for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+		if(!batchExecIsActive(active, done, i))
+			continue;
+		pMsg = pBatch->pElem[i].pMsg;
+		switch(stmt->nodetype) {
+		case S_IF:
+			bRet = evalIfCond(stmt, pMsg, pWti);
+			break;
+		case S_PRIFILT:
+			bRet = evalPRIFILT(stmt, pMsg);
+			break;
+		default: /* S_PROPFILT, others are caught above */
+			bRet = evalPROPFILT(stmt, pMsg);
+			break;
+		}
+		if(bRet) {
+			maskThen[i] = 1;
+			++nThen;
+		} else {
+			maskElse[i] = 1;
+			++nElse;
+		}
+	}
+	DBGPRINTF("batch condition result: %d then, %d else\n", nThen, nElse);
+
+	/* execution phase */
+	CHKiRet(execBatchBranch(t_then, pBatch, maskThen, nThen, done, pWti));
+	CHKiRet(execBatchBranch(t_else, pBatch, maskElse, nElse, done, pWti));
+
+finalize_it:
+	if(maskThen != NULL)
+		wtiReleaseBatchMask(pWti);
+	RETiRet;
+}
+
+/* execute a PROPFILT_MULTI over the batch. All filters are evaluated for
+ * all active elements first, then the filter actions are run in filter
+ * order, each for the elements the filter matched.
+ */
+static rsRetVal
+execBatchPROPFILTMulti(struct cnfstmt *const stmt, batch_t *const pBatch, const sbool *const active,
+	sbool *const done, wti_t *const pWti)
+{
+	struct cnfstmt *filt;
+	const int nElem = batchNumMsgs(pBatch);
+	const int nfilters = stmt->d.s_propfilt_multi.nfilters;
+	sbool *hits = NULL;
+	sbool *mask;
+	int nSel;
+	int i, j;
+	DEFiRet;
+
+	CHKmalloc(hits = wtiGetBatchMask(pWti, (size_t) (nfilters + 1) * nElem));
+	mask = hits + (size_t) nfilters * nElem;
+
+	for(i = 0 ; i < nElem ; ++i) {
+		if(batchExecIsActive(active, done, i))
+			evalPROPFILTMulti(stmt, pBatch->pElem[i].pMsg, hits + (size_t) i * nfilters);
+	}
+
+	for(filt = stmt->d.s_propfilt_multi.filters, j = 0 ; filt != NULL ; filt = filt->next, ++j) {
+		nSel = 0;
+		for(i = 0 ; i < nElem ; ++i) {
+			mask[i] = hits[(size_t) i * nfilters + j];
+			nSel += mask[i];
+		}
+		CHKiRet(execBatchBranch(filt->d.s_propfilt.t_then, pBatch, mask, nSel, done, pWti));
+	}
+
+finalize_it:
+	if(hits != NULL)
+		wtiReleaseBatchMask(pWti);
+	RETiRet;
+}
+
+/* The batch executor itself. Returns an error only if the whole batch must
+ * be aborted (e.g. on immediate shutdown). Per-message errors are recorded
+ * in the done array.
+ */
+static rsRetVal ATTR_NONNULL(2, 3, 4, 5)
+scriptExecBatch(struct cnfstmt *const root, batch_t *const pBatch, const sbool *const active,
+	sbool *const done, wti_t *const pWti)
+{
+	struct cnfstmt *stmt;
+	smsg_t *pMsg;
+	int i;
+	DEFiRet;
+
+	for(stmt = root ; stmt != NULL ; stmt = stmt->next) {
+		if(*pWti->pbShutdownImmediate) {
+			DBGPRINTF("scriptExecBatch: ShutdownImmediate set, "
+				  "force terminating\n");
+			ABORT_FINALIZE(RS_RET_FORCE_TERM);
+		}
+		if(Debug) {
+			cnfstmtPrintOnly(stmt, 2, 0);
+		}
+		switch(stmt->nodetype) {
+		case S_NOP:
+			break;
+		case S_RELOAD_LOOKUP_TABLE:
+			/* the reload is message-independent, so it is sufficient
+			 * to trigger it once if any message reaches this point.
+			 */
+			for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+				if(batchExecIsActive(active, done, i)) {
+					execReloadLookupTable(stmt);
+					break;
+				}
+			}
+			break;
+		case S_STOP:
+			for(i = 0 ; i < batchNumMsgs(pBatch) ; ++i) {
+				if(active[i])
+					done[i] = 1;
+			}
+			FINALIZE; /* nothing left to do at this level */
+		case S_ACT:
+			BATCHEXEC_PER_MSG(active, done, execAct(stmt, pMsg, pWti));
+			break;
+		case S_SET:
+			BATCHEXEC_PER_MSG(active, done, execSet(stmt, pMsg, pWti));
+			break;
+		case S_UNSET:
+			BATCHEXEC_PER_MSG(active, done, execUnset(stmt, pMsg));
+			break;
+		case S_CALL:
+			if(stmt->d.s_call.ruleset == NULL) {
+				CHKiRet(scriptExecBatch(stmt->d.s_call.stmt, pBatch, active, done, pWti));
+			} else {
+				BATCHEXEC_PER_MSG(active, done, execCall(stmt, pMsg, pWti));
+			}
+			break;
+		case S_CALL_INDIRECT:
+			BATCHEXEC_PER_MSG(active, done, execCallIndirect(stmt, pMsg, pWti));
+			break;
+		case S_FOREACH:
+			BATCHEXEC_PER_MSG(active, done, execForeach(stmt, pMsg, pWti));
+			break;
+		case S_IF:
+		case S_PRIFILT:
+		case S_PROPFILT:
+			CHKiRet(execBatchCond(stmt, pBatch, active, done, pWti));
+			break;
+		case S_PROPFILT_MULTI:
+			CHKiRet(execBatchPROPFILTMulti(stmt, pBatch, active, done, pWti));
+			break;
+		default:
+			dbgprintf("error: unknown stmt type %u during exec\n",
+				(unsigned) stmt->nodetype);
+			break;
+		}
+	}
+finalize_it:
+	RETiRet;
+}
+
+
+/* process a batch with the batch-at-a-time executor. A batch may contain
+ * messages bound to different rulesets. We run one pass per ruleset, each
+ * with a mask selecting this ruleset's messages. Usually, all messages
+ * belong to the same ruleset, so there is only a single pass.
+ */
+static rsRetVal
+processBatchScriptBatched(batch_t *const pBatch, wti_t *const pWti)
+{
+	int i, j;
+	ruleset_t *pRuleset;
+	sbool *active = NULL;
+	sbool *done;
+	rsRetVal localRet;
+	DEFiRet;
+
+	CHKmalloc(active = wtiGetBatchMask(pWti, 2 * (size_t) batchNumMsgs(pBatch)));
+	done = active + batchNumMsgs(pBatch);
+
+	for(i = 0 ; i < batchNumMsgs(pBatch) && !*(pWti->pbShutdownImmediate) ; ++i) {
+		if(done[i])
+			continue; /* already handled by previous pass */
+		pRuleset = batchElemRuleset(pBatch, i);
+		for(j = i ; j < batchNumMsgs(pBatch) ; ++j)
+			active[j] = !done[j] && batchElemRuleset(pBatch, j) == pRuleset;
+		if(pRuleset->bNeedsPrevSuspState) {
+			/* the batch executor runs each action over all messages
+			 * before the next one is started, so the "previous action
+			 * suspended" state would be that of some other message.
+			 * Such rulesets are executed message-at-a-time.
+			 */
+			DBGPRINTF("processBATCH: ruleset %p needs per-message suspend "
+				"state, executing msg-at-a-time\n", pRuleset);
+			localRet = RS_RET_OK;
+			for(j = i ; j < batchNumMsgs(pBatch) ; ++j) {
+				if(!active[j])
+					continue;
+				if(*(pWti->pbShutdownImmediate)) {
+					localRet = RS_RET_FORCE_TERM;
+					break;
+				}
+				if(scriptExec(pRuleset->root, pBatch->pElem[j].pMsg, pWti) == RS_RET_OK)
+					batchSetElemState(pBatch, j, BATCH_STATE_COMM);
+				done[j] = 1;
+				active[j] = 0;
+			}
+		} else {
+			DBGPRINTF("processBATCH: batch-executing ruleset %p starting at msg %d\n",
+				pRuleset, i);
+			localRet = scriptExecBatch(pRuleset->root, pBatch, active, done, pWti);
+		}
+		/* same as for the message-at-a-time case, messages MUST NOT be
+		 * flagged as committed if processing was aborted.
+		 */
+		for(j = i ; j < batchNumMsgs(pBatch) ; ++j) {
+			if(!active[j])
+				continue;
+			if(localRet == RS_RET_OK && !done[j])
+				batchSetElemState(pBatch, j, BATCH_STATE_COMM);
+			done[j] = 1;
+			active[j] = 0;
+		}
+		if(localRet == RS_RET_FORCE_TERM)
+			break;
+	}
+
+finalize_it:
+	if(active != NULL)
+		wtiReleaseBatchMask(pWti);
+	RETiRet;
+}
+
+
 /* Process (consume) a batch of messages. Calls the actions configured.
  * This is called by MAIN queues.
  */
@@ -650,18 +1047,23 @@ processBatch(batch_t *pBatch, wti_t *pWti)
 	wtiResetExecState(pWti, pBatch);
 
 	/* execution phase */
-	for(i = 0 ; i < batchNumMsgs(pBatch) && !*(pWti->pbShutdownImmediate) ; ++i) {
-		pMsg = pBatch->pElem[i].pMsg;
-		DBGPRINTF("processBATCH: next msg %d: %.128s\n", i, pMsg->pszRawMsg);
-		pRuleset = (pMsg->pRuleset == NULL) ? ourConf->rulesets.pDflt : pMsg->pRuleset;
-		localRet = scriptExec(pRuleset->root, pMsg, pWti);
-		/* the most important case here is that processing may be aborted
-		 * due to pbShutdownImmediate, in which case we MUST NOT flag this
-		 * message as committed. If we would do so, the message would
-		 * potentially be lost.
-		 */
-		if(localRet == RS_RET_OK)
-			batchSetElemState(pBatch, i, BATCH_STATE_COMM);
+	if(glblScriptBatchExec && batchNumMsgs(pBatch) > 1) {
+		iRet = processBatchScriptBatched(pBatch, pWti);
+		i = batchNumMsgs(pBatch);
+	} else {
+		for(i = 0 ; i < batchNumMsgs(pBatch) && !*(pWti->pbShutdownImmediate) ; ++i) {
+			pMsg = pBatch->pElem[i].pMsg;
+			DBGPRINTF("processBATCH: next msg %d: %.128s\n", i, pMsg->pszRawMsg);
+			pRuleset = batchElemRuleset(pBatch, i);
+			localRet = scriptExec(pRuleset->root, pMsg, pWti);
+			/* the most important case here is that processing may be aborted
+			 * due to pbShutdownImmediate, in which case we MUST NOT flag this
+			 * message as committed. If we would do so, the message would
+			 * potentially be lost.
+			 */
+			if(localRet == RS_RET_OK)
+				batchSetElemState(pBatch, i, BATCH_STATE_COMM);
+		}
 	}
 
 	/* commit phase */
@@ -938,6 +1340,18 @@ DEFFUNC_llExecFunc(doRulesetOptimizeAll)
 	rulesetOptimize((ruleset_t*) pData);
 	return RS_RET_OK;
 }
+/* helper for rulsetOptimizeAll(), checks if a ruleset can be executed by
+ * the batch executor. This must be done after all rulesets have been
+ * optimized, as only then CALLs are resolved.
+ */
+DEFFUNC_llExecFunc(doRulesetCheckPrevSuspState)
+{
+	ruleset_t *const pRuleset = (ruleset_t*) pData;
+	pRuleset->bNeedsPrevSuspState = cnfstmtNeedsPrevSuspState(pRuleset->root);
+	DBGPRINTF("ruleset '%s' needs previous-action-suspended state: %d\n",
+		pRuleset->pszName, pRuleset->bNeedsPrevSuspState);
+	return RS_RET_OK;
+}
 /* optimize all rulesets
  */
 rsRetVal
@@ -946,6 +1360,7 @@ rulesetOptimizeAll(rsconf_t *conf)
 	DEFiRet;
 	dbgprintf("begin ruleset optimization phase\n");
 	llExecFunc(&(conf->rulesets.llRulesets), doRulesetOptimizeAll, NULL);
+	llExecFunc(&(conf->rulesets.llRulesets), doRulesetCheckPrevSuspState, NULL);
 	dbgprintf("ruleset optimization phase finished.\n");
 	RETiRet;
 }
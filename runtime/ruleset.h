@@ -35,6 +35,7 @@ struct ruleset_s {
 	struct cnfstmt *root;
 	struct cnfstmt *last;
 	parserList_t *pParserLst;/* list of parsers to use for this ruleset */
+	sbool bNeedsPrevSuspState; /* script needs per-msg "previous action suspended" state? */
 };
 
 /* interfaces */
@@ -99,6 +99,10 @@ void seedRandomNumber(void);
 #define MAX_RANDOM_NUMBER RAND_MAX
 long int randomNumber(void);
 long long currentTimeMills(void);
+size_t srScanChars(const uchar *p, size_t len, uchar c1, uchar c2);
+size_t srScanJSON(const uchar *p, size_t len);
+rsRetVal srCheckAffinity(const uchar *pszCpuset, int numaNode);
+rsRetVal srSetThreadAffinity(const uchar *pszCpuset, int numaNode);
 rsRetVal ATTR_NONNULL() split_binary_parameters(uchar **const szBinary,
 	char ***const aParams, int *const iParams, es_str_t *const param_binary);
 
@@ -43,6 +43,10 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <fcntl.h>
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#include <pthread.h>
+#endif
 #include "srUtils.h"
 #include "obj.h"
 #include "errmsg.h"
@@ -50,6 +54,13 @@
 #if _POSIX_TIMERS <= 0
 #include <sys/time.h>
 #endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 5)
+#define SR_AVX2_DISPATCH 1
+#include <immintrin.h>
+#endif
 
 /* here we host some syslog specific names. There currently is no better place
  * to do it, but over here is also not ideal... -- rgerhards, 2008-02-14
@@ -846,3 +857,264 @@ finalize_it:
 	}
 	RETiRet;
 }
+
+
+/* Fast scanners for escape processing. Both return the offset of the first
+ * byte inside p[0..len) which needs attention, or len if there is none.
+ * srScanChars() stops at c1, c2 and '\0'. srScanJSON() stops at every
+ * character that must be escaped in a JSON string (control characters
+ * including '\0', '"', '/' and '\\').
+ * On x86-64, 16 bytes (SSE2) or 32 bytes (AVX2, if supported by the CPU,
+ * detected at runtime) are checked at once; elsewhere, we scan byte by byte.
+ */
+#ifdef SR_AVX2_DISPATCH
+static int srHaveAVX2 = -1; /* -1: not yet checked; races are benign */
+
+static inline int
+srUseAVX2(void)
+{
+	if(srHaveAVX2 == -1)
+		srHaveAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	return srHaveAVX2;
+}
+
+static size_t __attribute__((target("avx2")))
+srScanCharsAVX2(const uchar *const p, const size_t len, const uchar c1, const uchar c2)
+{
+	const __m256i v1 = _mm256_set1_epi8((char) c1);
+	const __m256i v2 = _mm256_set1_epi8((char) c2);
+	const __m256i vz = _mm256_setzero_si256();
+	size_t i;
+	for(i = 0 ; i + 32 <= len ; i += 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i*) (p + i));
+		const unsigned mask = (unsigned) _mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, v1),
+							_mm256_cmpeq_epi8(x, v2)),
+					_mm256_cmpeq_epi8(x, vz)));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i;
+}
+
+static size_t __attribute__((target("avx2")))
+srScanJSONAVX2(const uchar *const p, const size_t len)
+{
+	const __m256i vctl = _mm256_set1_epi8(0x1f);
+	const __m256i vquot = _mm256_set1_epi8('"');
+	const __m256i vslash = _mm256_set1_epi8('/');
+	const __m256i vbslash = _mm256_set1_epi8('\\');
+	size_t i;
+	for(i = 0 ; i + 32 <= len ; i += 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i*) (p + i));
+		/* unsigned x <= 0x1f is the same as max(x, 0x1f) == 0x1f */
+		const __m256i ctl = _mm256_cmpeq_epi8(_mm256_max_epu8(x, vctl), vctl);
+		const unsigned mask = (unsigned) _mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_or_si256(ctl, _mm256_cmpeq_epi8(x, vquot)),
+					_mm256_or_si256(_mm256_cmpeq_epi8(x, vslash),
+							_mm256_cmpeq_epi8(x, vbslash))));
+		if(mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i;
+}
+#endif /* #ifdef SR_AVX2_DISPATCH */
+
+size_t
+srScanChars(const uchar *const p, const size_t len, const uchar c1, const uchar c2)
+{
+	size_t i = 0;
+#ifdef SR_AVX2_DISPATCH
+	if(len >= 32 && srUseAVX2()) {
+		i = srScanCharsAVX2(p, len, c1, c2);
+		if(i + 32 <= len)
+			return i; /* found inside a full block */
+	}
+#endif
+#ifdef __SSE2__
+	{
+		const __m128i v1 = _mm_set1_epi8((char) c1);
+		const __m128i v2 = _mm_set1_epi8((char) c2);
+		const __m128i vz = _mm_setzero_si128();
+		for( ; i + 16 <= len ; i += 16) {
+			const __m128i x = _mm_loadu_si128((const __m128i*) (p + i));
+			const int mask = _mm_movemask_epi8(
+				_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, v1),
+							  _mm_cmpeq_epi8(x, v2)),
+					     _mm_cmpeq_epi8(x, vz)));
+			if(mask != 0)
+				return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for( ; i < len ; ++i) {
+		if(p[i] == c1 || p[i] == c2 || p[i] == '\0')
+			break;
+	}
+	return i;
+}
+
+size_t
+srScanJSON(const uchar *const p, const size_t len)
+{
+	size_t i = 0;
+	uchar c;
+#ifdef SR_AVX2_DISPATCH
+	if(len >= 32 && srUseAVX2()) {
+		i = srScanJSONAVX2(p, len);
+		if(i + 32 <= len)
+			return i; /* found inside a full block */
+	}
+#endif
+#ifdef __SSE2__
+	{
+		const __m128i vctl = _mm_set1_epi8(0x1f);
+		const __m128i vquot = _mm_set1_epi8('"');
+		const __m128i vslash = _mm_set1_epi8('/');
+		const __m128i vbslash = _mm_set1_epi8('\\');
+		for( ; i + 16 <= len ; i += 16) {
+			const __m128i x = _mm_loadu_si128((const __m128i*) (p + i));
+			const __m128i ctl = _mm_cmpeq_epi8(_mm_max_epu8(x, vctl), vctl);
+			const int mask = _mm_movemask_epi8(
+				_mm_or_si128(_mm_or_si128(ctl, _mm_cmpeq_epi8(x, vquot)),
+					     _mm_or_si128(_mm_cmpeq_epi8(x, vslash),
+							  _mm_cmpeq_epi8(x, vbslash))));
+			if(mask != 0)
+				return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for( ; i < len ; ++i) {
+		c = p[i];
+		if(c < 0x20 || c == '"' || c == '/' || c == '\\')
+			break;
+	}
+	return i;
+}
+
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/* parse a cpuset in Linux "cpulist" format, e.g. "0-3,8,10-11" */
+static rsRetVal
+srParseCpulist(const char *spec, cpu_set_t *const set)
+{
+	long lo, hi;
+	char *end;
+	DEFiRet;
+
+	CPU_ZERO(set);
+	while(*spec != '\0' && *spec != '\n') {
+		lo = strtol(spec, &end, 10);
+		if(end == spec || lo < 0 || lo >= CPU_SETSIZE)
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		hi = lo;
+		if(*end == '-') {
+			spec = end + 1;
+			hi = strtol(spec, &end, 10);
+			if(end == spec || hi < lo || hi >= CPU_SETSIZE)
+				ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		}
+		for( ; lo <= hi ; ++lo)
+			CPU_SET(lo, set);
+		spec = end;
+		if(*spec == ',')
+			++spec;
+		else if(*spec != '\0' && *spec != '\n')
+			ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+	}
+	if(CPU_COUNT(set) == 0)
+		ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* build the cpu set from cpuset string and/or NUMA node. The node's
+ * CPUs are taken from sysfs; if both are given, their intersection is used.
+ */
+static rsRetVal
+srBuildAffinity(const uchar *const pszCpuset, const int numaNode, cpu_set_t *const set)
+{
+	cpu_set_t nodeSet;
+	char path[64];
+	char buf[4096];
+	FILE *fp;
+	DEFiRet;
+
+	if(pszCpuset != NULL)
+		CHKiRet(srParseCpulist((const char*) pszCpuset, set));
+	if(numaNode >= 0) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", numaNode);
+		if((fp = fopen(path, "r")) == NULL)
+			ABORT_FINALIZE(RS_RET_NOT_FOUND);
+		if(fgets(buf, sizeof(buf), fp) == NULL) {
+			fclose(fp);
+			ABORT_FINALIZE(RS_RET_NOT_FOUND);
+		}
+		fclose(fp);
+		CHKiRet(srParseCpulist(buf, &nodeSet));
+		if(pszCpuset == NULL) {
+			*set = nodeSet;
+		} else {
+			CPU_AND(set, set, &nodeSet);
+			if(CPU_COUNT(set) == 0)
+				ABORT_FINALIZE(RS_RET_INVALID_VALUE);
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_PTHREAD_SETAFFINITY_NP */
+
+
+/* check if a cpuset ("0-3,8") and/or NUMA node (-1 means none) can be
+ * used for thread affinity. This is meant to be called during config
+ * processing, so that errors can be reported to the user early.
+ */
+rsRetVal
+srCheckAffinity(const uchar *const pszCpuset, const int numaNode)
+{
+	DEFiRet;
+
+	if(pszCpuset == NULL && numaNode < 0)
+		FINALIZE;
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t set;
+	iRet = srBuildAffinity(pszCpuset, numaNode, &set);
+#else
+	iRet = RS_RET_NOT_IMPLEMENTED;
+#endif
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* pin the calling thread to the given cpuset and/or NUMA node. As the
+ * kernel allocates memory node-local to the CPU that first touches it,
+ * this also keeps the thread's buffers on its node.
+ */
+rsRetVal
+srSetThreadAffinity(const uchar *const pszCpuset, const int numaNode)
+{
+	DEFiRet;
+
+	if(pszCpuset == NULL && numaNode < 0)
+		FINALIZE;
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	cpu_set_t set;
+	int err;
+	CHKiRet(srBuildAffinity(pszCpuset, numaNode, &set));
+	if((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+		DBGPRINTF("pthread_setaffinity_np() failed with error %d\n", err);
+		ABORT_FINALIZE(RS_RET_ERR);
+	}
+#else
+	iRet = RS_RET_NOT_IMPLEMENTED;
+#endif
+
+finalize_it:
+	RETiRet;
+}
@@ -80,6 +80,8 @@ struct statsobj_s {
 	uchar *reporting_ns;
     statsobj_read_notifier_t read_notifier;
     void *read_notifier_ctx;
+	statsobj_read_notifier_t pre_read_notifier;
+	void *pre_read_notifier_ctx;
 	pthread_mutex_t mutCtr;		/* to guard counter linked-list ops */
 	ctr_t *ctrRoot;			/* doubly-linked list of statsobj counters */
 	ctr_t *ctrLast;
@@ -119,14 +121,16 @@ BEGINinterface(statsobj) /* name must also be changed in ENDinterface macro! */
 	void (*DestructUnlinkedCounter)(ctr_t *ctr);
 	ctr_t* (*UnlinkAllCounters)(statsobj_t *pThis);
 	rsRetVal (*EnableStats)(void);
+	rsRetVal (*SetPreReadNotifier)(statsobj_t *pThis, statsobj_read_notifier_t notifier, void* ctx);
 ENDinterface(statsobj)
-#define statsobjCURR_IF_VERSION 13 /* increment whenever you change the interface structure! */
+#define statsobjCURR_IF_VERSION 14 /* increment whenever you change the interface structure! */
 /* Changes
  * v2-v9 rserved for future use in "older" version branches
  * v10, 2012-04-01: GetAllStatsLines got fmt parameter
  * v11, 2013-09-07: - add "flags" to AddCounter API
  *                  - GetAllStatsLines got parameter telling if ctrs shall be reset
  * v13, 2016-05-19: GetAllStatsLines cb data type changed (char* instead of cstr)
+ * v14, 2018-04-10: added SetPreReadNotifier
  */
 
 
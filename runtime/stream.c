@@ -47,6 +47,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>	 /* required for HP UX */
+#include <sys/mman.h>
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
@@ -87,6 +88,8 @@ static rsRetVal doZipWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf, int bFlush
 static rsRetVal doZipFinish(strm_t *pThis);
 static rsRetVal strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf);
 static rsRetVal strmSeekCurrOffs(strm_t *pThis);
+static rsRetVal syncFile(strm_t *pThis);
+static void strmUnmap(strm_t *pThis);
 
 
 /* methods */
@@ -452,10 +455,16 @@ static rsRetVal strmCloseFile(strm_t *pThis)
 		}
 	}
 
+	strmUnmap(pThis);
+
 	/* the file may already be closed (or never have opened), so guard
 	 * against this. -- rgerhards, 2010-03-19
 	 */
 	if(pThis->fd != -1) {
+		if(pThis->bSync && pThis->bGroupCommit && pThis->tOperationsMode != STREAMMODE_READ) {
+			/* the owner syncs only the current file, so this one is ours */
+			syncFile(pThis);
+		}
 		currOffs = lseek64(pThis->fd, 0, SEEK_CUR);
 		close(pThis->fd);
 		pThis->fd = -1;
@@ -599,6 +608,97 @@ finalize_it:
 	RETiRet;
 }
 
+/* drop the current mapping (if any) and go back to our own read buffer.
+ */
+static void
+strmUnmap(strm_t *pThis)
+{
+	if(pThis->pMmap == NULL)
+		return;
+	munmap(pThis->pMmap, pThis->lenMmap);
+	pThis->pMmap = NULL;
+	pThis->lenMmap = 0;
+	pThis->offsMmapReleased = 0;
+	pThis->pIOBuf = pThis->pIOBufOwn;
+	pThis->iBufPtr = pThis->iBufPtrMax = 0;
+}
+
+
+/* mmap() counterpart of read(): make the rest of the file available as the
+ * current "buffer". The whole file is mapped and pIOBuf points right into the
+ * mapping, so the data is not copied at all. As the file may still be
+ * written to (queue files!), we re-map it if it grew since the last call.
+ * The OS file pointer is advanced just like read() would do, so seeking
+ * works as usual. Returns the number of bytes now available, 0 on EOF and
+ * -1 on error. If the file cannot be mapped, mmap mode is turned off and
+ * the caller must use read() instead.
+ */
+static ssize_t
+strmReadMmap(strm_t *pThis)
+{
+	struct stat statBuf;
+	off64_t pos;
+	void *pMap;
+
+	pos = lseek64(pThis->fd, 0, SEEK_CUR);
+	if(pos < 0)
+		return -1;
+
+	if((size_t) pos >= pThis->lenMmap) {
+		if(fstat(pThis->fd, &statBuf) != 0)
+			return -1;
+		if(statBuf.st_size <= pos)
+			return 0;
+		pMap = mmap(NULL, statBuf.st_size, PROT_READ, MAP_SHARED, pThis->fd, 0);
+		if(pMap == MAP_FAILED) {
+			DBGOPRINT((obj_t*) pThis, "file %d: mmap failed with errno %d, "
+				"falling back to read()\n", pThis->fd, errno);
+			strmUnmap(pThis);
+			pThis->bMmap = 0;
+			return -1;
+		}
+		if(pThis->pMmap == NULL) {
+			pThis->pIOBufOwn = pThis->pIOBuf;
+		} else {
+			munmap(pThis->pMmap, pThis->lenMmap);
+		}
+		madvise(pMap, statBuf.st_size, MADV_SEQUENTIAL);
+		pThis->pMmap = pMap;
+		pThis->lenMmap = statBuf.st_size;
+	}
+
+	if(lseek64(pThis->fd, pThis->lenMmap, SEEK_SET) < 0)
+		return -1;
+	pThis->pIOBuf = pThis->pMmap + pos;
+	return pThis->lenMmap - pos;
+}
+
+
+/* tell the stream that everything up to offs in file number fileNum has been
+ * consumed and will not be read again. In mmap mode, this releases the pages
+ * of the mapping, so that draining a large file does not make them pile up
+ * in our resident set. In all other cases, this is a null operation.
+ */
+void
+strmReleaseConsumed(strm_t *const pThis, const unsigned int fileNum, const int64 offs)
+{
+	size_t offsRelease;
+
+	ISOBJ_TYPE_assert(pThis, strm);
+	if(pThis->pMmap == NULL || pThis->iCurrFNum != fileNum || offs <= 0)
+		return;
+
+	offsRelease = (size_t) offs & ~((size_t) getpagesize() - 1);
+	if(offsRelease > pThis->lenMmap)
+		offsRelease = pThis->lenMmap & ~((size_t) getpagesize() - 1);
+	if(offsRelease > pThis->offsMmapReleased) {
+		madvise(pThis->pMmap + pThis->offsMmapReleased,
+			offsRelease - pThis->offsMmapReleased, MADV_DONTNEED);
+		pThis->offsMmapReleased = offsRelease;
+	}
+}
+
+
 /* read the next buffer from disk
  * rgerhards, 2008-02-13
  */
@@ -631,7 +731,12 @@ strmReadBuf(strm_t *pThis, int *padBytes)
 				toRead = (size_t) bytesLeft;
 			}
 		}
-		iLenRead = read(pThis->fd, pThis->pIOBuf, toRead);
+		if(pThis->bMmap && pThis->cryprov == NULL) {
+			iLenRead = strmReadMmap(pThis);
+		}
+		if(!pThis->bMmap || pThis->cryprov != NULL) {
+			iLenRead = read(pThis->fd, pThis->pIOBuf, toRead);
+		}
 		DBGOPRINT((obj_t*) pThis, "file %d read %ld bytes\n", pThis->fd, iLenRead);
 		/* end crypto */
 		if(iLenRead == 0) {
@@ -714,6 +819,98 @@ finalize_it:
 }
 
 
+/* read a block of exactly lenBuf octets. This is the bulk counterpart to
+ * strmReadChar() and is meant for binary records, where the caller knows
+ * the size in advance (e.g. from a length prefix). A block may span
+ * multiple IO buffers and, in circular mode, even files.
+ */
+rsRetVal
+strmReadBlock(strm_t *const pThis, uchar *pBuf, size_t lenBuf)
+{
+	int padBytes;
+	size_t toCopy;
+	DEFiRet;
+
+	ISOBJ_TYPE_assert(pThis, strm);
+
+	if(lenBuf > 0 && pThis->iUngetC != -1) {
+		*pBuf++ = pThis->iUngetC;
+		++pThis->iCurrOffs;
+		pThis->iUngetC = -1;
+		--lenBuf;
+	}
+
+	while(lenBuf > 0) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			padBytes = 0;
+			CHKiRet(strmReadBuf(pThis, &padBytes));
+			pThis->iCurrOffs += padBytes;
+		}
+		toCopy = pThis->iBufPtrMax - pThis->iBufPtr;
+		if(toCopy > lenBuf)
+			toCopy = lenBuf;
+		memcpy(pBuf, pThis->pIOBuf + pThis->iBufPtr, toCopy);
+		pThis->iBufPtr += toCopy;
+		pThis->iCurrOffs += toCopy;
+		pBuf += toCopy;
+		lenBuf -= toCopy;
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
+/* read up to and including the next LF and append the data in front of it
+ * to pCStr (the LF itself is not appended). Instead of going through
+ * strmReadChar() for each character, the IO buffer is scanned with memchr()
+ * and whole runs are appended. If EOF or an error is hit before a LF is found,
+ * the data read so far has been appended and the error is returned, just as
+ * if the caller had read character by character.
+ */
+static rsRetVal
+strmReadToLF(strm_t *const pThis, cstr_t *const pCStr)
+{
+	int padBytes;
+	uchar c;
+	uchar *pRun;
+	uchar *pLF;
+	size_t lenRun;
+	DEFiRet;
+
+	if(pThis->iUngetC != -1) {
+		CHKiRet(strmReadChar(pThis, &c));
+		if(c == '\n')
+			FINALIZE;
+		CHKiRet(cstrAppendChar(pCStr, c));
+	}
+
+	while(1) {
+		if(pThis->iBufPtr >= pThis->iBufPtrMax) {
+			padBytes = 0;
+			CHKiRet(strmReadBuf(pThis, &padBytes));
+			pThis->iCurrOffs += padBytes;
+		}
+		pRun = pThis->pIOBuf + pThis->iBufPtr;
+		lenRun = pThis->iBufPtrMax - pThis->iBufPtr;
+		pLF = memchr(pRun, '\n', lenRun);
+		if(pLF != NULL)
+			lenRun = pLF - pRun;
+		CHKiRet(rsCStrAppendStrWithLen(pCStr, pRun, lenRun));
+		pThis->iBufPtr += lenRun;
+		pThis->iCurrOffs += lenRun;
+		if(pLF != NULL) {
+			++pThis->iBufPtr; /* consume the LF */
+			++pThis->iCurrOffs;
+			break;
+		}
+	}
+
+finalize_it:
+	RETiRet;
+}
+
+
 /* unget a single character just like ungetc(). As with that call, there is only a single
  * character buffering capability.
  * rgerhards, 2008-01-07
@@ -742,6 +939,8 @@ static rsRetVal strmUnreadChar(strm_t *pThis, uchar c)
  * mode = 1 LFLF mode (paragraph, blank line between entries)
  * mode = 2 LF <not whitespace> mode, a log line starts at the beginning of
  * a line, but following lines that are indented are part of the same log entry
+ * Line content is read in bulk via strmReadToLF(), only the characters around
+ * the LFs go through the per-character state machine.
  */
 static rsRetVal
 strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF,
@@ -749,7 +948,6 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF,
 {
         uchar c;
 	uchar finished;
-	rsRetVal readCharRet;
         DEFiRet;
 
         ASSERT(pThis != NULL);
@@ -767,15 +965,13 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF,
 		cstrDestruct(&pThis->prevLineSegment);
 	}
         if(mode == 0) {
-		while(c != '\n') {
+		if(c != '\n') {
 			CHKiRet(cstrAppendChar(*ppCStr, c));
-			readCharRet = strmReadChar(pThis, &c);
-			if((readCharRet == RS_RET_TIMED_OUT) ||
-			   (readCharRet == RS_RET_EOF) ) { /* end reached without \n? */
-				CHKiRet(rsCStrConstructFromCStr(&pThis->prevLineSegment, *ppCStr));
-                	}
-                	CHKiRet(readCharRet);
-        	}
+			/* if the end is reached without \n, the partial line is
+			 * kept in prevLineSegment (see finalize_it).
+			 */
+			CHKiRet(strmReadToLF(pThis, *ppCStr));
+		}
 		if (trimLineOverBytes > 0 && (uint32_t) cstrLen(*ppCStr) > trimLineOverBytes) {
 			/* Truncate long line at trimLineOverBytes position */
 			dbgprintf("Truncate long line at %u, mode %d\n", trimLineOverBytes, mode);
@@ -788,8 +984,9 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF,
 		while(finished == 0){
         		if(c != '\n') {
                 		CHKiRet(cstrAppendChar(*ppCStr, c));
-                		CHKiRet(strmReadChar(pThis, &c));
 				pThis->bPrevWasNL = 0;
+				CHKiRet(strmReadToLF(pThis, *ppCStr));
+				c = '\n';
 			} else {
 				if ((((*ppCStr)->iStrLen) > 0) ){
 					if(pThis->bPrevWasNL) {
@@ -851,10 +1048,13 @@ strmReadLine(strm_t *pThis, cstr_t **ppCStr, uint8_t mode, sbool bEscapeLF,
 						} else {
 							CHKiRet(cstrAppendChar(*ppCStr, c));
 						}
+						CHKiRet(strmReadChar(pThis, &c));
 					} else {
+						/* rest of the line up to and including the LF */
 						CHKiRet(cstrAppendChar(*ppCStr, c));
+						CHKiRet(strmReadToLF(pThis, *ppCStr));
+						c = '\n';
 					}
-               				CHKiRet(strmReadChar(pThis, &c));
 				}
 			}
 		}
@@ -937,9 +1137,9 @@ strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *preg, const sbool bEs
 			cstrDestruct(&pThis->prevLineSegment);
 		}
 
-		while(c != '\n') {
+		if(c != '\n') {
 			CHKiRet(cstrAppendChar(thisLine, c));
-			readCharRet = strmReadChar(pThis, &c);
+			readCharRet = strmReadToLF(pThis, thisLine);
 			if(readCharRet == RS_RET_EOF) {/* end of file reached without \n? */
 				CHKiRet(rsCStrConstructFromCStr(&pThis->prevLineSegment, thisLine));
 			}
@@ -1563,6 +1763,41 @@ syncFile(strm_t *pThis)
 finalize_it:
 	RETiRet;
 }
+
+
+/* Group commit support. In group commit mode, writes are not synced one by
+ * one. Instead, the owner of the stream obtains private handles for the
+ * current file and its directory while it holds the lock that protects the
+ * stream, and later syncs them without holding that lock. As the handles
+ * are dup()ed, they stay valid even if the stream switches to a new file in
+ * the meantime. Files we switch away from are synced on close.
+ */
+rsRetVal
+strmGetSyncHandle(strm_t *const pThis, int *const pFd, int *const pFdDir)
+{
+	ISOBJ_TYPE_assert(pThis, strm);
+	*pFd = (pThis->fd == -1 || pThis->bIsTTY) ? -1 : dup(pThis->fd);
+	*pFdDir = (pThis->fdDir == -1) ? -1 : dup(pThis->fdDir);
+	return RS_RET_OK;
+}
+
+/* sync and close handles obtained via strmGetSyncHandle(). As with
+ * syncFile(), errors are ignored.
+ */
+void
+strmSyncHandle(const int fd, const int fdDir)
+{
+	if(fd != -1) {
+		if(SYNCCALL(fd) != 0)
+			DBGPRINTF("stream/strmSyncHandle: sync returned error %d, ignoring\n", errno);
+		close(fd);
+	}
+	if(fdDir != -1) {
+		if(fsync(fdDir) != 0)
+			DBGPRINTF("stream/strmSyncHandle: fsync for directory returned error, ignoring\n");
+		close(fdDir);
+	}
+}
 #undef SYNCCALL
 
 /* physically write to the output file. the provided data is ready for
@@ -1596,7 +1831,7 @@ strmPhysWrite(strm_t *pThis, uchar *pBuf, size_t lenBuf)
 	if(pThis->pUsrWCntr != NULL)
 		*pThis->pUsrWCntr += iWritten;
 
-	if(pThis->bSync) {
+	if(pThis->bSync && !pThis->bGroupCommit) {
 		CHKiRet(syncFile(pThis));
 	}
 
@@ -2009,6 +2244,8 @@ DEFpropSetMeth(strm, sType, strmType_t)
 DEFpropSetMeth(strm, iZipLevel, int)
 DEFpropSetMeth(strm, bVeryReliableZip, int)
 DEFpropSetMeth(strm, bSync, int)
+DEFpropSetMeth(strm, bGroupCommit, int)
+DEFpropSetMeth(strm, bMmap, int)
 DEFpropSetMeth(strm, bReopenOnTruncate, int)
 DEFpropSetMeth(strm, sIOBufSize, size_t)
 DEFpropSetMeth(strm, iSizeLimit, off_t)
@@ -2240,6 +2477,7 @@ strmDup(strm_t *const pThis, strm_t **ppNew)
 	pNew->iFileNumDigits = pThis->iFileNumDigits;
 	pNew->bDeleteOnClose = pThis->bDeleteOnClose;
 	pNew->iCurrOffs = pThis->iCurrOffs;
+	pNew->bMmap = pThis->bMmap;
 	
 	*ppNew = pNew;
 	pNew = NULL;
@@ -2392,6 +2630,8 @@ CODESTARTobjQueryInterface(strm)
 	pIf->SetiZipLevel = strmSetiZipLevel;
 	pIf->SetbVeryReliableZip = strmSetbVeryReliableZip;
 	pIf->SetbSync = strmSetbSync;
+	pIf->SetbGroupCommit = strmSetbGroupCommit;
+	pIf->SetbMmap = strmSetbMmap;
 	pIf->SetbReopenOnTruncate = strmSetbReopenOnTruncate;
 	pIf->SetsIOBufSize = strmSetsIOBufSize;
 	pIf->SetiSizeLimit = strmSetiSizeLimit;
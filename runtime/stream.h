@@ -113,7 +113,13 @@ typedef struct strm_s {
 	/* dynamic properties, valid only during file open, not to be persistet */
 	sbool bDisabled; /* should file no longer be written to? (currently set only if omfile file size limit fails) */
 	sbool bSync;	/* sync this file after every write? */
+	sbool bGroupCommit;/* with bSync: owner syncs via strmGetSyncHandle(), we sync only on close */
 	sbool bReopenOnTruncate;
+	sbool bMmap;	/* read via mmap() instead of read() (plain read streams only) */
+	uchar *pMmap;	/* current mapping of the whole file, NULL if none */
+	size_t lenMmap;	/* size of that mapping */
+	size_t offsMmapReleased; /* mapping pages up to here have already been released */
+	uchar *pIOBufOwn; /* our own read buffer while pIOBuf points into the mapping */
 	size_t sIOBufSize;/* size of IO buffer */
 	uchar *pszDir; /* Directory */
 	int lenDir;
@@ -213,18 +219,28 @@ BEGINinterface(strm) /* name must also be changed in ENDinterface macro! */
 	/* v9 added  2013-04-04 */
 	INTERFACEpropSetMeth(strm, cryprov, cryprov_if_t*);
 	INTERFACEpropSetMeth(strm, cryprovData, void*);
+	/* v14 added 2018-04-09 */
+	INTERFACEpropSetMeth(strm, bGroupCommit, int);
+	/* v15 added 2018-04-10 */
+	INTERFACEpropSetMeth(strm, bMmap, int);
 ENDinterface(strm)
-#define strmCURR_IF_VERSION 13 /* increment whenever you change the interface structure! */
+#define strmCURR_IF_VERSION 15 /* increment whenever you change the interface structure! */
 /* V10, 2013-09-10: added new parameter bEscapeLF, changed mode to uint8_t (rgerhards) */
 /* V11, 2015-12-03: added new parameter bReopenOnTruncate */
 /* V12, 2015-12-11: added new parameter trimLineOverBytes, changed mode to uint32_t */
 /* V13, 2017-09-06: added new parameter strtoffs to ReadLine() */
+/* V14, 2018-04-09: added bGroupCommit */
+/* V15, 2018-04-10: added bMmap */
 
 #define strmGetCurrFileNum(pStrm) ((pStrm)->iCurrFNum)
 
 /* prototypes */
 PROTOTYPEObjClassInit(strm);
 rsRetVal strmMultiFileSeek(strm_t *pThis, unsigned int fileNum, off64_t offs, off64_t *bytesDel);
+rsRetVal strmReadBlock(strm_t *pThis, uchar *pBuf, size_t lenBuf);
+void strmReleaseConsumed(strm_t *pThis, unsigned int fileNum, int64 offs);
+rsRetVal strmGetSyncHandle(strm_t *pThis, int *pFd, int *pFdDir);
+void strmSyncHandle(int fd, int fdDir);
 rsRetVal strmReadMultiLine(strm_t *pThis, cstr_t **ppCStr, regex_t *preg,
 	sbool bEscapeLF, sbool discardTruncatedMsg, sbool msgDiscardingError, int64 *const strtOffs);
 int strmReadMultiLine_isTimedOut(const strm_t *const __restrict__ pThis);
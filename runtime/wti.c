@@ -48,6 +48,9 @@
 #include "action.h"
 #include "atomic.h"
 
+/* number of nesting levels of batch executor masks preallocated per worker */
+#define WTI_BATCH_MASK_PREALLOC_LVLS 4
+
 /* static data */
 DEFobjStaticHelpers
 DEFobjCurrIf(glbl)
@@ -207,6 +210,13 @@ BEGINobjDestruct(wti) /* be sure to specify the object type also in END and CODE
 CODESTARTobjDestruct(wti)
 	/* actual destruction */
 	batchFree(&pThis->batch);
+	for(int i = 0 ; i < CNFEXPRPROG_MAXREGS ; ++i) {
+		if(pThis->exprRegs[i] != NULL)
+			es_deleteStr(pThis->exprRegs[i]);
+	}
+	for(int i = 0 ; i < pThis->nBatchMasks ; ++i)
+		free(pThis->batchMasks[i].pMask);
+	free(pThis->batchMasks);
 	free(pThis->actWrkrInfo);
 	pthread_cond_destroy(&pThis->pcondBusy);
 	DESTROY_ATOMIC_HELPER_MUT(pThis->mutIsRunning);
@@ -251,11 +261,71 @@ wtiConstructFinalize(wti_t *pThis)
 	CHKiRet(pThis->pWtp->pfGetDeqBatchSize(pThis->pWtp->pUsr, &iDeqBatchSize));
 	CHKiRet(batchInit(&pThis->batch, iDeqBatchSize));
 
+	/* preallocate the batch executor's scratch masks for the outermost
+	 * levels, so that a full batch does not need any malloc.
+	 */
+	for(int i = 0 ; i < WTI_BATCH_MASK_PREALLOC_LVLS ; ++i) {
+		if(wtiGetBatchMask(pThis, 2 * (size_t) iDeqBatchSize) == NULL)
+			ABORT_FINALIZE(RS_RET_OUT_OF_MEMORY);
+	}
+	pThis->iBatchMaskLvl = 0;
+
 finalize_it:
 	RETiRet;
 }
 
 
+/* obtain a zero-initialized scratch array of nElem sbools for the batch
+ * script executor. Conditions may be nested, and every level needs its own
+ * masks while the inner levels run, so there is one array per nesting level.
+ * The arrays are kept for the lifetime of the worker and only grow, so
+ * after warm-up this does not allocate. Must be paired with
+ * wtiReleaseBatchMask(). Returns NULL if out of memory.
+ */
+sbool *
+wtiGetBatchMask(wti_t *const pThis, const size_t nElem)
+{
+	wtiBatchMask_t *pLvl;
+	size_t lenNew;
+
+	if(pThis->iBatchMaskLvl == pThis->nBatchMasks) {
+		wtiBatchMask_t *const newMasks = realloc(pThis->batchMasks,
+			(pThis->nBatchMasks + 1) * sizeof(wtiBatchMask_t));
+		if(newMasks == NULL)
+			return NULL;
+		pThis->batchMasks = newMasks;
+		pThis->batchMasks[pThis->nBatchMasks].pMask = NULL;
+		pThis->batchMasks[pThis->nBatchMasks].lenMask = 0;
+		++pThis->nBatchMasks;
+	}
+
+	pLvl = &pThis->batchMasks[pThis->iBatchMaskLvl];
+	if(pLvl->lenMask < nElem) {
+		/* size for the largest batch we can see, not just this one */
+		lenNew = 2 * (size_t) pThis->batch.maxElem;
+		if(lenNew < nElem)
+			lenNew = nElem;
+		free(pLvl->pMask);
+		if((pLvl->pMask = malloc(lenNew * sizeof(sbool))) == NULL) {
+			pLvl->lenMask = 0;
+			return NULL;
+		}
+		pLvl->lenMask = lenNew;
+	}
+	memset(pLvl->pMask, 0, nElem * sizeof(sbool));
+	++pThis->iBatchMaskLvl;
+	return pLvl->pMask;
+}
+
+/* give back the mask most recently obtained by wtiGetBatchMask() */
+void
+wtiReleaseBatchMask(wti_t *const pThis)
+{
+	assert(pThis->iBatchMaskLvl > 0);
+	--pThis->iBatchMaskLvl;
+}
+
+
 /* cancellation cleanup handler for queueWorker ()
  * Most importantly, it must bring back the batch into a consistent state.
  * Keep in mind that cancellation is disabled if we run into
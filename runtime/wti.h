@@ -28,6 +28,7 @@
 #include "obj.h"
 #include "batch.h"
 #include "action.h"
+#include "rainerscript.h"
 
 
 #define ACT_STATE_RDY  0	/* action ready, waiting for new transaction */
@@ -63,6 +64,12 @@ typedef struct actWrkrInfo {
 	} p; /* short name for "parameters" */
 } actWrkrInfo_t;
 
+/* scratch array for the batch script executor, see wtiGetBatchMask() */
+typedef struct wtiBatchMask_s {
+	sbool *pMask;
+	size_t lenMask;
+} wtiBatchMask_t;
+
 /* the worker thread instance class */
 struct wti_s {
 	BEGINobjInstance;
@@ -86,6 +93,11 @@ struct wti_s {
 					* also be added as a user-selectable option (not implemented yet)
 					*/
 	} execState;	/* state for the execution engine */
+	es_str_t *exprRegs[CNFEXPRPROG_MAXREGS]; /* string registers for compiled expressions,
+						  * kept across messages to avoid malloc */
+	wtiBatchMask_t *batchMasks; /* one scratch mask per nesting level of the batch executor */
+	int nBatchMasks;	/* number of levels allocated */
+	int iBatchMaskLvl;	/* number of levels currently in use */
 };
 
 
@@ -101,6 +113,8 @@ rsRetVal wtiSetState(wti_t * const pThis, int bNew);
 rsRetVal wtiWakeupThrd(wti_t * const pThis);
 int wtiGetState(wti_t * const pThis);
 wti_t *wtiGetDummy(void);
+sbool *wtiGetBatchMask(wti_t *const pThis, const size_t nElem);
+void wtiReleaseBatchMask(wti_t *const pThis);
 PROTOTYPEObjClassInit(wti);
 PROTOTYPEObjClassExit(wti);
 PROTOTYPEpropSetMeth(wti, pszDbgHdr, uchar*);
@@ -104,6 +104,7 @@ BEGINobjConstruct(wtp) /* be sure to specify the object type also in END macro!
 	pThis->pfGetDeqBatchSize = (rsRetVal (*)(void*,int*))NotImplementedDummy;
 	pThis->pfDoWork = (rsRetVal (*)(void*,void*))NotImplementedDummy;
 	pThis->pfObjProcessed = (rsRetVal (*)(void*,wti_t*))NotImplementedDummy;
+	pThis->iNumaNode = -1;
 	INIT_ATOMIC_HELPER_MUT(pThis->mutCurNumWrkThrd);
 	INIT_ATOMIC_HELPER_MUT(pThis->mutWtpState);
 ENDobjConstruct(wtp)
@@ -404,6 +405,11 @@ wtpWorker(void *arg) /* the arg is actually a wti object, even though we are in
 	dbgOutputTID((char*)thrdName);
 #	endif
 
+	/* errors were already reported during config load, so we just note them */
+	if(srSetThreadAffinity(pThis->pszCpuset, pThis->iNumaNode) != RS_RET_OK) {
+		DBGPRINTF("%s: could not set worker CPU affinity\n", wtpGetDbgHdr(pThis));
+	}
+
         /* let the parent know we're done with initialization */
         d_pthread_mutex_lock(&pThis->mutWtp);
 	wtiSetState(pWti, WRKTHRD_RUNNING);
@@ -539,6 +545,8 @@ finalize_it:
 DEFpropSetMeth(wtp, toWrkShutdown, long)
 DEFpropSetMeth(wtp, wtpState, wtpState_t)
 DEFpropSetMeth(wtp, iNumWorkerThreads, int)
+DEFpropSetMeth(wtp, pszCpuset, uchar*)
+DEFpropSetMeth(wtp, iNumaNode, int)
 DEFpropSetMeth(wtp, pUsr, void*)
 DEFpropSetMethPTR(wtp, pmutUsr, pthread_mutex_t)
 DEFpropSetMethFP(wtp, pfChkStopWrkr, rsRetVal(*pVal)(void*, int))
@@ -51,6 +51,8 @@ struct wtp_s {
 	int 	iCurNumWrkThrd;/* current number of active worker threads */
 	struct wti_s **pWrkr;/* array with control structure for the worker thread(s) associated with this wtp */
 	int	toWrkShutdown;	/* timeout for idle workers in ms, -1 means indefinite (0 is immediate) */
+	uchar	*pszCpuset;	/* CPUs to pin workers to (owned by user object), NULL - no pinning */
+	int	iNumaNode;	/* NUMA node to pin workers to, -1 - none */
 	rsRetVal (*pConsumer)(void *); /* user-supplied consumer function for dewtpd messages */
 	/* synchronization variables */
 	pthread_mutex_t mutWtp; /* mutex for the wtp's thread management */
@@ -99,6 +101,8 @@ PROTOTYPEpropSetMeth(wtp, wtpState, wtpState_t);
 PROTOTYPEpropSetMeth(wtp, iMaxWorkerThreads, int);
 PROTOTYPEpropSetMeth(wtp, pUsr, void*);
 PROTOTYPEpropSetMeth(wtp, iNumWorkerThreads, int);
+PROTOTYPEpropSetMeth(wtp, pszCpuset, uchar*);
+PROTOTYPEpropSetMeth(wtp, iNumaNode, int);
 PROTOTYPEpropSetMethPTR(wtp, pmutUsr, pthread_mutex_t);
 
 #endif /* #ifndef WTP_H_INCLUDED */
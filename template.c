@@ -47,6 +47,7 @@
 #include "msg.h"
 #include "parserif.h"
 #include "unicode-helper.h"
+#include "srUtils.h"
 
 #if !defined(_AIX)
 #pragma GCC diagnostic ignored "-Wswitch-enum"
@@ -141,6 +142,221 @@ finalize_it:
 }
 
 
+/* check if a field entry needs no processing except for jsonf/jsonfr
+ * formatting. Such entries can be streamed directly into the output
+ * buffer, without MsgGetProp() building the "name":"value" string first.
+ */
+static int
+tplIsPureJSONF(const struct templateEntry *const pTpe)
+{
+	return pTpe->fieldName != NULL
+		&& (pTpe->data.field.options.bJSONf || pTpe->data.field.options.bJSONfr)
+		&& !pTpe->data.field.options.bJSONr
+		&& !pTpe->data.field.options.bJSON
+		&& !pTpe->data.field.options.bCSV
+		&& pTpe->data.field.has_fields == 0
+#ifdef FEATURE_REGEXP
+		&& pTpe->data.field.has_regex == 0
+#endif
+		&& pTpe->data.field.iFromPos == 0
+		&& pTpe->data.field.iToPos == 0
+		&& pTpe->data.field.eCaseConv == tplCaseConvNo
+		&& !pTpe->data.field.options.bDropCC
+		&& !pTpe->data.field.options.bSpaceCC
+		&& !pTpe->data.field.options.bEscapeCC
+		&& !pTpe->data.field.options.bCompressSP
+		&& !pTpe->data.field.options.bDropLastLF
+		&& !pTpe->data.field.options.bSecPathDrop
+		&& !pTpe->data.field.options.bSecPathReplace
+		&& !pTpe->data.field.options.bSPIffNo1stSP
+		&& !pTpe->data.field.options.bFixedWidth;
+}
+
+
+/* free the compiled form of a template (if any) */
+static void
+tplFreeOps(struct template *const pTpl)
+{
+	int i;
+
+	if(pTpl->pOps == NULL)
+		return;
+	for(i = 0 ; i < pTpl->nOps ; ++i)
+		free(pTpl->pOps[i].pTpeRaw);
+	free(pTpl->pOps);
+	pTpl->pOps = NULL;
+	pTpl->nOps = 0;
+}
+
+
+/* Compile the entry list of a "regular" template into a flat op array.
+ * This is done once at config load. If the template cannot be compiled,
+ * pOps stays NULL and tplToString() uses the entry list directly.
+ */
+static void
+tplCompile(struct template *const pTpl)
+{
+	struct templateEntry *pTpe;
+	struct tplOp *pOps;
+	int i;
+
+	if(pTpl->pStrgen != NULL || pTpl->bHaveSubtree || pTpl->pOps != NULL
+	   || pTpl->tpenElements == 0 || pTpl->tpenElements > TPL_MAX_OPS)
+		return;
+
+	if((pOps = calloc(pTpl->tpenElements, sizeof(struct tplOp))) == NULL)
+		return; /* not a problem, we just render via the entry list */
+
+	i = 0;
+	for(pTpe = pTpl->pEntryRoot ; pTpe != NULL ; pTpe = pTpe->pNext) {
+		if(i == pTpl->tpenElements || pTpe->eEntryType == UNDEFINED)
+			goto fail;
+		pOps[i].pTpe = pTpe;
+		pOps[i].escapeMode = NO_ESCAPE;
+		if(pTpe->eEntryType == CONSTANT) {
+			pOps[i].type = TPLOP_CONST;
+		} else if(tplIsPureJSONF(pTpe) && (pTpl->optFormatEscape == NO_ESCAPE
+			  || pTpl->optFormatEscape == JSONF)) {
+			if((pOps[i].pTpeRaw = malloc(sizeof(struct templateEntry))) == NULL)
+				goto fail;
+			/* shallow copy: property name etc. remain owned by pTpe */
+			memcpy(pOps[i].pTpeRaw, pTpe, sizeof(struct templateEntry));
+			pOps[i].pTpeRaw->bComplexProcessing = 0;
+			pOps[i].pTpeRaw->pNext = NULL;
+			pOps[i].type = TPLOP_JSONF;
+			pOps[i].bEscapeAll = pTpe->data.field.options.bJSONf ? RSTRUE : RSFALSE;
+			pOps[i].getter = MsgGetPropGetter(pOps[i].pTpeRaw);
+		} else {
+			pOps[i].getter = MsgGetPropGetter(pTpe);
+			pOps[i].type = (pOps[i].getter == NULL) ? TPLOP_PROP : TPLOP_GETTER;
+			if(pTpl->optFormatEscape == SQL_ESCAPE
+			   || pTpl->optFormatEscape == JSON_ESCAPE
+			   || pTpl->optFormatEscape == STDSQL_ESCAPE)
+				pOps[i].escapeMode = pTpl->optFormatEscape;
+		}
+		++i;
+	}
+
+	pTpl->pOps = pOps;
+	pTpl->nOps = i;
+	DBGPRINTF("template '%s' compiled into %d ops\n", pTpl->pszName, i);
+	return;
+
+fail:	/* not a problem, we just render via the entry list */
+	pTpl->pOps = pOps;
+	pTpl->nOps = pTpl->tpenElements; /* pOps was calloc()ed, so unused slots are NULL */
+	tplFreeOps(pTpl);
+}
+
+
+/* Render a compiled template. All values are obtained first, so that the
+ * size of the result is known and the output buffer needs to be extended
+ * at most once. The result is identical to the entry-list loop in
+ * tplToString().
+ */
+static rsRetVal
+tplToStringCompiled(struct template *__restrict__ const pTpl,
+	    smsg_t *__restrict__ const pMsg,
+	    actWrkrIParams_t *__restrict__ const iparam,
+	    struct syslogTime *const ttNow)
+{
+	struct {
+		uchar *pVal;
+		rs_size_t iLenVal;	/* length of value as obtained */
+		rs_size_t iLenOut;	/* length of value in output */
+		unsigned short bMustBeFreed;
+	} vals[TPL_MAX_OPS];
+	struct tplOp *pOp;
+	const int nOps = pTpl->nOps;
+	const int bJSONF = (pTpl->optFormatEscape == JSONF);
+	size_t lenTotal;
+	size_t iBuf;
+	int i;
+	DEFiRet;
+
+	/* pass 1: obtain values and compute the result size */
+	lenTotal = bJSONF ? 1 : 0;
+	for(i = 0 ; i < nOps ; ++i) {
+		pOp = pTpl->pOps + i;
+		vals[i].bMustBeFreed = 0;
+		switch(pOp->type) {
+		case TPLOP_CONST:
+			vals[i].pVal = pOp->pTpe->data.constant.pConstant;
+			vals[i].iLenVal = pOp->pTpe->data.constant.iLenConstant;
+			break;
+		case TPLOP_GETTER:
+			vals[i].pVal = pOp->getter(pMsg, pOp->pTpe, &vals[i].iLenVal);
+			break;
+		case TPLOP_JSONF:
+			if(pOp->getter != NULL) {
+				vals[i].pVal = pOp->getter(pMsg, pOp->pTpeRaw, &vals[i].iLenVal);
+			} else {
+				vals[i].pVal = MsgGetProp(pMsg, pOp->pTpeRaw, &pOp->pTpeRaw->data.field.msgProp,
+							  &vals[i].iLenVal, &vals[i].bMustBeFreed, ttNow);
+			}
+			break;
+		case TPLOP_PROP:
+		default:
+			vals[i].pVal = MsgGetProp(pMsg, pOp->pTpe, &pOp->pTpe->data.field.msgProp,
+						  &vals[i].iLenVal, &vals[i].bMustBeFreed, ttNow);
+			break;
+		}
+		if(pOp->escapeMode != NO_ESCAPE)
+			doEscape(&vals[i].pVal, &vals[i].iLenVal, &vals[i].bMustBeFreed, pOp->escapeMode);
+		if(pOp->type == TPLOP_JSONF) {
+			/* "name":"value" - the opening quote, the three chars ":"
+			 * and the closing quote (the separator is counted below),
+			 * exactly as written in pass 2 and by jsonField().
+			 */
+			vals[i].iLenOut = pOp->pTpe->lenFieldName + 5
+				+ jsonEscapeBuf(NULL, vals[i].pVal, vals[i].iLenVal, pOp->bEscapeAll);
+		} else {
+			vals[i].iLenOut = vals[i].iLenVal;
+		}
+		if(vals[i].iLenOut > 0) /* may be zero depending on property */
+			lenTotal += vals[i].iLenOut + (bJSONF ? 2 : 0);
+	}
+
+	/* pass 2: copy values over */
+	if(lenTotal >= iparam->lenBuf) /* we reserve one char for the final \0! */
+		CHKiRet(ExtendBuf(iparam, lenTotal + 1));
+	iBuf = 0;
+	if(bJSONF)
+		iparam->param[iBuf++] = '{';
+	for(i = 0 ; i < nOps ; ++i) {
+		if(vals[i].iLenOut <= 0)
+			continue;
+		pOp = pTpl->pOps + i;
+		if(pOp->type == TPLOP_JSONF) {
+			iparam->param[iBuf++] = '"';
+			memcpy(iparam->param + iBuf, pOp->pTpe->fieldName, pOp->pTpe->lenFieldName);
+			iBuf += pOp->pTpe->lenFieldName;
+			memcpy(iparam->param + iBuf, "\":\"", 3);
+			iBuf += 3;
+			iBuf += jsonEscapeBuf(iparam->param + iBuf, vals[i].pVal, vals[i].iLenVal,
+				pOp->bEscapeAll);
+			iparam->param[iBuf++] = '"';
+		} else {
+			memcpy(iparam->param + iBuf, vals[i].pVal, vals[i].iLenVal);
+			iBuf += vals[i].iLenVal;
+		}
+		if(bJSONF) {
+			memcpy(iparam->param + iBuf, (i == nOps - 1) ? "}\n" : ", ", 2);
+			iBuf += 2;
+		}
+	}
+	iparam->param[iBuf] = '\0';
+	iparam->lenStr = iBuf;
+
+finalize_it:
+	for(i = 0 ; i < nOps ; ++i) {
+		if(vals[i].bMustBeFreed)
+			free(vals[i].pVal);
+	}
+	RETiRet;
+}
+
+
 /* This functions converts a template into a string.
  *
  * The function takes a pointer to a template and a pointer to a msg object
@@ -184,6 +400,11 @@ tplToString(struct template *__restrict__ const pTpl,
 	
 	/* we have a "regular" template with template entries */
 
+	if(pTpl->pOps != NULL) {
+		CHKiRet(tplToStringCompiled(pTpl, pMsg, iparam, ttNow));
+		FINALIZE;
+	}
+
 	/* loop through the template. We obtain one value
 	 * and copy it over to our dynamic string buffer. Then, we
 	 * free the obtained value (if requested). We continue this
@@ -474,64 +695,76 @@ rsRetVal
 doEscape(uchar **pp, rs_size_t *pLen, unsigned short *pbMustBeFreed, int mode)
 {
 	DEFiRet;
-	uchar *p = NULL;
-	int iLen;
-	cstr_t *pStrB = NULL;
+	uchar *p;
+	uchar *pDst;
 	uchar *pszGenerated;
+	uchar c1, c2;
+	size_t len;
+	size_t lenEnd;
+	size_t i;
+	size_t n;
+	size_t nEsc;
 
 	assert(pp != NULL);
 	assert(*pp != NULL);
 	assert(pLen != NULL);
 	assert(pbMustBeFreed != NULL);
 
-	/* first check if we need to do anything at all... */
-	if(mode == STDSQL_ESCAPE)
-		for(p = *pp ; *p && *p != '\'' ; ++p)
-			;
-	else if(mode == SQL_ESCAPE)
-		for(p = *pp ; *p && *p != '\'' && *p != '\\' ; ++p)
-			;
-	else if(mode == JSON_ESCAPE)
-		for(p = *pp ; *p &&  (*p == '"' || *p == '\\' ) ; ++p)
-			;
-	/* when we get out of the loop, we are either at the
-	 * string terminator or the first character to escape */
-	if(p && *p == '\0')
-		FINALIZE; /* nothing to do in this case! */
+	/* characters to be escaped */
+	if(mode == STDSQL_ESCAPE) {
+		c1 = c2 = '\'';
+	} else if(mode == SQL_ESCAPE) {
+		c1 = '\'';
+		c2 = '\\';
+	} else if(mode == JSON_ESCAPE) {
+		c1 = '"';
+		c2 = '\\';
+	} else {
+		FINALIZE;
+	}
 
+	/* first check if we need to do anything at all... */
 	p = *pp;
-	iLen = *pLen;
-	CHKiRet(cstrConstruct(&pStrB));
+	len = *pLen;
+	i = srScanChars(p, len, c1, c2);
+	/* we are now either at the end of the string or the first character to escape */
+	if(i == len || p[i] == '\0')
+		FINALIZE; /* nothing to do in this case! */
 
-	while(*p) {
-		if((mode == SQL_ESCAPE || mode == STDSQL_ESCAPE) && *p == '\'') {
-			CHKiRet(cstrAppendChar(pStrB, (mode == STDSQL_ESCAPE) ? '\'' : '\\'));
-			iLen++;	/* reflect the extra character */
-		} else if((mode == SQL_ESCAPE) && *p == '\\') {
-			CHKiRet(cstrAppendChar(pStrB, '\\'));
-			iLen++;	/* reflect the extra character */
-		} else if((mode == JSON_ESCAPE) &&  (*p == '"' || *p == '\\' )) {
-			CHKiRet(cstrAppendChar(pStrB, '\\'));
-			iLen++;	/* reflect the extra character */
-		}
-		CHKiRet(cstrAppendChar(pStrB, *p));
-		++p;
-	}
-	cstrFinalize(pStrB);
-	CHKiRet(cstrConvSzStrAndDestruct(&pStrB, &pszGenerated, 0));
+	/* count the characters to escape, so that the result can be allocated
+	 * at once. Clean runs between them are skipped by the fast scanner.
+	 */
+	nEsc = 0;
+	lenEnd = i;
+	while(lenEnd < len && p[lenEnd] != '\0') {
+		++nEsc;
+		++lenEnd;
+		lenEnd += srScanChars(p + lenEnd, len - lenEnd, c1, c2);
+	}
+
+	CHKmalloc(pszGenerated = MALLOC(lenEnd + nEsc + 1));
+	memcpy(pszGenerated, p, i);
+	pDst = pszGenerated + i;
+	while(i < lenEnd) {
+		*pDst++ = (mode == STDSQL_ESCAPE) ? '\'' : '\\';
+		*pDst++ = p[i++];
+		n = srScanChars(p + i, lenEnd - i, c1, c2);
+		memcpy(pDst, p + i, n);
+		pDst += n;
+		i += n;
+	}
+	*pDst = '\0';
 
 	if(*pbMustBeFreed)
 		free(*pp); /* discard previous value */
 
 	*pp = pszGenerated;
-	*pLen = iLen;
+	*pLen = pDst - pszGenerated;
 	*pbMustBeFreed = 1;
 
 finalize_it:
 	if(iRet != RS_RET_OK) {
 		doEmergencyEscape(*pp, mode);
-		if(pStrB != NULL)
-			cstrDestruct(&pStrB);
 	}
 
 	RETiRet;
@@ -1434,6 +1667,7 @@ struct template *tplAddLine(rsconf_t *conf, const char* pName, uchar** ppRestOfC
 
 	*ppRestOfConfLine = p;
 	apply_case_sensitivity(pTpl);
+	tplCompile(pTpl);
 
 	return(pTpl);
 }
@@ -2135,6 +2369,7 @@ tplProcessCnf(struct cnfobj *o)
 	if(o_casesensitive)
 		pTpl->optCaseSensitive = 1;
 	apply_case_sensitivity(pTpl);
+	tplCompile(pTpl);
 finalize_it:
 	free(tplStr);
 	free(plugin);
@@ -2227,6 +2462,7 @@ void tplDeleteAll(rsconf_t *conf)
 		pTplDel = pTpl;
 		pTpl = pTpl->pNext;
 		free(pTplDel->pszName);
+		tplFreeOps(pTplDel);
 		if(pTplDel->bHaveSubtree)
 			msgPropDescrDestruct(&pTplDel->subtree);
 		free(pTplDel);
@@ -2285,6 +2521,7 @@ void tplDeleteNew(rsconf_t *conf)
 		pTplDel = pTpl;
 		pTpl = pTpl->pNext;
 		free(pTplDel->pszName);
+		tplFreeOps(pTplDel);
 		if(pTplDel->bHaveSubtree)
 			msgPropDescrDestruct(&pTplDel->subtree);
 		free(pTplDel);
@@ -56,6 +56,8 @@ struct template {
 	 * than short...
 	 */
 	char optCaseSensitive;  /* case-sensitive variable property references, default False, 0 */
+	struct tplOp *pOps;	/* compiled form of the entry list, NULL if not compiled */
+	int nOps;		/* number of elements in pOps */
 };
 
 enum EntryTypes { UNDEFINED = 0, CONSTANT = 1, FIELD = 2 };
@@ -138,6 +140,25 @@ struct templateEntry {
 	} data;
 };
 
+/* a compiled template entry. At config load, the entry list of a "regular"
+ * template is turned into a flat array of these, so that tplToString() does
+ * not need to decide on each entry's processing for every message.
+ */
+#define TPL_MAX_OPS 64	/* templates with more entries are not compiled */
+enum tplOpType { TPLOP_CONST = 0,	/* copy constant text */
+		 TPLOP_GETTER = 1,	/* call direct property getter */
+		 TPLOP_PROP = 2,	/* full MsgGetProp() call */
+		 TPLOP_JSONF = 3	/* "name":"value" streamed into output */
+	       };
+struct tplOp {
+	enum tplOpType type;
+	char escapeMode;		/* doEscape() mode to apply, NO_ESCAPE if none */
+	sbool bEscapeAll;		/* for TPLOP_JSONF: jsonf (1) or jsonfr (0) */
+	msgPropGetter_t getter;		/* for TPLOP_GETTER, TPLOP_JSONF: direct getter or NULL */
+	struct templateEntry *pTpe;	/* entry this op was compiled from */
+	struct templateEntry *pTpeRaw;	/* for TPLOP_JSONF: copy of pTpe without processing */
+};
+
 
 /* interfaces */
 BEGINinterface(tpl) /* name must also be changed in ENDinterface macro! */
@@ -0,0 +1,54 @@
+#!/bin/bash
+# check that allowed sender prefixes which do not end on a trie
+# stride boundary are correctly matched, also when mixed with
+# hostname wildcard entries. The sender is always 127.0.0.1, so for the
+# negative cases we vary the ACL: a prefix that does not contain the
+# sender and a near-miss prefix, one bit longer than the one that would
+# match. Messages from such senders must be rejected.
+# added 2018-04-16, released under ASL 2.0
+. $srcdir/diag.sh init
+
+# $1 - allowed senders
+run_acl() {
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+$AllowedSender TCP, '"$1"'
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+			         file="rsyslog.out.log")
+'
+. $srcdir/diag.sh startup
+}
+
+# 127.0.0.1 is inside 127.0.0.0/9 and 127.0.0.0/31
+run_acl "192.0.2.0/24, *.example.net, 127.0.0.0/9, 198.51.100.7"
+. $srcdir/diag.sh tcpflood -m1000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 999
+rm -f rsyslog.out.log
+
+run_acl "192.0.2.0/24, 127.0.0.0/31"
+. $srcdir/diag.sh tcpflood -m1000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 999
+rm -f rsyslog.out.log
+
+# negative cases: sender outside the prefix and near-miss prefix length
+for acl in "192.0.2.0/24, *.example.net, 127.128.0.0/9, 198.51.100.7" \
+	   "192.0.2.0/24, 127.0.0.0/32"; do
+	run_acl "$acl"
+	./tcpflood -m100 > /dev/null 2>&1 # connection is dropped by rsyslog
+	. $srcdir/diag.sh shutdown-when-empty
+	. $srcdir/diag.sh wait-shutdown
+	if [ -s rsyslog.out.log ]; then
+		echo "FAIL: message from 127.0.0.1 accepted with AllowedSender $acl:"
+		head rsyslog.out.log
+		. $srcdir/diag.sh error-exit 1
+	fi
+done
+. $srcdir/diag.sh exit
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Test that a disk queue switched to the binary record format can still
+# read the text-format records that were persisted by a previous run.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(workDirectory="test-spool")
+main_queue(queue.type="Disk" queue.filename="mainq" queue.serializationFormat="text"
+	   queue.timeoutShutdown="1" queue.saveOnShutdown="on")
+module(load="../plugins/omtesting/.libs/omtesting")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" file="rsyslog.out.log" template="outfmt")
+:msg, contains, "msgnum:" :omtesting:sleep 0 1000
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg 0 5000
+. $srcdir/diag.sh shutdown-immediate
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh check-mainq-spool
+
+# now restart with binary format, new records are appended to the old ones
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(workDirectory="test-spool")
+main_queue(queue.type="Disk" queue.filename="mainq" queue.serializationFormat="binary")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg 5000 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+# duplicates are permitted, see queue-persist-drvr.sh
+. $srcdir/diag.sh seq-check 0 9999 -d
+. $srcdir/diag.sh exit
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Test for the binary disk queue record format. Message variables are
+# set before the action queue, so they need to survive the round trip
+# through the queue files.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(workDirectory="test-spool")
+main_queue(queue.type="Disk" queue.filename="mainq" queue.serializationFormat="binary")
+
+template(name="outfmt" type="string" string="%$!num%\n")
+if $msg contains "msgnum:" then {
+	set $!num = field($msg, 58, 2);
+	action(type="omfile" file="rsyslog.out.log" template="outfmt"
+	       queue.type="Disk" queue.filename="actq" queue.serializationFormat="binary"
+	       queue.timeoutShutdown="20000")
+}
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg 0 10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Test for group commit on synced disk queue files. Several producers
+# write to the same queue, so their writes are batched into a single
+# sync; nothing may get lost in the process.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(workDirectory="test-spool")
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" file="rsyslog.out.log" template="outfmt"
+	queue.type="Disk" queue.filename="actq" queue.syncQueueFiles="on"
+	queue.groupCommitInterval="5" queue.groupCommitBytes="64k"
+	queue.timeoutShutdown="20000")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -c4 -m10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
@@ -0,0 +1,21 @@
+#!/bin/bash
+# Test for reading disk queue files via mmap(). We use small queue files
+# so that the reader needs to switch files (and re-map growing ones)
+# many times.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(workDirectory="test-spool")
+main_queue(queue.type="Disk" queue.filename="mainq" queue.mmapRead="on"
+	   queue.maxFileSize="64k")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg 0 10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
@@ -0,0 +1,54 @@
+#!/bin/bash
+# check that the reverse lookup cache works with async resolvers, TTL and
+# a (tiny) size limit: %fromhost% must carry the resolved name once the
+# lookup has completed, and messages must not be held back while it is
+# still pending (deadline 0: the IP address is used until then).
+# added 2018-04-17, released under ASL 2.0
+HOSTNAME_EXPECTED=$(getent hosts 127.0.0.1 | awk '{print $2; exit}')
+if [ "$HOSTNAME_EXPECTED" == "" ] || [ "$HOSTNAME_EXPECTED" == "127.0.0.1" ]; then
+	echo "127.0.0.1 does not reverse-resolve on this system, skipping test"
+	exit 77
+fi
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(preserveFQDN="on"
+       reverselookup.async.workers="2"
+       reverselookup.async.deadline="0"
+       reverselookup.cache.maxentries="1"
+       reverselookup.cache.ttl.enable="on"
+       reverselookup.cache.ttl.default="1"
+       reverselookup.cache.ttl.negative="1")
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="hostfmt" type="string" string="%msg:F,58:2% %fromhost%\n")
+if $msg contains "msgnum:" then {
+	action(type="omfile" template="outfmt" file="rsyslog.out.log")
+	action(type="omfile" template="hostfmt" file="rsyslog2.out.log")
+}
+'
+. $srcdir/diag.sh startup
+# the first connection finds an empty cache, so its lookup is pending
+. $srcdir/diag.sh tcpflood -c5 -m5000
+. $srcdir/diag.sh wait-queueempty
+./msleep 1000 # let the resolver complete
+. $srcdir/diag.sh tcpflood -c1 -m1000 -i5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 5999
+
+if ! grep -q " 127\.0\.0\.1$" rsyslog2.out.log; then
+	echo "FAIL: no message was passed on while the lookup was pending"
+	. $srcdir/diag.sh error-exit 1
+fi
+awk -v exp="$HOSTNAME_EXPECTED" '$1 >= 5000 && $2 != exp { print; bad=1 } END { exit bad }' \
+	rsyslog2.out.log > rsyslog.bad.log
+if [ $? -ne 0 ]; then
+	echo "FAIL: fromhost not resolved to '$HOSTNAME_EXPECTED', wrong lines:"
+	head rsyslog.bad.log
+	. $srcdir/diag.sh error-exit 1
+fi
+rm -f rsyslog.bad.log
+. $srcdir/diag.sh exit
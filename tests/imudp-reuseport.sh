@@ -0,0 +1,21 @@
+#!/bin/bash
+# check that imudp receives all messages when it binds several
+# SO_REUSEPORT sockets to the same port, each with its own worker
+# added 2018-04-19, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../plugins/imudp/.libs/imudp" threads="1")
+input(type="imudp" address="127.0.0.1" port="13514"
+      reuseport.sockets="4" reuseport.cpusteering="on")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+			         file="rsyslog.out.log")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -t 127.0.0.1 -m500 -Tudp
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 499
+. $srcdir/diag.sh exit
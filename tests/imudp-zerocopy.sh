@@ -0,0 +1,24 @@
+#!/bin/bash
+# check that imudp's zerocopy mode delivers all messages, both those
+# received in place and smaller ones copied into a new msg object.
+# maxMessageSize is lowered so that the 300 byte messages fill enough of
+# the receive buffer to be taken over in place.
+# added 2018-04-20, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(maxMessageSize="1k")
+module(load="../plugins/imudp/.libs/imudp" zerocopy="on" batchsize="8")
+input(type="imudp" address="127.0.0.1" port="13514")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+			         file="rsyslog.out.log")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -t 127.0.0.1 -m250 -Tudp
+. $srcdir/diag.sh tcpflood -t 127.0.0.1 -i250 -m250 -d300 -Tudp
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 499
+. $srcdir/diag.sh exit
@@ -0,0 +1,22 @@
+#!/bin/bash
+# Test for the LockFree queue type. We use several concurrent senders and
+# workers and a queue size small enough that the queue also runs into the
+# (mutex-protected) flow control path.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+main_queue(queue.type="LockFree" queue.size="2000" queue.workerThreads="4"
+	   queue.workerThreadMinimumMessages="200" queue.dequeueBatchSize="64")
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -c4 -m40000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 39999
+. $srcdir/diag.sh exit
@@ -0,0 +1,38 @@
+#!/bin/bash
+# check that TAG emulation and programname derivation give consistent
+# results when RFC5424 messages are evaluated by concurrent action workers
+# added 2018-04-22, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="prognamefmt" type="string" string="%programname%\n")
+template(name="tagfmt" type="string" string="%syslogtag%\n")
+:msg, contains, "msgnum:" {
+	action(type="omfile" template="prognamefmt" file="rsyslog.out.log"
+	       queue.type="LinkedList")
+	action(type="omfile" template="tagfmt" file="rsyslog2.out.log"
+	       queue.type="LinkedList")
+}
+'
+. $srcdir/diag.sh startup
+for i in $(seq 0 9999); do
+	echo "<165>1 2003-08-24T05:14:15.000003-07:00 192.0.2.1 tcpflood 8710 - - msgnum:$i"
+done > tmp.in
+. $srcdir/diag.sh tcpflood -I tmp.in
+rm tmp.in
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+if [ $(grep -c '^tcpflood$' rsyslog.out.log) -ne 10000 ]; then
+  echo "unexpected programname, rsyslog.out.log is:"
+  sort rsyslog.out.log | uniq -c
+  . $srcdir/diag.sh error-exit 1
+fi;
+if [ $(grep -c '^tcpflood\[8710\]$' rsyslog2.out.log) -ne 10000 ]; then
+  echo "unexpected syslogtag, rsyslog2.out.log is:"
+  sort rsyslog2.out.log | uniq -c
+  . $srcdir/diag.sh error-exit 1
+fi;
+. $srcdir/diag.sh exit
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Test for the per-thread msg object cache. Messages are created by the
+# injecting thread and destructed by the queue workers, so they need to
+# make their way back to the creator's cache. We check that this actually
+# happens (cache hits) and that no message is damaged by re-using objects.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1" log.file="./rsyslog.out.stats.log")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg 0 20000
+. $srcdir/diag.sh wait-queueempty
+. $srcdir/diag.sh wait-for-stats-flush 'rsyslog.out.stats.log'
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 19999
+. $srcdir/diag.sh assert-first-column-sum-greater-than 's/.*hits=\([0-9]\+\).*/\1/g' 'msg-slab:.\+hits=' 'rsyslog.out.stats.log' 0
+. $srcdir/diag.sh exit
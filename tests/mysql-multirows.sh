@@ -0,0 +1,20 @@
+#!/bin/bash
+# test for multi-row INSERT mode of ommysql
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+mysql --user=rsyslog --password=testbench < testsuites/mysql-truncate.sql
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../plugins/ommysql/.libs/ommysql")
+if $msg contains "msgnum" then {
+	action(type="ommysql" server="127.0.0.1"
+	       db="Syslog" uid="rsyslog" pwd="testbench" multirows="100")
+}'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+# note "-s" is requried to suppress the select "field header"
+mysql -s --user=rsyslog --password=testbench < testsuites/mysql-select-msg.sql > rsyslog.out.log
+. $srcdir/diag.sh seq-check  0 4999
+. $srcdir/diag.sh exit
@@ -0,0 +1,44 @@
+#!/bin/bash
+# check that with udp.sendtoall="on" omfwd delivers every message to
+# every address the target resolves to. We forward to "localhost" and
+# receive on all local addresses, so each message must arrive once per
+# address localhost resolves to.
+# added 2018-04-19, released under ASL 2.0
+NADDRS=$(getent ahosts localhost | awk '$2 == "DGRAM" { print $1 }' | sort -u | wc -l)
+if [ "$NADDRS" -lt 2 ] || [ ! -e /proc/net/if_inet6 ]; then
+	echo "localhost does not resolve to multiple addresses, skipping test"
+	exit 77
+fi
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+main_queue(queue.dequeueBatchSize="64")
+module(load="../plugins/imtcp/.libs/imtcp")
+module(load="../plugins/imudp/.libs/imudp")
+input(type="imtcp" port="13514")
+input(type="imudp" port="13515" ruleset="rcv")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+ruleset(name="rcv") {
+	:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+					 file="rsyslog.out.log")
+}
+
+:msg, contains, "msgnum:" action(type="omfwd" target="localhost" port="13515"
+				 protocol="udp" udp.sendtoall="on")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -m500
+./msleep 1000 # UDP: give the receiver a chance to see all datagrams
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+# every message must have been received once per target address
+sort rsyslog.out.log | uniq -c | awk -v n=$NADDRS '$1 != n { print; bad=1 } END { exit bad }' \
+	> rsyslog.bad.log
+if [ $? -ne 0 ] || [ $(sort -u rsyslog.out.log | wc -l) -ne 500 ]; then
+	echo "FAIL: not every message was delivered to all $NADDRS targets, bad counts:"
+	head rsyslog.bad.log
+	. $srcdir/diag.sh error-exit 1
+fi
+rm -f rsyslog.bad.log
+. $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+#!/bin/bash
+# test for multi-row INSERT mode of ompgsql
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+
+psql -h localhost -U postgres -f testsuites/pgsql-basic.sql
+
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../plugins/ompgsql/.libs/ompgsql")
+if $msg contains "msgnum" then {
+	action(type="ompgsql" server="127.0.0.1"
+		db="syslogtest" user="postgres" pass="testbench" multirows="100")
+}'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+
+
+psql -h localhost -U postgres -d syslogtest -f testsuites/pgsql-select-msg.sql -t -A > rsyslog.out.log
+
+. $srcdir/diag.sh seq-check  0 4999
+
+echo cleaning up test database
+psql -h localhost -U postgres -c 'DROP DATABASE IF EXISTS syslogtest;'
+
+. $srcdir/diag.sh exit
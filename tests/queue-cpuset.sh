@@ -0,0 +1,57 @@
+#!/bin/bash
+# check that messages flow through main and action queues whose
+# worker threads are pinned via queue.cpuset, and that the worker
+# threads really run with the configured CPU affinity
+# added 2018-04-18, released under ASL 2.0
+if [ ! -r /proc/self/status ] || ! grep -q "^Cpus_allowed_list:" /proc/self/status; then
+	echo "no /proc or Cpus_allowed_list on this system, skipping test"
+	exit 77
+fi
+if ! taskset -c 0 true 2>/dev/null; then
+	echo "cannot bind to CPU 0 (no taskset or sched_setaffinity), skipping test"
+	exit 77
+fi
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+main_queue(queue.type="LinkedList" queue.workerthreads="2" queue.cpuset="0"
+	   queue.timeoutWorkerthreadShutdown="-1")
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(name="pin" type="omfile" template="outfmt"
+			         file="rsyslog.out.log"
+			         queue.type="LinkedList" queue.cpuset="0"
+			         queue.timeoutWorkerthreadShutdown="-1")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -m10000
+. $srcdir/diag.sh wait-queueempty
+
+# check the affinity of the queue worker threads (they do not time out)
+. $srcdir/diag.sh getpid
+nchecked=0
+for task in /proc/$pid/task/*; do
+	name=$(cat $task/comm 2>/dev/null)
+	case "$name" in
+	"rs:main Q:Reg"*|"rs:pin queue"*)
+		cpus=$(grep "^Cpus_allowed_list:" $task/status | awk '{print $2}')
+		echo "worker thread '$name' has Cpus_allowed_list '$cpus'"
+		if [ "$cpus" != "0" ]; then
+			echo "FAIL: worker thread '$name' not pinned to CPU 0"
+			. $srcdir/diag.sh error-exit 1
+		fi
+		nchecked=$((nchecked + 1))
+		;;
+	esac
+done
+if [ $nchecked -lt 2 ]; then
+	echo "FAIL: expected at least 2 queue worker threads, found $nchecked"
+	. $srcdir/diag.sh error-exit 1
+fi
+
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
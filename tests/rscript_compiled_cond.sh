@@ -0,0 +1,29 @@
+#!/bin/bash
+# check that if-conditions which are compiled to bytecode (property
+# vs. constant comparisons combined with and/or/not) evaluate exactly
+# like the expression tree does.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+
+if $msg contains "msgnum:" and $programname == ["other", "tag"] and
+   not ($hostname startswith "10." or $msg contains ["invalid", "bad"]) and
+   $programname > "s" and $programname != "other" and
+   ($msg startswith_i " MSGNUM:" or $msg contains_i "MSGNUM:") then
+	action(type="omfile" file="rsyslog.out.log" template="outfmt")
+else
+	action(type="omfile" file="rsyslog2.out.log" template="outfmt")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check  0 4999
+if [ -e rsyslog2.out.log ]; then
+  echo "condition evaluated to false for some messages, rsyslog2.out.log is:"
+  head rsyslog2.out.log
+  . $srcdir/diag.sh error-exit 1
+fi;
+. $srcdir/diag.sh exit
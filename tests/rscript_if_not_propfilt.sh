@@ -0,0 +1,25 @@
+#!/bin/bash
+# check that "if not (...)" without else, which the optimizer must not
+# convert into a property filter, loads and filters correctly
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+
+if not ($msg contains "msgnum:") then
+	action(type="omfile" file="rsyslog2.out.log" template="outfmt")
+if not ($msg contains "nomatch") then
+	action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check  0 4999
+if [ -e rsyslog2.out.log ]; then
+  echo "filter matched unexpectedly, rsyslog2.out.log is:"
+  head rsyslog2.out.log
+  . $srcdir/diag.sh error-exit 1
+fi;
+. $srcdir/diag.sh exit
@@ -0,0 +1,28 @@
+#!/bin/bash
+# check that a chain of property filters on the same property, which the
+# optimizer groups into a single multi-pattern match, still behaves
+# exactly like the individual filters (including "stop" inside the chain).
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+
+:msg, contains, "nomatch" action(type="omfile" file="rsyslog2.out.log" template="outfmt")
+:msg, !startswith, " msgnum:" action(type="omfile" file="rsyslog2.out.log" template="outfmt")
+:msg, contains, ":00004" stop
+:msg, isequal, "msgnum:" action(type="omfile" file="rsyslog2.out.log" template="outfmt")
+if $msg contains "msgnum:" then
+	action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh injectmsg  0 5000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check  0 3999
+if [ -e rsyslog2.out.log ]; then
+  echo "filter matched unexpectedly, rsyslog2.out.log is:"
+  head rsyslog2.out.log
+  . $srcdir/diag.sh error-exit 1
+fi;
+. $srcdir/diag.sh exit
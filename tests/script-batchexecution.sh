@@ -0,0 +1,83 @@
+#!/bin/bash
+# Check that batch-at-a-time script execution produces the same
+# results as the classic message-at-a-time executor, including
+# stop, nested conditions, PRI/property filters, called rulesets and
+# failover actions (action.execOnlyWhenPreviousIsSuspended), which the
+# batch executor hands over to message-at-a-time processing. We run the
+# very same config with both executors and compare the output.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+
+# $1 - value for script.batchExecution
+generate_conf() {
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(script.batchExecution="'$1'")
+main_queue(queue.dequeueBatchSize="128" queue.workerthreads="1")
+module(load="../plugins/imtcp/.libs/imtcp")
+module(load="../plugins/omtesting/.libs/omtesting")
+input(type="imtcp" port="13514")
+input(type="imtcp" port="13515" ruleset="failover")
+
+template(name="outfmt" type="string" string="%$.nbr%\n")
+template(name="failfmt" type="string" string="%msg:F,58:2%\n")
+
+ruleset(name="out") {
+	action(type="omfile" file="rsyslog.out.log" template="outfmt")
+}
+
+ruleset(name="failover") {
+	*.* :omtesting:fail 2 0
+	action(type="omfile" file="rsyslog2.out.log" template="failfmt"
+	       action.execOnlyWhenPreviousIsSuspended="on")
+}
+
+if $msg contains "msgnum:" then {
+	set $.nbr = field($msg, 58, 2);
+	if cnum($.nbr) < 100 then
+		stop
+	if cnum($.nbr) > 999 then {
+		if cnum($.nbr) < 1500 then
+			stop
+		else
+			unset $.nbr;
+	}
+	if $.nbr == "" then
+		stop
+	*.* {
+		:msg, contains, "msgnum:" call out
+	}
+}
+'
+}
+
+# reference run with the message-at-a-time executor
+generate_conf off
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -m2000 -i1
+. $srcdir/diag.sh tcpflood -p13515 -m1000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+mv rsyslog.out.log rsyslog.nonbatch.log
+mv rsyslog2.out.log rsyslog2.nonbatch.log
+
+generate_conf on
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -m2000 -i1
+. $srcdir/diag.sh tcpflood -p13515 -m1000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 100 999
+if [ ! -s rsyslog2.out.log ]; then
+	echo "FAIL: failover action was never executed"
+	. $srcdir/diag.sh error-exit 1
+fi
+for f in rsyslog rsyslog2; do
+	if ! cmp $f.nonbatch.log $f.out.log; then
+		echo "FAIL: batch and message-at-a-time output differ ($f):"
+		diff $f.nonbatch.log $f.out.log | head -20
+		. $srcdir/diag.sh error-exit 1
+	fi
+done
+rm -f rsyslog.nonbatch.log rsyslog2.nonbatch.log
+. $srcdir/diag.sh exit
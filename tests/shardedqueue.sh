@@ -0,0 +1,27 @@
+#!/bin/bash
+# Test for sharded main queues. imtcp runs a single input thread, so all
+# messages end up in the same shard and the other shards' workers need to
+# steal work from it. We check via impstats that this actually happens;
+# the root queue reports the sum of its shards' counters.
+# This file is part of the rsyslog project, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../plugins/impstats/.libs/impstats" interval="1" log.file="./rsyslog.out.stats.log")
+main_queue(queue.shards="4" queue.size="8000" queue.workerThreads="4"
+	   queue.dequeueBatchSize="64")
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+:msg, contains, "msgnum:" action(type="omfile" file="rsyslog.out.log" template="outfmt")
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -c4 -m40000
+. $srcdir/diag.sh wait-queueempty
+. $srcdir/diag.sh wait-for-stats-flush 'rsyslog.out.stats.log'
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+. $srcdir/diag.sh seq-check 0 39999
+. $srcdir/diag.sh assert-first-column-sum-greater-than 's/.*stolen=\([0-9]\+\).*/\1/g' 'main.Q:.\+stolen=' 'rsyslog.out.stats.log' 0
+. $srcdir/diag.sh exit
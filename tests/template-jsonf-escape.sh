@@ -0,0 +1,34 @@
+#!/bin/bash
+# check that jsonf/jsonfr fields are correctly escaped when they are
+# streamed directly into the output buffer
+# added 2018-04-12, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="outfmt" type="list" option.jsonf="on") {
+	 property(outname="message" name="msg" format="jsonf")
+	 property(outname="raw" name="msg" format="jsonfr")
+	 property(outname="host" name="hostname" format="jsonf")
+}
+
+:msg, contains, "msgnum:" action(type="omfile" template="outfmt"
+			         file="rsyslog.out.log")
+'
+. $srcdir/diag.sh startup
+# we need to generate a file, because otherwise the backslashes
+# do not survive the execution pathes through the shell
+printf '%s\n' '<165>1 2003-08-24T05:14:15.000003-07:00 192.0.2.1 tcpflood 8710 - - msgnum:0 a"b\c/d\"e' > tmp.in
+. $srcdir/diag.sh tcpflood -I tmp.in
+rm tmp.in
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+printf '%s\n' '{"message":"msgnum:0 a\"b\\c\/d\\\"e", "raw":"msgnum:0 a\"b\\c\/d\"e", "host":"192.0.2.1"}' | cmp - rsyslog.out.log
+if [ ! $? -eq 0 ]; then
+  echo "invalid message recorded, rsyslog.out.log is:"
+  cat rsyslog.out.log
+  . $srcdir/diag.sh error-exit 1
+fi;
+. $srcdir/diag.sh exit
@@ -0,0 +1,29 @@
+#!/bin/bash
+# check that timestamps are generated correctly with the coarse clock and
+# the per-thread time cache, with the time zone set via global(environment)
+# added 2018-04-21, released under ASL 2.0
+. $srcdir/diag.sh init
+. $srcdir/diag.sh generate-conf
+. $srcdir/diag.sh add-conf '
+global(timestamp.coarseclock="on" environment=["TZ=UTC"])
+module(load="../plugins/imtcp/.libs/imtcp")
+input(type="imtcp" port="13514")
+
+template(name="outfmt" type="string" string="%msg:F,58:2%\n")
+template(name="tsfmt" type="string" string="%timegenerated:::date-rfc3339%\n")
+:msg, contains, "msgnum:" {
+	action(type="omfile" template="outfmt" file="rsyslog.out.log")
+	action(type="omfile" template="tsfmt" file="rsyslog2.out.log")
+}
+'
+. $srcdir/diag.sh startup
+. $srcdir/diag.sh tcpflood -m10000
+. $srcdir/diag.sh shutdown-when-empty
+. $srcdir/diag.sh wait-shutdown
+if grep -qv '^[0-9-]*T[0-9:.]*+00:00$' rsyslog2.out.log; then
+  printf "timestamps not in UTC or malformed:\n"
+  grep -v '^[0-9-]*T[0-9:.]*+00:00$' rsyslog2.out.log | head
+  . $srcdir/diag.sh error-exit 1
+fi;
+. $srcdir/diag.sh seq-check 0 9999
+. $srcdir/diag.sh exit
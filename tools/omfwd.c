@@ -40,6 +40,7 @@
 #include <fcntl.h>
 #include <zlib.h>
 #include <pthread.h>
+#include <sys/socket.h>
 #include "syslogd.h"
 #include "conf.h"
 #include "syslogd-types.h"
@@ -130,6 +131,11 @@ typedef struct wrkrInstanceData {
 	uchar sndBuf[16*1024];	/* this is intensionally fixed -- see no good reason to make configurable */
 	unsigned offsSndBuf;	/* next free spot in send buffer */
 	int errsToReport;	/* (remaining) number of errors to report */
+#	ifdef HAVE_SENDMMSG
+	struct mmsghdr *udpBatch;	/* sendmmsg() vector for UDP transactions */
+	struct iovec *udpIov;		/* message buffers for udpBatch */
+	unsigned maxUdpBatch;		/* number of allocated elements in above arrays */
+#	endif
 } wrkrInstanceData_t;
 
 /* config data */
@@ -408,6 +414,10 @@ CODESTARTfreeWrkrInstance
 	if(pWrkrData->pData->protocol == FORW_TCP) {
 		tcpclt.Destruct(&pWrkrData->pTCPClt);
 	}
+#	ifdef HAVE_SENDMMSG
+	free(pWrkrData->udpBatch);
+	free(pWrkrData->udpIov);
+#	endif
 ENDfreeWrkrInstance
 
 
@@ -521,6 +531,166 @@ finalize_it:
 }
 
 
+#ifdef HAVE_SENDMMSG
+/* Batched UDP sending. A whole transaction is sent with as few sendmmsg()
+ * calls as possible, instead of one sendto() per message and target. This
+ * is only done if no per-message processing (send delay, rebinding,
+ * compression) is configured; otherwise UDPSend() is used.
+ */
+static int
+canBatchUDP(const instanceData *const pData)
+{
+	return pData->protocol == FORW_UDP
+		&& pData->iUDPSendDelay == 0
+		&& pData->iRebindInterval == 0
+		&& pData->compressionMode != COMPRESS_SINGLE_MSG;
+}
+
+
+/* send messages [from, n) of the batch to target r via socket sock.
+ * Returns the index of the first message which could not be sent
+ * (n on full success).
+ */
+static unsigned
+UDPSendBatchSock(wrkrInstanceData_t *__restrict__ const pWrkrData,
+	const int sock,
+	const unsigned from,
+	const unsigned n,
+	int *const pLasterrno)
+{
+	struct mmsghdr *const hdrs = pWrkrData->udpBatch;
+	unsigned done = from;
+	int sent;
+
+	while(done < n) {
+		sent = sendmmsg(sock, hdrs + done, n - done, 0);
+		if(sent > 0) {
+			done += sent;
+		} else if(errno == EINTR) {
+			continue;
+		} else if(errno == EMSGSIZE) {
+			/* handle just this message like UDPSend() does */
+			struct iovec *const iov = hdrs[done].msg_hdr.msg_iov;
+			const size_t newlen = (iov->iov_len > 1024) ? iov->iov_len - 1024 : 512;
+			if(iov->iov_len <= 512) {
+				*pLasterrno = errno;
+				break;
+			}
+			LogError(0, RS_RET_UDP_MSGSIZE_TOO_LARGE,
+				"omfwd/udp: send failed due to message being too "
+				"large for this system. Message size was %u bytes. "
+				"Truncating to %u bytes and retrying.",
+				(unsigned) iov->iov_len, (unsigned) newlen);
+			iov->iov_len = newlen;
+		} else {
+			*pLasterrno = errno;
+			LogError(errno, RS_RET_ERR_UDPSEND,
+				"omfwd/udp: socket %d: sendmmsg() error", sock);
+			break;
+		}
+	}
+	return done;
+}
+
+
+/* Send a whole transaction via UDP. The target addresses are tried in
+ * order. Without udp.sendtoall, a target only gets the messages that all
+ * previous targets failed to take. With udp.sendtoall, every target is
+ * offered every message. In both cases, as in UDPSend(), a message counts
+ * as sent if at least one target address took it.
+ */
+static rsRetVal
+UDPSendBatch(wrkrInstanceData_t *__restrict__ const pWrkrData,
+	actWrkrIParams_t *__restrict__ const pParams,
+	const unsigned nParams)
+{
+	instanceData *__restrict__ const pData = pWrkrData->pData;
+	struct addrinfo *r;
+	actWrkrIParams_t *iparam;
+	unsigned first; /* first message not yet delivered to any target */
+	unsigned done;
+	unsigned i;
+	size_t len;
+	int iMaxLine;
+	int iSock;
+	int lasterrno = ENOENT;
+	sbool reInit = RSFALSE;
+	DEFiRet;
+
+	if(pWrkrData->pSockArray == NULL) {
+		CHKiRet(doTryResume(pWrkrData));
+	}
+	if(pWrkrData->pSockArray == NULL) {
+		FINALIZE;
+	}
+
+	if(nParams > pWrkrData->maxUdpBatch) {
+		struct mmsghdr *newBatch;
+		struct iovec *newIov;
+		CHKmalloc(newBatch = realloc(pWrkrData->udpBatch, nParams * sizeof(struct mmsghdr)));
+		pWrkrData->udpBatch = newBatch;
+		CHKmalloc(newIov = realloc(pWrkrData->udpIov, nParams * sizeof(struct iovec)));
+		pWrkrData->udpIov = newIov;
+		pWrkrData->maxUdpBatch = nParams;
+	}
+
+	iMaxLine = glbl.GetMaxLine();
+	memset(pWrkrData->udpBatch, 0, nParams * sizeof(struct mmsghdr));
+	for(i = 0 ; i < nParams ; ++i) {
+		iparam = &actParam(pParams, 1, i, 0);
+		len = iparam->lenStr;
+		if((int) len > iMaxLine)
+			len = iMaxLine;
+		if(len > UDP_MAX_MSGSIZE) {
+			LogError(0, RS_RET_UDP_MSGSIZE_TOO_LARGE, "omfwd/udp: message is %u "
+				"bytes long, but UDP can send at most %d bytes (by RFC limit) "
+				"- truncating message", (unsigned) len, UDP_MAX_MSGSIZE);
+			len = UDP_MAX_MSGSIZE;
+		}
+		pWrkrData->udpIov[i].iov_base = iparam->param;
+		pWrkrData->udpIov[i].iov_len = len;
+		pWrkrData->udpBatch[i].msg_hdr.msg_iov = &pWrkrData->udpIov[i];
+		pWrkrData->udpBatch[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	first = 0;
+	for(r = pWrkrData->f_addr ; r != NULL ; r = r->ai_next) {
+		const unsigned from = pData->bSendToAll ? 0 : first;
+		if(from == nParams)
+			break;
+		for(i = from ; i < nParams ; ++i) {
+			pWrkrData->udpBatch[i].msg_hdr.msg_name = r->ai_addr;
+			pWrkrData->udpBatch[i].msg_hdr.msg_namelen = r->ai_addrlen;
+		}
+		done = from;
+		for(iSock = 0 ; done < nParams && iSock < *pWrkrData->pSockArray ; ++iSock) {
+			done = UDPSendBatchSock(pWrkrData, pWrkrData->pSockArray[iSock+1],
+				done, nParams, &lasterrno);
+			if(done < nParams)
+				reInit = RSTRUE;
+		}
+		if(done > first)
+			first = done;
+	}
+
+	/* one or more send failures; close sockets and re-init */
+	if(reInit == RSTRUE) {
+		CHKiRet(closeUDPSockets(pWrkrData));
+	}
+
+	if(first < nParams) {
+		LogError(lasterrno, RS_RET_ERR_UDPSEND,
+			"omfwd: error sending via udp: %u of %u messages of batch could "
+			"not be sent", nParams - first, nParams);
+		iRet = RS_RET_SUSPENDED;
+	}
+
+finalize_it:
+	RETiRet;
+}
+#endif /* #ifdef HAVE_SENDMMSG */
+
+
 /* set the permitted peers -- rgerhards, 2008-05-19
  */
 static rsRetVal
@@ -890,7 +1060,7 @@ static rsRetVal doTryResume(wrkrInstanceData_t *pWrkrData)
 		if(pWrkrData->pSockArray == NULL) {
 			CHKiRet(changeToNs(pData));
 			pWrkrData->pSockArray = net.create_udp_socket((uchar*)pData->target,
-				NULL, 0, 0, pData->UDPSendBuf, 0, pData->device);
+				NULL, 0, 0, pData->UDPSendBuf, 0, pData->device, 0);
 			CHKiRet(returnToOriginalNs(pData));
 		}
 		if(pWrkrData->pSockArray != NULL) {
@@ -1013,6 +1183,13 @@ CODESTARTcommitTransaction
 	DBGPRINTF(" %s:%s/%s\n", pWrkrData->pData->target, pWrkrData->pData->port,
 		 pWrkrData->pData->protocol == FORW_UDP ? "udp" : "tcp");
 
+#	ifdef HAVE_SENDMMSG
+	if(canBatchUDP(pWrkrData->pData)) {
+		iRet = UDPSendBatch(pWrkrData, pParams, nParams);
+		FINALIZE;
+	}
+#	endif
+
 	for(i = 0 ; i < nParams ; ++i) {
 		iRet = processMsg(pWrkrData, &actParam(pParams, 1, i, 0));
 		if(iRet != RS_RET_OK && iRet != RS_RET_DEFER_COMMIT && iRet != RS_RET_PREVIOUS_COMMITTED)